@@ -0,0 +1,281 @@
+/* vim: set fdm=marker : */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "listener_private.h"
+
+/*
+ * Times the inotify decode path on its own: synthetic read buffers are fed
+ * straight into the backend's handler and drained again, so the kernel is
+ * only involved in setting up the watches. Every heap allocation made while
+ * the clock runs is counted too; once the names are interned there should
+ * be none.
+ */
+
+/* Events per synthetic read, about what a 256 KiB read returns */
+#define BENCH_BATCH 4096
+
+/* Allocations {{{ */
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static gboolean bench_counting;
+static guint64 bench_allocs;
+
+void *malloc(size_t size)
+{
+	if (bench_counting)
+		bench_allocs++;
+
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+	if (bench_counting)
+		bench_allocs++;
+
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	if (bench_counting)
+		bench_allocs++;
+
+	return __libc_realloc(ptr, size);
+}
+
+/* }}} */
+
+/* Workload {{{ */
+
+static void bench_state(struct Listener *listener, enum ListenerState state, guint root,
+		const char *message, gpointer data)
+{
+	if (state == LISTENER_ERROR)
+		fprintf(stderr, "bench-decode: %s\n", message);
+}
+
+static void bench_batch(const struct RingEvent *events, guint n, gpointer data)
+{
+	guint64 *bytes = data;
+
+	/* Touch every path, as any consumer would */
+	for (guint i = 0; i < n; ++i)
+	{
+		if (events[i].path != NULL)
+			*bytes += strlen(events[i].path);
+	}
+}
+
+/*
+ * Fills buf with n events spread over the watched directories, naming one
+ * of names entries each. Returns the length used.
+ */
+static gsize bench_fill(char *buf, guint n, const int *wds, guint n_wds, guint names)
+{
+	static const guint32 masks[] = { IN_OPEN, IN_MODIFY, IN_CLOSE_WRITE, IN_CLOSE_NOWRITE, IN_CREATE, IN_DELETE };
+	gsize len = 0;
+
+	for (guint i = 0; i < n; ++i)
+	{
+		struct inotify_event *event = (struct inotify_event*) (buf + len);
+		guint32 id = g_random_int_range(0, names);
+		char name[32];
+		gsize name_len;
+
+		name_len = g_snprintf(name, sizeof(name), "file%06u.txt", id) + 1;
+		name_len = (name_len + sizeof(struct inotify_event) - 1) & ~(sizeof(struct inotify_event) - 1);
+
+		event->wd = wds[g_random_int_range(0, n_wds)];
+		event->mask = masks[i % G_N_ELEMENTS(masks)];
+		event->cookie = 0;
+		event->len = name_len;
+		memset(event->name, 0, name_len);
+		strcpy(event->name, name);
+
+		len += sizeof(struct inotify_event) + name_len;
+	}
+
+	return len;
+}
+
+static void bench_remove(const char *dir, guint dirs)
+{
+	for (guint i = 0; i < dirs; ++i)
+	{
+		char *path = g_strdup_printf("%s/dir%04u", dir, i);
+		rmdir(path);
+		g_free(path);
+	}
+
+	rmdir(dir);
+}
+
+/* }}} */
+
+int main(int argc, char *argv[])
+{
+	int events = 4000000;
+	int names = 1000;
+	int dirs = 64;
+	int coalesce = 0;
+	GError *error = NULL;
+
+	GOptionEntry options[] =
+	{
+		{ "events", 'n', 0, G_OPTION_ARG_INT, &events, "Decode N events (default 4000000)", "N" },
+		{ "names", 'f', 0, G_OPTION_ARG_INT, &names, "Distinct file names (default 1000)", "N" },
+		{ "dirs", 'd', 0, G_OPTION_ARG_INT, &dirs, "Watched directories (default 64)", "N" },
+		{ "coalesce", 'c', 0, G_OPTION_ARG_INT, &coalesce, "Coalescing window in ms (default 0)", "MS" },
+		{ NULL }
+	};
+
+	GOptionContext *context = g_option_context_new("[DIRECTORY]");
+	g_option_context_set_summary(context,
+			"Times decoding of synthetic inotify events, from read buffer to drained\n"
+			"batch. Watches are set up in a new directory under DIRECTORY (default\n"
+			"/dev/shm).");
+	g_option_context_add_main_entries(context, options, NULL);
+
+	if (!g_option_context_parse(context, &argc, &argv, &error))
+	{
+		fprintf(stderr, "bench-decode: %s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(context);
+		return 2;
+	}
+
+	g_option_context_free(context);
+
+	if (argc > 2 || events < BENCH_BATCH || names < 1 || dirs < 1 || coalesce < 0)
+	{
+		fprintf(stderr, "Usage: %s [OPTION...] [DIRECTORY]\n", argv[0]);
+		return 2;
+	}
+
+	char *tmpl = g_build_filename(argc == 2 ? argv[1] : "/dev/shm", "bench-decode.XXXXXX", NULL);
+	char *dir = g_mkdtemp(tmpl);
+
+	if (dir == NULL)
+	{
+		fprintf(stderr, "bench-decode: can't create a directory: %s\n", strerror(errno));
+		g_free(tmpl);
+		return 1;
+	}
+
+	for (int i = 0; i < dirs; ++i)
+	{
+		char *path = g_strdup_printf("%s/dir%04u", dir, i);
+		mkdir(path, 0755);
+		g_free(path);
+	}
+
+	struct ListenerRoot root = { .dir = dir, .recursive = TRUE };
+	struct ListenerOptions opts = { .roots = &root, .n_roots = 1, .coalesce_ms = coalesce };
+	struct Listener *listener = listener_new(&opts, bench_state, NULL, &error);
+
+	if (listener == NULL)
+	{
+		fprintf(stderr, "bench-decode: %s\n", error->message);
+		g_error_free(error);
+		bench_remove(dir, dirs);
+		g_free(dir);
+		return 1;
+	}
+
+	int status = 1;
+
+	if (listener_open(listener) == -1 || listener->n_active == 0)
+		goto out;
+
+	listener_inotify_walk(listener, G_MAXUINT);
+
+	/* Every watch the walk set up */
+	GArray *wds = g_array_new(FALSE, FALSE, sizeof(int));
+	GHashTableIter iter;
+	gpointer key;
+
+	g_hash_table_iter_init(&iter, listener->wd_dirs);
+	while (g_hash_table_iter_next(&iter, &key, NULL))
+	{
+		int wd = GPOINTER_TO_INT(key);
+		g_array_append_val(wds, wd);
+	}
+
+	char *buf = g_malloc(BENCH_BATCH * (sizeof(struct inotify_event) + 32));
+	gsize len = bench_fill(buf, BENCH_BATCH, (int*) wds->data, wds->len, names);
+	GString *str = g_string_sized_new(4096);
+	guint64 bytes = 0, decoded = 0, drained = 0;
+	gint64 decode_time = 0, drain_time = 0;
+	int rounds = events / BENCH_BATCH;
+
+	/* Warm up: intern every name and size every buffer once */
+	for (int i = 0; i < 8 + names / BENCH_BATCH; ++i)
+	{
+		listener->handle(listener, buf, len, str);
+		coalescer_flush(listener->coalescer, G_MAXINT64);
+		listener_drain(listener, bench_batch, &bytes, G_MAXUINT);
+	}
+
+	bench_allocs = 0;
+	bench_counting = TRUE;
+
+	for (int i = 0; i < rounds; ++i)
+	{
+		gint64 start = g_get_monotonic_time();
+
+		decoded += listener->handle(listener, buf, len, str);
+		coalescer_flush(listener->coalescer, G_MAXINT64);
+
+		gint64 mid = g_get_monotonic_time();
+
+		drained += listener_drain(listener, bench_batch, &bytes, G_MAXUINT);
+
+		decode_time += mid - start;
+		drain_time += g_get_monotonic_time() - mid;
+	}
+
+	bench_counting = FALSE;
+
+	decode_time = MAX(decode_time, 1);
+	drain_time = MAX(drain_time, 1);
+
+	printf("%12s %12s %12s %12s %12s %10s\n", "events", "decoded/s", "drained/s", "total/s", "dropped", "allocs/ev");
+	printf("%12" G_GUINT64_FORMAT " %12.0f %12.0f %12.0f %12u %10.4f\n",
+			decoded,
+			decoded * 1e6 / decode_time,
+			drained * 1e6 / drain_time,
+			decoded * 1e6 / (decode_time + drain_time),
+			listener_take_dropped(listener),
+			(double) bench_allocs / MAX(decoded, 1));
+
+	fprintf(stderr, "bench-decode: %u watches, %u interned strings, %" G_GUINT64_FORMAT " path bytes\n",
+			wds->len, string_table_size(listener->paths[listener->paths_current]), bytes);
+
+	g_string_free(str, TRUE);
+	g_free(buf);
+	g_array_free(wds, TRUE);
+	status = 0;
+
+out:
+	listener_close(listener);
+	listener_free(listener);
+
+	bench_remove(dir, dirs);
+	g_free(dir);
+
+	return status;
+}
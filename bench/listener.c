@@ -0,0 +1,747 @@
+/* vim: set fdm=marker : */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <gio/gio.h>
+#include <poll.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dir_scan.h"
+#include "listener.h"
+#include "mime_cache.h"
+#include "workload.h"
+
+/*
+ * End-to-end numbers for both halves of the application. File system
+ * workloads run on a tmpfs while the listener watches it, and every event
+ * the workload can attribute is timed from just before the system call that
+ * caused it to the moment the consumer drains it. Then directories of
+ * growing size are listed and sorted the way the view lists them.
+ */
+
+/* The consumer gives up this long after the workload, if events stop coming */
+#define BENCH_QUIET_MS 500
+
+/* Operations a workload times, each on a name carrying its id */
+enum BenchOp
+{
+	BENCH_CREATE,
+	BENCH_MODIFY,
+	BENCH_MOVE,
+	BENCH_DELETE,
+	BENCH_OPS,
+};
+
+struct BenchRun
+{
+	const struct BenchWorkload *workload;
+	char *dir;
+	guint files;
+	guint depth;
+	guint rate;
+
+	/* Real time before each timed operation, 0 once its event arrived */
+	_Atomic(gint64) (*stamps)[BENCH_OPS];
+	guint64 timed;
+	atomic_int done;
+	gint64 cpu;
+
+	/* Consumer side */
+	GArray *latencies;
+	GArray *queued;
+	guint64 events;
+	gint64 last;
+};
+
+struct BenchWorkload
+{
+	const char *name;
+	const char *description;
+	void (*run)(struct BenchRun *run);
+};
+
+static atomic_int bench_started;
+static atomic_int bench_failed;
+
+/* Workloads {{{ */
+
+/* Keeps the workload at run->rate files per second, if set */
+static void bench_pace(struct BenchRun *run, gint64 start, guint id)
+{
+	if (run->rate == 0)
+		return;
+
+	gint64 due = start + (gint64) id * G_USEC_PER_SEC / run->rate;
+	gint64 now = g_get_monotonic_time();
+
+	if (due > now)
+		g_usleep(due - now);
+}
+
+static void bench_stamp(struct BenchRun *run, guint id, enum BenchOp op)
+{
+	atomic_store_explicit(&run->stamps[id][op], g_get_real_time(), memory_order_relaxed);
+	run->timed++;
+}
+
+/* Creates, writes and closes f<id> in dfd */
+static gboolean bench_write(struct BenchRun *run, int dfd, guint id)
+{
+	static const char content[64] = "bench";
+	char name[16];
+
+	g_snprintf(name, sizeof(name), "f%07u", id);
+
+	bench_stamp(run, id, BENCH_CREATE);
+	int fd = openat(dfd, name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1)
+		return FALSE;
+
+	bench_stamp(run, id, BENCH_MODIFY);
+	gboolean ok = write(fd, content, sizeof(content)) == sizeof(content);
+
+	close(fd);
+	return ok;
+}
+
+static int bench_open_dir(const char *dir, const char *name)
+{
+	char *path = g_build_filename(dir, name, NULL);
+	int dfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+	g_free(path);
+	return dfd;
+}
+
+/*
+ * Every file goes through its whole life at once: created, written,
+ * renamed and deleted, spread over the 16 directories made beforehand.
+ */
+static void bench_storm(struct BenchRun *run)
+{
+	int dfds[16];
+	gint64 start = g_get_monotonic_time();
+
+	for (guint i = 0; i < G_N_ELEMENTS(dfds); ++i)
+	{
+		char name[16];
+
+		g_snprintf(name, sizeof(name), "d%02u", i);
+		dfds[i] = bench_open_dir(run->dir, name);
+	}
+
+	for (guint id = 0; id < run->files; ++id)
+	{
+		int dfd = dfds[id % G_N_ELEMENTS(dfds)];
+		char from[16], to[16];
+
+		bench_pace(run, start, id);
+
+		if (dfd == -1 || !bench_write(run, dfd, id))
+			break;
+
+		g_snprintf(from, sizeof(from), "f%07u", id);
+		g_snprintf(to, sizeof(to), "m%07u", id);
+
+		bench_stamp(run, id, BENCH_MOVE);
+		if (renameat(dfd, from, dfd, to) == -1)
+			break;
+
+		bench_stamp(run, id, BENCH_DELETE);
+		if (unlinkat(dfd, to, 0) == -1)
+			break;
+	}
+
+	for (guint i = 0; i < G_N_ELEMENTS(dfds); ++i)
+	{
+		if (dfds[i] != -1)
+			close(dfds[i]);
+	}
+}
+
+/* Many small files that stay, in one directory */
+static void bench_small(struct BenchRun *run)
+{
+	int dfd = bench_open_dir(run->dir, "d00");
+	gint64 start = g_get_monotonic_time();
+
+	for (guint id = 0; id < run->files && dfd != -1; ++id)
+	{
+		bench_pace(run, start, id);
+
+		if (!bench_write(run, dfd, id))
+			break;
+	}
+
+	if (dfd != -1)
+		close(dfd);
+}
+
+/*
+ * A new chain of run->depth nested directories for every 16 files, which
+ * are written to the deepest one right away. Whatever is created before
+ * the listener has watched the new directories is what recursive
+ * watching loses.
+ */
+static void bench_tree(struct BenchRun *run)
+{
+	int dfd = -1;
+	gint64 start = g_get_monotonic_time();
+
+	for (guint id = 0; id < run->files; ++id)
+	{
+		bench_pace(run, start, id);
+
+		if (id % 16 == 0)
+		{
+			if (dfd != -1)
+				close(dfd);
+
+			dfd = open(run->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+			for (guint level = 0; level < run->depth && dfd != -1; ++level)
+			{
+				char name[16];
+				int next;
+
+				g_snprintf(name, sizeof(name), level == 0 ? "t%06u" : "l%02u", level == 0 ? id / 16 : level);
+
+				if (mkdirat(dfd, name, 0755) == -1)
+					next = -1;
+				else
+					next = openat(dfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+				close(dfd);
+				dfd = next;
+			}
+		}
+
+		if (dfd == -1 || !bench_write(run, dfd, id))
+			break;
+	}
+
+	if (dfd != -1)
+		close(dfd);
+}
+
+static const struct BenchWorkload bench_workloads[] =
+{
+	{ "storm", "create/write/rename/delete over 16 directories", bench_storm },
+	{ "small", "many small files written into one directory", bench_small },
+	{ "tree", "files written into freshly made deep directories", bench_tree },
+};
+
+static gpointer bench_generate(gpointer data)
+{
+	struct BenchRun *run = data;
+	struct timespec ts;
+
+	run->workload->run(run);
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	run->cpu = ts.tv_sec * G_USEC_PER_SEC + ts.tv_nsec / 1000;
+
+	atomic_store(&run->done, 1);
+
+	return NULL;
+}
+
+/* }}} */
+
+/* Consumer {{{ */
+
+static void bench_state(struct Listener *listener, enum ListenerState state, guint root,
+		const char *message, gpointer data)
+{
+	switch (state)
+	{
+	case LISTENER_STARTED:
+		atomic_store(&bench_started, 1);
+		break;
+	case LISTENER_ERROR:
+		fprintf(stderr, "bench-listener: %s\n", message);
+		atomic_store(&bench_failed, 1);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Which timed operation an event reports, from its mask and the name's prefix */
+static gboolean bench_match(const struct RingEvent *ev, guint *id, enum BenchOp *op)
+{
+	const char *name;
+	char *end;
+
+	if (ev->path == NULL || (ev->mask & IN_ISDIR))
+		return FALSE;
+
+	name = strrchr(ev->path, '/');
+	name = name != NULL ? name + 1 : ev->path;
+
+	if (ev->mask & IN_CREATE && name[0] == 'f')
+		*op = BENCH_CREATE;
+	else if (ev->mask & IN_MODIFY && name[0] == 'f')
+		*op = BENCH_MODIFY;
+	else if (ev->mask & IN_MOVED_TO && name[0] == 'm')
+		*op = BENCH_MOVE;
+	else if (ev->mask & IN_DELETE && name[0] == 'm')
+		*op = BENCH_DELETE;
+	else
+		return FALSE;
+
+	*id = strtoul(name + 1, &end, 10);
+
+	return *end == '\0';
+}
+
+static void bench_batch(const struct RingEvent *events, guint n, gpointer data)
+{
+	struct BenchRun *run = data;
+	gint64 now = g_get_real_time();
+
+	run->events += n;
+	run->last = now;
+
+	for (guint i = 0; i < n; ++i)
+	{
+		const struct RingEvent *ev = &events[i];
+		enum BenchOp op;
+		guint id;
+
+		if (!bench_match(ev, &id, &op) || id >= run->files)
+			continue;
+
+		/* Coalesced repeats and replays count once */
+		gint64 stamp = atomic_exchange_explicit(&run->stamps[id][op], 0, memory_order_relaxed);
+		if (stamp == 0)
+			continue;
+
+		gint64 latency = now - stamp;
+		gint64 queued = now - ev->time;
+
+		g_array_append_val(run->latencies, latency);
+		g_array_append_val(run->queued, queued);
+	}
+}
+
+/*
+ * Drains until the workload is over and the listener has gone quiet for
+ * BENCH_QUIET_MS, like the GUI does once per frame but without the frame.
+ */
+static void bench_consume(struct Listener *listener, struct BenchRun *run)
+{
+	struct pollfd pfd = { .fd = listener_get_fd(listener), .events = POLLIN };
+	gint64 quiet_since = 0;
+
+	while (listener_is_running(listener))
+	{
+		if (poll(&pfd, 1, 50) == -1 && errno != EINTR)
+			break;
+
+		if (listener_drain(listener, bench_batch, run, G_MAXUINT) > 0)
+		{
+			quiet_since = 0;
+			continue;
+		}
+
+		if (!atomic_load(&run->done))
+			continue;
+
+		if (quiet_since == 0)
+			quiet_since = g_get_monotonic_time();
+		else if (g_get_monotonic_time() - quiet_since > BENCH_QUIET_MS * 1000)
+			break;
+	}
+}
+
+/* }}} */
+
+/* Report {{{ */
+
+static int bench_cmp(gconstpointer a, gconstpointer b)
+{
+	gint64 ta = *(const gint64*) a;
+	gint64 tb = *(const gint64*) b;
+
+	return (ta > tb) - (ta < tb);
+}
+
+/* The p-th percentile of sorted times, in milliseconds */
+static double bench_percentile(GArray *times, double p)
+{
+	if (times->len == 0)
+		return 0;
+
+	guint i = MIN((guint) (p / 100 * times->len), times->len - 1);
+
+	return g_array_index(times, gint64, i) / 1000.0;
+}
+
+static gint64 bench_rusage_cpu(struct rusage *ru)
+{
+	return (ru->ru_utime.tv_sec + ru->ru_stime.tv_sec) * G_USEC_PER_SEC +
+		ru->ru_utime.tv_usec + ru->ru_stime.tv_usec;
+}
+
+/* }}} */
+
+/* Listener {{{ */
+
+static int bench_listener(const struct BenchWorkload *workload, const char *base,
+		guint files, guint depth, guint rate, guint coalesce, enum ListenerBackend backend)
+{
+	struct BenchRun run = {0};
+	struct rusage before, after;
+	GError *error = NULL;
+	int status = 1;
+
+	run.workload = workload;
+	run.files = files;
+	run.depth = depth;
+	run.rate = rate;
+	run.dir = bench_mkdtemp(base, "bench-listener");
+
+	if (run.dir == NULL)
+	{
+		fprintf(stderr, "bench-listener: can't create a directory: %s\n", strerror(errno));
+		return 1;
+	}
+
+	/* Watched from the start, so no workload waits on a new watch for them */
+	for (guint i = 0; i < 16; ++i)
+	{
+		char *path = g_strdup_printf("%s/d%02u", run.dir, i);
+		mkdir(path, 0755);
+		g_free(path);
+	}
+
+	run.stamps = g_malloc0(sizeof(*run.stamps) * files);
+	run.latencies = g_array_sized_new(FALSE, FALSE, sizeof(gint64), files * 2);
+	run.queued = g_array_sized_new(FALSE, FALSE, sizeof(gint64), files * 2);
+
+	struct ListenerRoot root = { .dir = run.dir, .recursive = TRUE };
+	struct ListenerOptions opts = { .roots = &root, .n_roots = 1, .backend = backend, .coalesce_ms = coalesce };
+
+	atomic_store(&bench_started, 0);
+	atomic_store(&bench_failed, 0);
+
+	getrusage(RUSAGE_SELF, &before);
+
+	struct Listener *listener = listener_start(&opts, bench_state, NULL, &error);
+	if (listener == NULL)
+	{
+		fprintf(stderr, "bench-listener: %s\n", error->message);
+		g_error_free(error);
+		goto out;
+	}
+
+	while (!atomic_load(&bench_started) && !atomic_load(&bench_failed) && listener_is_running(listener))
+		g_usleep(1000);
+
+	if (atomic_load(&bench_failed) || !listener_is_running(listener))
+	{
+		listener_stop(listener);
+		listener_free(listener);
+		goto out;
+	}
+
+	gint64 start = g_get_real_time();
+	GThread *generator = g_thread_new("bench-workload", bench_generate, &run);
+
+	bench_consume(listener, &run);
+	g_thread_join(generator);
+
+	guint dropped = listener_take_dropped(listener);
+	guint overflows = listener_get_overflows(listener);
+
+	listener_stop(listener);
+	listener_drain(listener, bench_batch, &run, G_MAXUINT);
+	dropped += listener_take_dropped(listener);
+	listener_free(listener);
+
+	getrusage(RUSAGE_SELF, &after);
+
+	g_array_sort(run.latencies, bench_cmp);
+	g_array_sort(run.queued, bench_cmp);
+
+	gint64 elapsed = MAX(run.last - start, 1);
+	gint64 cpu = bench_rusage_cpu(&after) - bench_rusage_cpu(&before) - run.cpu;
+
+	printf("%-6s %10" G_GUINT64_FORMAT " %10.0f %9" G_GUINT64_FORMAT " %8u %9u %8.2f %8.2f %8.2f %8.2f %9.0f %9ld\n",
+			workload->name,
+			run.events,
+			run.events * 1e6 / elapsed,
+			run.timed - run.latencies->len,
+			dropped,
+			overflows,
+			bench_percentile(run.latencies, 50),
+			bench_percentile(run.latencies, 99),
+			bench_percentile(run.queued, 50),
+			bench_percentile(run.queued, 99),
+			cpu / 1000.0,
+			after.ru_maxrss);
+	fflush(stdout);
+
+	status = 0;
+
+out:
+	bench_remove(run.dir);
+	g_free(run.dir);
+	g_free(run.stamps);
+	g_array_free(run.latencies, TRUE);
+	g_array_free(run.queued, TRUE);
+
+	return status;
+}
+
+/* }}} */
+
+/* Scan {{{ */
+
+struct BenchScan
+{
+	GMainLoop *loop;
+	GPtrArray *items;
+	gboolean failed;
+};
+
+static void bench_scan_chunk(GArray *items, gpointer data)
+{
+	struct BenchScan *bs = data;
+
+	for (guint i = 0; i < items->len; ++i)
+		g_ptr_array_add(bs->items, g_memdup2(&g_array_index(items, struct dir_item_info, i), sizeof(struct dir_item_info)));
+
+	/* The strings now belong to bs->items */
+	g_array_set_clear_func(items, NULL);
+	g_array_free(items, TRUE);
+}
+
+static void bench_scan_done(GObject *source, GAsyncResult *result, gpointer data)
+{
+	struct BenchScan *bs = data;
+	GError *error = NULL;
+
+	if (!dir_scan_finish(result, NULL, &error))
+	{
+		fprintf(stderr, "bench-listener: %s\n", error->message);
+		g_error_free(error);
+		bs->failed = TRUE;
+	}
+
+	g_main_loop_quit(bs->loop);
+}
+
+/*
+ * Lists dir like update_view() does: scanned in chunks on the pool, then
+ * sorted by name once. Times both parts in microseconds.
+ */
+static gboolean bench_scan_once(const char *dir, gint64 *scan, gint64 *sort, guint *entries)
+{
+	struct BenchScan bs = {0};
+	gint64 start;
+
+	bs.loop = g_main_loop_new(NULL, FALSE);
+	bs.items = g_ptr_array_new_with_free_func((GDestroyNotify) dir_item_free);
+
+	/* A directory listed for the first time has nothing sniffed yet */
+	mime_cache_clear();
+
+	start = g_get_monotonic_time();
+	dir_scan_async(NULL, dir, NULL, bench_scan_chunk, bench_scan_done, &bs);
+	g_main_loop_run(bs.loop);
+	*scan = g_get_monotonic_time() - start;
+
+	start = g_get_monotonic_time();
+	dir_item_sort((struct dir_item_info**) bs.items->pdata, bs.items->len, DIR_SORT_NAME);
+	*sort = g_get_monotonic_time() - start;
+
+	*entries = bs.items->len;
+
+	g_ptr_array_free(bs.items, TRUE);
+	g_main_loop_unref(bs.loop);
+
+	return !bs.failed;
+}
+
+static int bench_scan(const char *base, guint size, int runs)
+{
+	char *dir = bench_mkdtemp(base, "bench-listener");
+	gint64 *scans = g_new(gint64, runs);
+	gint64 *sorts = g_new(gint64, runs);
+	guint entries = 0;
+	int status = 1;
+
+	if (dir == NULL)
+	{
+		fprintf(stderr, "bench-listener: can't create a directory: %s\n", strerror(errno));
+		goto out;
+	}
+
+	if (!bench_populate(dir, size))
+	{
+		fprintf(stderr, "bench-listener: can't populate %s: %s\n", dir, strerror(errno));
+		goto out;
+	}
+
+	for (int r = 0; r < runs; ++r)
+	{
+		if (!bench_scan_once(dir, &scans[r], &sorts[r], &entries))
+			goto out;
+	}
+
+	qsort(scans, runs, sizeof(*scans), bench_cmp);
+	qsort(sorts, runs, sizeof(*sorts), bench_cmp);
+
+	printf("%10u %10u %10.1f %10.1f %10.1f %12.0f\n", size, entries,
+			scans[runs / 2] / 1000.0,
+			sorts[runs / 2] / 1000.0,
+			(scans[0] + sorts[0]) / 1000.0,
+			entries * 1e6 / MAX(scans[0] + sorts[0], 1));
+	fflush(stdout);
+
+	status = 0;
+
+out:
+	if (dir != NULL)
+		bench_remove(dir);
+
+	g_free(dir);
+	g_free(scans);
+	g_free(sorts);
+
+	return status;
+}
+
+/* }}} */
+
+int main(int argc, char *argv[])
+{
+	char *workloads = NULL;
+	char *sizes = NULL;
+	char *backend_name = NULL;
+	int files = 100000;
+	int depth = 8;
+	int rate = 0;
+	int coalesce = 0;
+	int runs = 3;
+	GError *error = NULL;
+
+	GOptionEntry options[] =
+	{
+		{ "workloads", 'w', 0, G_OPTION_ARG_STRING, &workloads, "Comma-separated workloads: storm, small, tree (default all, \"\" for none)", "LIST" },
+		{ "files", 'n', 0, G_OPTION_ARG_INT, &files, "Files per workload (default 100000)", "N" },
+		{ "depth", 'd', 0, G_OPTION_ARG_INT, &depth, "Directory depth of the tree workload (default 8)", "N" },
+		{ "rate", 'r', 0, G_OPTION_ARG_INT, &rate, "Files per second, 0 for as fast as possible (default 0)", "N" },
+		{ "coalesce", 'c', 0, G_OPTION_ARG_INT, &coalesce, "Coalescing window in ms (default 0)", "MS" },
+		{ "backend", 'b', 0, G_OPTION_ARG_STRING, &backend_name, "inotify or fanotify (default inotify)", "NAME" },
+		{ "sizes", 's', 0, G_OPTION_ARG_STRING, &sizes, "Comma-separated directory sizes to list (default 1000,100000,1000000, \"\" for none)", "LIST" },
+		{ "runs", 0, 0, G_OPTION_ARG_INT, &runs, "Listings per size (default 3)", "N" },
+		{ NULL }
+	};
+
+	GOptionContext *context = g_option_context_new("[DIRECTORY]");
+	g_option_context_set_summary(context,
+			"Runs file system workloads under a watched directory and reports event\n"
+			"throughput, lost events, latency from system call to consumer, CPU time\n"
+			"and peak RSS; then times listing directories of the given sizes. Work\n"
+			"happens in new directories under DIRECTORY (default /dev/shm).\n"
+			"\n"
+			"Latency is timed for creates, writes, renames and deletes; \"queued\" is\n"
+			"the part spent between the listener reading an event and the consumer\n"
+			"draining it. CPU time leaves out the thread generating the workload.");
+	g_option_context_add_main_entries(context, options, NULL);
+
+	if (!g_option_context_parse(context, &argc, &argv, &error))
+	{
+		fprintf(stderr, "bench-listener: %s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(context);
+		return 2;
+	}
+
+	g_option_context_free(context);
+
+	enum ListenerBackend backend = LISTENER_BACKEND_INOTIFY;
+
+	if (backend_name != NULL && strcmp(backend_name, "fanotify") == 0)
+		backend = LISTENER_BACKEND_FANOTIFY;
+	else if (backend_name != NULL && strcmp(backend_name, "inotify") != 0)
+		argc = 0;
+
+	if (argc > 2 || files < 1 || depth < 1 || rate < 0 || coalesce < 0 || runs < 1)
+	{
+		fprintf(stderr, "Usage: %s [OPTION...] [DIRECTORY]\n", argv[0]);
+		return 2;
+	}
+
+	const char *base = argc == 2 ? argv[1] : NULL;
+	char **list = g_strsplit(workloads != NULL ? workloads : "storm,small,tree", ",", -1);
+	int status = 0;
+
+	if (list[0] != NULL)
+	{
+		printf("%-6s %10s %10s %9s %8s %9s %8s %8s %8s %8s %9s %9s\n",
+				"load", "events", "events/s", "lost", "dropped", "overflows",
+				"p50 ms", "p99 ms", "q50 ms", "q99 ms", "cpu ms", "rss KiB");
+	}
+
+	for (char **w = list; *w && status == 0; ++w)
+	{
+		const struct BenchWorkload *workload = NULL;
+
+		for (guint i = 0; i < G_N_ELEMENTS(bench_workloads); ++i)
+		{
+			if (strcmp(bench_workloads[i].name, *w) == 0)
+				workload = &bench_workloads[i];
+		}
+
+		if (workload == NULL)
+		{
+			fprintf(stderr, "bench-listener: unknown workload %s\n", *w);
+			status = 2;
+			break;
+		}
+
+		fprintf(stderr, "bench-listener: %s: %s\n", workload->name, workload->description);
+		status = bench_listener(workload, base, files, depth, rate, coalesce, backend);
+	}
+
+	g_strfreev(list);
+	list = g_strsplit(sizes != NULL ? sizes : "1000,100000,1000000", ",", -1);
+
+	if (status == 0 && list[0] != NULL)
+	{
+		printf("\n%10s %10s %10s %10s %10s %12s\n",
+				"size", "entries", "scan ms", "sort ms", "best ms", "entries/s");
+	}
+
+	for (char **s = list; *s && status == 0; ++s)
+	{
+		guint size = strtoul(*s, NULL, 10);
+
+		if (size == 0)
+			continue;
+
+		fprintf(stderr, "bench-listener: listing %u entries\n", size);
+		status = bench_scan(base, size, runs);
+	}
+
+	g_strfreev(list);
+	g_free(workloads);
+	g_free(sizes);
+	g_free(backend_name);
+
+	return status;
+}
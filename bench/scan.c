@@ -0,0 +1,232 @@
+/* vim: set fdm=marker : */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <gio/gio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dir_scan.h"
+#include "mime_cache.h"
+#include "workload.h"
+
+/*
+ * Times dir_scan_async() over a directory with different numbers of pool
+ * threads. Point it at a tmpfs for the CPU-bound case. For the case where
+ * every stat and every sniff is a round trip, point it at a FUSE mount
+ * (sshfs, say), or stand one in with --latency, which makes the scan wait
+ * that long before each stat and each sniff.
+ */
+
+struct BenchScan
+{
+	GMainLoop *loop;
+	guint64 entries;
+	gboolean failed;
+};
+
+/* Scan {{{ */
+
+static void bench_chunk(GArray *items, gpointer data)
+{
+	struct BenchScan *bs = data;
+
+	bs->entries += items->len;
+	g_array_free(items, TRUE);
+}
+
+static void bench_done(GObject *source, GAsyncResult *result, gpointer data)
+{
+	struct BenchScan *bs = data;
+	GError *error = NULL;
+
+	if (!dir_scan_finish(result, NULL, &error))
+	{
+		fprintf(stderr, "bench-scan: %s\n", error->message);
+		g_error_free(error);
+		bs->failed = TRUE;
+	}
+
+	g_main_loop_quit(bs->loop);
+}
+
+/* Wall time of one scan in microseconds, or -1 */
+static gint64 bench_scan(const char *dir, guint64 *entries)
+{
+	struct BenchScan bs = {0};
+	gint64 start;
+
+	bs.loop = g_main_loop_new(NULL, FALSE);
+	start = g_get_monotonic_time();
+
+	dir_scan_async(NULL, dir, NULL, bench_chunk, bench_done, &bs);
+	g_main_loop_run(bs.loop);
+
+	gint64 elapsed = g_get_monotonic_time() - start;
+	g_main_loop_unref(bs.loop);
+
+	*entries = bs.entries;
+
+	return bs.failed ? -1 : elapsed;
+}
+
+static int bench_cmp(gconstpointer a, gconstpointer b)
+{
+	gint64 ta = *(const gint64*) a;
+	gint64 tb = *(const gint64*) b;
+
+	return (ta > tb) - (ta < tb);
+}
+
+/* }}} */
+
+int main(int argc, char *argv[])
+{
+	int entries = 200000;
+	int runs = 3;
+	int latency = 0;
+	char *threads = NULL;
+	gboolean warm = FALSE;
+	gboolean keep = FALSE;
+	GError *error = NULL;
+
+	GOptionEntry options[] =
+	{
+		{ "entries", 'n', 0, G_OPTION_ARG_INT, &entries, "Create N entries to scan (default 200000, 0 scans DIRECTORY as it is)", "N" },
+		{ "runs", 'r', 0, G_OPTION_ARG_INT, &runs, "Scans per thread count (default 3)", "N" },
+		{ "threads", 't', 0, G_OPTION_ARG_STRING, &threads, "Comma-separated thread counts (default 1, 2, 4 ... up to the core count)", "LIST" },
+		{ "warm", 'w', 0, G_OPTION_ARG_NONE, &warm, "Keep sniffed types cached between scans", NULL },
+		{ "latency", 'l', 0, G_OPTION_ARG_INT, &latency, "Wait US before every stat and every sniff, as on a slow FUSE mount (default 0)", "US" },
+		{ "keep", 'k', 0, G_OPTION_ARG_NONE, &keep, "Don't remove the created entries", NULL },
+		{ NULL }
+	};
+
+	GOptionContext *context = g_option_context_new("[DIRECTORY]");
+	g_option_context_set_summary(context,
+			"Times directory scans with different numbers of threads. Entries are\n"
+			"created in a new directory under DIRECTORY (default /dev/shm).");
+	g_option_context_add_main_entries(context, options, NULL);
+
+	if (!g_option_context_parse(context, &argc, &argv, &error))
+	{
+		fprintf(stderr, "bench-scan: %s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(context);
+		return 2;
+	}
+
+	g_option_context_free(context);
+
+	if (argc > 2 || runs < 1 || entries < 0 || latency < 0 || (entries == 0 && argc != 2))
+	{
+		fprintf(stderr, "Usage: %s [OPTION...] [DIRECTORY]\n", argv[0]);
+		return 2;
+	}
+
+	GArray *counts = g_array_new(FALSE, FALSE, sizeof(guint));
+
+	if (threads != NULL)
+	{
+		char **list = g_strsplit(threads, ",", -1);
+
+		for (char **t = list; *t; ++t)
+		{
+			guint n = strtoul(*t, NULL, 10);
+			if (n > 0)
+				g_array_append_val(counts, n);
+		}
+
+		g_strfreev(list);
+		g_free(threads);
+	}
+	else
+	{
+		guint cores = g_get_num_processors();
+
+		for (guint n = 1; n < cores; n *= 2)
+			g_array_append_val(counts, n);
+
+		g_array_append_val(counts, cores);
+	}
+
+	char *dir;
+
+	if (entries > 0)
+	{
+		dir = bench_mkdtemp(argc == 2 ? argv[1] : NULL, "bench-scan");
+		if (dir == NULL)
+		{
+			fprintf(stderr, "bench-scan: can't create a directory: %s\n", strerror(errno));
+			return 1;
+		}
+
+		fprintf(stderr, "bench-scan: creating %d entries in %s\n", entries, dir);
+
+		if (!bench_populate(dir, entries))
+		{
+			fprintf(stderr, "bench-scan: can't populate %s: %s\n", dir, strerror(errno));
+			bench_remove(dir);
+			g_free(dir);
+			return 1;
+		}
+	}
+	else
+		dir = g_strdup(argv[1]);
+
+	dir_scan_set_latency(latency);
+
+	printf("%8s %10s %10s %12s %8s\n", "threads", "best ms", "median ms", "entries/s", "speedup");
+
+	gint64 *times = g_new(gint64, runs);
+	gint64 base = 0;
+	int status = 0;
+
+	for (guint c = 0; c < counts->len && status == 0; ++c)
+	{
+		guint n = g_array_index(counts, guint, c);
+		guint64 scanned = 0;
+
+		dir_scan_set_max_threads(n);
+
+		for (int r = 0; r < runs; ++r)
+		{
+			/* Otherwise only the first scan would sniff anything */
+			if (!warm)
+				mime_cache_clear();
+
+			times[r] = bench_scan(dir, &scanned);
+			if (times[r] < 0)
+			{
+				status = 1;
+				break;
+			}
+		}
+
+		if (status != 0)
+			break;
+
+		qsort(times, runs, sizeof(*times), bench_cmp);
+
+		gint64 best = MAX(times[0], 1);
+		gint64 median = times[runs / 2];
+
+		if (base == 0)
+			base = best;
+
+		printf("%8u %10.1f %10.1f %12.0f %7.2fx\n", n,
+				best / 1000.0, median / 1000.0,
+				scanned * 1e6 / best, (double) base / best);
+		fflush(stdout);
+	}
+
+	if (entries > 0 && !keep)
+		bench_remove(dir);
+
+	g_free(times);
+	g_free(dir);
+	g_array_free(counts, TRUE);
+
+	return status;
+}
@@ -0,0 +1,96 @@
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <glib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "workload.h"
+
+gboolean bench_populate(const char *dir, guint n)
+{
+	int dfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dfd == -1)
+		return FALSE;
+
+	for (guint i = 0; i < n; ++i)
+	{
+		char name[64];
+
+		if (i % 64 == 0)
+		{
+			g_snprintf(name, sizeof(name), "dir%07u", i);
+			if (mkdirat(dfd, name, 0755) == -1)
+				goto fail;
+			continue;
+		}
+
+		if (i % 4 == 0)
+			g_snprintf(name, sizeof(name), "file%07u", i);
+		else
+			g_snprintf(name, sizeof(name), "file%07u.txt", i);
+
+		int fd = openat(dfd, name, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (fd == -1)
+			goto fail;
+
+		const char *content = i % 4 == 0 ? "#!/bin/sh\necho bench\n" : "bench\n";
+		if (write(fd, content, strlen(content)) == -1)
+		{
+			close(fd);
+			goto fail;
+		}
+
+		close(fd);
+	}
+
+	close(dfd);
+	return TRUE;
+
+fail:
+	close(dfd);
+	return FALSE;
+}
+
+void bench_remove(const char *dir)
+{
+	GDir *d = g_dir_open(dir, 0, NULL);
+	const char *name;
+
+	if (d != NULL)
+	{
+		while ((name = g_dir_read_name(d)))
+		{
+			char *path = g_build_filename(dir, name, NULL);
+			struct stat st;
+
+			if (lstat(path, &st) == 0 && S_ISDIR(st.st_mode))
+				bench_remove(path);
+			else
+				unlink(path);
+
+			g_free(path);
+		}
+
+		g_dir_close(d);
+	}
+
+	rmdir(dir);
+}
+
+char *bench_mkdtemp(const char *base, const char *prefix)
+{
+	char *name = g_strdup_printf("%s.XXXXXX", prefix);
+	char *tmpl = g_build_filename(base != NULL ? base : "/dev/shm", name, NULL);
+
+	g_free(name);
+
+	if (g_mkdtemp(tmpl) == NULL)
+	{
+		g_free(tmpl);
+		return NULL;
+	}
+
+	return tmpl;
+}
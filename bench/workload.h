@@ -0,0 +1,21 @@
+#ifndef BENCH_WORKLOAD_H
+#define BENCH_WORKLOAD_H
+
+#include <glib.h>
+
+/* File system fixtures shared by the benchmarks */
+
+/*
+ * Fills dir with n entries: one in 64 is a directory, one in 4 is a file
+ * with no extension whose type has to be sniffed, the rest are small text
+ * files recognised by name.
+ */
+gboolean bench_populate(const char *dir, guint n);
+
+/* Removes dir and everything below it */
+void bench_remove(const char *dir);
+
+/* A new directory under base (/dev/shm if NULL), or NULL with errno set */
+char *bench_mkdtemp(const char *base, const char *prefix);
+
+#endif /* end of include guard: BENCH_WORKLOAD_H */
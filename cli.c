@@ -0,0 +1,541 @@
+/* vim: set fdm=marker : */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <glib.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/poll.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+
+#include "journal.h"
+#include "listener.h"
+#include "metrics.h"
+#include "path_filter.h"
+#include "trace.h"
+
+/* stdout buffer; everything drained in one wakeup is written in one go */
+#define CLI_OUTPUT_BUFFER (1 << 20)
+
+/* Default --metrics-interval, in seconds */
+#define CLI_METRICS_INTERVAL 10
+
+/* Output {{{ */
+
+/*
+ * Fixed-size header of one binary record, in host byte order. path_len
+ * bytes of path follow it without a terminator; path_len is 0 for a queue
+ * overflow. root is the 1-based position of the DIRECTORY argument the
+ * event was seen under, 0 for an overflow.
+ */
+struct CliRecord
+{
+	guint32 mask;
+	guint32 count;
+	gint64 time;
+	gint64 last_time;
+	guint32 cookie;
+	guint32 path_len;
+	guint32 root;
+	guint32 reserved;
+};
+
+/*
+ * Paths are bytes, JSON strings are UTF-8. Bytes that aren't part of
+ * valid UTF-8 come out as U+FFFD; the caller adds the exact bytes.
+ */
+static void write_json_string(const char *str, FILE *out)
+{
+	const char *valid;
+
+	putc('"', out);
+
+	for (;;)
+	{
+		/* Everything before valid is UTF-8, the byte at it isn't */
+		g_utf8_validate(str, -1, &valid);
+
+		for (const unsigned char *p = (const unsigned char*) str; p < (const unsigned char*) valid; ++p)
+		{
+			switch (*p)
+			{
+			case '"':  fputs("\\\"", out); break;
+			case '\\': fputs("\\\\", out); break;
+			case '\n': fputs("\\n", out); break;
+			case '\r': fputs("\\r", out); break;
+			case '\t': fputs("\\t", out); break;
+			default:
+				if (*p < 0x20)
+					fprintf(out, "\\u%04x", *p);
+				else
+					putc(*p, out);
+			}
+		}
+
+		if (*valid == '\0')
+			break;
+
+		fputs("\\ufffd", out);
+		str = valid + 1;
+	}
+
+	putc('"', out);
+}
+
+static void write_json(const struct RingEvent *events, guint n, gpointer data)
+{
+	FILE *out = data;
+
+	for (guint i = 0; i < n; ++i)
+	{
+		const struct RingEvent *ev = &events[i];
+
+		fprintf(out, "{\"time\":%" G_GINT64_FORMAT ",\"last_time\":%" G_GINT64_FORMAT
+				",\"count\":%u,\"mask\":%u,\"event\":\"%s\",\"root\":%u,\"path\":",
+				ev->time, ev->last_time, ev->count, ev->mask, listener_event_name(ev->mask), ev->root);
+
+		if (ev->path)
+			write_json_string(ev->path, out);
+		else
+			fputs("null", out);
+
+		/* Only for paths the string above couldn't carry exactly */
+		if (ev->path && !g_utf8_validate(ev->path, -1, NULL))
+		{
+			char *raw = g_base64_encode((const guchar*) ev->path, strlen(ev->path));
+			fprintf(out, ",\"path_base64\":\"%s\"", raw);
+			g_free(raw);
+		}
+
+		fputs("}\n", out);
+	}
+}
+
+static void write_binary(const struct RingEvent *events, guint n, gpointer data)
+{
+	FILE *out = data;
+
+	for (guint i = 0; i < n; ++i)
+	{
+		const struct RingEvent *ev = &events[i];
+		struct CliRecord rec;
+
+		rec.mask = ev->mask;
+		rec.count = ev->count;
+		rec.time = ev->time;
+		rec.last_time = ev->last_time;
+		rec.cookie = ev->cookie;
+		rec.path_len = ev->path ? strlen(ev->path) : 0;
+		rec.root = ev->root;
+		rec.reserved = 0;
+
+		fwrite(&rec, sizeof(rec), 1, out);
+		fwrite(ev->path, 1, rec.path_len, out);
+	}
+}
+
+/* Where each drained batch goes */
+struct CliOutput
+{
+	FILE *out;
+	ListenerBatchFunc write;
+	struct Journal *journal;
+};
+
+static void cli_batch(const struct RingEvent *events, guint n, gpointer data)
+{
+	struct CliOutput *output = data;
+
+	if (output->journal)
+	{
+		GError *error = NULL;
+
+		if (!journal_append(output->journal, events, n, &error))
+		{
+			fprintf(stderr, "inotify-cli: %s, journal stopped\n", error->message);
+			g_error_free(error);
+
+			journal_close(output->journal);
+			output->journal = NULL;
+		}
+	}
+
+	output->write(events, n, output->out);
+}
+
+/* }}} */
+
+/* Listening {{{ */
+
+static atomic_int failed;
+
+/* Runs on the listener thread; stderr is unbuffered, so it is safe to write from here */
+static void cli_state(struct Listener *listener,
+		enum ListenerState state,
+		guint root,
+		const char *message,
+		gpointer data)
+{
+	switch (state)
+	{
+	case LISTENER_ERROR:
+		fprintf(stderr, "inotify-cli: %s\n", message);
+		atomic_store(&failed, 1);
+		break;
+	case LISTENER_STATUS:
+		fprintf(stderr, "inotify-cli: %s\n", message);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Where the listener's counters are published, and when next */
+struct CliMetrics
+{
+	struct Metrics *metrics;
+	gint64 interval;
+	gint64 next;
+	char **dirs;
+	guint n_roots;
+	GString *text;
+};
+
+static void cli_publish(struct Listener *listener, struct CliMetrics *metrics)
+{
+	struct ListenerStats stats;
+	struct ListenerRootStats *roots = g_new0(struct ListenerRootStats, metrics->n_roots);
+	GError *error = NULL;
+
+	listener_get_stats(listener, &stats);
+
+	for (guint i = 0; i < metrics->n_roots; ++i)
+		if (!listener_get_root_stats(listener, i + 1, &roots[i]))
+			memset(&roots[i], 0, sizeof(roots[i]));
+
+	g_string_truncate(metrics->text, 0);
+	metrics_format(metrics->text, &stats);
+	metrics_format_roots(metrics->text, (const char *const*) metrics->dirs, roots, metrics->n_roots);
+	g_free(roots);
+
+	if (!metrics_publish(metrics->metrics, metrics->text, &error))
+	{
+		fprintf(stderr, "inotify-cli: %s\n", error->message);
+		g_error_free(error);
+	}
+
+	metrics->next = g_get_monotonic_time() + metrics->interval;
+}
+
+/* Poll timeout in ms until the metrics are due, -1 without any */
+static int cli_timeout(struct CliMetrics *metrics)
+{
+	gint64 left;
+
+	if (metrics == NULL)
+		return -1;
+
+	left = metrics->next - g_get_monotonic_time();
+	return left <= 0 ? 0 : (int) ((left + 999) / 1000);
+}
+
+/*
+ * Sleeps until the listener has something queued, a signal arrives or the
+ * metrics are due, and writes out everything queued at once. Returns when
+ * the listener stopped on its own, the output went away or SIGINT/SIGTERM
+ * was received.
+ */
+static void cli_loop(struct Listener *listener, int sfd, struct CliOutput *output, struct CliMetrics *metrics)
+{
+	struct pollfd fds[2];
+
+	fds[0].fd = sfd;
+	fds[0].events = POLLIN;
+
+	fds[1].fd = listener_get_fd(listener);
+	fds[1].events = POLLIN;
+
+	while (1)
+	{
+		int n = poll(fds, 2, cli_timeout(metrics));
+		if (n == -1)
+		{
+			if (errno == EINTR)
+				continue;
+
+			fprintf(stderr, "inotify-cli: poll: %s\n", strerror(errno));
+			break;
+		}
+
+		if (metrics && cli_timeout(metrics) == 0)
+			cli_publish(listener, metrics);
+
+		if (n == 0)
+			continue;
+
+		if (fds[0].revents & POLLIN)
+			break;
+
+		/* Checked before draining, so nothing queued before the stop is missed */
+		gboolean running = listener_is_running(listener);
+
+		listener_drain(listener, cli_batch, output, G_MAXUINT);
+
+		guint dropped = listener_take_dropped(listener);
+		if (dropped > 0)
+			fprintf(stderr, "inotify-cli: %u events dropped\n", dropped);
+
+		if (fflush(stdout) == EOF)
+			break;
+
+		if (!running)
+			break;
+	}
+
+	listener_stop(listener);
+	listener_drain(listener, cli_batch, output, G_MAXUINT);
+	fflush(stdout);
+
+	/* Final counters, for whoever reads them after we're gone */
+	if (metrics)
+		cli_publish(listener, metrics);
+}
+
+/* Per-directory counters, written to stderr once listening stopped */
+static void cli_stats(struct Listener *listener, char **dirs, guint n)
+{
+	for (guint i = 0; i < n; ++i)
+	{
+		struct ListenerRootStats stats;
+
+		if (!listener_get_root_stats(listener, i + 1, &stats))
+			continue;
+
+		fprintf(stderr, "inotify-cli: %s: %" G_GUINT64_FORMAT " events, %" G_GUINT64_FORMAT
+				" filtered, %u directories\n", dirs[i], stats.events, stats.filtered, stats.watches);
+	}
+}
+
+/* }}} */
+
+int main(int argc, char *argv[])
+{
+	gboolean recursive = FALSE;
+	gboolean print_stats = FALSE;
+	char *backend = NULL;
+	char *format = NULL;
+	char *journal = NULL;
+	char *metrics_target = NULL;
+	int metrics_interval = CLI_METRICS_INTERVAL;
+	char *trace = NULL;
+	char *events = NULL;
+	char **excludes = NULL;
+	char **includes = NULL;
+	char *exclude_from = NULL;
+	int coalesce = 100;
+	GError *error = NULL;
+
+	GOptionEntry entries[] =
+	{
+		{ "recursive", 'r', 0, G_OPTION_ARG_NONE, &recursive, "Watch subdirectories too", NULL },
+		{ "backend", 'b', 0, G_OPTION_ARG_STRING, &backend, "Notification backend: inotify (default) or fanotify", "NAME" },
+		{ "coalesce", 'c', 0, G_OPTION_ARG_INT, &coalesce, "Merge repeated events within MS milliseconds (default 100, 0 disables)", "MS" },
+		{ "format", 'f', 0, G_OPTION_ARG_STRING, &format, "Output format: json (JSON Lines, default) or binary", "FORMAT" },
+		{ "journal", 'j', 0, G_OPTION_ARG_FILENAME, &journal, "Also record events into a rotating journal at PATH", "PATH" },
+		{ "stats", 's', 0, G_OPTION_ARG_NONE, &print_stats, "Print per-directory counters to stderr on exit", NULL },
+		{ "metrics", 'm', 0, G_OPTION_ARG_FILENAME, &metrics_target, "Publish counters in the Prometheus text format to FILE, or serve them on unix:PATH", "TARGET" },
+		{ "metrics-interval", 0, 0, G_OPTION_ARG_INT, &metrics_interval, "Update the published counters every SECONDS (default 10)", "SECONDS" },
+		{ "trace", 0, 0, G_OPTION_ARG_FILENAME, &trace, "Write a Chrome trace of the hot paths to FILE on exit (or set " TRACE_ENV ")", "FILE" },
+		{ "events", 'e', 0, G_OPTION_ARG_STRING, &events, "Only report these events, e.g. create,delete,close_write (default all)", "LIST" },
+		{ "exclude", 'x', 0, G_OPTION_ARG_STRING_ARRAY, &excludes, "Skip paths matching a .gitignore-style RULE; excluded directories aren't watched", "RULE" },
+		{ "exclude-from", 0, 0, G_OPTION_ARG_FILENAME, &exclude_from, "Read exclude rules from a .gitignore-style FILE", "FILE" },
+		{ "include", 'i', 0, G_OPTION_ARG_STRING_ARRAY, &includes, "Only report files matching GLOB", "GLOB" },
+		{ NULL }
+	};
+
+	GOptionContext *context = g_option_context_new("DIRECTORY...");
+	g_option_context_set_summary(context,
+			"Streams filesystem events under each DIRECTORY to stdout. All of them\n"
+			"share one notification queue and one thread.");
+	g_option_context_add_main_entries(context, entries, NULL);
+
+	if (!g_option_context_parse(context, &argc, &argv, &error))
+	{
+		fprintf(stderr, "inotify-cli: %s\n", error->message);
+		g_error_free(error);
+		g_option_context_free(context);
+		return 2;
+	}
+
+	g_option_context_free(context);
+
+	if (argc < 2)
+	{
+		fprintf(stderr, "Usage: %s [OPTION...] DIRECTORY...\n", argv[0]);
+		return 2;
+	}
+
+	struct ListenerOptions options = {0};
+	struct CliOutput output = {stdout, write_json, NULL};
+	struct PathFilter *filter = path_filter_new();
+	guint32 event_mask = 0;
+
+	if (events && !listener_parse_events(events, &event_mask, &error))
+	{
+		fprintf(stderr, "inotify-cli: %s\n", error->message);
+		return 2;
+	}
+
+	if (exclude_from && !path_filter_load(filter, exclude_from, &error))
+	{
+		fprintf(stderr, "inotify-cli: %s\n", error->message);
+		return 2;
+	}
+
+	for (char **rule = excludes; rule && *rule; ++rule)
+		path_filter_add_exclude(filter, *rule);
+
+	for (char **rule = includes; rule && *rule; ++rule)
+		path_filter_add_include(filter, *rule);
+
+	g_free(events);
+	g_free(exclude_from);
+	g_strfreev(excludes);
+	g_strfreev(includes);
+
+	guint n_roots = argc - 1;
+	struct ListenerRoot *roots = g_new0(struct ListenerRoot, n_roots);
+
+	for (guint i = 0; i < n_roots; ++i)
+	{
+		roots[i].dir = argv[i + 1];
+		roots[i].recursive = recursive;
+		roots[i].events = event_mask;
+		roots[i].filter = filter;
+	}
+
+	options.roots = roots;
+	options.n_roots = n_roots;
+	options.coalesce_ms = coalesce < 0 ? 0 : coalesce;
+
+	if (backend == NULL || strcmp(backend, "inotify") == 0)
+		options.backend = LISTENER_BACKEND_INOTIFY;
+	else if (strcmp(backend, "fanotify") == 0)
+		options.backend = LISTENER_BACKEND_FANOTIFY;
+	else
+	{
+		fprintf(stderr, "inotify-cli: unknown backend '%s'\n", backend);
+		return 2;
+	}
+
+	if (format == NULL || strcmp(format, "json") == 0)
+		output.write = write_json;
+	else if (strcmp(format, "binary") == 0)
+		output.write = write_binary;
+	else
+	{
+		fprintf(stderr, "inotify-cli: unknown format '%s'\n", format);
+		return 2;
+	}
+
+	g_free(backend);
+	g_free(format);
+
+	if (journal)
+	{
+		output.journal = journal_open(journal, JOURNAL_SEGMENT_SIZE, JOURNAL_MAX_SEGMENTS, &error);
+		g_free(journal);
+
+		if (output.journal == NULL)
+		{
+			fprintf(stderr, "inotify-cli: %s\n", error->message);
+			g_error_free(error);
+			return 1;
+		}
+	}
+
+	setvbuf(stdout, NULL, _IOFBF, CLI_OUTPUT_BUFFER);
+
+	/* Blocked before the listener thread starts, so that it inherits the mask */
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	sigaddset(&mask, SIGPIPE);
+	sigprocmask(SIG_BLOCK, &mask, NULL);
+
+	sigdelset(&mask, SIGPIPE);
+	int sfd = signalfd(-1, &mask, SFD_CLOEXEC);
+	if (sfd == -1)
+	{
+		fprintf(stderr, "inotify-cli: signalfd: %s\n", strerror(errno));
+		return 1;
+	}
+
+	struct CliMetrics metrics = {0};
+
+	/* Opened after the mask is set, as a socket is served by its own thread */
+	if (metrics_target)
+	{
+		metrics.metrics = metrics_open(metrics_target, &error);
+		g_free(metrics_target);
+
+		if (metrics.metrics == NULL)
+		{
+			fprintf(stderr, "inotify-cli: %s\n", error->message);
+			g_error_free(error);
+			journal_close(output.journal);
+			close(sfd);
+			return 1;
+		}
+
+		metrics.interval = (gint64) MAX(metrics_interval, 1) * G_USEC_PER_SEC;
+		metrics.next = g_get_monotonic_time() + metrics.interval;
+		metrics.dirs = argv + 1;
+		metrics.n_roots = n_roots;
+		metrics.text = g_string_new(NULL);
+	}
+
+	if (trace || g_getenv(TRACE_ENV))
+	{
+		if (!trace_open(trace ? trace : g_getenv(TRACE_ENV), &error))
+		{
+			fprintf(stderr, "inotify-cli: %s\n", error->message);
+			g_clear_error(&error);
+		}
+
+		g_free(trace);
+	}
+
+	struct Listener *listener = listener_start(&options, cli_state, NULL, &error);
+	if (listener == NULL)
+	{
+		fprintf(stderr, "inotify-cli: %s\n", error->message);
+		g_error_free(error);
+		journal_close(output.journal);
+		metrics_close(metrics.metrics);
+		close(sfd);
+		return 1;
+	}
+
+	cli_loop(listener, sfd, &output, metrics.metrics ? &metrics : NULL);
+
+	if (print_stats)
+		cli_stats(listener, argv + 1, n_roots);
+
+	listener_free(listener);
+	trace_close();
+	path_filter_unref(filter);
+	g_free(roots);
+	journal_close(output.journal);
+	metrics_close(metrics.metrics);
+	if (metrics.text)
+		g_string_free(metrics.text, TRUE);
+	close(sfd);
+
+	return atomic_load(&failed) ? 1 : 0;
+}
@@ -0,0 +1,268 @@
+#include <glib.h>
+#include <sys/inotify.h>
+
+#include "coalescer.h"
+
+/* Events that can be merged without hiding a change to the tree */
+#define COALESCE_MASK (IN_ACCESS | IN_MODIFY | IN_ATTRIB | IN_OPEN | IN_CLOSE_WRITE | IN_CLOSE_NOWRITE)
+
+/* Every event pending for one path of a root, whatever its mask */
+struct CoalescerPath
+{
+	guint32 root;
+	guint32 dir;
+	guint32 name;
+	GQueue entries;
+	GList link;
+};
+
+struct CoalescerEntry
+{
+	struct RingEvent ev;
+	GList link;
+
+	struct CoalescerPath *path;
+	GList path_link;
+};
+
+static guint entry_hash(gconstpointer key)
+{
+	const struct CoalescerEntry *entry = key;
+	guint hash = entry->ev.dir * 2654435761u;
+
+	hash = (hash ^ entry->ev.name) * 2246822519u;
+	return hash ^ (entry->ev.mask * 3266489917u) ^ entry->ev.root;
+}
+
+static gboolean entry_equal(gconstpointer a, gconstpointer b)
+{
+	const struct CoalescerEntry *ea = a;
+	const struct CoalescerEntry *eb = b;
+
+	return ea->ev.mask == eb->ev.mask && ea->ev.root == eb->ev.root &&
+		ea->ev.dir == eb->ev.dir && ea->ev.name == eb->ev.name;
+}
+
+static guint path_hash(gconstpointer key)
+{
+	const struct CoalescerPath *path = key;
+	guint hash = path->dir * 2654435761u;
+
+	hash = (hash ^ path->name) * 2246822519u;
+	return hash ^ path->root;
+}
+
+static gboolean path_equal(gconstpointer a, gconstpointer b)
+{
+	const struct CoalescerPath *pa = a;
+	const struct CoalescerPath *pb = b;
+
+	return pa->root == pb->root && pa->dir == pb->dir && pa->name == pb->name;
+}
+
+struct Coalescer *coalescer_new(gint64 window, CoalescerFunc func, gpointer data)
+{
+	struct Coalescer *co = g_new(struct Coalescer, 1);
+
+	co->window = window;
+	co->pending = g_hash_table_new(entry_hash, entry_equal);
+	co->paths = g_hash_table_new(path_hash, path_equal);
+	co->func = func;
+	co->data = data;
+	co->spare = NULL;
+	co->spare_paths = NULL;
+	g_queue_init(&co->order);
+
+	return co;
+}
+
+/* Pending events are released, not dropped */
+void coalescer_free(struct Coalescer *co)
+{
+	if (co == NULL)
+		return;
+
+	coalescer_flush(co, G_MAXINT64);
+	g_hash_table_destroy(co->pending);
+	g_hash_table_destroy(co->paths);
+
+	while (co->spare != NULL)
+	{
+		struct CoalescerEntry *entry = co->spare->data;
+
+		co->spare = co->spare->next;
+		g_free(entry);
+	}
+
+	while (co->spare_paths != NULL)
+	{
+		struct CoalescerPath *path = co->spare_paths->data;
+
+		co->spare_paths = co->spare_paths->next;
+		g_free(path);
+	}
+
+	g_free(co);
+}
+
+static void coalescer_release(struct Coalescer *co, struct CoalescerEntry *entry)
+{
+	struct CoalescerPath *path = entry->path;
+
+	g_queue_unlink(&co->order, &entry->link);
+	g_hash_table_remove(co->pending, entry);
+
+	g_queue_unlink(&path->entries, &entry->path_link);
+	if (path->entries.length == 0)
+	{
+		g_hash_table_remove(co->paths, path);
+		path->link.next = co->spare_paths;
+		co->spare_paths = &path->link;
+	}
+
+	co->func(&entry->ev, co->data);
+
+	/* Kept for the next event, so that a steady stream allocates nothing */
+	entry->link.next = co->spare;
+	co->spare = &entry->link;
+}
+
+/* Releases everything pending for the path of ev, oldest first */
+static void coalescer_release_path(struct Coalescer *co, const struct RingEvent *ev)
+{
+	struct CoalescerPath key;
+	struct CoalescerPath *path;
+
+	key.root = ev->root;
+	key.dir = ev->dir;
+	key.name = ev->name;
+
+	path = g_hash_table_lookup(co->paths, &key);
+	if (path == NULL)
+		return;
+
+	/* The path goes away with its last entry */
+	for (guint n = path->entries.length; n > 0; --n)
+		coalescer_release(co, g_queue_peek_head_link(&path->entries)->data);
+}
+
+/* The path an entry is pending under, taken from the spare ones if it is new */
+static struct CoalescerPath *coalescer_get_path(struct Coalescer *co, const struct RingEvent *ev)
+{
+	struct CoalescerPath key;
+	struct CoalescerPath *path;
+
+	key.root = ev->root;
+	key.dir = ev->dir;
+	key.name = ev->name;
+
+	path = g_hash_table_lookup(co->paths, &key);
+	if (path != NULL)
+		return path;
+
+	if (co->spare_paths != NULL)
+	{
+		path = co->spare_paths->data;
+		co->spare_paths = co->spare_paths->next;
+	}
+	else
+		path = g_new(struct CoalescerPath, 1);
+
+	*path = key;
+	g_queue_init(&path->entries);
+	path->link.data = path;
+	path->link.prev = path->link.next = NULL;
+
+	g_hash_table_add(co->paths, path);
+
+	return path;
+}
+
+/* The event either reaches the callback right away or is held until its window runs out */
+void coalescer_add(struct Coalescer *co, struct RingEvent *ev)
+{
+	struct CoalescerEntry key;
+	struct CoalescerEntry *entry;
+
+	if (co->window <= 0)
+	{
+		co->func(ev, co->data);
+		return;
+	}
+
+	/* Overflow markers relate to everything that is pending */
+	if (ev->dir == RING_EVENT_NONE)
+	{
+		coalescer_flush(co, G_MAXINT64);
+		co->func(ev, co->data);
+		return;
+	}
+
+	if ((ev->mask & ~(COALESCE_MASK | IN_ISDIR)) != 0)
+	{
+		coalescer_release_path(co, ev);
+		co->func(ev, co->data);
+		return;
+	}
+
+	key.ev = *ev;
+	entry = g_hash_table_lookup(co->pending, &key);
+	if (entry != NULL && ev->time - entry->ev.time >= co->window)
+	{
+		coalescer_release(co, entry);
+		entry = NULL;
+	}
+
+	if (entry != NULL)
+	{
+		entry->ev.count += ev->count;
+		entry->ev.last_time = ev->last_time;
+		return;
+	}
+
+	if (co->spare != NULL)
+	{
+		entry = co->spare->data;
+		co->spare = co->spare->next;
+	}
+	else
+		entry = g_new(struct CoalescerEntry, 1);
+
+	entry->ev = *ev;
+	entry->link.data = entry;
+	entry->link.prev = entry->link.next = NULL;
+	entry->path_link.data = entry;
+	entry->path_link.prev = entry->path_link.next = NULL;
+	entry->path = coalescer_get_path(co, ev);
+
+	g_hash_table_add(co->pending, entry);
+	g_queue_push_tail_link(&co->order, &entry->link);
+	g_queue_push_tail_link(&entry->path->entries, &entry->path_link);
+}
+
+/* Releases every event whose window ended at or before now */
+void coalescer_flush(struct Coalescer *co, gint64 now)
+{
+	GList *head;
+
+	while ((head = g_queue_peek_head_link(&co->order)) != NULL)
+	{
+		struct CoalescerEntry *entry = head->data;
+
+		if (now != G_MAXINT64 && entry->ev.time + co->window > now)
+			break;
+
+		coalescer_release(co, entry);
+	}
+}
+
+/* When the oldest pending event is due, or -1 when nothing is pending */
+gint64 coalescer_next_deadline(struct Coalescer *co)
+{
+	GList *head = g_queue_peek_head_link(&co->order);
+
+	if (head == NULL)
+		return -1;
+
+	return ((struct CoalescerEntry*) head->data)->ev.time + co->window;
+}
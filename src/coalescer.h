@@ -0,0 +1,41 @@
+#ifndef COALESCER_H
+#define COALESCER_H
+
+#include <glib.h>
+
+#include "event_ring.h"
+
+/*
+ * Merges repeats of the same (root, path, mask) event seen within a time window
+ * into one event carrying a repeat count and first/last timestamps. Only
+ * events that don't change the tree (opens, closes, modifications, ...)
+ * are merged; any other event for a path first releases what is pending
+ * for it, in the order it arrived, so per-path order is kept.
+ */
+
+typedef void (*CoalescerFunc)(struct RingEvent *ev, gpointer data);
+
+struct Coalescer
+{
+	gint64 window;
+	GHashTable *pending;
+	GQueue order;
+
+	/* Pending entries of each (root, dir, name), in arrival order */
+	GHashTable *paths;
+	CoalescerFunc func;
+	gpointer data;
+
+	/* Links of released entries, chained through next, and of emptied paths */
+	GList *spare;
+	GList *spare_paths;
+};
+
+struct Coalescer *coalescer_new(gint64 window, CoalescerFunc func, gpointer data);
+void coalescer_free(struct Coalescer *co);
+
+void coalescer_add(struct Coalescer *co, struct RingEvent *ev);
+void coalescer_flush(struct Coalescer *co, gint64 now);
+gint64 coalescer_next_deadline(struct Coalescer *co);
+
+#endif /* end of include guard: COALESCER_H */
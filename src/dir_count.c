@@ -0,0 +1,237 @@
+/* vim: set fdm=marker : */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <gio/gio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "dir_count.h"
+
+/* getdents64() buffer; big enough for most directories in one call */
+#define DIR_COUNT_BUFFER (64 << 10)
+
+struct linux_dirent64
+{
+	guint64 d_ino;
+	gint64 d_off;
+	unsigned short d_reclen;
+	unsigned char d_type;
+	char d_name[];
+};
+
+struct DirCountKey
+{
+	dev_t dev;
+	ino_t ino;
+	gint64 mtime_sec;
+	glong mtime_nsec;
+};
+
+struct DirCount
+{
+	char *dir;
+	GArray *requests;
+};
+
+static GHashTable *cache;
+
+/* Cache {{{ */
+
+static guint dir_count_key_hash(gconstpointer key)
+{
+	const struct DirCountKey *k = key;
+
+	return (guint) (k->ino * 2654435761u) ^ (guint) k->dev ^ (guint) k->mtime_sec ^ (guint) k->mtime_nsec;
+}
+
+static gboolean dir_count_key_equal(gconstpointer a, gconstpointer b)
+{
+	const struct DirCountKey *ka = a;
+	const struct DirCountKey *kb = b;
+
+	return ka->ino == kb->ino && ka->dev == kb->dev &&
+		ka->mtime_sec == kb->mtime_sec && ka->mtime_nsec == kb->mtime_nsec;
+}
+
+static void dir_count_key_init(struct DirCountKey *key, const struct DirCountRequest *req)
+{
+	memset(key, 0, sizeof(*key));
+
+	key->dev = req->dev;
+	key->ino = req->ino;
+	key->mtime_sec = req->mtime_sec;
+	key->mtime_nsec = req->mtime_nsec;
+}
+
+gboolean dir_count_lookup(const struct DirCountRequest *req, gint64 *count)
+{
+	struct DirCountKey key;
+	gpointer value;
+
+	if (cache == NULL)
+		return FALSE;
+
+	dir_count_key_init(&key, req);
+
+	if (!g_hash_table_lookup_extended(cache, &key, NULL, &value))
+		return FALSE;
+
+	*count = GPOINTER_TO_SIZE(value);
+	return TRUE;
+}
+
+void dir_count_remember(const struct DirCountRequest *req)
+{
+	struct DirCountKey key;
+
+	if (req->count < 0)
+		return;
+
+	if (cache == NULL)
+		cache = g_hash_table_new_full(dir_count_key_hash, dir_count_key_equal, g_free, NULL);
+
+	if (g_hash_table_size(cache) >= DIR_COUNT_CACHE)
+		g_hash_table_remove_all(cache);
+
+	dir_count_key_init(&key, req);
+	g_hash_table_insert(cache, g_memdup2(&key, sizeof(key)), GSIZE_TO_POINTER(req->count));
+}
+
+/* }}} */
+
+/* Counting {{{ */
+
+static void dir_count_request_clear(gpointer data)
+{
+	struct DirCountRequest *req = data;
+
+	g_free(req->name);
+}
+
+GArray *dir_count_request_array_new(void)
+{
+	GArray *requests = g_array_new(FALSE, FALSE, sizeof(struct DirCountRequest));
+	g_array_set_clear_func(requests, dir_count_request_clear);
+
+	return requests;
+}
+
+static void dir_count_free(gpointer data)
+{
+	struct DirCount *dc = data;
+
+	if (dc->requests)
+		g_array_free(dc->requests, TRUE);
+
+	g_free(dc->dir);
+	g_free(dc);
+}
+
+/* Entries of the directory name in dfd, not counting "." and "..", or -1 */
+static gint64 dir_count_entries(int dfd, const char *name, char *buf)
+{
+	gint64 count = 0;
+	long len;
+	int fd;
+
+	fd = openat(dfd, name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd == -1)
+		return -1;
+
+	while ((len = syscall(SYS_getdents64, fd, buf, DIR_COUNT_BUFFER)) > 0)
+	{
+		for (long pos = 0; pos < len;)
+		{
+			struct linux_dirent64 *d = (struct linux_dirent64*) (buf + pos);
+
+			if (!(d->d_name[0] == '.' && (d->d_name[1] == '\0' ||
+							(d->d_name[1] == '.' && d->d_name[2] == '\0'))))
+				count++;
+
+			pos += d->d_reclen;
+		}
+	}
+
+	close(fd);
+
+	return len == -1 ? -1 : count;
+}
+
+static void dir_count_thread(GTask *task,
+		gpointer source_object,
+		gpointer task_data,
+		GCancellable *cancellable)
+{
+	struct DirCount *dc = task_data;
+	GArray *requests;
+	char *buf;
+	int dfd;
+
+	dfd = open(dc->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dfd == -1)
+	{
+		int err = errno;
+		g_task_return_new_error(task, G_IO_ERROR, g_io_error_from_errno(err),
+				"Can't open '%s': %s", dc->dir, strerror(err));
+		return;
+	}
+
+	buf = g_malloc(DIR_COUNT_BUFFER);
+
+	for (guint i = 0; i < dc->requests->len; ++i)
+	{
+		struct DirCountRequest *req = &g_array_index(dc->requests, struct DirCountRequest, i);
+
+		if (g_cancellable_is_cancelled(cancellable))
+			break;
+
+		req->count = dir_count_entries(dfd, req->name, buf);
+	}
+
+	g_free(buf);
+	close(dfd);
+
+	if (g_task_return_error_if_cancelled(task))
+		return;
+
+	requests = dc->requests;
+	dc->requests = NULL;
+
+	g_task_return_pointer(task, requests, (GDestroyNotify) g_array_unref);
+}
+
+/*
+ * Counts the entries of every requested subdirectory of dir. Takes
+ * ownership of requests and hands them back, counted, from
+ * dir_count_finish().
+ */
+void dir_count_async(gpointer source_object,
+		const char *dir,
+		GArray *requests,
+		GCancellable *cancellable,
+		GAsyncReadyCallback callback,
+		gpointer data)
+{
+	struct DirCount *dc;
+	GTask *task;
+
+	dc = g_new(struct DirCount, 1);
+	dc->dir = g_strdup(dir);
+	dc->requests = requests;
+
+	task = g_task_new(source_object, cancellable, callback, data);
+	g_task_set_task_data(task, dc, dir_count_free);
+	g_task_run_in_thread(task, dir_count_thread);
+	g_object_unref(task);
+}
+
+GArray *dir_count_finish(GAsyncResult *result, GError **error)
+{
+	return g_task_propagate_pointer(G_TASK(result), error);
+}
+
+/* }}} */
@@ -0,0 +1,44 @@
+#ifndef DIR_COUNT_H
+#define DIR_COUNT_H
+
+#include <gio/gio.h>
+#include <sys/types.h>
+
+/*
+ * Counts the entries of subdirectories on a worker thread, for the "N
+ * items" shown next to directories in the view. The view only asks for
+ * the rows it is showing; results are cached by (dev, inode, mtime), so a
+ * directory is only read again once it has changed.
+ */
+
+/* Cached counts kept before the cache starts over */
+#define DIR_COUNT_CACHE 65536
+
+struct DirCountRequest
+{
+	char *name;
+	guint index;
+	dev_t dev;
+	ino_t ino;
+	gint64 mtime_sec;
+	glong mtime_nsec;
+
+	/* Filled in by the count, -1 if the directory couldn't be read */
+	gint64 count;
+};
+
+GArray *dir_count_request_array_new(void);
+
+void dir_count_async(gpointer source_object,
+		const char *dir,
+		GArray *requests,
+		GCancellable *cancellable,
+		GAsyncReadyCallback callback,
+		gpointer data);
+GArray *dir_count_finish(GAsyncResult *result, GError **error);
+
+/* The cache is only touched from the main thread */
+gboolean dir_count_lookup(const struct DirCountRequest *req, gint64 *count);
+void dir_count_remember(const struct DirCountRequest *req);
+
+#endif /* end of include guard: DIR_COUNT_H */
@@ -0,0 +1,969 @@
+/* vim: set fdm=marker : */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <gio/gio.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "dir_scan.h"
+#include "dir_stat.h"
+#include "mime_cache.h"
+#include "trace.h"
+
+/*
+ * Entries are read and stat'ed in batches, each handed to the main thread as
+ * one chunk. The first batch is small so the first rows show up quickly.
+ */
+#define DIR_SCAN_BATCH_MIN 64
+#define DIR_SCAN_BATCH_MAX 4096
+
+/* Entries per pool job; small enough to keep every worker busy on a batch */
+#define DIR_SCAN_SLICE 128
+
+/* Below the rank, the bits of the first chunk an item sorts by */
+#define DIR_SORT_VALUE_BITS 56
+#define DIR_SORT_VALUE_MASK ((G_GUINT64_CONSTANT(1) << DIR_SORT_VALUE_BITS) - 1)
+
+/*
+ * Runs of items this short are sorted with dir_item_compare() right away;
+ * runs longer than DIR_SORT_RADIX are radix sorted on their chunks.
+ */
+#define DIR_SORT_SMALL 8
+#define DIR_SORT_RADIX 256
+
+struct DirScan
+{
+	char *dir;
+	DirScanChunkFunc func;
+	gpointer data;
+	time_t mtime;
+};
+
+struct DirScanChunk
+{
+	GTask *task;
+	GArray *items;
+};
+
+/* One readdir() batch, shared by the workers stat'ing its slices */
+struct DirScanBatch
+{
+	int dfd;
+	GCancellable *cancellable;
+	char **names;
+	struct statx *stx;
+	GArray *items;
+	guint n;
+	guint index;
+
+	GMutex lock;
+	GCond done;
+	guint pending;
+};
+
+/* What the pool runs; the first member of every kind of job */
+struct DirScanJob
+{
+	void (*run)(struct DirScanJob *job);
+};
+
+struct DirScanSlice
+{
+	struct DirScanJob job;
+	struct DirScanBatch *batch;
+	guint start;
+};
+
+/* Content types a live listing only guessed, looked at closer on the pool */
+struct DirScanSniff
+{
+	struct DirScanJob job;
+	GTask *task;
+	int dfd;
+	GArray *requests;
+};
+
+/* One item and the 64 bits it is ordered by at the current level */
+struct DirSortEntry
+{
+	guint64 chunk;
+	struct dir_item_info *item;
+};
+
+static GPrivate worker_stat = G_PRIVATE_INIT((GDestroyNotify) dir_stat_free);
+static guint max_threads;
+static guint stat_latency;
+
+/* Items {{{ */
+
+static void dir_item_clear(gpointer data)
+{
+	struct dir_item_info *item = data;
+
+	g_free(item->name);
+	g_free(item->key);
+}
+
+void dir_item_free(struct dir_item_info *item)
+{
+	dir_item_clear(item);
+	g_free(item);
+}
+
+GArray *dir_item_array_new(void)
+{
+	GArray *items = g_array_new(FALSE, FALSE, sizeof(struct dir_item_info));
+	g_array_set_clear_func(items, dir_item_clear);
+
+	return items;
+}
+
+/* Writes bytes with a binary unit into buf, e.g. "1.5 MiB" */
+void transormBytes(off_t bytes, char *buf, gsize size)
+{
+	long double b = (long double) bytes;
+	char *symb;
+
+	while (1)
+	{
+		if (b < 1024)
+		{
+			symb = "";
+			break;
+		}
+
+		b /= 1024;
+
+		if (b < 1024)
+		{
+			symb = "Ki";
+			break;
+		}
+
+		b /= 1024;
+
+		if (b < 1024)
+		{
+			symb = "Mi";
+			break;
+		}
+
+		b /= 1024;
+
+		if (b < 1024)
+		{
+			symb = "Gi";
+			break;
+		}
+
+		b /= 1024;
+
+		if (b < 1024)
+		{
+			symb = "Ti";
+			break;
+		}
+
+		b /= 1024;
+
+		if (b < 1024)
+		{
+			symb = "Pi";
+			break;
+		}
+
+		b /= 1024;
+
+		if (b < 1024)
+		{
+			symb = "Ei";
+			break;
+		}
+
+		b /= 1024;
+
+		if (b < 1024)
+		{
+			symb = "Zi";
+			break;
+		}
+
+		b /= 1024;
+		symb = "Yi";
+		break;
+	}
+
+	if (ceill(b) == b)
+		g_snprintf(buf, size, "%.0Lf %sB", b, symb);
+	else
+		g_snprintf(buf, size, "%.1Lf %sB", b, symb);
+}
+
+/*
+ * Works out what the item sorts by: a rank that keeps "..", directories and
+ * hidden entries together, and a collation key that makes locale-aware
+ * comparisons plain strcmp()s, with numbers in names ordered by value.
+ * Done once per entry, on the scan workers.
+ */
+void dir_item_set_key(struct dir_item_info *item)
+{
+	gboolean hidden = item->name[0] == '.';
+
+	if (strcmp(item->name, "..") == 0)
+		item->rank = 0;
+	else if (item->is_dir)
+		item->rank = hidden ? 2 : 1;
+	else
+		item->rank = hidden ? 4 : 3;
+
+	g_free(item->key);
+
+	if (g_utf8_validate(item->name, -1, NULL))
+		item->key = g_utf8_collate_key_for_filename(item->name, -1);
+	else
+	{
+		char *valid = g_utf8_make_valid(item->name, -1);
+		item->key = g_utf8_collate_key_for_filename(valid, -1);
+		g_free(valid);
+	}
+}
+
+/* Sizes and times as the sort prefix holds them */
+static guint64 dir_sort_bytes(const struct dir_item_info *item)
+{
+	return MIN((guint64) MAX(item->bytes, 0), DIR_SORT_VALUE_MASK);
+}
+
+static guint64 dir_sort_mtime(const struct dir_item_info *item)
+{
+	gint64 bias = G_GINT64_CONSTANT(1) << (DIR_SORT_VALUE_BITS - 1);
+
+	return (guint64) (CLAMP(item->mtime_sec, -bias, bias - 1) + bias);
+}
+
+int dir_item_compare(gconstpointer a, gconstpointer b, gpointer sort)
+{
+	const struct dir_item_info *da = a;
+	const struct dir_item_info *db = b;
+	guint column = GPOINTER_TO_UINT(sort) & ~DIR_SORT_DESCENDING;
+	gboolean desc = (GPOINTER_TO_UINT(sort) & DIR_SORT_DESCENDING) != 0;
+	guint64 va, vb;
+	int res;
+
+	if (da->rank != db->rank)
+		return da->rank < db->rank ? -1 : 1;
+
+	if (column == DIR_SORT_SIZE)
+	{
+		va = dir_sort_bytes(da);
+		vb = dir_sort_bytes(db);
+
+		if (va != vb)
+			return (va < vb) == !desc ? -1 : 1;
+	}
+	else if (column == DIR_SORT_MODIFIED)
+	{
+		va = dir_sort_mtime(da);
+		vb = dir_sort_mtime(db);
+
+		if (va == vb)
+		{
+			va = da->mtime_nsec;
+			vb = db->mtime_nsec;
+		}
+
+		if (va != vb)
+			return (va < vb) == !desc ? -1 : 1;
+	}
+
+	/* Names are unique, the key may not be */
+	res = strcmp(da->key, db->key);
+	if (res == 0)
+		res = strcmp(da->name, db->name);
+
+	return column == DIR_SORT_NAME && desc ? -res : res;
+}
+
+/* }}} */
+
+/* Sorting {{{ */
+
+/*
+ * Up to n bytes of key from offset on as a big-endian number, zero-padded
+ * past its end, so numbers compare like strcmp() compares the bytes. *more
+ * tells whether all n were part of the key.
+ */
+static guint64 dir_sort_key_chunk(const char *key, gsize offset, guint n, gboolean *more)
+{
+	const guchar *p = (const guchar*) key + offset;
+	guint64 chunk = 0;
+	guint i;
+
+	for (i = 0; i < n && p[i] != '\0'; ++i)
+		chunk = chunk << 8 | p[i];
+
+	*more = i == n;
+
+	/* A key that ended on the previous chunk; shifting by 64 is undefined */
+	if (i == 0)
+		return 0;
+
+	return chunk << (8 * (n - i));
+}
+
+/*
+ * What an item is ordered by at one level of dir_item_sort(), in the same
+ * order as dir_item_compare() looks at it: the rank with the column's value
+ * or the first bytes of the key, then 8 more bytes of the key per level.
+ * Items equal at a level have the same *more, which tells whether a next
+ * level can still tell them apart.
+ */
+static guint64 dir_sort_chunk(const struct dir_item_info *item, guint sort, guint level, gboolean *more)
+{
+	guint column = sort & ~DIR_SORT_DESCENDING;
+	gboolean desc = (sort & DIR_SORT_DESCENDING) != 0;
+	guint64 rank = (guint64) item->rank << DIR_SORT_VALUE_BITS;
+	guint64 value;
+
+	if (column == DIR_SORT_NAME)
+	{
+		if (level == 0)
+			value = dir_sort_key_chunk(item->key, 0, 7, more);
+		else
+			value = dir_sort_key_chunk(item->key, 7 + (level - 1) * 8, 8, more);
+
+		if (desc)
+			value = level == 0 ? ~value & DIR_SORT_VALUE_MASK : ~value;
+
+		return level == 0 ? rank | value : value;
+	}
+
+	if (level == 0)
+	{
+		*more = TRUE;
+		value = column == DIR_SORT_SIZE ? dir_sort_bytes(item) : dir_sort_mtime(item);
+
+		return rank | (desc ? ~value & DIR_SORT_VALUE_MASK : value);
+	}
+
+	/* Files changed within the same second */
+	if (column == DIR_SORT_MODIFIED && level == 1)
+	{
+		*more = TRUE;
+		value = item->mtime_nsec;
+
+		return desc ? ~value : value;
+	}
+
+	level -= column == DIR_SORT_MODIFIED ? 2 : 1;
+	return dir_sort_key_chunk(item->key, level * 8, 8, more);
+}
+
+static int dir_sort_entry_cmp(const void *a, const void *b)
+{
+	const struct DirSortEntry *ea = a;
+	const struct DirSortEntry *eb = b;
+
+	return (ea->chunk > eb->chunk) - (ea->chunk < eb->chunk);
+}
+
+static int dir_sort_item_cmp(const void *a, const void *b, void *sort)
+{
+	const struct DirSortEntry *ea = a;
+	const struct DirSortEntry *eb = b;
+
+	return dir_item_compare(ea->item, eb->item, sort);
+}
+
+/*
+ * Sorts entries on their chunks a byte at a time, least significant first,
+ * through scratch. Bytes every entry has in common, like the rank in most
+ * listings, are skipped.
+ */
+static void dir_sort_radix(struct DirSortEntry *entries, struct DirSortEntry *scratch, guint n)
+{
+	guint counts[8][256] = { { 0 } };
+	struct DirSortEntry *from = entries;
+	struct DirSortEntry *to = scratch;
+
+	for (guint i = 0; i < n; ++i)
+	{
+		for (guint byte = 0; byte < 8; ++byte)
+			counts[byte][(entries[i].chunk >> (8 * byte)) & 0xff]++;
+	}
+
+	for (guint byte = 0; byte < 8; ++byte)
+	{
+		guint *count = counts[byte];
+		guint sum = 0;
+
+		if (count[(entries[0].chunk >> (8 * byte)) & 0xff] == n)
+			continue;
+
+		for (guint digit = 0; digit < 256; ++digit)
+		{
+			guint c = count[digit];
+			count[digit] = sum;
+			sum += c;
+		}
+
+		for (guint i = 0; i < n; ++i)
+			to[count[(from[i].chunk >> (8 * byte)) & 0xff]++] = from[i];
+
+		struct DirSortEntry *swap = from;
+		from = to;
+		to = swap;
+	}
+
+	if (from != entries)
+		memcpy(entries, from, n * sizeof(*entries));
+}
+
+/*
+ * Sorts entries on one chunk each, then every run that ties on it on the
+ * next one. The keys themselves are only read once per level; everything
+ * else compares integers held in the array.
+ */
+static void dir_sort_level(struct DirSortEntry *entries, struct DirSortEntry *scratch,
+		guint n, guint sort, guint level)
+{
+	gboolean more;
+	guint start, end;
+
+	if (n <= DIR_SORT_SMALL)
+	{
+		qsort_r(entries, n, sizeof(*entries), dir_sort_item_cmp, GUINT_TO_POINTER(sort));
+		return;
+	}
+
+	/* Keys are all over the heap; fetch them a few entries ahead */
+	for (guint i = 0; i < n; ++i)
+	{
+		if (i + 16 < n)
+			__builtin_prefetch(entries[i + 16].item);
+		if (i + 8 < n)
+			__builtin_prefetch(entries[i + 8].item->key);
+
+		entries[i].chunk = dir_sort_chunk(entries[i].item, sort, level, &more);
+	}
+
+	if (n > DIR_SORT_RADIX)
+		dir_sort_radix(entries, scratch, n);
+	else
+		qsort(entries, n, sizeof(*entries), dir_sort_entry_cmp);
+
+	for (start = 0; start < n; start = end)
+	{
+		for (end = start + 1; end < n && entries[end].chunk == entries[start].chunk; ++end)
+			;
+
+		if (end - start < 2)
+			continue;
+
+		dir_sort_chunk(entries[start].item, sort, level, &more);
+
+		/* Keys that are equal all the way; only the names are left */
+		if (!more)
+			qsort_r(entries + start, end - start, sizeof(*entries), dir_sort_item_cmp, GUINT_TO_POINTER(sort));
+		else
+			dir_sort_level(entries + start, scratch + start, end - start, sort, level + 1);
+	}
+}
+
+/* Puts items in dir_item_compare() order for sort */
+void dir_item_sort(struct dir_item_info **items, guint n, guint sort)
+{
+	struct DirSortEntry *entries;
+	gint64 span;
+
+	if (n < 2)
+		return;
+
+	span = trace_begin();
+	entries = g_new(struct DirSortEntry, 2 * n);
+
+	for (guint i = 0; i < n; ++i)
+		entries[i].item = items[i];
+
+	dir_sort_level(entries, entries + n, n, sort, 0);
+
+	for (guint i = 0; i < n; ++i)
+		items[i] = entries[i].item;
+
+	g_free(entries);
+	trace_end("sort", span, n);
+}
+
+/* }}} */
+
+/* Scan {{{ */
+
+static void dir_scan_free(gpointer data)
+{
+	struct DirScan *scan = data;
+
+	g_free(scan->dir);
+	g_free(scan);
+}
+
+/* Chunks of a cancelled scan are dropped here, so the callee never sees stale rows */
+static gboolean dir_scan_deliver(gpointer data)
+{
+	struct DirScanChunk *chunk = data;
+	struct DirScan *scan = g_task_get_task_data(chunk->task);
+
+	if (!g_cancellable_is_cancelled(g_task_get_cancellable(chunk->task)))
+		scan->func(chunk->items, scan->data);
+	else
+		g_array_free(chunk->items, TRUE);
+
+	g_object_unref(chunk->task);
+	g_free(chunk);
+
+	return FALSE;
+}
+
+/*
+ * Same priority as the task's own completion, so every chunk is delivered
+ * before the callback passed to dir_scan_async() runs.
+ */
+static void dir_scan_post(GTask *task, GArray *items)
+{
+	struct DirScanChunk *chunk = g_new(struct DirScanChunk, 1);
+
+	chunk->task = g_object_ref(task);
+	chunk->items = items;
+
+	g_idle_add_full(G_PRIORITY_DEFAULT, dir_scan_deliver, chunk, NULL);
+}
+
+static void dir_scan_item(struct dir_item_info *item, char *name, const struct statx *stx, guint index)
+{
+	if (S_ISDIR(stx->stx_mode))
+	{
+		item->bytes = 0;
+		item->is_dir = TRUE;
+	}
+	else
+	{
+		item->bytes = stx->stx_size;
+		item->is_dir = FALSE;
+	}
+
+	item->name = name;
+	item->index = index;
+	item->count_state = DIR_ITEM_UNCOUNTED;
+	item->count = -1;
+	item->dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+	item->ino = stx->stx_ino;
+	item->mtime_sec = stx->stx_mtime.tv_sec;
+	item->mtime_nsec = stx->stx_mtime.tv_nsec;
+	item->ct = NULL;
+	item->key = NULL;
+
+	dir_item_set_key(item);
+}
+
+/*
+ * Stats one entry of the directory dfd into item; FALSE if it is gone.
+ * The content type only goes by the name, and *sniff is set when
+ * dir_scan_sniff_async() should read the file to tell it better.
+ */
+gboolean dir_scan_entry(int dfd, const char *name, struct dir_item_info *item, gboolean *sniff)
+{
+	struct statx stx;
+
+	if (statx(dfd, name, 0, DIR_STAT_MASK, &stx) == -1)
+		return FALSE;
+
+	dir_scan_item(item, g_strdup(name), &stx, 0);
+	item->ct = mime_cache_guess(name, &stx, sniff);
+
+	return TRUE;
+}
+
+/* Pool {{{ */
+
+/* Stats and sniffs names[start..end) of a batch into its items */
+static void dir_scan_range(struct DirScanBatch *batch, struct DirStat *ds, guint start, guint end)
+{
+	gint64 span = trace_begin();
+	guint latency;
+
+	dir_stat_batch(ds, batch->dfd, batch->names + start, batch->stx + start, end - start);
+
+	/* One round trip per entry, as each would take on a FUSE mount */
+	latency = g_atomic_int_get(&stat_latency);
+	if (latency != 0)
+		g_usleep((gulong) latency * (end - start));
+
+	trace_end("stat", span, end - start);
+
+	/* Content types and sort keys */
+	span = trace_begin();
+
+	for (guint i = start; i < end; ++i)
+	{
+		struct dir_item_info *item = &g_array_index(batch->items, struct dir_item_info, i);
+
+		if (g_cancellable_is_cancelled(batch->cancellable))
+			break;
+
+		dir_scan_item(item, batch->names[i], &batch->stx[i], batch->index + i);
+		item->ct = mime_cache_get(batch->dfd, item->name, &batch->stx[i]);
+		batch->names[i] = NULL;
+	}
+
+	trace_end("sniff", span, end - start);
+}
+
+static void dir_scan_slice(struct DirScanJob *job)
+{
+	struct DirScanSlice *slice = (struct DirScanSlice*) job;
+	struct DirScanBatch *batch = slice->batch;
+	struct DirStat *ds;
+
+	/* Each worker keeps its own ring, like it keeps its own magic handle */
+	ds = g_private_get(&worker_stat);
+	if (ds == NULL)
+	{
+		ds = dir_stat_new(DIR_STAT_AUTO);
+		g_private_set(&worker_stat, ds);
+	}
+
+	dir_scan_range(batch, ds, slice->start, MIN(slice->start + DIR_SCAN_SLICE, batch->n));
+
+	g_mutex_lock(&batch->lock);
+
+	if (--batch->pending == 0)
+		g_cond_signal(&batch->done);
+
+	g_mutex_unlock(&batch->lock);
+}
+
+static void dir_scan_job(gpointer data, gpointer user_data)
+{
+	struct DirScanJob *job = data;
+
+	job->run(job);
+}
+
+static guint dir_scan_threads(void)
+{
+	guint threads = g_atomic_int_get(&max_threads);
+
+	return threads != 0 ? threads : g_get_num_processors();
+}
+
+/* Shared by all scans, so concurrent scans don't multiply the threads */
+static GThreadPool *dir_scan_pool(void)
+{
+	static GThreadPool *pool;
+
+	if (g_once_init_enter(&pool))
+		g_once_init_leave(&pool, g_thread_pool_new(dir_scan_job, NULL, dir_scan_threads(), FALSE, NULL));
+
+	return pool;
+}
+
+void dir_scan_set_max_threads(guint threads)
+{
+	g_atomic_int_set(&max_threads, threads);
+	g_thread_pool_set_max_threads(dir_scan_pool(), dir_scan_threads(), NULL);
+}
+
+void dir_scan_set_latency(guint usec)
+{
+	g_atomic_int_set(&stat_latency, usec);
+	mime_cache_set_latency(usec);
+}
+
+/*
+ * Splits the batch into slices for the pool and waits for all of them.
+ * Small batches, and a single thread, are done right here.
+ */
+static void dir_scan_batch(struct DirScanBatch *batch, struct DirStat *ds)
+{
+	struct DirScanSlice *slices;
+	guint n_slices;
+
+	if (dir_scan_threads() <= 1 || batch->n <= DIR_SCAN_SLICE)
+	{
+		dir_scan_range(batch, ds, 0, batch->n);
+		return;
+	}
+
+	n_slices = (batch->n + DIR_SCAN_SLICE - 1) / DIR_SCAN_SLICE;
+	slices = g_new(struct DirScanSlice, n_slices);
+	batch->pending = n_slices;
+
+	for (guint i = 0; i < n_slices; ++i)
+	{
+		slices[i].job.run = dir_scan_slice;
+		slices[i].batch = batch;
+		slices[i].start = i * DIR_SCAN_SLICE;
+		g_thread_pool_push(dir_scan_pool(), &slices[i], NULL);
+	}
+
+	g_mutex_lock(&batch->lock);
+
+	while (batch->pending > 0)
+		g_cond_wait(&batch->done, &batch->lock);
+
+	g_mutex_unlock(&batch->lock);
+
+	g_free(slices);
+}
+
+/* }}} */
+
+static void dir_scan_thread(GTask *task,
+		gpointer source_object,
+		gpointer task_data,
+		GCancellable *cancellable)
+{
+	struct DirScan *scan = task_data;
+	gint64 scan_span = trace_begin();
+	struct DirScanBatch batch;
+	struct DirStat *ds;
+	struct dirent *ep;
+	struct stat dst;
+	GPtrArray *names;
+	guint size = DIR_SCAN_BATCH_MIN;
+	guint index = 0;
+	DIR *dp;
+
+	dp = opendir(scan->dir);
+	if (dp == NULL)
+	{
+		int err = errno;
+		g_task_return_new_error(task, G_IO_ERROR, g_io_error_from_errno(err),
+				"Can't open '%s': %s", scan->dir, strerror(err));
+		return;
+	}
+
+	memset(&batch, 0, sizeof(batch));
+	batch.dfd = dirfd(dp);
+	batch.cancellable = cancellable;
+	batch.stx = g_new(struct statx, DIR_SCAN_BATCH_MAX);
+	g_mutex_init(&batch.lock);
+	g_cond_init(&batch.done);
+
+	if (fstat(batch.dfd, &dst) == 0)
+		scan->mtime = dst.st_mtim.tv_sec;
+
+	ds = dir_stat_new(DIR_STAT_AUTO);
+	names = g_ptr_array_new_full(DIR_SCAN_BATCH_MAX, g_free);
+	ep = readdir(dp);
+
+	while (ep != NULL && !g_cancellable_is_cancelled(cancellable))
+	{
+		gint64 span = trace_begin();
+
+		g_ptr_array_set_size(names, 0);
+
+		for (; ep != NULL && names->len < size; ep = readdir(dp))
+		{
+			if (strcmp(ep->d_name, ".") != 0)
+				g_ptr_array_add(names, g_strdup(ep->d_name));
+		}
+
+		trace_end("readdir", span, names->len);
+
+		if (names->len == 0)
+			break;
+
+		/* Zeroed, so items a cancelled scan never got to are safe to clear */
+		batch.items = g_array_sized_new(FALSE, TRUE, sizeof(struct dir_item_info), names->len);
+		g_array_set_clear_func(batch.items, dir_item_clear);
+		g_array_set_size(batch.items, names->len);
+
+		batch.names = (char**) names->pdata;
+		batch.n = names->len;
+		batch.index = index;
+
+		/* The names move into the items */
+		span = trace_begin();
+		dir_scan_batch(&batch, ds);
+		trace_end("scan_batch", span, batch.n);
+
+		dir_scan_post(task, batch.items);
+		index += batch.n;
+		size = MIN(size * 2, DIR_SCAN_BATCH_MAX);
+	}
+
+	g_ptr_array_free(names, TRUE);
+	dir_stat_free(ds);
+	g_mutex_clear(&batch.lock);
+	g_cond_clear(&batch.done);
+	g_free(batch.stx);
+	closedir(dp);
+
+	trace_end("dir_scan", scan_span, index);
+
+	if (!g_task_return_error_if_cancelled(task))
+		g_task_return_boolean(task, TRUE);
+}
+
+/*
+ * Lists dir on a worker thread. chunk_func gets the entries as they are
+ * read, callback runs once the scan is over; cancelling stops both the
+ * scan and the delivery of chunks that are still queued.
+ */
+void dir_scan_async(gpointer source_object,
+		const char *dir,
+		GCancellable *cancellable,
+		DirScanChunkFunc chunk_func,
+		GAsyncReadyCallback callback,
+		gpointer data)
+{
+	struct DirScan *scan;
+	GTask *task;
+
+	scan = g_new0(struct DirScan, 1);
+	scan->dir = g_strdup(dir);
+	scan->func = chunk_func;
+	scan->data = data;
+
+	task = g_task_new(source_object, cancellable, callback, data);
+	g_task_set_task_data(task, scan, dir_scan_free);
+	g_task_run_in_thread(task, dir_scan_thread);
+	g_object_unref(task);
+}
+
+/* mtime is the modification time of the directory itself */
+gboolean dir_scan_finish(GAsyncResult *result, time_t *mtime, GError **error)
+{
+	struct DirScan *scan = g_task_get_task_data(G_TASK(result));
+
+	if (!g_task_propagate_boolean(G_TASK(result), error))
+		return FALSE;
+
+	if (mtime)
+		*mtime = scan->mtime;
+
+	return TRUE;
+}
+
+/* }}} */
+
+/* Sniffing {{{ */
+
+static void dir_sniff_request_clear(gpointer data)
+{
+	struct DirSniffRequest *req = data;
+
+	g_free(req->name);
+}
+
+GArray *dir_sniff_request_array_new(void)
+{
+	GArray *requests = g_array_new(FALSE, FALSE, sizeof(struct DirSniffRequest));
+	g_array_set_clear_func(requests, dir_sniff_request_clear);
+
+	return requests;
+}
+
+static void dir_scan_sniff_free(gpointer data)
+{
+	struct DirScanSniff *sniff = data;
+
+	if (sniff->requests)
+		g_array_free(sniff->requests, TRUE);
+
+	if (sniff->dfd != -1)
+		close(sniff->dfd);
+
+	g_free(sniff);
+}
+
+/* An entry replaced since it was stat'ed keeps the type it was guessed */
+static void dir_scan_sniff(struct DirScanJob *job)
+{
+	struct DirScanSniff *sniff = (struct DirScanSniff*) job;
+	GCancellable *cancellable = g_task_get_cancellable(sniff->task);
+	GTask *task = sniff->task;
+	GArray *requests;
+
+	for (guint i = 0; i < sniff->requests->len; ++i)
+	{
+		struct DirSniffRequest *req = &g_array_index(sniff->requests, struct DirSniffRequest, i);
+		struct statx stx;
+
+		if (g_cancellable_is_cancelled(cancellable))
+			break;
+
+		if (statx(sniff->dfd, req->name, 0, DIR_STAT_MASK, &stx) == -1)
+			continue;
+
+		if (makedev(stx.stx_dev_major, stx.stx_dev_minor) != req->dev || stx.stx_ino != req->ino ||
+				stx.stx_mtime.tv_sec != req->mtime_sec || stx.stx_mtime.tv_nsec != req->mtime_nsec)
+			continue;
+
+		req->ct = mime_cache_get(sniff->dfd, req->name, &stx);
+	}
+
+	if (!g_task_return_error_if_cancelled(task))
+	{
+		requests = sniff->requests;
+		sniff->requests = NULL;
+
+		g_task_return_pointer(task, requests, (GDestroyNotify) g_array_unref);
+	}
+
+	g_object_unref(task);
+}
+
+/*
+ * Works out the content types of the requested entries of the directory
+ * dfd on the scan pool, whose workers already have libmagic loaded. Takes
+ * ownership of requests and hands them back from dir_scan_sniff_finish().
+ */
+void dir_scan_sniff_async(gpointer source_object,
+		int dfd,
+		GArray *requests,
+		GCancellable *cancellable,
+		GAsyncReadyCallback callback,
+		gpointer data)
+{
+	struct DirScanSniff *sniff;
+	GTask *task;
+
+	task = g_task_new(source_object, cancellable, callback, data);
+
+	sniff = g_new(struct DirScanSniff, 1);
+	sniff->job.run = dir_scan_sniff;
+	sniff->task = task;
+	sniff->requests = requests;
+
+	/* The caller may close its descriptor before the pool gets to this */
+	sniff->dfd = fcntl(dfd, F_DUPFD_CLOEXEC, 0);
+	g_task_set_task_data(task, sniff, dir_scan_sniff_free);
+
+	if (sniff->dfd == -1)
+	{
+		int err = errno;
+		g_task_return_new_error(task, G_IO_ERROR, g_io_error_from_errno(err),
+				"Can't duplicate descriptor: %s", strerror(err));
+		g_object_unref(task);
+		return;
+	}
+
+	g_thread_pool_push(dir_scan_pool(), &sniff->job, NULL);
+}
+
+GArray *dir_scan_sniff_finish(GAsyncResult *result, GError **error)
+{
+	return g_task_propagate_pointer(G_TASK(result), error);
+}
+
+/* }}} */
@@ -0,0 +1,127 @@
+#ifndef DIR_SCAN_H
+#define DIR_SCAN_H
+
+#include <gio/gio.h>
+#include <sys/types.h>
+
+/*
+ * Directory listing for the view, done on a worker thread. Entries reach
+ * the main thread in chunks while the scan runs, so the first rows show up
+ * long before a large or slow directory has been read completely.
+ */
+
+/*
+ * Sizes and times are kept as numbers and only formatted for the rows on
+ * screen; the content type is interned and shared by every item.
+ */
+struct dir_item_info
+{
+	const char *ct;
+	char 	*name;
+	gboolean is_dir;
+
+	/*
+	 * What the listing is sorted by, see dir_item_set_key(): "..", then
+	 * directories, hidden directories, files and hidden files, each by the
+	 * collation key of its name unless a column says otherwise.
+	 */
+	guint8 	rank;
+	char 	*key;
+	goffset bytes;
+
+	/* Position the item was delivered at, or had before the last sort */
+	guint 	index;
+
+	/* Directories are only counted once their row is shown; -1 until then */
+	guint 	count_state;
+	gint64 	count;
+	dev_t 	dev;
+	ino_t 	ino;
+	gint64 	mtime_sec;
+	glong 	mtime_nsec;
+};
+
+enum
+{
+	DIR_ITEM_UNCOUNTED,
+	DIR_ITEM_COUNTING,
+	DIR_ITEM_COUNTED,
+};
+
+/* Columns a listing can be sorted by; DIR_SORT_DESCENDING may be or'ed in */
+enum
+{
+	DIR_SORT_NAME,
+	DIR_SORT_SIZE,
+	DIR_SORT_MODIFIED,
+
+	DIR_SORT_DESCENDING = 0x100,
+};
+
+/*
+ * Called on the main thread for every chunk of a scan that hasn't been
+ * cancelled, with an array of struct dir_item_info in directory order.
+ * The array and its items belong to the callee.
+ */
+typedef void (*DirScanChunkFunc)(GArray *items, gpointer data);
+
+void dir_scan_async(gpointer source_object,
+		const char *dir,
+		GCancellable *cancellable,
+		DirScanChunkFunc chunk_func,
+		GAsyncReadyCallback callback,
+		gpointer data);
+gboolean dir_scan_finish(GAsyncResult *result, time_t *mtime, GError **error);
+
+/*
+ * Entries are stat'ed and sniffed by a pool shared by all scans, as many
+ * threads as there are cores unless set here; 0 goes back to that default.
+ */
+void dir_scan_set_max_threads(guint threads);
+
+/*
+ * For benchmarks: every entry a scan stats and every file it sniffs waits
+ * usec first, standing in for a slow (FUSE, network) file system. 0 is off.
+ */
+void dir_scan_set_latency(guint usec);
+
+/* For keeping a listing up to date after the scan */
+gboolean dir_scan_entry(int dfd, const char *name, struct dir_item_info *item, gboolean *sniff);
+
+/* An entry dir_scan_entry() could only guess the content type of */
+struct DirSniffRequest
+{
+	char *name;
+	dev_t dev;
+	ino_t ino;
+	gint64 mtime_sec;
+	glong mtime_nsec;
+
+	/* Filled in by the sniff, NULL if the entry changed or is gone */
+	const char *ct;
+};
+
+GArray *dir_sniff_request_array_new(void);
+
+void dir_scan_sniff_async(gpointer source_object,
+		int dfd,
+		GArray *requests,
+		GCancellable *cancellable,
+		GAsyncReadyCallback callback,
+		gpointer data);
+GArray *dir_scan_sniff_finish(GAsyncResult *result, GError **error);
+
+GArray *dir_item_array_new(void);
+void dir_item_free(struct dir_item_info *item);
+void dir_item_set_key(struct dir_item_info *item);
+
+/* sort is a DIR_SORT_* value passed with GUINT_TO_POINTER() */
+int dir_item_compare(gconstpointer a, gconstpointer b, gpointer sort);
+void dir_item_sort(struct dir_item_info **items, guint n, guint sort);
+
+/* Longest text transormBytes() writes, including the terminator */
+#define DIR_SIZE_TEXT 32
+
+void transormBytes(off_t bytes, char *buf, gsize size);
+
+#endif /* end of include guard: DIR_SCAN_H */
@@ -0,0 +1,322 @@
+/* vim: set fdm=marker : */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <linux/io_uring.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "dir_stat.h"
+
+struct DirStat
+{
+	enum DirStatMode mode;
+
+	/* -1 while every entry is stat'ed synchronously */
+	int fd;
+	gboolean ring_failed;
+
+	/* Synchronous stats have been slow enough for the ring to pay off */
+	gboolean slow;
+
+	void *sq_ring;
+	size_t sq_ring_size;
+	void *cq_ring;
+	size_t cq_ring_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	unsigned *sq_head;
+	unsigned *sq_tail;
+	unsigned *sq_array;
+	unsigned sq_mask;
+	unsigned sq_entries;
+
+	unsigned *cq_head;
+	unsigned *cq_tail;
+	struct io_uring_cqe *cqes;
+	unsigned cq_mask;
+	unsigned cq_entries;
+};
+
+/* Sync {{{ */
+
+static void dir_stat_one(int dfd, const char *name, struct statx *out)
+{
+	if (statx(dfd, name, 0, DIR_STAT_MASK, out) == -1)
+		memset(out, 0, sizeof(*out));
+}
+
+static void dir_stat_sync(int dfd, char *const *names, struct statx *out, guint n)
+{
+	for (guint i = 0; i < n; ++i)
+		dir_stat_one(dfd, names[i], &out[i]);
+}
+
+/* }}} */
+
+/* Ring {{{ */
+
+static int io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return syscall(SYS_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+	return syscall(SYS_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args)
+{
+	return syscall(SYS_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/* IORING_OP_STATX came later than io_uring itself, so ask before relying on it */
+static gboolean dir_stat_probe(int fd)
+{
+	struct io_uring_probe *probe;
+	gboolean supported = FALSE;
+	size_t size;
+
+	size = sizeof(*probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+	probe = g_malloc0(size);
+
+	if (io_uring_register(fd, IORING_REGISTER_PROBE, probe, IORING_OP_LAST) == 0 &&
+			probe->last_op >= IORING_OP_STATX)
+		supported = (probe->ops[IORING_OP_STATX].flags & IO_URING_OP_SUPPORTED) != 0;
+
+	g_free(probe);
+
+	return supported;
+}
+
+static void dir_stat_unmap(struct DirStat *ds)
+{
+	if (ds->sqes != NULL && ds->sqes != MAP_FAILED)
+		munmap(ds->sqes, ds->sqes_size);
+
+	if (ds->cq_ring != NULL && ds->cq_ring != MAP_FAILED && ds->cq_ring != ds->sq_ring)
+		munmap(ds->cq_ring, ds->cq_ring_size);
+
+	if (ds->sq_ring != NULL && ds->sq_ring != MAP_FAILED)
+		munmap(ds->sq_ring, ds->sq_ring_size);
+
+	if (ds->fd != -1)
+		close(ds->fd);
+
+	ds->sq_ring = ds->cq_ring = NULL;
+	ds->sqes = NULL;
+	ds->fd = -1;
+	ds->ring_failed = TRUE;
+}
+
+static gboolean dir_stat_map(struct DirStat *ds)
+{
+	struct io_uring_params p;
+
+	memset(&p, 0, sizeof(p));
+
+	ds->fd = io_uring_setup(DIR_STAT_RING, &p);
+	if (ds->fd == -1)
+		return FALSE;
+
+	if (!dir_stat_probe(ds->fd))
+		return FALSE;
+
+	ds->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	ds->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		ds->sq_ring_size = ds->cq_ring_size = MAX(ds->sq_ring_size, ds->cq_ring_size);
+
+	ds->sq_ring = mmap(NULL, ds->sq_ring_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ds->fd, IORING_OFF_SQ_RING);
+	if (ds->sq_ring == MAP_FAILED)
+		return FALSE;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		ds->cq_ring = ds->sq_ring;
+	else
+	{
+		ds->cq_ring = mmap(NULL, ds->cq_ring_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, ds->fd, IORING_OFF_CQ_RING);
+		if (ds->cq_ring == MAP_FAILED)
+			return FALSE;
+	}
+
+	ds->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ds->sqes = mmap(NULL, ds->sqes_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ds->fd, IORING_OFF_SQES);
+	if (ds->sqes == MAP_FAILED)
+		return FALSE;
+
+	char *sq = ds->sq_ring;
+	ds->sq_head = (unsigned*) (sq + p.sq_off.head);
+	ds->sq_tail = (unsigned*) (sq + p.sq_off.tail);
+	ds->sq_array = (unsigned*) (sq + p.sq_off.array);
+	ds->sq_mask = *(unsigned*) (sq + p.sq_off.ring_mask);
+	ds->sq_entries = *(unsigned*) (sq + p.sq_off.ring_entries);
+
+	char *cq = ds->cq_ring;
+	ds->cq_head = (unsigned*) (cq + p.cq_off.head);
+	ds->cq_tail = (unsigned*) (cq + p.cq_off.tail);
+	ds->cqes = (struct io_uring_cqe*) (cq + p.cq_off.cqes);
+	ds->cq_mask = *(unsigned*) (cq + p.cq_off.ring_mask);
+	ds->cq_entries = *(unsigned*) (cq + p.cq_off.ring_entries);
+
+	return TRUE;
+}
+
+/* Moves finished entries out of the completion queue, returns how many */
+static guint dir_stat_reap(struct DirStat *ds, struct statx *out)
+{
+	unsigned head = *ds->cq_head;
+	unsigned tail = __atomic_load_n(ds->cq_tail, __ATOMIC_ACQUIRE);
+	guint reaped = 0;
+
+	for (; head != tail; ++head, ++reaped)
+	{
+		struct io_uring_cqe *cqe = &ds->cqes[head & ds->cq_mask];
+
+		if (cqe->res < 0)
+			memset(&out[cqe->user_data], 0, sizeof(*out));
+	}
+
+	__atomic_store_n(ds->cq_head, head, __ATOMIC_RELEASE);
+
+	return reaped;
+}
+
+/*
+ * Fills the submission queue as far as it goes and waits for everything in
+ * flight, so each round is a single io_uring_enter(). Returns FALSE if the
+ * ring broke down with nothing in flight; the caller finishes from next.
+ */
+static gboolean dir_stat_ring(struct DirStat *ds, int dfd, char *const *names,
+		struct statx *out, guint n, guint *next)
+{
+	guint inflight = 0;
+
+	while (*next < n || inflight > 0)
+	{
+		unsigned tail = *ds->sq_tail;
+		unsigned head = __atomic_load_n(ds->sq_head, __ATOMIC_ACQUIRE);
+
+		while (*next < n && tail - head < ds->sq_entries && inflight < ds->cq_entries)
+		{
+			unsigned idx = tail & ds->sq_mask;
+			struct io_uring_sqe *sqe = &ds->sqes[idx];
+
+			memset(sqe, 0, sizeof(*sqe));
+			sqe->opcode = IORING_OP_STATX;
+			sqe->fd = dfd;
+			sqe->addr = (guint64) (guintptr) names[*next];
+			sqe->len = DIR_STAT_MASK;
+			sqe->off = (guint64) (guintptr) &out[*next];
+			sqe->statx_flags = 0;
+			sqe->user_data = *next;
+
+			ds->sq_array[idx] = idx;
+			tail++;
+			(*next)++;
+			inflight++;
+		}
+
+		__atomic_store_n(ds->sq_tail, tail, __ATOMIC_RELEASE);
+
+		/* Whatever the kernel hasn't consumed yet is still pending */
+		unsigned pending = tail - __atomic_load_n(ds->sq_head, __ATOMIC_ACQUIRE);
+
+		if (io_uring_enter(ds->fd, pending, inflight, IORING_ENTER_GETEVENTS) == -1 &&
+				errno != EINTR && errno != EAGAIN && errno != EBUSY)
+		{
+			/* Take back what was never submitted */
+			unsigned consumed = __atomic_load_n(ds->sq_head, __ATOMIC_ACQUIRE);
+
+			*next -= tail - consumed;
+			inflight -= tail - consumed;
+			__atomic_store_n(ds->sq_tail, consumed, __ATOMIC_RELEASE);
+
+			if (inflight == 0)
+				return FALSE;
+		}
+
+		inflight -= dir_stat_reap(ds, out);
+	}
+
+	return TRUE;
+}
+
+/* }}} */
+
+struct DirStat *dir_stat_new(enum DirStatMode mode)
+{
+	struct DirStat *ds = g_new0(struct DirStat, 1);
+
+	ds->mode = mode;
+	ds->fd = -1;
+
+	return ds;
+}
+
+void dir_stat_free(struct DirStat *ds)
+{
+	dir_stat_unmap(ds);
+	g_free(ds);
+}
+
+gboolean dir_stat_is_batched(struct DirStat *ds)
+{
+	return ds->fd != -1;
+}
+
+/* The ring is only set up once a batch is going to use it */
+static gboolean dir_stat_use_ring(struct DirStat *ds)
+{
+	if (ds->fd != -1)
+		return TRUE;
+
+	if (ds->ring_failed || ds->mode == DIR_STAT_SYNC)
+		return FALSE;
+
+	if (ds->mode == DIR_STAT_AUTO && !ds->slow)
+		return FALSE;
+
+	if (!dir_stat_map(ds))
+	{
+		dir_stat_unmap(ds);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void dir_stat_batch(struct DirStat *ds, int dfd, char *const *names, struct statx *out, guint n)
+{
+	guint next = 0;
+	gint64 start;
+
+	if (n == 0)
+		return;
+
+	if (dir_stat_use_ring(ds))
+	{
+		if (dir_stat_ring(ds, dfd, names, out, n, &next))
+			return;
+
+		dir_stat_unmap(ds);
+	}
+
+	start = g_get_monotonic_time();
+	dir_stat_sync(dfd, names + next, out + next, n - next);
+
+	if (next == 0)
+		ds->slow = (g_get_monotonic_time() - start) * 1000 / n > DIR_STAT_SLOW_NS;
+}
@@ -0,0 +1,52 @@
+#ifndef DIR_STAT_H
+#define DIR_STAT_H
+
+#include <glib.h>
+#include <sys/stat.h>
+
+/*
+ * Batched statx() of directory entries. A batch can go through one io_uring,
+ * so a large directory costs a few io_uring_enter() calls instead of one
+ * blocking syscall per entry, and the kernel stats entries in parallel.
+ *
+ * The kernel runs every io_uring statx on a worker, which makes it slower
+ * than plain statx() when the inodes are a cheap local lookup. In
+ * DIR_STAT_AUTO batches therefore start out synchronous and only move to the
+ * ring once entries take long enough to point at a slow or remote file
+ * system. Without io_uring (old kernel, seccomp, containers) every entry is
+ * stat'ed in turn.
+ *
+ * A struct DirStat belongs to a single thread. Needs _GNU_SOURCE for statx.
+ */
+
+/* Only what the view shows, plus what the caches are keyed by */
+#define DIR_STAT_MASK (STATX_TYPE | STATX_MODE | STATX_INO | STATX_SIZE | STATX_MTIME)
+
+/* Submission queue size; bigger batches are fed through it in rounds */
+#define DIR_STAT_RING 1024
+
+/* Average cost of a synchronous statx() (ns) above which AUTO uses the ring */
+#define DIR_STAT_SLOW_NS 50000
+
+enum DirStatMode
+{
+	DIR_STAT_AUTO,
+	DIR_STAT_SYNC,
+	DIR_STAT_URING,
+};
+
+struct DirStat;
+
+struct DirStat *dir_stat_new(enum DirStatMode mode);
+void dir_stat_free(struct DirStat *ds);
+
+/* TRUE once batches go through io_uring rather than one statx() per entry */
+gboolean dir_stat_is_batched(struct DirStat *ds);
+
+/*
+ * Stats names[0..n) relative to dfd, following symlinks. The statx of an
+ * entry that couldn't be stat'ed is zeroed.
+ */
+void dir_stat_batch(struct DirStat *ds, int dfd, char *const *names, struct statx *out, guint n);
+
+#endif /* end of include guard: DIR_STAT_H */
@@ -0,0 +1,993 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <gio/gio.h>
+#include <glib-object.h>
+#include <glib/gstdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "event_log.h"
+#include "path_index.h"
+#include "string_table.h"
+
+/* Bytes of records in one chunk */
+#define EVENT_LOG_CHUNK_BYTES (EVENT_LOG_CHUNK_SIZE * sizeof(struct EventRecord))
+
+/* Spilled chunks kept after being paged back in */
+#define EVENT_LOG_PAGES 4
+
+/* What an interned path costs beyond its characters: hash node, pointers */
+#define EVENT_LOG_PATH_OVERHEAD 48
+
+/* Paths below which the table isn't worth compacting */
+#define EVENT_LOG_COMPACT_MIN 4096
+
+/*
+ * Trigram filter of a spilled chunk: bits per distinct trigram, at least
+ * as many as 1 << EVENT_LOG_BLOOM_MIN, and bits set per trigram. About 1%
+ * of absent trigrams pass.
+ */
+#define EVENT_LOG_BLOOM_BITS 10
+#define EVENT_LOG_BLOOM_MIN 6
+#define EVENT_LOG_BLOOM_HASHES 3
+
+/* New paths a query tests one by one rather than through the index */
+#define EVENT_LOG_QUERY_SCAN 256
+
+/* Shown for rows whose spilled chunk can't be read back */
+#define EVENT_LOG_UNREADABLE "(history could not be read back)"
+
+/* Row {{{ */
+
+struct _EventLogRow
+{
+	GObject parent;
+	struct EventRecord record;
+	char *path;
+};
+
+G_DEFINE_TYPE(EventLogRow, event_log_row, G_TYPE_OBJECT);
+
+static void event_log_row_finalize(GObject *object)
+{
+	EventLogRow *row = EVENT_LOG_ROW(object);
+
+	g_free(row->path);
+
+	G_OBJECT_CLASS(event_log_row_parent_class)->finalize(object);
+}
+
+static void event_log_row_init(EventLogRow *row)
+{
+
+}
+
+static void event_log_row_class_init(EventLogRowClass *class)
+{
+	G_OBJECT_CLASS(class)->finalize = event_log_row_finalize;
+}
+
+guint32 event_log_row_get_mask(EventLogRow *row)
+{
+	return row->record.mask;
+}
+
+gint64 event_log_row_get_time(EventLogRow *row)
+{
+	return row->record.time;
+}
+
+gint64 event_log_row_get_last_time(EventLogRow *row)
+{
+	return row->record.time + (gint64) row->record.span * 1000;
+}
+
+guint32 event_log_row_get_count(EventLogRow *row)
+{
+	return row->record.count;
+}
+
+const char *event_log_row_get_path(EventLogRow *row)
+{
+	return row->path;
+}
+
+/* }}} */
+
+/* Log {{{ */
+
+/* Rows of a spilled chunk with one mask */
+struct EventLogMaskCount
+{
+	guint32 mask;
+	guint32 count;
+};
+
+/*
+ * A chunk of EVENT_LOG_CHUNK_SIZE records, in memory or spilled. A spilled
+ * chunk is its records followed by the paths they use, with each path_id
+ * replaced by the offset of the path after the records. What stays in
+ * memory of it lets searches skip it or take it whole without reading it:
+ * how many rows have each mask, and a Bloom filter of its paths' trigrams
+ * sized to how many distinct ones there are.
+ */
+struct EventLogChunk
+{
+	guint64 seq;
+	struct EventRecord *records;
+	guint32 types;
+	goffset offset;
+	gsize size;
+
+	/* Once spilled */
+	struct EventLogMaskCount *masks;
+	guint n_masks;
+	guint8 *bloom;
+	guint bloom_shift;
+};
+
+/* A spilled chunk paged back in */
+struct EventLogPage
+{
+	guint64 seq;
+	guint64 used;
+	char *data;
+};
+
+struct _EventLog
+{
+	GObject parent;
+	GArray *chunks;
+	struct StringTable *paths;
+	guint size;
+	guint flushed;
+
+	/* Limits, and chunks[first_resident..] being the ones in memory */
+	gsize memory_limit;
+	gsize disk_limit;
+	guint first_resident;
+	guint64 next_seq;
+
+	/* Paths in the table right after it was last compacted, which voids ids */
+	guint paths_live;
+	gboolean paths_stale;
+	guint generation;
+	struct PathIndex *index;
+
+	/* Spill file, created on first use and already unlinked */
+	int fd;
+	gboolean spill_failed;
+	goffset disk_end;
+	gsize disk_used;
+
+	/* What spilled chunks keep in memory */
+	gsize summary_bytes;
+
+	/* Searches read spilled chunks into their own page, not the view's */
+	struct EventLogPage pages[EVENT_LOG_PAGES];
+	struct EventLogPage search_page;
+	guint64 page_clock;
+};
+
+static void event_log_model_init(GListModelInterface *iface);
+
+G_DEFINE_TYPE_WITH_CODE(EventLog, event_log, G_TYPE_OBJECT,
+		G_IMPLEMENT_INTERFACE(G_TYPE_LIST_MODEL, event_log_model_init));
+
+/* Spilling {{{ */
+
+static gboolean event_log_write(int fd, const void *buf, gsize len, goffset offset)
+{
+	while (len > 0)
+	{
+		ssize_t n = pwrite(fd, buf, len, offset);
+		if (n == -1)
+		{
+			if (errno == EINTR)
+				continue;
+
+			return FALSE;
+		}
+
+		buf = (const char*) buf + n;
+		len -= n;
+		offset += n;
+	}
+
+	return TRUE;
+}
+
+static gboolean event_log_read(int fd, void *buf, gsize len, goffset offset)
+{
+	while (len > 0)
+	{
+		ssize_t n = pread(fd, buf, len, offset);
+		if (n == -1 && errno == EINTR)
+			continue;
+
+		if (n <= 0)
+			return FALSE;
+
+		buf = (char*) buf + n;
+		len -= n;
+		offset += n;
+	}
+
+	return TRUE;
+}
+
+static gboolean event_log_open_spill(EventLog *log)
+{
+	GError *error = NULL;
+	char *name;
+
+	log->fd = g_file_open_tmp("inotify-log-XXXXXX", &name, &error);
+	if (log->fd == -1)
+	{
+		log->spill_failed = TRUE;
+		g_warning("Event log can't spill to disk: %s", error->message);
+		g_error_free(error);
+		return FALSE;
+	}
+
+	/* Only the fd keeps it, so nothing is left behind after a crash */
+	g_unlink(name);
+	g_free(name);
+
+	return TRUE;
+}
+
+/* Where the i-th bit of a trigram goes in a filter of 1 << shift bits */
+static guint32 event_log_bloom_bit(guint32 gram, guint i, guint shift)
+{
+	guint32 h1 = gram * 0x9E3779B1u;
+	guint32 h2 = (gram * 0x85EBCA77u) | 1;
+
+	return (h1 + i * h2) >> (32 - shift);
+}
+
+/* A filter sized to the distinct trigrams in grams, a set of them */
+static guint8 *event_log_bloom_new(GHashTable *grams, guint *shift)
+{
+	GHashTableIter iter;
+	gpointer gram;
+	guint8 *bloom;
+	gsize bits = (gsize) g_hash_table_size(grams) * EVENT_LOG_BLOOM_BITS;
+
+	*shift = MIN(MAX(g_bit_storage(bits), EVENT_LOG_BLOOM_MIN), 31);
+	bloom = g_malloc0(((gsize) 1 << *shift) / 8);
+
+	g_hash_table_iter_init(&iter, grams);
+	while (g_hash_table_iter_next(&iter, &gram, NULL))
+	{
+		for (guint i = 0; i < EVENT_LOG_BLOOM_HASHES; ++i)
+		{
+			guint32 bit = event_log_bloom_bit(GPOINTER_TO_UINT(gram), i, *shift);
+			bloom[bit / 8] |= 1 << (bit % 8);
+		}
+	}
+
+	return bloom;
+}
+
+/* FALSE if no path of the chunk has every trigram of text */
+static gboolean event_log_bloom_test(const struct EventLogChunk *chunk, const char *text)
+{
+	gsize len = strlen(text);
+
+	for (gsize i = 0; i + PATH_INDEX_GRAM <= len; ++i)
+	{
+		guint32 gram = path_index_gram(text + i);
+
+		for (guint j = 0; j < EVENT_LOG_BLOOM_HASHES; ++j)
+		{
+			guint32 bit = event_log_bloom_bit(gram, j, chunk->bloom_shift);
+
+			if (!(chunk->bloom[bit / 8] & (1 << (bit % 8))))
+				return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+/* Rows of a spilled chunk whose mask has any of the bits in mask, 0 for any */
+static guint event_log_chunk_count(const struct EventLogChunk *chunk, guint32 mask)
+{
+	guint count = 0;
+
+	if (mask == 0)
+		return EVENT_LOG_CHUNK_SIZE;
+
+	for (guint i = 0; i < chunk->n_masks; ++i)
+	{
+		if (chunk->masks[i].mask & mask)
+			count += chunk->masks[i].count;
+	}
+
+	return count;
+}
+
+static gboolean event_log_spill(EventLog *log, struct EventLogChunk *chunk)
+{
+	struct EventRecord *records;
+	GHashTable *offsets, *grams, *masks;
+	GHashTableIter iter;
+	gpointer mask, count;
+	GString *strings;
+	gboolean ok;
+
+	if (log->spill_failed || (log->fd == -1 && !event_log_open_spill(log)))
+		return FALSE;
+
+	records = g_memdup2(chunk->records, EVENT_LOG_CHUNK_BYTES);
+	offsets = g_hash_table_new(g_direct_hash, g_direct_equal);
+	grams = g_hash_table_new(g_direct_hash, g_direct_equal);
+	masks = g_hash_table_new(g_direct_hash, g_direct_equal);
+	strings = g_string_new(NULL);
+
+	for (guint i = 0; i < EVENT_LOG_CHUNK_SIZE; ++i)
+	{
+		gpointer key = GUINT_TO_POINTER(records[i].path_id);
+		gpointer offset;
+
+		if (!g_hash_table_lookup_extended(offsets, key, NULL, &offset))
+		{
+			const char *path = string_table_lookup(log->paths, records[i].path_id);
+			gsize len = strlen(path);
+
+			offset = GUINT_TO_POINTER(strings->len);
+			g_string_append_len(strings, path, len + 1);
+			g_hash_table_insert(offsets, key, offset);
+
+			for (gsize j = 0; j + PATH_INDEX_GRAM <= len; ++j)
+				g_hash_table_add(grams, GUINT_TO_POINTER(path_index_gram(path + j)));
+		}
+
+		records[i].path_id = GPOINTER_TO_UINT(offset);
+
+		key = GUINT_TO_POINTER(records[i].mask);
+		g_hash_table_insert(masks, key, GUINT_TO_POINTER(GPOINTER_TO_UINT(g_hash_table_lookup(masks, key)) + 1));
+	}
+
+	ok = event_log_write(log->fd, records, EVENT_LOG_CHUNK_BYTES, log->disk_end) &&
+		event_log_write(log->fd, strings->str, strings->len, log->disk_end + EVENT_LOG_CHUNK_BYTES);
+
+	if (ok)
+	{
+		chunk->offset = log->disk_end;
+		chunk->size = EVENT_LOG_CHUNK_BYTES + strings->len;
+		log->disk_end += chunk->size;
+		log->disk_used += chunk->size;
+
+		g_free(chunk->records);
+		chunk->records = NULL;
+		log->paths_stale = TRUE;
+
+		chunk->bloom = event_log_bloom_new(grams, &chunk->bloom_shift);
+		chunk->n_masks = 0;
+		chunk->masks = g_new(struct EventLogMaskCount, g_hash_table_size(masks));
+
+		g_hash_table_iter_init(&iter, masks);
+		while (g_hash_table_iter_next(&iter, &mask, &count))
+		{
+			chunk->masks[chunk->n_masks].mask = GPOINTER_TO_UINT(mask);
+			chunk->masks[chunk->n_masks].count = GPOINTER_TO_UINT(count);
+			chunk->n_masks++;
+		}
+
+		log->summary_bytes += ((gsize) 1 << chunk->bloom_shift) / 8 +
+			chunk->n_masks * sizeof(struct EventLogMaskCount);
+	}
+	else
+	{
+		g_warning("Event log can't spill to disk: %s", g_strerror(errno));
+		log->spill_failed = TRUE;
+	}
+
+	g_hash_table_destroy(offsets);
+	g_hash_table_destroy(grams);
+	g_hash_table_destroy(masks);
+	g_string_free(strings, TRUE);
+	g_free(records);
+
+	return ok;
+}
+
+/* Reads a spilled chunk into page */
+static gboolean event_log_page_read(EventLog *log, const struct EventLogChunk *chunk,
+		struct EventLogPage *page)
+{
+	g_free(page->data);
+	page->data = g_malloc(chunk->size);
+
+	if (!event_log_read(log->fd, page->data, chunk->size, chunk->offset))
+	{
+		g_clear_pointer(&page->data, g_free);
+		return FALSE;
+	}
+
+	page->seq = chunk->seq;
+	return TRUE;
+}
+
+/* Reads a spilled chunk back, into the least recently used page */
+static struct EventLogPage *event_log_page_in(EventLog *log, const struct EventLogChunk *chunk)
+{
+	struct EventLogPage *page = &log->pages[0];
+
+	for (guint i = 0; i < EVENT_LOG_PAGES; ++i)
+	{
+		if (log->pages[i].data != NULL && log->pages[i].seq == chunk->seq)
+		{
+			log->pages[i].used = ++log->page_clock;
+			return &log->pages[i];
+		}
+
+		if (log->pages[i].used < page->used)
+			page = &log->pages[i];
+	}
+
+	if (!event_log_page_read(log, chunk, page))
+		return NULL;
+
+	page->used = ++log->page_clock;
+
+	return page;
+}
+
+static void event_log_drop_pages(EventLog *log)
+{
+	for (guint i = 0; i < EVENT_LOG_PAGES; ++i)
+	{
+		g_clear_pointer(&log->pages[i].data, g_free);
+		log->pages[i].used = 0;
+	}
+
+	g_clear_pointer(&log->search_page.data, g_free);
+}
+
+/* }}} */
+
+/* Budget {{{ */
+
+static gsize event_log_memory(EventLog *log)
+{
+	return (log->chunks->len - log->first_resident) * EVENT_LOG_CHUNK_BYTES +
+		log->summary_bytes +
+		log->paths->bytes + string_table_size(log->paths) * EVENT_LOG_PATH_OVERHEAD +
+		path_index_get_bytes(log->index);
+}
+
+/* Removes the oldest chunk from the log, and from the spill file if it's there */
+static void event_log_evict(EventLog *log)
+{
+	struct EventLogChunk *chunk = &g_array_index(log->chunks, struct EventLogChunk, 0);
+
+	if (chunk->records != NULL)
+		log->paths_stale = TRUE;
+	else
+	{
+		fallocate(log->fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, chunk->offset, chunk->size);
+		log->disk_used -= chunk->size;
+		log->summary_bytes -= ((gsize) 1 << chunk->bloom_shift) / 8 +
+			chunk->n_masks * sizeof(struct EventLogMaskCount);
+	}
+
+	g_array_remove_index(log->chunks, 0);
+
+	if (log->first_resident > 0)
+		log->first_resident--;
+
+	log->size -= EVENT_LOG_CHUNK_SIZE;
+	log->flushed -= EVENT_LOG_CHUNK_SIZE;
+}
+
+/*
+ * Re-interns the paths of the records still in memory into a new table
+ * and index, once the table doubled since this was last done and records
+ * have left memory since. Ids handed out before are void afterwards.
+ */
+static void event_log_compact(EventLog *log)
+{
+	struct StringTable *paths;
+	struct PathIndex *index;
+
+	if (!log->paths_stale || string_table_size(log->paths) < 2 * MAX(log->paths_live, EVENT_LOG_COMPACT_MIN))
+		return;
+
+	paths = string_table_new();
+	index = path_index_new();
+
+	for (guint c = log->first_resident; c < log->chunks->len; ++c)
+	{
+		struct EventRecord *records = g_array_index(log->chunks, struct EventLogChunk, c).records;
+		guint n = MIN(log->size - c * EVENT_LOG_CHUNK_SIZE, EVENT_LOG_CHUNK_SIZE);
+
+		for (guint i = 0; i < n; ++i)
+		{
+			const char *path = string_table_lookup(log->paths, records[i].path_id);
+			guint size = string_table_size(paths);
+
+			records[i].path_id = string_table_intern(paths, path);
+			if (records[i].path_id == size)
+				path_index_add(index, records[i].path_id, path);
+		}
+	}
+
+	string_table_free(log->paths);
+	path_index_free(log->index);
+	log->paths = paths;
+	log->index = index;
+	log->generation++;
+	log->paths_live = string_table_size(paths);
+	log->paths_stale = FALSE;
+}
+
+/*
+ * Keeps memory within its limit by spilling the oldest chunks in memory,
+ * or evicting them if they can't be spilled, and the spill file within its
+ * limit by evicting the oldest spilled chunks. The chunk being filled
+ * always stays. Returns how many rows were evicted from the front.
+ */
+static guint event_log_enforce(EventLog *log)
+{
+	guint evicted = 0;
+
+	while (event_log_memory(log) > log->memory_limit && log->first_resident + 1 < log->chunks->len)
+	{
+		struct EventLogChunk *chunk = &g_array_index(log->chunks, struct EventLogChunk, log->first_resident);
+
+		if (log->disk_limit > 0 && event_log_spill(log, chunk))
+			log->first_resident++;
+		else
+		{
+			/* Spilling failed or is off; history goes from the front */
+			event_log_evict(log);
+			evicted += EVENT_LOG_CHUNK_SIZE;
+		}
+
+		event_log_compact(log);
+	}
+
+	while (log->disk_used > log->disk_limit && log->first_resident > 0)
+	{
+		event_log_evict(log);
+		evicted += EVENT_LOG_CHUNK_SIZE;
+	}
+
+	event_log_compact(log);
+
+	return evicted;
+}
+
+/* }}} */
+
+static GType event_log_get_item_type(GListModel *model)
+{
+	return EVENT_LOG_ROW_TYPE;
+}
+
+/* Only rows that have been announced through items-changed are visible */
+static guint event_log_get_n_items(GListModel *model)
+{
+	return EVENT_LOG(model)->flushed;
+}
+
+/* Rows get a copy of their path, as ids don't outlive compaction */
+static gpointer event_log_get_item(GListModel *model, guint position)
+{
+	EventLog *log = EVENT_LOG(model);
+	struct EventLogChunk *chunk;
+	struct EventLogPage *page;
+	EventLogRow *row;
+	guint i;
+
+	if (position >= log->flushed)
+		return NULL;
+
+	chunk = &g_array_index(log->chunks, struct EventLogChunk, position >> EVENT_LOG_CHUNK_SHIFT);
+	i = position & (EVENT_LOG_CHUNK_SIZE - 1);
+
+	row = g_object_new(EVENT_LOG_ROW_TYPE, NULL);
+
+	if (chunk->records != NULL)
+	{
+		row->record = chunk->records[i];
+		row->path = g_strdup(string_table_lookup(log->paths, row->record.path_id));
+	}
+	else if ((page = event_log_page_in(log, chunk)) != NULL)
+	{
+		row->record = ((struct EventRecord*) page->data)[i];
+		row->path = g_strdup(page->data + EVENT_LOG_CHUNK_BYTES + row->record.path_id);
+	}
+	else
+		row->path = g_strdup(EVENT_LOG_UNREADABLE);
+
+	return row;
+}
+
+static void event_log_model_init(GListModelInterface *iface)
+{
+	iface->get_item_type = event_log_get_item_type;
+	iface->get_n_items = event_log_get_n_items;
+	iface->get_item = event_log_get_item;
+}
+
+static void event_log_chunk_clear(gpointer data)
+{
+	g_free(((struct EventLogChunk*) data)->records);
+	g_free(((struct EventLogChunk*) data)->masks);
+	g_free(((struct EventLogChunk*) data)->bloom);
+}
+
+static void event_log_finalize(GObject *object)
+{
+	EventLog *log = EVENT_LOG(object);
+
+	g_array_free(log->chunks, TRUE);
+	string_table_free(log->paths);
+	path_index_free(log->index);
+	event_log_drop_pages(log);
+
+	if (log->fd != -1)
+		close(log->fd);
+
+	G_OBJECT_CLASS(event_log_parent_class)->finalize(object);
+}
+
+static void event_log_init(EventLog *log)
+{
+	log->chunks = g_array_new(FALSE, FALSE, sizeof(struct EventLogChunk));
+	g_array_set_clear_func(log->chunks, event_log_chunk_clear);
+	log->paths = string_table_new();
+	log->index = path_index_new();
+	log->size = 0;
+	log->flushed = 0;
+	log->memory_limit = EVENT_LOG_MEMORY;
+	log->disk_limit = EVENT_LOG_DISK;
+	log->fd = -1;
+}
+
+static void event_log_class_init(EventLogClass *class)
+{
+	G_OBJECT_CLASS(class)->finalize = event_log_finalize;
+}
+
+EventLog *event_log_new(void)
+{
+	return g_object_new(EVENT_LOG_TYPE, NULL);
+}
+
+/*
+ * Bytes the log may keep in memory and spill to disk; older rows are
+ * spilled, then dropped. Memory is rounded up to two chunks, disk 0 drops
+ * rows right away. Takes effect on the next flush.
+ */
+void event_log_set_limits(EventLog *log, gsize memory, gsize disk)
+{
+	log->memory_limit = MAX(memory, 2 * EVENT_LOG_CHUNK_BYTES);
+	log->disk_limit = disk;
+}
+
+/* The id is only good for appending before the next flush */
+guint32 event_log_intern(EventLog *log, const char *path)
+{
+	guint size = string_table_size(log->paths);
+	guint32 id = string_table_intern(log->paths, path);
+
+	if (id == size)
+		path_index_add(log->index, id, path);
+
+	return id;
+}
+
+void event_log_append(EventLog *log, guint32 mask, guint32 path_id,
+		gint64 time, gint64 last_time, guint32 count)
+{
+	struct EventLogChunk *last;
+	struct EventRecord *chunk;
+	guint offset = log->size & (EVENT_LOG_CHUNK_SIZE - 1);
+
+	if (offset == 0)
+	{
+		struct EventLogChunk new_chunk = { .seq = log->next_seq++ };
+
+		new_chunk.records = g_new(struct EventRecord, EVENT_LOG_CHUNK_SIZE);
+		g_array_append_val(log->chunks, new_chunk);
+	}
+
+	last = &g_array_index(log->chunks, struct EventLogChunk, log->chunks->len - 1);
+	last->types |= mask;
+	chunk = last->records;
+
+	chunk[offset].mask = mask;
+	chunk[offset].path_id = path_id;
+	chunk[offset].time = time;
+	chunk[offset].count = count;
+	chunk[offset].span = (guint32) MIN((last_time - time) / 1000, G_MAXUINT32);
+
+	log->size++;
+}
+
+/*
+ * Announces everything appended since the last flush with a single
+ * items-changed emission, then one more for rows the limits pushed out.
+ */
+void event_log_flush(EventLog *log)
+{
+	guint position = log->flushed;
+	guint added = log->size - log->flushed;
+	guint evicted;
+
+	if (added == 0)
+		return;
+
+	log->flushed = log->size;
+
+	g_list_model_items_changed(G_LIST_MODEL(log), position, 0, added);
+
+	evicted = event_log_enforce(log);
+	if (evicted > 0)
+		g_list_model_items_changed(G_LIST_MODEL(log), 0, evicted, 0);
+}
+
+/*
+ * Drops every record. Interned paths are kept for now since they tend to
+ * recur, and go with the next compaction like any others no row uses.
+ */
+void event_log_clear(EventLog *log)
+{
+	guint removed = log->flushed;
+
+	g_array_set_size(log->chunks, 0);
+	log->size = 0;
+	log->flushed = 0;
+	log->first_resident = 0;
+	log->summary_bytes = 0;
+	log->paths_live = 0;
+	log->paths_stale = TRUE;
+
+	event_log_drop_pages(log);
+
+	if (log->fd != -1)
+	{
+		ftruncate(log->fd, 0);
+		log->disk_end = 0;
+		log->disk_used = 0;
+	}
+
+	if (removed > 0)
+		g_list_model_items_changed(G_LIST_MODEL(log), 0, removed, 0);
+}
+
+guint event_log_get_size(EventLog *log)
+{
+	return log->flushed;
+}
+
+/* Search {{{ */
+
+struct EventLogQuery
+{
+	/* NULL for any path */
+	char *text;
+	guint32 mask;
+
+	/* Which path ids match, known for those below checked in generation */
+	guint generation;
+	guint checked;
+	GByteArray *matches;
+	GArray *ids;
+};
+
+/*
+ * Rows whose path contains text, ignoring ASCII case, and whose mask has
+ * any of the bits in mask. An empty text or a 0 mask leaves that part out.
+ */
+struct EventLogQuery *event_log_query_new(const char *text, guint32 mask)
+{
+	struct EventLogQuery *query = g_new0(struct EventLogQuery, 1);
+
+	query->text = text && *text ? g_strdup(text) : NULL;
+	query->mask = mask;
+	query->matches = g_byte_array_new();
+	query->ids = g_array_new(FALSE, FALSE, sizeof(guint32));
+
+	return query;
+}
+
+void event_log_query_free(struct EventLogQuery *query)
+{
+	if (query == NULL)
+		return;
+
+	g_free(query->text);
+	g_byte_array_free(query->matches, TRUE);
+	g_array_free(query->ids, TRUE);
+	g_free(query);
+}
+
+static void event_log_query_set(struct EventLogQuery *query, guint32 id)
+{
+	query->matches->data[id / 8] |= 1 << (id % 8);
+}
+
+static gboolean event_log_query_test(struct EventLogQuery *query, guint32 id)
+{
+	return (query->matches->data[id / 8] & (1 << (id % 8))) != 0;
+}
+
+/*
+ * Brings the matching path ids up to date with the table: through the
+ * index for many new paths, one by one for a few, from scratch once the
+ * table was compacted.
+ */
+static void event_log_query_update(EventLog *log, struct EventLogQuery *query)
+{
+	guint size = string_table_size(log->paths);
+	guint from;
+
+	if (query->generation != log->generation)
+	{
+		query->generation = log->generation;
+		query->checked = 0;
+		g_byte_array_set_size(query->matches, 0);
+	}
+
+	if (query->checked >= size)
+		return;
+
+	from = query->matches->len;
+	g_byte_array_set_size(query->matches, (size + 7) / 8);
+	memset(query->matches->data + from, 0, query->matches->len - from);
+
+	g_array_set_size(query->ids, 0);
+
+	if (size - query->checked > EVENT_LOG_QUERY_SCAN &&
+			path_index_query(log->index, query->text, query->checked, query->ids))
+	{
+		for (guint i = 0; i < query->ids->len; ++i)
+		{
+			guint32 id = g_array_index(query->ids, guint32, i);
+
+			if (strcasestr(string_table_lookup(log->paths, id), query->text))
+				event_log_query_set(query, id);
+		}
+	}
+	else
+	{
+		for (guint32 id = query->checked; id < size; ++id)
+		{
+			if (strcasestr(string_table_lookup(log->paths, id), query->text))
+				event_log_query_set(query, id);
+		}
+	}
+
+	query->checked = size;
+}
+
+/*
+ * Checks a spilled chunk row by row, each of its paths once. It is read
+ * into the search page unless the view has it paged in already.
+ */
+static void event_log_search_page(EventLog *log, struct EventLogQuery *query,
+		const struct EventLogChunk *chunk, guint base, guint from, guint to, GArray *positions)
+{
+	struct EventLogPage *page = NULL;
+	const struct EventRecord *records;
+	GHashTable *seen = NULL;
+
+	for (guint i = 0; i < EVENT_LOG_PAGES && page == NULL; ++i)
+	{
+		if (log->pages[i].data != NULL && log->pages[i].seq == chunk->seq)
+			page = &log->pages[i];
+	}
+
+	if (page == NULL)
+	{
+		page = &log->search_page;
+
+		if ((page->data == NULL || page->seq != chunk->seq) && !event_log_page_read(log, chunk, page))
+			return;
+	}
+
+	records = (const struct EventRecord*) page->data;
+
+	if (query->text)
+		seen = g_hash_table_new(g_direct_hash, g_direct_equal);
+
+	for (guint p = from; p < to; ++p)
+	{
+		const struct EventRecord *record = &records[p - base];
+		gpointer match;
+
+		if (query->mask && !(record->mask & query->mask))
+			continue;
+
+		if (seen)
+		{
+			gpointer key = GUINT_TO_POINTER(record->path_id);
+
+			if (!g_hash_table_lookup_extended(seen, key, NULL, &match))
+			{
+				match = GINT_TO_POINTER(strcasestr(page->data + EVENT_LOG_CHUNK_BYTES + record->path_id,
+							query->text) != NULL);
+				g_hash_table_insert(seen, key, match);
+			}
+
+			if (!match)
+				continue;
+		}
+
+		g_array_append_val(positions, p);
+	}
+
+	if (seen)
+		g_hash_table_destroy(seen);
+}
+
+/*
+ * Appends the positions in [from, to) of rows that match query to
+ * positions, in order. Spilled chunks are only read back when their mask
+ * counts and trigram filter can't settle the query for them: no row can
+ * match, or every row does.
+ */
+void event_log_search(EventLog *log, struct EventLogQuery *query, guint from, guint to, GArray *positions)
+{
+	to = MIN(to, log->flushed);
+
+	if (from >= to)
+		return;
+
+	if (query->text)
+		event_log_query_update(log, query);
+
+	for (guint c = from >> EVENT_LOG_CHUNK_SHIFT; c <= (to - 1) >> EVENT_LOG_CHUNK_SHIFT; ++c)
+	{
+		const struct EventLogChunk *chunk = &g_array_index(log->chunks, struct EventLogChunk, c);
+		guint base = c << EVENT_LOG_CHUNK_SHIFT;
+		guint start = MAX(from, base);
+		guint end = MIN(to, base + EVENT_LOG_CHUNK_SIZE);
+
+		if (query->mask && !(chunk->types & query->mask))
+			continue;
+
+		if (chunk->records == NULL)
+		{
+			guint count = event_log_chunk_count(chunk, query->mask);
+
+			if (count == 0 || (query->text && !event_log_bloom_test(chunk, query->text)))
+				continue;
+
+			if (count == EVENT_LOG_CHUNK_SIZE && query->text == NULL)
+			{
+				for (guint p = start; p < end; ++p)
+					g_array_append_val(positions, p);
+			}
+			else
+				event_log_search_page(log, query, chunk, base, start, end, positions);
+
+			continue;
+		}
+
+		for (guint p = start; p < end; ++p)
+		{
+			const struct EventRecord *record = &chunk->records[p - base];
+
+			if (query->mask && !(record->mask & query->mask))
+				continue;
+
+			if (query->text && !event_log_query_test(query, record->path_id))
+				continue;
+
+			g_array_append_val(positions, p);
+		}
+	}
+}
+
+/* }}} */
+
+/* }}} */
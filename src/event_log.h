@@ -0,0 +1,73 @@
+#ifndef EVENT_LOG_H
+#define EVENT_LOG_H
+
+#include <gio/gio.h>
+#include <glib-object.h>
+
+/*
+ * Event log kept as fixed-size records in an arena of chunks, exposed as a
+ * GListModel. Row objects are created on demand by get_item(), so only the
+ * rows a view is actually showing exist as GObjects.
+ *
+ * Memory is bounded: past its limit the oldest chunks are spilled to an
+ * unlinked temporary file and paged back in when a view scrolls to them,
+ * and past the disk limit they are dropped, oldest first.
+ *
+ * Interned paths are indexed by trigram, so searches for a substring of
+ * the path only look at rows whose path can contain it.
+ */
+
+/* Not an inotify bit: marks a row standing for events the UI had to drop */
+#define EVENT_DROPPED 0x00001000
+
+#define EVENT_LOG_CHUNK_SHIFT 12
+#define EVENT_LOG_CHUNK_SIZE (1 << EVENT_LOG_CHUNK_SHIFT)
+
+/* Default limits, see event_log_set_limits() */
+#define EVENT_LOG_MEMORY ((gsize) 64 << 20)
+#define EVENT_LOG_DISK ((gsize) 1 << 30)
+
+/*
+ * One logged row. Coalesced repeats share a record: count is how many
+ * events it stands for and span how many ms passed between the first
+ * (time) and the last of them.
+ */
+struct EventRecord
+{
+	guint32 mask;
+	guint32 path_id;
+	gint64 time;
+	guint32 count;
+	guint32 span;
+};
+
+#define EVENT_LOG_TYPE (event_log_get_type())
+G_DECLARE_FINAL_TYPE(EventLog, event_log, EVENT, LOG, GObject)
+
+#define EVENT_LOG_ROW_TYPE (event_log_row_get_type())
+G_DECLARE_FINAL_TYPE(EventLogRow, event_log_row, EVENT, LOG_ROW, GObject)
+
+EventLog *event_log_new(void);
+void event_log_set_limits(EventLog *log, gsize memory, gsize disk);
+
+guint32 event_log_intern(EventLog *log, const char *path);
+void event_log_append(EventLog *log, guint32 mask, guint32 path_id,
+		gint64 time, gint64 last_time, guint32 count);
+void event_log_flush(EventLog *log);
+void event_log_clear(EventLog *log);
+
+guint event_log_get_size(EventLog *log);
+
+struct EventLogQuery;
+
+struct EventLogQuery *event_log_query_new(const char *text, guint32 mask);
+void event_log_query_free(struct EventLogQuery *query);
+void event_log_search(EventLog *log, struct EventLogQuery *query, guint from, guint to, GArray *positions);
+
+guint32 event_log_row_get_mask(EventLogRow *row);
+gint64 event_log_row_get_time(EventLogRow *row);
+gint64 event_log_row_get_last_time(EventLogRow *row);
+guint32 event_log_row_get_count(EventLogRow *row);
+const char *event_log_row_get_path(EventLogRow *row);
+
+#endif /* end of include guard: EVENT_LOG_H */
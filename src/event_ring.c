@@ -0,0 +1,107 @@
+#include <glib.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "event_ring.h"
+
+struct EventRing *event_ring_new(guint capacity)
+{
+	struct EventRing *ring;
+	guint cap = 1;
+
+	/* Power of two, so that a slot index is just a mask away */
+	while (cap < capacity)
+		cap <<= 1;
+
+	/*
+	 * g_new() only aligns to 16 bytes; the producer's and the consumer's
+	 * halves need their own cache lines. sizeof is a multiple of the
+	 * alignment, as aligned_alloc() wants.
+	 */
+	ring = aligned_alloc(_Alignof(struct EventRing), sizeof(struct EventRing));
+	if (ring == NULL)
+		g_error("event_ring_new: out of memory");
+
+	memset(ring, 0, sizeof(*ring));
+	ring->capacity = cap;
+	ring->slots = g_new0(struct RingEvent, cap);
+
+	atomic_init(&ring->head, 0);
+	atomic_init(&ring->tail, 0);
+	atomic_init(&ring->dropped, 0);
+
+	return ring;
+}
+
+void event_ring_free(struct EventRing *ring)
+{
+	if (ring == NULL)
+		return;
+
+	g_free(ring->slots);
+	free(ring);
+}
+
+/* Called only from the producer thread */
+gboolean event_ring_push(struct EventRing *ring, const struct RingEvent *ev)
+{
+	guint head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+	if (head - ring->tail_cache == ring->capacity)
+	{
+		ring->tail_cache = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+		if (head - ring->tail_cache == ring->capacity)
+		{
+			atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+			return FALSE;
+		}
+	}
+
+	ring->slots[head & (ring->capacity - 1)] = *ev;
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+	return TRUE;
+}
+
+/*
+ * Called only from the consumer thread. Copies up to max events into out
+ * and returns how many were taken.
+ */
+guint event_ring_pop(struct EventRing *ring, struct RingEvent *out, guint max)
+{
+	guint tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	guint avail = ring->head_cache - tail;
+
+	if (avail < max)
+	{
+		ring->head_cache = atomic_load_explicit(&ring->head, memory_order_acquire);
+		avail = ring->head_cache - tail;
+	}
+
+	if (avail > max)
+		avail = max;
+
+	for (guint i = 0; i < avail; ++i)
+		out[i] = ring->slots[(tail + i) & (ring->capacity - 1)];
+
+	atomic_store_explicit(&ring->tail, tail + avail, memory_order_release);
+
+	return avail;
+}
+
+guint event_ring_take_dropped(struct EventRing *ring)
+{
+	return atomic_exchange_explicit(&ring->dropped, 0, memory_order_relaxed);
+}
+
+/* Events queued right now; from any thread, so only a snapshot */
+guint event_ring_length(struct EventRing *ring)
+{
+	guint tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+	guint head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+
+	/* tail was read first, so head can't be behind it */
+	return head - tail;
+}
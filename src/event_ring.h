@@ -0,0 +1,64 @@
+#ifndef EVENT_RING_H
+#define EVENT_RING_H
+
+#include <glib.h>
+#include <stdatomic.h>
+
+/* No dir or name, as for queue overflows */
+#define RING_EVENT_NONE G_MAXUINT32
+
+/*
+ * Bounded single-producer/single-consumer ring of decoded events.
+ *
+ * The listener thread is the only producer and the GTK main thread is the
+ * only consumer, so head and tail each have exactly one writer and the ring
+ * needs nothing stronger than acquire/release ordering.
+ */
+
+struct RingEvent
+{
+	guint32 mask;
+	guint32 cookie;
+	guint32 count;
+
+	/* Listener root the event was seen under, 0 if it concerns them all */
+	guint32 root;
+	gint64 time;
+	gint64 last_time;
+
+	/*
+	 * Ids in the listener's path tables; name is RING_EVENT_NONE for events
+	 * about the directory itself. Nothing in the ring is owned, so pushing
+	 * and dropping events never allocates or frees.
+	 */
+	guint32 dir;
+	guint32 name;
+
+	/* Set by whoever hands the event to a consumer, NULL for overflows */
+	const char *path;
+};
+
+struct EventRing
+{
+	/* Producer side */
+	_Alignas(64) atomic_uint head;
+	guint tail_cache;
+
+	/* Consumer side */
+	_Alignas(64) atomic_uint tail;
+	guint head_cache;
+
+	_Alignas(64) atomic_uint dropped;
+	guint capacity;
+	struct RingEvent *slots;
+};
+
+struct EventRing *event_ring_new(guint capacity);
+void event_ring_free(struct EventRing *ring);
+
+gboolean event_ring_push(struct EventRing *ring, const struct RingEvent *ev);
+guint event_ring_pop(struct EventRing *ring, struct RingEvent *out, guint max);
+guint event_ring_take_dropped(struct EventRing *ring);
+guint event_ring_length(struct EventRing *ring);
+
+#endif /* end of include guard: EVENT_RING_H */
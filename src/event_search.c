@@ -0,0 +1,292 @@
+/* vim: set fdm=marker : */
+
+#include <gio/gio.h>
+#include <glib-object.h>
+
+#include "event_search.h"
+#include "trace.h"
+
+/* Time a refilter may take per main loop iteration, in µs */
+#define EVENT_SEARCH_SLICE 4000
+
+struct _EventSearch
+{
+	GObject parent;
+	EventLog *log;
+
+	/* NULL when showing every row */
+	struct EventLogQuery *query;
+
+	/*
+	 * Positions in the log of the matching rows, ascending, for the rows
+	 * before scanned. A refilter moves scanned up to the end of the log
+	 * in idle slices.
+	 */
+	GArray *positions;
+	guint scanned;
+	guint idle_id;
+	gint64 span;
+	gulong changed_id;
+};
+
+static void event_search_model_init(GListModelInterface *iface);
+
+G_DEFINE_TYPE_WITH_CODE(EventSearch, event_search, G_TYPE_OBJECT,
+		G_IMPLEMENT_INTERFACE(G_TYPE_LIST_MODEL, event_search_model_init));
+
+/* Model {{{ */
+
+static GType event_search_get_item_type(GListModel *model)
+{
+	return EVENT_LOG_ROW_TYPE;
+}
+
+static guint event_search_get_n_items(GListModel *model)
+{
+	EventSearch *search = EVENT_SEARCH(model);
+
+	if (search->query == NULL)
+		return g_list_model_get_n_items(G_LIST_MODEL(search->log));
+
+	return search->positions->len;
+}
+
+static gpointer event_search_get_item(GListModel *model, guint position)
+{
+	EventSearch *search = EVENT_SEARCH(model);
+
+	if (search->query == NULL)
+		return g_list_model_get_item(G_LIST_MODEL(search->log), position);
+
+	if (position >= search->positions->len)
+		return NULL;
+
+	return g_list_model_get_item(G_LIST_MODEL(search->log),
+			g_array_index(search->positions, guint, position));
+}
+
+static void event_search_model_init(GListModelInterface *iface)
+{
+	iface->get_item_type = event_search_get_item_type;
+	iface->get_n_items = event_search_get_n_items;
+	iface->get_item = event_search_get_item;
+}
+
+/* }}} */
+
+/* Following the log {{{ */
+
+/* First index in positions holding a position of at least position */
+static guint event_search_lower_bound(GArray *positions, guint position)
+{
+	guint lo = 0, hi = positions->len;
+
+	while (lo < hi)
+	{
+		guint mid = lo + (hi - lo) / 2;
+
+		if (g_array_index(positions, guint, mid) < position)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/*
+ * Matches the log from scanned on, a chunk at a time, until it is done or
+ * its time slice is used up, and announces the new matches.
+ */
+static gboolean event_search_step(gpointer data)
+{
+	EventSearch *search = EVENT_SEARCH(data);
+	guint size = event_log_get_size(search->log);
+	guint lo = search->positions->len;
+	gint64 start = g_get_monotonic_time();
+
+	while (search->scanned < size && g_get_monotonic_time() - start < EVENT_SEARCH_SLICE)
+	{
+		guint end = MIN((search->scanned | (EVENT_LOG_CHUNK_SIZE - 1)) + 1, size);
+
+		event_log_search(search->log, search->query, search->scanned, end, search->positions);
+		search->scanned = end;
+	}
+
+	if (search->positions->len > lo)
+		g_list_model_items_changed(G_LIST_MODEL(search), lo, 0, search->positions->len - lo);
+
+	if (search->scanned < size)
+		return G_SOURCE_CONTINUE;
+
+	trace_end("search", search->span, search->positions->len);
+	search->idle_id = 0;
+
+	return G_SOURCE_REMOVE;
+}
+
+/*
+ * Matches the whole log again, in place of the removed rows shown so far.
+ * Runs in slices while the main loop is idle, so that a query over a long
+ * spilled history doesn't hold up the UI.
+ */
+static void event_search_refilter(EventSearch *search, guint removed)
+{
+	g_array_set_size(search->positions, 0);
+	search->scanned = 0;
+	search->span = trace_begin();
+
+	g_list_model_items_changed(G_LIST_MODEL(search), 0, removed, 0);
+
+	if (search->idle_id == 0)
+		search->idle_id = g_idle_add(event_search_step, search);
+}
+
+/*
+ * The log only ever appends at its end and removes from its start, or
+ * everything; the matches for those are worked out from what changed.
+ */
+static void event_search_log_changed(GListModel *log, guint position, guint removed, guint added,
+		gpointer data)
+{
+	EventSearch *search = EVENT_SEARCH(data);
+	GArray *positions = search->positions;
+	guint lo, hi;
+
+	if (search->query == NULL)
+	{
+		g_list_model_items_changed(G_LIST_MODEL(search), position, removed, added);
+		return;
+	}
+
+	lo = event_search_lower_bound(positions, position);
+
+	if (removed > 0)
+	{
+		if (added > 0)
+		{
+			event_search_refilter(search, positions->len);
+			return;
+		}
+
+		hi = event_search_lower_bound(positions, position + removed);
+
+		for (guint i = hi; i < positions->len; ++i)
+			g_array_index(positions, guint, i) -= removed;
+
+		g_array_remove_range(positions, lo, hi - lo);
+
+		if (search->scanned >= position + removed)
+			search->scanned -= removed;
+		else if (search->scanned > position)
+			search->scanned = position;
+
+		if (hi > lo)
+			g_list_model_items_changed(G_LIST_MODEL(search), lo, hi - lo, 0);
+	}
+	else if (added > 0)
+	{
+		/* A refilter still running gets to them */
+		if (search->scanned < position)
+			return;
+
+		if (lo < positions->len)
+		{
+			event_search_refilter(search, positions->len);
+			return;
+		}
+
+		event_log_search(search->log, search->query, position, position + added, positions);
+		search->scanned = position + added;
+
+		if (positions->len > lo)
+			g_list_model_items_changed(G_LIST_MODEL(search), lo, 0, positions->len - lo);
+	}
+}
+
+/* }}} */
+
+static void event_search_dispose(GObject *object)
+{
+	EventSearch *search = EVENT_SEARCH(object);
+
+	if (search->idle_id)
+	{
+		g_source_remove(search->idle_id);
+		search->idle_id = 0;
+	}
+
+	if (search->changed_id)
+	{
+		g_signal_handler_disconnect(search->log, search->changed_id);
+		search->changed_id = 0;
+	}
+
+	g_clear_object(&search->log);
+
+	G_OBJECT_CLASS(event_search_parent_class)->dispose(object);
+}
+
+static void event_search_finalize(GObject *object)
+{
+	EventSearch *search = EVENT_SEARCH(object);
+
+	event_log_query_free(search->query);
+	g_array_free(search->positions, TRUE);
+
+	G_OBJECT_CLASS(event_search_parent_class)->finalize(object);
+}
+
+static void event_search_init(EventSearch *search)
+{
+	search->positions = g_array_new(FALSE, FALSE, sizeof(guint));
+}
+
+static void event_search_class_init(EventSearchClass *class)
+{
+	G_OBJECT_CLASS(class)->dispose = event_search_dispose;
+	G_OBJECT_CLASS(class)->finalize = event_search_finalize;
+}
+
+EventSearch *event_search_new(EventLog *log)
+{
+	EventSearch *search = g_object_new(EVENT_SEARCH_TYPE, NULL);
+
+	search->log = g_object_ref(log);
+	search->changed_id = g_signal_connect(log, "items-changed", G_CALLBACK(event_search_log_changed), search);
+
+	return search;
+}
+
+/*
+ * Shows only rows whose path contains text, ignoring ASCII case, and
+ * whose mask has any of the bits in mask; an empty text and a 0 mask
+ * show every row again.
+ */
+void event_search_set_query(EventSearch *search, const char *text, guint32 mask)
+{
+	guint removed = event_search_get_n_items(G_LIST_MODEL(search));
+
+	g_clear_pointer(&search->query, event_log_query_free);
+
+	if ((text == NULL || *text == '\0') && mask == 0)
+	{
+		if (search->idle_id)
+		{
+			g_source_remove(search->idle_id);
+			search->idle_id = 0;
+		}
+
+		g_array_set_size(search->positions, 0);
+		g_list_model_items_changed(G_LIST_MODEL(search), 0, removed, event_log_get_size(search->log));
+		return;
+	}
+
+	search->query = event_log_query_new(text, mask);
+	event_search_refilter(search, removed);
+}
+
+gboolean event_search_is_active(EventSearch *search)
+{
+	return search->query != NULL;
+}
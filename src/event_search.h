@@ -0,0 +1,24 @@
+#ifndef EVENT_SEARCH_H
+#define EVENT_SEARCH_H
+
+#include <gio/gio.h>
+#include <glib-object.h>
+
+#include "event_log.h"
+
+/*
+ * The rows of an EventLog that match a query, as a GListModel of the same
+ * rows. Only the positions of matching rows are kept; they follow the log
+ * as rows are appended, evicted or cleared. A new query is matched in
+ * slices while the main loop is idle, and matches show up as they are
+ * found. Without a query it passes the log through as is.
+ */
+
+#define EVENT_SEARCH_TYPE (event_search_get_type())
+G_DECLARE_FINAL_TYPE(EventSearch, event_search, EVENT, SEARCH, GObject)
+
+EventSearch *event_search_new(EventLog *log);
+void event_search_set_query(EventSearch *search, const char *text, guint32 mask);
+gboolean event_search_is_active(EventSearch *search);
+
+#endif /* end of include guard: EVENT_SEARCH_H */
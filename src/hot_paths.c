@@ -0,0 +1,214 @@
+/* vim: set fdm=marker : */
+
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/inotify.h>
+
+#include "hot_paths.h"
+
+struct HotPaths
+{
+	guint capacity;
+	guint n;
+
+	/* n entries in use, and a min-heap of them by count */
+	struct HotPath *entries;
+	struct HotPath **heap;
+
+	/* Path to entry; keys are the entries' own strings */
+	GHashTable *index;
+	guint64 total;
+
+	/* Parent directory of the event being counted */
+	GString *dir;
+};
+
+/* Heap {{{ */
+
+static void hot_heap_set(struct HotPaths *hot, guint pos, struct HotPath *entry)
+{
+	hot->heap[pos] = entry;
+	entry->pos = pos;
+}
+
+/* Counts only grow, so an entry only ever moves away from the root */
+static void hot_heap_down(struct HotPaths *hot, guint pos)
+{
+	struct HotPath *entry = hot->heap[pos];
+
+	while (1)
+	{
+		guint child = 2 * pos + 1;
+
+		if (child >= hot->n)
+			break;
+
+		if (child + 1 < hot->n && hot->heap[child + 1]->count < hot->heap[child]->count)
+			child++;
+
+		if (entry->count <= hot->heap[child]->count)
+			break;
+
+		hot_heap_set(hot, pos, hot->heap[child]);
+		pos = child;
+	}
+
+	hot_heap_set(hot, pos, entry);
+}
+
+/* }}} */
+
+/* Counting {{{ */
+
+static int hot_path_type(guint32 mask)
+{
+	if (mask & IN_CREATE)
+		return HOT_PATH_CREATE;
+	if (mask & (IN_MODIFY | IN_CLOSE_WRITE))
+		return HOT_PATH_MODIFY;
+	if (mask & (IN_DELETE | IN_DELETE_SELF))
+		return HOT_PATH_DELETE;
+	if (mask & (IN_MOVED_FROM | IN_MOVED_TO | IN_MOVE_SELF))
+		return HOT_PATH_MOVE;
+	if (mask & (IN_OPEN | IN_ACCESS | IN_CLOSE_NOWRITE))
+		return HOT_PATH_ACCESS;
+	if (mask & IN_ATTRIB)
+		return HOT_PATH_ATTRIB;
+
+	return -1;
+}
+
+static void hot_paths_count(struct HotPaths *hot, const char *path, int type, guint64 weight)
+{
+	struct HotPath *entry = g_hash_table_lookup(hot->index, path);
+
+	if (entry == NULL)
+	{
+		if (hot->n < hot->capacity)
+		{
+			entry = &hot->entries[hot->n];
+			entry->count = 0;
+			entry->error = 0;
+			hot_heap_set(hot, hot->n++, entry);
+		}
+		else
+		{
+			/* The least counted path gives its counter up */
+			entry = hot->heap[0];
+			g_hash_table_remove(hot->index, entry->path);
+			g_free(entry->path);
+			entry->error = entry->count;
+		}
+
+		entry->path = g_strdup(path);
+		memset(entry->types, 0, sizeof(entry->types));
+		g_hash_table_insert(hot->index, entry->path, entry);
+	}
+
+	entry->count += weight;
+	if (type >= 0)
+		entry->types[type] += weight;
+
+	hot_heap_down(hot, entry->pos);
+}
+
+void hot_paths_add(struct HotPaths *hot, const struct RingEvent *events, guint n)
+{
+	for (guint i = 0; i < n; ++i)
+	{
+		const struct RingEvent *ev = &events[i];
+		int type = hot_path_type(ev->mask);
+		const char *slash;
+
+		/* Overflows */
+		if (ev->path == NULL)
+			continue;
+
+		hot->total += ev->count;
+		hot_paths_count(hot, ev->path, type, ev->count);
+
+		slash = strrchr(ev->path, '/');
+		if (slash == NULL || slash[1] == '\0')
+			continue;
+
+		g_string_truncate(hot->dir, 0);
+		g_string_append_len(hot->dir, ev->path, slash - ev->path + 1);
+		hot_paths_count(hot, hot->dir->str, type, ev->count);
+	}
+}
+
+/* }}} */
+
+struct HotPaths *hot_paths_new(guint capacity)
+{
+	struct HotPaths *hot = g_new0(struct HotPaths, 1);
+
+	hot->capacity = MAX(capacity, 1);
+	hot->entries = g_new(struct HotPath, hot->capacity);
+	hot->heap = g_new(struct HotPath*, hot->capacity);
+	hot->index = g_hash_table_new(g_str_hash, g_str_equal);
+	hot->dir = g_string_new(NULL);
+
+	return hot;
+}
+
+void hot_paths_clear(struct HotPaths *hot)
+{
+	for (guint i = 0; i < hot->n; ++i)
+		g_free(hot->entries[i].path);
+
+	g_hash_table_remove_all(hot->index);
+	hot->n = 0;
+	hot->total = 0;
+}
+
+void hot_paths_free(struct HotPaths *hot)
+{
+	if (hot == NULL)
+		return;
+
+	hot_paths_clear(hot);
+
+	g_hash_table_destroy(hot->index);
+	g_string_free(hot->dir, TRUE);
+	g_free(hot->heap);
+	g_free(hot->entries);
+	g_free(hot);
+}
+
+guint64 hot_paths_get_total(struct HotPaths *hot)
+{
+	return hot->total;
+}
+
+guint hot_paths_get_size(struct HotPaths *hot)
+{
+	return hot->n;
+}
+
+static int hot_path_cmp(const void *a, const void *b)
+{
+	const struct HotPath *pa = *(const struct HotPath* const*) a;
+	const struct HotPath *pb = *(const struct HotPath* const*) b;
+
+	if (pa->count != pb->count)
+		return pa->count < pb->count ? 1 : -1;
+
+	return strcmp(pa->path, pb->path);
+}
+
+guint hot_paths_top(struct HotPaths *hot, const struct HotPath **out, guint max)
+{
+	const struct HotPath **all = g_new(const struct HotPath*, hot->n);
+	guint n = MIN(max, hot->n);
+
+	for (guint i = 0; i < hot->n; ++i)
+		all[i] = &hot->entries[i];
+
+	qsort(all, hot->n, sizeof(*all), hot_path_cmp);
+	memcpy(out, all, n * sizeof(*all));
+	g_free(all);
+
+	return n;
+}
@@ -0,0 +1,68 @@
+#ifndef HOT_PATHS_H
+#define HOT_PATHS_H
+
+#include <glib.h>
+
+#include "event_ring.h"
+
+/*
+ * Paths that see the most events, tracked with Space-Saving: a fixed
+ * number of counters, each evicted path handing its count on to the path
+ * that replaces it, and each count is at most error too high.
+ *
+ * Directories are tracked as well, with a trailing slash, counting every
+ * event on the entries directly in them. An event on an entry inside a
+ * directory thus takes two increments of the same counters, so the paths
+ * guaranteed a counter are those with more than 2 * total / capacity
+ * events, total being the events counted.
+ */
+
+/* Default number of counters */
+#define HOT_PATHS_CAPACITY 1024
+
+enum HotPathType
+{
+	HOT_PATH_CREATE,
+	HOT_PATH_MODIFY,
+	HOT_PATH_DELETE,
+	HOT_PATH_MOVE,
+	HOT_PATH_ACCESS,
+	HOT_PATH_ATTRIB,
+	HOT_PATH_TYPES,
+};
+
+struct HotPath
+{
+	char *path;
+
+	/* Events counted, of which up to error belonged to evicted paths */
+	guint64 count;
+	guint64 error;
+
+	/* Events since the path got its counter, by type */
+	guint64 types[HOT_PATH_TYPES];
+
+	/* Position in the heap */
+	guint pos;
+};
+
+struct HotPaths;
+
+struct HotPaths *hot_paths_new(guint capacity);
+void hot_paths_free(struct HotPaths *hot);
+void hot_paths_clear(struct HotPaths *hot);
+
+/* Counts resolved events, weighted by how many each one stands for */
+void hot_paths_add(struct HotPaths *hot, const struct RingEvent *events, guint n);
+
+/* Events counted so far, and paths being tracked */
+guint64 hot_paths_get_total(struct HotPaths *hot);
+guint hot_paths_get_size(struct HotPaths *hot);
+
+/*
+ * The max paths with the highest counts, highest first. They stay valid
+ * until the next call that adds or clears.
+ */
+guint hot_paths_top(struct HotPaths *hot, const struct HotPath **out, guint max);
+
+#endif /* end of include guard: HOT_PATHS_H */
@@ -1,17 +1,171 @@
+#include "event_log.h"
 #include "inotify_app.h"
 #include "inotify_app_win.h"
+#include "listener.h"
+#include "path_filter.h"
+#include "trace.h"
 #include <gtk/gtk.h>
 
 struct _InotifyApp
 {
 	GtkApplication parent;
+	char *journal;
+	char *metrics;
+	char *trace;
+	char *replay;
+	double replay_speed;
+	gint log_memory;
+	gint log_disk;
+	guint32 events;
+	struct PathFilter *filter;
 };
 
 G_DEFINE_TYPE(InotifyApp, inotify_app, GTK_TYPE_APPLICATION);
 
+static const GOptionEntry inotify_app_options[] =
+{
+	{ "journal", 'j', 0, G_OPTION_ARG_FILENAME, NULL, "Record events into a rotating journal at PATH", "PATH" },
+	{ "metrics", 'm', 0, G_OPTION_ARG_FILENAME, NULL, "Publish listener counters in the Prometheus text format to FILE, or serve them on unix:PATH", "TARGET" },
+	{ "trace", 0, 0, G_OPTION_ARG_FILENAME, NULL, "Write a Chrome trace of the hot paths to FILE on exit (or set " TRACE_ENV ")", "FILE" },
+	{ "replay", 0, 0, G_OPTION_ARG_FILENAME, NULL, "Replay the journal at PATH into the event list", "PATH" },
+	{ "replay-speed", 0, 0, G_OPTION_ARG_DOUBLE, NULL, "Replay speed relative to the recorded pace, 0 for as fast as possible (default 1)", "FACTOR" },
+	{ "log-memory", 0, 0, G_OPTION_ARG_INT, NULL, "Keep at most MIB MiB of the event list in memory, spilling older rows to disk (default 64)", "MIB" },
+	{ "log-disk", 0, 0, G_OPTION_ARG_INT, NULL, "Spill at most MIB MiB of older event list rows to disk before dropping them, 0 to drop right away (default 1024)", "MIB" },
+	{ "events", 'e', 0, G_OPTION_ARG_STRING, NULL, "Only listen for these events, e.g. create,delete,close_write (default all)", "LIST" },
+	{ "exclude", 'x', 0, G_OPTION_ARG_STRING_ARRAY, NULL, "Skip paths matching a .gitignore-style RULE; excluded directories aren't watched", "RULE" },
+	{ "exclude-from", 0, 0, G_OPTION_ARG_FILENAME, NULL, "Read exclude rules from a .gitignore-style FILE", "FILE" },
+	{ "include", 'i', 0, G_OPTION_ARG_STRING_ARRAY, NULL, "Only list files matching GLOB", "GLOB" },
+	{ NULL }
+};
+
 static void inotify_app_init(InotifyApp *app)
 {
+	app->replay_speed = 1.0;
+	app->log_memory = EVENT_LOG_MEMORY >> 20;
+	app->log_disk = EVENT_LOG_DISK >> 20;
+	app->filter = path_filter_new();
 
+	g_application_add_main_option_entries(G_APPLICATION(app), inotify_app_options);
+}
+
+static gint inotify_app_handle_local_options(GApplication *app, GVariantDict *options)
+{
+	InotifyApp *self = INOTIFY_APP(app);
+	GError *error = NULL;
+	char *events = NULL, *exclude_from = NULL;
+	char **excludes = NULL, **includes = NULL;
+	gint status = -1;
+
+	g_variant_dict_lookup(options, "journal", "^ay", &self->journal);
+	g_variant_dict_lookup(options, "metrics", "^ay", &self->metrics);
+	g_variant_dict_lookup(options, "trace", "^ay", &self->trace);
+	g_variant_dict_lookup(options, "replay", "^ay", &self->replay);
+	g_variant_dict_lookup(options, "replay-speed", "d", &self->replay_speed);
+	g_variant_dict_lookup(options, "log-memory", "i", &self->log_memory);
+	g_variant_dict_lookup(options, "log-disk", "i", &self->log_disk);
+	g_variant_dict_lookup(options, "events", "s", &events);
+	g_variant_dict_lookup(options, "exclude", "^as", &excludes);
+	g_variant_dict_lookup(options, "exclude-from", "^ay", &exclude_from);
+	g_variant_dict_lookup(options, "include", "^as", &includes);
+
+	if (self->log_memory <= 0 || self->log_disk < 0)
+	{
+		g_set_error(&error, g_quark_from_static_string("inotify-app-error"), 0,
+				"--log-memory must be positive and --log-disk not negative");
+		goto fail;
+	}
+
+	if (events && !listener_parse_events(events, &self->events, &error))
+		goto fail;
+
+	if (exclude_from && !path_filter_load(self->filter, exclude_from, &error))
+		goto fail;
+
+	for (char **rule = excludes; rule && *rule; ++rule)
+		path_filter_add_exclude(self->filter, *rule);
+
+	for (char **rule = includes; rule && *rule; ++rule)
+		path_filter_add_include(self->filter, *rule);
+
+	/* Carry on with the default handling */
+	goto out;
+
+fail:
+	g_printerr("%s\n", error->message);
+	g_error_free(error);
+	status = 2;
+
+out:
+	g_free(events);
+	g_free(exclude_from);
+	g_strfreev(excludes);
+	g_strfreev(includes);
+
+	return status;
+}
+
+/*
+ * Hands the journal and metrics options over to the first window, once;
+ * the filter and log limits to every window.
+ */
+static void inotify_app_setup_window(InotifyApp *app, InotifyAppWindow *win)
+{
+	inotify_app_window_set_filter(win, app->events, app->filter);
+	inotify_app_window_set_log_limits(win, (gsize) app->log_memory << 20, (gsize) app->log_disk << 20);
+
+	if (app->journal)
+	{
+		inotify_app_window_set_journal(win, app->journal);
+		g_clear_pointer(&app->journal, g_free);
+	}
+
+	if (app->metrics)
+	{
+		inotify_app_window_set_metrics(win, app->metrics);
+		g_clear_pointer(&app->metrics, g_free);
+	}
+
+	if (app->replay)
+	{
+		inotify_app_window_replay(win, app->replay, MAX(app->replay_speed, 0));
+		g_clear_pointer(&app->replay, g_free);
+	}
+}
+
+static void inotify_app_finalize(GObject *object)
+{
+	InotifyApp *app = INOTIFY_APP(object);
+
+	g_free(app->journal);
+	g_free(app->metrics);
+	g_free(app->trace);
+	g_free(app->replay);
+	path_filter_unref(app->filter);
+
+	G_OBJECT_CLASS(inotify_app_parent_class)->finalize(object);
+}
+
+/* Only the primary instance traces, from before its first window on */
+static void inotify_app_startup(GApplication *app)
+{
+	InotifyApp *self = INOTIFY_APP(app);
+	const char *path = self->trace ? self->trace : g_getenv(TRACE_ENV);
+	GError *error = NULL;
+
+	G_APPLICATION_CLASS(inotify_app_parent_class)->startup(app);
+
+	if (path && !trace_open(path, &error))
+	{
+		g_printerr("%s\n", error->message);
+		g_error_free(error);
+	}
+}
+
+static void inotify_app_shutdown(GApplication *app)
+{
+	G_APPLICATION_CLASS(inotify_app_parent_class)->shutdown(app);
+
+	trace_close();
 }
 
 static void inotify_app_activate(GApplication *app)
@@ -22,6 +176,7 @@ static void inotify_app_activate(GApplication *app)
 	GtkStyleContext *context;
 
 	win = inotify_app_window_new(INOTIFY_APP(app));
+	inotify_app_setup_window(INOTIFY_APP(app), win);
 	gtk_window_present(GTK_WINDOW(win));
 
 	css = gtk_css_provider_new();
@@ -49,9 +204,15 @@ static void inotify_app_open(GApplication *app,
 	else
 		win = inotify_app_window_new(INOTIFY_APP(app));
 
+	/* The first directory is shown, every one of them is listened to */
 	if (files[0])
 		inotify_app_window_open(win, files[0]);
 
+	for (int i = 1; i < n_files; ++i)
+		inotify_app_window_add_root(win, files[i]);
+
+	inotify_app_setup_window(INOTIFY_APP(app), win);
+
 	gtk_window_present(GTK_WINDOW(win));
 
 	css = gtk_css_provider_new();
@@ -64,6 +225,10 @@ static void inotify_app_open(GApplication *app,
 
 static void inotify_app_class_init(InotifyAppClass *class)
 {
+	G_OBJECT_CLASS(class)->finalize = inotify_app_finalize;
+	G_APPLICATION_CLASS(class)->handle_local_options = inotify_app_handle_local_options;
+	G_APPLICATION_CLASS(class)->startup = inotify_app_startup;
+	G_APPLICATION_CLASS(class)->shutdown = inotify_app_shutdown;
 	G_APPLICATION_CLASS(class)->activate = inotify_app_activate;
 	G_APPLICATION_CLASS(class)->open = inotify_app_open;
 }
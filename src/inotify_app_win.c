@@ -1,27 +1,79 @@
 /* vim: set fdm=marker : */
 
-#include <sys/eventfd.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <glib-unix.h>
 #include <gtk/gtk.h>
 #include <linux/limits.h>
-#include <magic.h>
-#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/inotify.h>
-#include <sys/poll.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
 #include <sys/stat.h>
 
+#include "event_log.h"
+#include "event_search.h"
+#include "dir_count.h"
+#include "dir_scan.h"
+#include "hot_paths.h"
 #include "inotify_app.h"
 #include "inotify_app_win.h"
+#include "journal.h"
+#include "listener.h"
+#include "metrics.h"
+#include "path_filter.h"
+#include "trace.h"
 
 /* Definitions {{{ */
 
+/*
+ * What the directory view follows; IN_CLOSE_WRITE catches size changes,
+ * the SELF events the directory itself going away.
+ */
+#define VIEW_WATCH_MASK (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+		IN_ATTRIB | IN_CLOSE_WRITE | IN_DELETE_SELF | IN_MOVE_SELF | \
+		IN_ONLYDIR | IN_EXCL_UNLINK)
+
+/* Up to ~250 events per dispatch */
+#define VIEW_WATCH_BUFFER 4096
+
+/* Seconds before counts that failed as a whole are asked for again */
+#define VIEW_COUNT_RETRY 2
+
+/* Formatted modification times kept, one per minute they fall in */
+#define VIEW_TIME_SLOTS 256
+
+/* Rows the hot paths table shows, and how often it follows the counts */
+#define HOT_TOP 100
+#define HOT_REFRESH_MS 250
+
+/* Columns of the hot paths store: path, count, error, then one per HotPathType */
+enum
+{
+	HOT_COL_PATH,
+	HOT_COL_COUNT,
+	HOT_COL_ERROR,
+	HOT_COL_TYPES,
+};
+
+/* Rows of the stats popover */
+enum
+{
+	STATS_EVENTS,
+	STATS_BYTES,
+	STATS_READS,
+	STATS_COALESCED,
+	STATS_DROPPED,
+	STATS_QUEUE,
+	STATS_OVERFLOWS,
+	STATS_DRAIN,
+	STATS_ROWS,
+};
+
 struct _InotifyAppWindow
 {
 	GtkApplicationWindow parent;
@@ -30,21 +82,92 @@ struct _InotifyAppWindow
 	GtkWidget *list;
 	GtkWidget *view;
 	GtkWidget *listening;
+	GtkWidget *recursive;
+	GtkWidget *backend;
+	GtkWidget *coalesce;
 	GtkWidget *status_bar;
 	GtkWidget *status_bar_entries;
 	GtkWidget *status_bar_listening_image;
 	GtkWidget *status_bar_listening_status;
 	GtkWidget *status_bar_clear;
 	GtkWidget *status_bar_err;
+	GtkWidget *status_bar_overflows;
+	GtkWidget *status_bar_overflows_box;
+	GtkWidget *stats_popover;
+	GtkWidget *stats_grid;
+	GtkWidget *stats_totals[STATS_ROWS];
+	GtkWidget *stats_rates[STATS_ROWS];
+	GtkWidget *stats_roots;
+	GPtrArray *run_roots;
 	GtkWidget *view_status_bar_contents;
 	GtkWidget *view_status_bar_modified;
 	GtkWidget *stack1;
 	GtkWidget *page1;
 	GtkWidget *page2;
+	GtkWidget *page3;
+	GtkWidget *hot_view;
+	GtkWidget *hot_status;
+	GtkWidget *search_entry;
+	GtkWidget *search_types;
+	GtkWidget *search_status;
+	EventLog *log;
+	EventSearch *search;
+	struct Listener *listener;
+	GPtrArray *roots;
+	guint32 events;
+	struct PathFilter *filter;
+	guint tick_id;
+	gint64 tick_time;
+	guint drain_check;
+	guint drain_watch;
+	guint session;
+	struct Journal *journal;
+	struct JournalReader *replay;
+	guint replay_tick_id;
+	gint64 replay_start;
+	gint64 replay_origin;
+	double replay_speed;
+	char *view_dir;
+	char *scan_dir;
+	GCancellable *scan;
+	gboolean scan_shown;
+	gboolean scan_change_entry;
+	GSequence *view_items;
+	GHashTable *view_names;
+	gboolean view_sorted;
+	guint view_sort;
+	GtkTreeViewColumn *view_columns[DIR_SORT_MODIFIED + 1];
+	int view_fd;
+	int view_wd;
+	int view_dfd;
+	guint view_watch;
+	GCancellable *sniff;
+	GCancellable *count;
+	guint count_idle;
+	guint64 entries;
+	guint overflows;
+	guint overflows_seen;
+	struct ListenerStats stats;
+	gint64 stats_time;
+	guint stats_id;
+	struct Metrics *metrics;
+	GString *metrics_text;
+	gint64 frame_span;
+	struct HotPaths *hot;
+	guint64 hot_shown;
+	guint hot_id;
 };
 
 G_DEFINE_TYPE(InotifyAppWindow, inotify_app_window, GTK_TYPE_APPLICATION_WINDOW);
 
+void update_view(InotifyAppWindow *win, const char *dir, gboolean change_entry);
+static void stats_update(InotifyAppWindow *win);
+static void stats_reset(InotifyAppWindow *win);
+static void roots_start(InotifyAppWindow *win, const struct ListenerRoot *roots, guint n);
+static void roots_track(InotifyAppWindow *win, guint id, const char *dir);
+static void roots_stopped(InotifyAppWindow *win);
+static void view_watch_stop(InotifyAppWindow *win);
+
 /* }}} */
 
 /* Choose directory {{{ */
@@ -90,351 +213,287 @@ static void directory_choose_clicked(GtkButton *button,
 
 /* Listening {{{ */
 
-#define event_case(str, mask, ev) if (mask & ev) str = #ev;
+/* Most events drained from the listener per frame */
+#define LISTENER_BATCH_SIZE 4096
 
-struct ListenerData
-{
-	GtkWidget *win;
-	const char *dir;
-};
+/*
+ * A hidden or minimized window gets no frames. After this many ms without
+ * one the listener's fd takes over draining, up to this many batches per
+ * wakeup, until frames come back.
+ */
+#define LISTENER_FRAME_TIMEOUT 200
+#define LISTENER_FD_BATCHES 16
 
-struct ListenerThread
+/* One listener run, as seen by the idle callbacks it posts */
+struct ListenerSession
 {
-	GThread *thread;
-	int efd;
-	int running;
-	int close;
+	InotifyAppWindow *win;
+	guint id;
 };
 
-struct ListenerLabelData
+struct ListenerStateData
 {
-	GtkWidget *label;
-	GtkWidget *clear;
-	int count;
+	struct ListenerSession *session;
+	enum ListenerState state;
+	char *message;
 };
 
-struct ListenerErrorData
+static const char *event_mask_name(guint32 mask)
 {
-	GtkWidget *label;
-	char *error;
-};
+	if (mask & EVENT_DROPPED)
+		return "EVENTS_DROPPED";
 
-static struct ListenerThread *lt;
-
-static gboolean worker_finish_in_idle(gpointer data)
-{
-	struct ListenerData *ld = data;
-	g_free(ld);
-	return FALSE;
+	return listener_event_name(mask);
 }
 
-static gboolean worker_set_err(gpointer data)
+/*
+ * Appends events to the log, and counts them for the hot paths; they show
+ * up on the next log_flush() and the next refresh of the table.
+ */
+static void log_append(InotifyAppWindow *win, const struct RingEvent *events, guint n)
 {
-	struct ListenerErrorData *led = data;
-	
-	gtk_label_set_text(GTK_LABEL(led->label), led->error);
-	if ((gtk_widget_get_visible(led->label)) == FALSE)
-		gtk_widget_set_visible(led->label, TRUE);
+	guint32 overflow_id = event_log_intern(win->log, "Kernel queue overflowed, events lost");
 
-	g_free(led->error);
-	g_free(data);
+	for (guint i = 0; i < n; ++i)
+	{
+		const struct RingEvent *ev = &events[i];
+		guint32 path_id = ev->path ? event_log_intern(win->log, ev->path) : overflow_id;
 
-	return FALSE;
+		event_log_append(win->log, ev->mask, path_id, ev->time, ev->last_time, ev->count);
+	}
+
+	hot_paths_add(win->hot, events, n);
 }
 
-static gboolean worker_update_label(gpointer data)
+/*
+ * Announces the rows appended since the last call. Touches the model and
+ * the entries label once no matter how many rows there were.
+ */
+static void log_flush(InotifyAppWindow *win, guint added)
 {
-	struct ListenerLabelData *lld = data;
-
-	int entries = atoi(gtk_label_get_text(GTK_LABEL(lld->label))) + lld->count;
-	char *entries_str = g_strdup_printf("%d", entries);
-	gtk_label_set_text(GTK_LABEL(lld->label), entries_str);
-	g_free(entries_str);
+	event_log_flush(win->log);
 
-	if ((gtk_widget_get_sensitive(lld->clear)) == FALSE)
-		gtk_widget_set_sensitive(lld->clear, TRUE);
+	if (added == 0)
+		return;
 
-	g_free(data);
+	char entries_str[32];
+	win->entries += added;
+	g_snprintf(entries_str, sizeof(entries_str), "%" G_GUINT64_FORMAT, win->entries);
+	gtk_label_set_text(GTK_LABEL(win->status_bar_entries), entries_str);
 
-	return FALSE;
+	if ((gtk_widget_get_sensitive(win->status_bar_clear)) == FALSE)
+		gtk_widget_set_sensitive(win->status_bar_clear, TRUE);
 }
 
-static gboolean worker_gui_set_stop(gpointer data)
+static void gui_set_err(InotifyAppWindow *win, const char *error)
 {
-	struct ListenerData *ld = data;
-	InotifyAppWindow *win = INOTIFY_APP_WINDOW(ld->win);
-
-	gtk_button_set_label(GTK_BUTTON(win->listening), "Stop listening");
-	gtk_widget_set_sensitive(win->directory_choose, FALSE);
-	gtk_widget_set_sensitive(win->directory_choose_entry, FALSE);
-	gtk_label_set_text(GTK_LABEL(win->status_bar_listening_status), "Listening...");
-	gtk_image_set_from_icon_name(GTK_IMAGE(win->status_bar_listening_image), "gtk-media-record");
-
-	return FALSE;
+	gtk_label_set_text(GTK_LABEL(win->status_bar_err), error);
+	if ((gtk_widget_get_visible(win->status_bar_err)) == FALSE)
+		gtk_widget_set_visible(win->status_bar_err, TRUE);
 }
 
-static gboolean worker_gui_set_start(gpointer data)
+static void listener_append(const struct RingEvent *events, guint n, gpointer data)
 {
-	struct ListenerData *ld = data;
-	InotifyAppWindow *win = INOTIFY_APP_WINDOW(ld->win);
-
-	gtk_button_set_label(GTK_BUTTON(win->listening), "Start listening");
-	gtk_widget_set_sensitive(win->directory_choose, TRUE);
-	gtk_widget_set_sensitive(win->directory_choose_entry, TRUE);
-	gtk_label_set_text(GTK_LABEL(win->status_bar_listening_status), "Not listening...");
-	gtk_image_set_from_icon_name(GTK_IMAGE(win->status_bar_listening_image), "gtk-media-stop");
+	InotifyAppWindow *win = INOTIFY_APP_WINDOW(data);
 
-	return FALSE;
-}
+	if (win->journal)
+	{
+		GError *error = NULL;
 
-static gboolean worker_switch_page(gpointer data)
-{
-	struct ListenerData *ld = data;
-	InotifyAppWindow *win = INOTIFY_APP_WINDOW(ld->win);
+		if (!journal_append(win->journal, events, n, &error))
+		{
+			gui_set_err(win, error->message);
+			g_error_free(error);
 
-	gtk_stack_set_visible_child(GTK_STACK(win->stack1), win->page2);
+			journal_close(win->journal);
+			win->journal = NULL;
+		}
+	}
 
-	return FALSE;
+	log_append(win, events, n);
 }
 
-static int handle_events(int fd, int wd, gpointer data)
+/*
+ * Moves up to one batch of queued events into the event log and returns
+ * how many rows were added. Runs on the main thread only.
+ */
+static guint listener_drain_to_log(InotifyAppWindow *win)
 {
-	char buf[4096] __attribute ((aligned(__alignof__(struct inotify_event))));
-	const struct inotify_event *event;
-	ssize_t len;
-	GString *str;
-	GtkTreeView *list;
-	GtkTreeModel *model;
-	GtkListStore *store;
-
-	if (lt->close == 1)
-		return 0;
+	guint dropped, overflows, total;
+	gint64 span = trace_begin();
 
-	struct ListenerData *ld = data;
-	InotifyAppWindow *win = INOTIFY_APP_WINDOW(ld->win);
+	total = listener_drain(win->listener, listener_append, win, LISTENER_BATCH_SIZE);
 
-	len = read(fd, buf, sizeof(buf));
-	if (len == -1 && errno != EAGAIN)
+	/* One path for every such row, with the number in the Count column */
+	dropped = listener_take_dropped(win->listener);
+	if (dropped > 0)
 	{
-		char *error = g_strdup_printf("perror: %s", strerror(errno));
-		struct ListenerErrorData *err = g_new(struct ListenerErrorData, 1);
-		err->error = error;
-		err->label = win->status_bar_err;
-
-		g_idle_add(worker_set_err, err);
-
-		return -1;
+		gint64 now = g_get_real_time();
+		event_log_append(win->log, EVENT_DROPPED, event_log_intern(win->log, "Events dropped"), now, now, dropped);
+		total++;
 	}
 
-	if (len == -1)
-		return 0;
-
-	list = GTK_TREE_VIEW(win->list);
-	model = gtk_tree_view_get_model(list);
-	store = GTK_LIST_STORE(model);
-
-	str = g_string_new(NULL);
-
-	int count = 0;
-
-	for (char *ptr = buf; ptr < buf + len;
-			ptr += sizeof(struct inotify_event) + event->len, ++count)
+	overflows = listener_get_overflows(win->listener);
+	if (overflows != win->overflows_seen)
 	{
-		if (lt->close == 1)
-			break;
-
-		GtkTreeIter iter;
-		char *ev_str = "";
-
-		event = (const struct inotify_event*) ptr;
-
-		event_case(ev_str, event->mask, IN_OPEN);
-		event_case(ev_str, event->mask, IN_CLOSE_NOWRITE);
-		event_case(ev_str, event->mask, IN_CLOSE_WRITE);
-		event_case(ev_str, event->mask, IN_MOVED_FROM);
-		event_case(ev_str, event->mask, IN_MOVED_TO);
-		event_case(ev_str, event->mask, IN_DELETE);
-		event_case(ev_str, event->mask, IN_DELETE_SELF);
-		event_case(ev_str, event->mask, IN_MODIFY);
-		event_case(ev_str, event->mask, IN_MOVE_SELF);
-		event_case(ev_str, event->mask, IN_CREATE);
-
-		if (ld->dir[strlen(ld->dir) - 1] == '/')
-			g_string_append(str, ld->dir);
-		else
-			g_string_append_printf(str, "%s/", ld->dir);
-
-		if (event->len)
-			g_string_append_printf(str, "%s", event->name);
-
-		gtk_list_store_append(store, &iter);
-		gtk_list_store_set(store, &iter,
-				0, ev_str,
-				1, str->str,
-				-1);
-
-		g_string_erase(str, 0, -1);
-
-		if (event->mask & IN_DELETE_SELF)
-		{
-			struct ListenerErrorData *err = g_new(struct ListenerErrorData, 1);
-			err->error =  g_strdup("Listening directory was deleted!");
-			err->label = win->status_bar_err;
+		char overflows_str[32];
+		win->overflows += overflows - win->overflows_seen;
+		win->overflows_seen = overflows;
+		g_snprintf(overflows_str, sizeof(overflows_str), "%u", win->overflows);
+		gtk_label_set_text(GTK_LABEL(win->status_bar_overflows), overflows_str);
+
+		if ((gtk_widget_get_visible(win->status_bar_overflows_box)) == FALSE)
+			gtk_widget_set_visible(win->status_bar_overflows_box, TRUE);
+	}
 
-			g_idle_add(worker_set_err, err);
+	log_flush(win, total);
+	trace_end("drain_to_log", span, total);
 
-			g_string_free(str, TRUE);
-			return -1;
-		}
+	return total;
+}
 
-		if (event->mask & IN_MOVE_SELF)
-		{
-			struct ListenerErrorData *err = g_new(struct ListenerErrorData, 1);
-			err->error =  g_strdup("Listening directory was moved!");
-			err->label = win->status_bar_err;
+static gboolean listener_tick(GtkWidget *widget,
+		GdkFrameClock *clock,
+		gpointer data)
+{
+	InotifyAppWindow *win = INOTIFY_APP_WINDOW(widget);
 
-			g_idle_add(worker_set_err, err);
+	win->tick_time = g_get_monotonic_time();
 
-			g_string_free(str, TRUE);
-			return -1;
-		}
+	/* Frames are back, so the drain goes back to one batch per frame */
+	if (win->drain_watch != 0)
+	{
+		g_source_remove(win->drain_watch);
+		win->drain_watch = 0;
 	}
 
-	g_string_free(str, TRUE);
-	return count;
+	listener_drain_to_log(win);
+	return G_SOURCE_CONTINUE;
 }
 
-static gpointer worker(gpointer data)
+static gboolean listener_fd_ready(gint fd, GIOCondition condition, gpointer data)
 {
-	int fd, wd;
-	struct ListenerData *ld;
-	InotifyAppWindow *win;
+	InotifyAppWindow *win = INOTIFY_APP_WINDOW(data);
 
-	fd = inotify_init1(IN_NONBLOCK);
-	
-	ld = data;
-	win = INOTIFY_APP_WINDOW(ld->win);
+	for (guint i = 0; i < LISTENER_FD_BATCHES && listener_drain_to_log(win) >= LISTENER_BATCH_SIZE; ++i)
+		;
 
-	if (fd == -1)
-	{
-		char *error = g_strdup_printf("inotify_init1: %s", strerror(errno));
-		struct ListenerErrorData *err = g_new(struct ListenerErrorData, 1);
-		err->error = error;
-		err->label = win->status_bar_err;
+	return G_SOURCE_CONTINUE;
+}
 
-		g_idle_add(worker_set_err, err);
+/* Keeps the ring from filling up while the window gets no frames */
+static gboolean listener_check_frames(gpointer data)
+{
+	InotifyAppWindow *win = INOTIFY_APP_WINDOW(data);
 
-		lt->running = 0;
-		g_idle_add(worker_finish_in_idle, ld);
-		return NULL;
+	if (win->drain_watch == 0 &&
+			g_get_monotonic_time() - win->tick_time > LISTENER_FRAME_TIMEOUT * G_TIME_SPAN_MILLISECOND)
+	{
+		listener_fd_ready(-1, G_IO_IN, win);
+		win->drain_watch = g_unix_fd_add(listener_get_fd(win->listener), G_IO_IN, listener_fd_ready, win);
 	}
 
-	wd = inotify_add_watch(fd, ld->dir, 
-			IN_OPEN | IN_CLOSE | IN_MOVE | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MODIFY | IN_MOVE_SELF);
+	return G_SOURCE_CONTINUE;
+}
 
-	if (wd == -1)
-	{
-		char *error = g_strdup_printf("Can't watch '%s': %s", ld->dir, strerror(errno));
-		struct ListenerErrorData *err = g_new(struct ListenerErrorData, 1);
-		err->error = error;
-		err->label = win->status_bar_err;
+/* While listening, the directory entry adds further roots to the listener */
+static void gui_set_listening(InotifyAppWindow *win, gboolean listening)
+{
+	gtk_button_set_label(GTK_BUTTON(win->listening), listening ? "Stop listening" : "Start listening");
+	gtk_widget_set_sensitive(win->recursive, !listening);
+	gtk_widget_set_sensitive(win->backend, !listening);
+	gtk_widget_set_sensitive(win->coalesce, !listening);
+	gtk_label_set_text(GTK_LABEL(win->status_bar_listening_status), listening ? "Listening..." : "Not listening...");
+	gtk_image_set_from_icon_name(GTK_IMAGE(win->status_bar_listening_image),
+			listening ? "gtk-media-record" : "gtk-media-stop");
+}
 
-		g_idle_add(worker_set_err, err);
-		
-		close(fd);
+/* Joins the listener and moves whatever it managed to queue into the list */
+static void listener_finish(InotifyAppWindow *win)
+{
+	if (win->listener == NULL)
+		return;
 
-		lt->running = 0;
-		g_idle_add(worker_finish_in_idle, ld);
-		return NULL;
-	}
+	gtk_widget_remove_tick_callback(GTK_WIDGET(win), win->tick_id);
+	win->tick_id = 0;
 
-	struct stat dir_stat;
-	stat(ld->dir, &dir_stat);
+	g_source_remove(win->drain_check);
+	win->drain_check = 0;
 
-	if (!S_ISDIR(dir_stat.st_mode))
+	if (win->drain_watch != 0)
 	{
-		char *error = g_strdup_printf("Can't watch '%s': it is not directory!", ld->dir);
-		struct ListenerErrorData *err = g_new(struct ListenerErrorData, 1);
-		err->error = error;
-		err->label = win->status_bar_err;
-
-		g_idle_add(worker_set_err, err);
-
-		close(fd);
-
-		lt->running = 0;
-		g_idle_add(worker_finish_in_idle, ld);
-		return NULL;
+		g_source_remove(win->drain_watch);
+		win->drain_watch = 0;
 	}
 
-	g_idle_add(worker_gui_set_stop, ld);
-	g_idle_add(worker_switch_page, ld);
+	listener_stop(win->listener);
+	while (listener_drain_to_log(win) > 0)
+		;
 
-	int poll_num;
-	nfds_t nfds;
-	struct pollfd fds[2];
+	/* The run's final totals */
+	stats_update(win);
 
-	nfds = 2;
+	listener_free(win->listener);
+	win->listener = NULL;
+	roots_stopped(win);
 
-	fds[0].fd = lt->efd;
-	fds[0].events = POLLIN;
+	gui_set_listening(win, FALSE);
+}
 
-	fds[1].fd = fd;
-	fds[1].events = POLLIN;
+static gboolean listener_state_in_idle(gpointer data)
+{
+	struct ListenerStateData *sd = data;
+	struct ListenerSession *session = sd->session;
+	InotifyAppWindow *win = session->win;
 
-	while (1) 
+	/* Idles of a run that was already stopped from here are stale */
+	if (session->id == win->session && win->listener != NULL)
 	{
-		if (lt->close == 1)
-			break;
-
-		poll_num = poll(fds, nfds, -1);
-		if (poll_num == -1)
+		switch (sd->state)
 		{
-			if (errno == EINTR)
-				continue;
-
-			char *error = g_strdup_printf("poll: %s", strerror(errno));
-			struct ListenerErrorData *err = g_new(struct ListenerErrorData, 1);
-			err->error = error;
-			err->label = win->status_bar_err;
-
-			g_idle_add(worker_set_err, err);
-
+		case LISTENER_STARTED:
+			gui_set_listening(win, TRUE);
+			gtk_stack_set_visible_child(GTK_STACK(win->stack1), win->page2);
+			break;
+		case LISTENER_STATUS:
+			gtk_label_set_text(GTK_LABEL(win->status_bar_listening_status), sd->message);
+			break;
+		case LISTENER_ERROR:
+			gui_set_err(win, sd->message);
+			break;
+		case LISTENER_STOPPED:
+			listener_finish(win);
 			break;
 		}
+	}
 
-		if (poll_num > 0) 
-		{
-			if (fds[0].revents & POLLIN) 
-			{
-				break;
-			}
-
-			if (fds[1].revents & POLLIN) 
-			{
-				int res = handle_events(fd, wd, ld);
-
-				if (res == -1)
-					break;
+	/* Nothing is posted after LISTENER_STOPPED */
+	if (sd->state == LISTENER_STOPPED)
+	{
+		g_object_unref(session->win);
+		g_free(session);
+	}
 
-				struct ListenerLabelData *lld = g_new(struct ListenerLabelData, 1);
-				lld->label = win->status_bar_entries;
-				lld->count = res;
-				lld->clear = win->status_bar_clear;
+	g_free(sd->message);
+	g_free(sd);
 
-				g_idle_add(worker_update_label, lld);
-			}
-		}
-	}
+	return FALSE;
+}
 
-	inotify_rm_watch(fd, wd);
-	close(fd);
+/* Runs on the listener thread, so everything is bounced to the main loop */
+static void listener_state(struct Listener *listener,
+		enum ListenerState state,
+		guint root,
+		const char *message,
+		gpointer data)
+{
+	struct ListenerStateData *sd = g_new(struct ListenerStateData, 1);
 
-	g_idle_add(worker_gui_set_start, ld);
+	sd->session = data;
+	sd->state = state;
+	sd->message = g_strdup(message);
 
-	lt->running = 0;
-	g_idle_add(worker_finish_in_idle, ld);
-	return NULL;
+	g_idle_add(listener_state_in_idle, sd);
 }
 
 static void listening_clicked(GtkButton *button,
@@ -443,365 +502,1631 @@ static void listening_clicked(GtkButton *button,
 	InotifyAppWindow *win;
 
 	win = INOTIFY_APP_WINDOW(data);
-	
-	if (lt && lt->running == 1)
+
+	if (win->listener && listener_is_running(win->listener))
 	{
-		eventfd_write(lt->efd, 1);
-		g_thread_join(lt->thread);
-		close(lt->efd);
-		g_free(lt);
-		lt = NULL;
+		listener_finish(win);
 	}
 	else
 	{
 		GtkEntry *entry;
 		GtkEntryBuffer *buffer;
-		struct ListenerData *ld;
-		int efd;
+		struct ListenerOptions options = {0};
+		struct ListenerSession *session;
+		struct ListenerRoot *roots;
+		const char *dir;
+		gboolean recursive;
+		guint n = 0;
+		GError *error = NULL;
 
-		efd = eventfd(0, 0);
+		/* The previous listener may have exited on its own */
+		listener_finish(win);
 
-		if (efd == -1)
+		entry = GTK_ENTRY(win->directory_choose_entry);
+		buffer = gtk_entry_get_buffer(entry);
+		dir = gtk_entry_buffer_get_text(buffer);
+		recursive = gtk_check_button_get_active(GTK_CHECK_BUTTON(win->recursive));
+
+		/* The directory in the entry, then the ones added on the command line */
+		roots = g_new0(struct ListenerRoot, win->roots->len + 1);
+		roots[n].dir = dir;
+
+		for (guint i = 0; i < win->roots->len; ++i)
 		{
-			char *error = g_strdup_printf("eventfd: %s", strerror(errno));
-			gtk_label_set_text(GTK_LABEL(win->status_bar_err), error);
+			const char *root = g_ptr_array_index(win->roots, i);
 
-			if ((gtk_widget_get_visible(win->status_bar_err)) == FALSE)
-				gtk_widget_set_visible(win->status_bar_err, TRUE);
+			if (strcmp(root, dir) != 0)
+				roots[++n].dir = root;
+		}
 
-			g_free(error);
-			return;
+		for (guint i = 0; i <= n; ++i)
+		{
+			roots[i].recursive = recursive;
+			roots[i].events = win->events;
+			roots[i].filter = win->filter;
 		}
 
-		entry = GTK_ENTRY(win->directory_choose_entry);
-		buffer = gtk_entry_get_buffer(entry);
+		n++;
+
+		options.roots = roots;
+		options.n_roots = n;
+		options.backend = gtk_drop_down_get_selected(GTK_DROP_DOWN(win->backend));
+		options.coalesce_ms = gtk_spin_button_get_value_as_int(GTK_SPIN_BUTTON(win->coalesce));
+
+		session = g_new(struct ListenerSession, 1);
+		session->win = g_object_ref(win);
+		session->id = ++win->session;
+
+		win->listener = listener_start(&options, listener_state, session, &error);
+
+		if (win->listener == NULL)
+		{
+			gui_set_err(win, error->message);
+			g_error_free(error);
 
-		const char *dir = gtk_entry_buffer_get_text(buffer);
+			g_object_unref(session->win);
+			g_free(session);
+			g_free(roots);
+			return;
+		}
 
-		ld = (struct ListenerData*)g_malloc(sizeof(struct ListenerData));
-		ld->dir = dir;
-		ld->win = GTK_WIDGET(win);
+		roots_start(win, roots, n);
+		g_free(roots);
 
-		lt = (struct ListenerThread*)g_malloc(sizeof(struct ListenerThread));
-		lt->running = 1;
-		lt->close = 0;
-		lt->efd = efd;
-		lt->thread = g_thread_new("worker", worker, (gpointer) ld);
+		win->overflows_seen = 0;
+		stats_reset(win);
+		win->tick_id = gtk_widget_add_tick_callback(GTK_WIDGET(win), listener_tick, NULL, NULL);
+		win->tick_time = g_get_monotonic_time();
+		win->drain_check = g_timeout_add(LISTENER_FRAME_TIMEOUT, listener_check_frames, win);
 	}
 }
 
 /* }}} */
 
-/* View {{{ */
+/* Stats {{{ */
 
-struct dir_item_info
+static const char *const stats_titles[STATS_ROWS] =
 {
-	char 	*ct;
-	char 	*name;
-	char 	*size;
-	char 	*modified;
-	gboolean is_dir;
+	[STATS_EVENTS] = "Events read",
+	[STATS_BYTES] = "Bytes read",
+	[STATS_READS] = "Reads per wakeup",
+	[STATS_COALESCED] = "Coalesced",
+	[STATS_DROPPED] = "Dropped",
+	[STATS_QUEUE] = "Queue depth",
+	[STATS_OVERFLOWS] = "Queue overflows",
+	[STATS_DRAIN] = "Drain time",
 };
 
-char* transormBytes(off_t bytes)
+static double stats_rate(guint64 now, guint64 before, double secs)
+{
+	return secs > 0 ? (now - before) / secs : 0;
+}
+
+static double stats_ratio(guint64 a, guint64 b)
+{
+	return b > 0 ? (double) a / b : 0;
+}
+
+static void stats_set(InotifyAppWindow *win, guint row, const char *total, const char *rate)
+{
+	gtk_label_set_text(GTK_LABEL(win->stats_totals[row]), total);
+	gtk_label_set_text(GTK_LABEL(win->stats_rates[row]), rate);
+}
+
+/* Totals next to the change since the previous snapshot, taken secs ago */
+static void stats_show(InotifyAppWindow *win, const struct ListenerStats *now,
+		const struct ListenerStats *before, double secs)
+{
+	char total[64], rate[64], size[DIR_SIZE_TEXT];
+
+	g_snprintf(total, sizeof(total), "%" G_GUINT64_FORMAT, now->events);
+	g_snprintf(rate, sizeof(rate), "%.0f/s", stats_rate(now->events, before->events, secs));
+	stats_set(win, STATS_EVENTS, total, rate);
+
+	transormBytes(now->bytes, total, sizeof(total));
+	transormBytes(stats_rate(now->bytes, before->bytes, secs), size, sizeof(size));
+	g_snprintf(rate, sizeof(rate), "%s/s", size);
+	stats_set(win, STATS_BYTES, total, rate);
+
+	g_snprintf(total, sizeof(total), "%.1f", stats_ratio(now->reads, now->wakeups));
+	g_snprintf(rate, sizeof(rate), "%.1f",
+			stats_ratio(now->reads - before->reads, now->wakeups - before->wakeups));
+	stats_set(win, STATS_READS, total, rate);
+
+	g_snprintf(total, sizeof(total), "%" G_GUINT64_FORMAT, now->coalesced);
+	g_snprintf(rate, sizeof(rate), "%.0f/s", stats_rate(now->coalesced, before->coalesced, secs));
+	stats_set(win, STATS_COALESCED, total, rate);
+
+	g_snprintf(total, sizeof(total), "%" G_GUINT64_FORMAT, now->dropped);
+	g_snprintf(rate, sizeof(rate), "%.0f/s", stats_rate(now->dropped, before->dropped, secs));
+	stats_set(win, STATS_DROPPED, total, rate);
+
+	g_snprintf(total, sizeof(total), "%u of %u", now->queued, now->capacity);
+	stats_set(win, STATS_QUEUE, total, "");
+
+	g_snprintf(total, sizeof(total), "%" G_GUINT64_FORMAT, now->overflows);
+	g_snprintf(rate, sizeof(rate), "%.0f/s", stats_rate(now->overflows, before->overflows, secs));
+	stats_set(win, STATS_OVERFLOWS, total, rate);
+
+	/* The rate is the share of every second the main loop spent draining */
+	g_snprintf(total, sizeof(total), "%.2f s", now->drain_time / (double) G_USEC_PER_SEC);
+	g_snprintf(rate, sizeof(rate), "%.1f ms/s",
+			stats_rate(now->drain_time, before->drain_time, secs) / 1000);
+	stats_set(win, STATS_DRAIN, total, rate);
+}
+
+static void stats_publish(InotifyAppWindow *win)
 {
-	long double b = (long double) bytes;
-	char *symb;
+	GError *error = NULL;
 
-	while (1)
+	g_string_truncate(win->metrics_text, 0);
+	metrics_format(win->metrics_text, &win->stats);
+
+	if (!metrics_publish(win->metrics, win->metrics_text, &error))
 	{
-		if (b < 1024)
-		{
-			symb = "";
-			break;
-		}
+		gui_set_err(win, error->message);
+		g_error_free(error);
 
-		b /= 1024;
+		g_clear_pointer(&win->metrics, metrics_close);
+	}
+}
 
-		if (b < 1024)
-		{
-			symb = "Ki";
-			break;
-		}
+/* Roots {{{ */
 
-		b /= 1024;
+/* A root of the current or last run, as listed in the popover */
+struct WindowRoot
+{
+	guint id;
+	char *dir;
+	GtkWidget *events;
+	GtkWidget *filtered;
+	GtkWidget *watches;
+	GtkWidget *remove;
+};
 
-		if (b < 1024)
-		{
-			symb = "Mi";
-			break;
-		}
+static void window_root_free(gpointer data)
+{
+	struct WindowRoot *root = data;
+
+	g_free(root->dir);
+	g_free(root);
+}
 
-		b /= 1024;
+static GtkWidget *roots_label(GtkGrid *grid, const char *text, int column, int row, gboolean header)
+{
+	GtkWidget *label = gtk_label_new(text);
 
-		if (b < 1024)
-		{
-			symb = "Gi";
-			break;
-		}
+	gtk_widget_set_sensitive(label, !header);
+	gtk_widget_set_halign(label, column == 0 ? GTK_ALIGN_START : GTK_ALIGN_END);
+	gtk_grid_attach(grid, label, column, row, 1, 1);
 
-		b /= 1024;
+	return label;
+}
 
-		if (b < 1024)
-		{
-			symb = "Ti";
-			break;
-		}
+static void roots_show(InotifyAppWindow *win)
+{
+	if (win->listener == NULL)
+		return;
 
-		b /= 1024;
+	for (guint i = 0; i < win->run_roots->len; ++i)
+	{
+		struct WindowRoot *root = g_ptr_array_index(win->run_roots, i);
+		struct ListenerRootStats stats;
+		char text[32];
 
-		if (b < 1024)
-		{
-			symb = "Pi";
-			break;
-		}
+		/* Not set up yet, or already dropped; the last numbers stay */
+		if (!listener_get_root_stats(win->listener, root->id, &stats))
+			continue;
 
-		b /= 1024;
+		g_snprintf(text, sizeof(text), "%" G_GUINT64_FORMAT, stats.events);
+		gtk_label_set_text(GTK_LABEL(root->events), text);
 
-		if (b < 1024)
-		{
-			symb = "Ei";
-			break;
-		}
+		g_snprintf(text, sizeof(text), "%" G_GUINT64_FORMAT, stats.filtered);
+		gtk_label_set_text(GTK_LABEL(root->filtered), text);
 
-		b /= 1024;
+		g_snprintf(text, sizeof(text), "%u", stats.watches);
+		gtk_label_set_text(GTK_LABEL(root->watches), text);
+	}
+}
 
-		if (b < 1024)
-		{
-			symb = "Zi";
-			break;
-		}
+static void root_remove_clicked(GtkButton *button, gpointer data);
 
-		b /= 1024;
-		symb = "Yi";
-		break;
+/* Adds one row, and the header above the first */
+static void roots_add_row(InotifyAppWindow *win, struct WindowRoot *root, int row)
+{
+	GtkGrid *grid = GTK_GRID(win->stats_roots);
+
+	if (row == 1)
+	{
+		roots_label(grid, "Root", 0, 0, TRUE);
+		roots_label(grid, "Events", 1, 0, TRUE);
+		roots_label(grid, "Filtered", 2, 0, TRUE);
+		roots_label(grid, "Watches", 3, 0, TRUE);
 	}
 
-	if (ceill(b) == b)			
-		return g_strdup_printf("%.0Lf %sB", b, symb);
-	else
-		return g_strdup_printf("%.1Lf %sB", b, symb);
+	gtk_widget_set_tooltip_text(roots_label(grid, root->dir, 0, row, FALSE), root->dir);
+	root->events = roots_label(grid, "0", 1, row, FALSE);
+	root->filtered = roots_label(grid, "0", 2, row, FALSE);
+	root->watches = roots_label(grid, "0", 3, row, FALSE);
+
+	root->remove = gtk_button_new_from_icon_name("list-remove-symbolic");
+	gtk_widget_set_tooltip_text(root->remove, "Stop listening to this directory");
+	gtk_widget_set_sensitive(root->remove, win->listener != NULL);
+	gtk_button_set_has_frame(GTK_BUTTON(root->remove), FALSE);
+	g_object_set_data(G_OBJECT(root->remove), "root", GUINT_TO_POINTER(root->id));
+	g_signal_connect(root->remove, "clicked", G_CALLBACK(root_remove_clicked), win);
+	gtk_grid_attach(grid, root->remove, 4, row, 1, 1);
 }
 
-int dir_item_cmp(gconstpointer a, gconstpointer b)
+/* Lays the whole list out again; it is a handful of rows */
+static void roots_layout(InotifyAppWindow *win)
 {
-	const struct dir_item_info *da = (const struct dir_item_info*) a;
-	const struct dir_item_info *db = (const struct dir_item_info*) b;
+	GtkWidget *child;
+
+	while ((child = gtk_widget_get_first_child(win->stats_roots)) != NULL)
+		gtk_grid_remove(GTK_GRID(win->stats_roots), child);
 
-	if (da->is_dir && !db->is_dir)
-		return -1;
+	for (guint i = 0; i < win->run_roots->len; ++i)
+		roots_add_row(win, g_ptr_array_index(win->run_roots, i), i + 1);
 
-	if (!da->is_dir && db->is_dir)
-		return 1;
+	roots_show(win);
+}
 
-	if (strcmp(da->name, "..") == 0)
-		return -1;
+static void root_remove_clicked(GtkButton *button, gpointer data)
+{
+	InotifyAppWindow *win = INOTIFY_APP_WINDOW(data);
+	guint id = GPOINTER_TO_UINT(g_object_get_data(G_OBJECT(button), "root"));
 
-	if (strcmp(db->name, "..") == 0)
-		return 1;
+	if (win->listener == NULL)
+		return;
 
-	if (da->is_dir == db->is_dir)
+	for (guint i = 0; i < win->run_roots->len; ++i)
 	{
-		if (da->name[0] == '.' && db->name[0] != '.')
-			return 1;
-		if (da->name[0] != '.' && db->name[0] == '.')
-			return -1;
+		struct WindowRoot *root = g_ptr_array_index(win->run_roots, i);
+
+		if (root->id != id)
+			continue;
+
+		/* Roots from the command line don't come back with the next run */
+		for (guint j = 0; j < win->roots->len; ++j)
+		{
+			if (strcmp(g_ptr_array_index(win->roots, j), root->dir) == 0)
+				g_ptr_array_remove_index(win->roots, j--);
+		}
+
+		/* The listener stops on its own once this was its last root */
+		listener_remove_root(win->listener, id);
+		g_ptr_array_remove_index(win->run_roots, i);
+		break;
 	}
 
-	return strcoll(da->name, db->name);
+	roots_layout(win);
 }
 
-void update_view(InotifyAppWindow *win, const char *dir, gboolean change_entry)
+/* The roots a run started with get the ids 1 to n, in order */
+static void roots_start(InotifyAppWindow *win, const struct ListenerRoot *roots, guint n)
 {
-	GtkEntry *entry;
-	GtkEntryBuffer *buffer;
-	DIR *dp;
-	magic_t magic;
-
-	magic = magic_open(MAGIC_MIME_TYPE);
-
-	g_assert(magic != NULL);
-	g_assert(magic_load(magic, NULL) == 0);
+	g_ptr_array_set_size(win->run_roots, 0);
 
-	if (change_entry)
+	for (guint i = 0; i < n; ++i)
 	{
-		entry = GTK_ENTRY(win->directory_choose_entry);
-		buffer = gtk_entry_get_buffer(entry);
+		struct WindowRoot *root = g_new0(struct WindowRoot, 1);
+
+		root->id = i + 1;
+		root->dir = g_strdup(roots[i].dir);
+		g_ptr_array_add(win->run_roots, root);
 	}
 
-	dp = opendir(dir);
+	roots_layout(win);
+}
 
-	if (dp != NULL)
-	{
-		GArray *arr;
-		struct dirent *ep, *hep;
-		DIR *hdp;
-		struct stat dst;
+static void roots_track(InotifyAppWindow *win, guint id, const char *dir)
+{
+	struct WindowRoot *root = g_new0(struct WindowRoot, 1);
 
-		stat(dir, &dst);
-		chdir(dir);
+	root->id = id;
+	root->dir = g_strdup(dir);
+	g_ptr_array_add(win->run_roots, root);
 
-		arr = g_array_new(TRUE, TRUE, sizeof(struct dir_item_info));
+	roots_layout(win);
+}
 
-		if (change_entry)
-			gtk_entry_buffer_set_text(buffer, dir, -1);
+/* The last run's numbers stay, but there is nothing left to remove */
+static void roots_stopped(InotifyAppWindow *win)
+{
+	for (guint i = 0; i < win->run_roots->len; ++i)
+		gtk_widget_set_sensitive(((struct WindowRoot*) g_ptr_array_index(win->run_roots, i))->remove, FALSE);
+}
 
-		while ((ep = readdir(dp))) 
-		{
-			if (strcmp(ep->d_name, ".") == 0)
-				continue;
-
-			struct stat st;
-			struct dir_item_info item;
-			stat(ep->d_name, &st);
-
-			if (S_ISDIR(st.st_mode))
-			{
-				hdp = opendir(ep->d_name);
-				size_t sz = 0;
-
-				if (hdp != NULL)
-				{
-					while ((hep = readdir(hdp)))
-						sz++;
-
-					if (sz <= 2)
-						sz = 0;
-					else
-						sz -= 2;
-
-					closedir(hdp);
-				}
-
-				item.size = g_strdup_printf("%lu items", sz);
-				item.is_dir = TRUE;
-			}
-			else 
-			{
-				item.size = transormBytes(st.st_size);
-				item.is_dir = FALSE;
-			}
-
-			char bf[64];
-			struct tm ts = *localtime(&st.st_mtim.tv_sec);
-			strftime(bf, sizeof(bf), "%d %b %Y %H:%M", &ts);
-
-			item.modified = g_strdup(bf);
-			item.name = g_strdup(ep->d_name);
-
-			const char *mime = magic_file(magic, item.name);
-			item.ct = g_content_type_from_mime_type(mime);
-
-			g_array_append_val(arr, item);
-		}
+/* }}} */
 
-		g_array_sort(arr, dir_item_cmp);
-		magic_close(magic);
-		closedir(dp);
+/*
+ * Takes a snapshot of the listener's counters. The popover is only updated
+ * while it is open; without a listener the last run's totals stay.
+ */
+static void stats_update(InotifyAppWindow *win)
+{
+	struct ListenerStats before = win->stats;
+	gint64 now = g_get_monotonic_time();
+	double secs = (now - win->stats_time) / (double) G_USEC_PER_SEC;
 
-		GtkTreeView *view = GTK_TREE_VIEW(win->view);
-		GtkTreeModel *model = gtk_tree_view_get_model(view);
+	if (win->listener == NULL)
+		return;
 
-		g_object_ref(model);
-		gtk_tree_view_set_model(view, NULL);
-		GtkListStore *store = GTK_LIST_STORE(model);
-		gtk_list_store_clear(store);
+	listener_get_stats(win->listener, &win->stats);
+	win->stats_time = now;
 
-		for (int i = 0; i < arr->len; ++i) 
-		{
-			GIcon *ct_icon;
-			GtkTreeIter iter;
+	if (gtk_widget_get_visible(win->stats_popover))
+	{
+		stats_show(win, &win->stats, &before, secs);
+		roots_show(win);
+	}
 
-			struct dir_item_info item = g_array_index(arr, struct dir_item_info, i);
+	if (win->metrics)
+		stats_publish(win);
+}
 
-			if (strcmp(item.name, "..") == 0)
-			{
-				ct_icon = g_themed_icon_new("go-up");
-			}
-			else
-				ct_icon = g_content_type_get_icon(item.ct);
+static gboolean stats_tick(gpointer data)
+{
+	stats_update(INOTIFY_APP_WINDOW(data));
+	return G_SOURCE_CONTINUE;
+}
 
-			gtk_list_store_append(store, &iter);
-			gtk_list_store_set(store, &iter,
-					0, ct_icon,
-					1, item.name,
-					2, item.size,
-					3, item.modified,
-					-1);
+/* Counters start over with every listener */
+static void stats_reset(InotifyAppWindow *win)
+{
+	memset(&win->stats, 0, sizeof(win->stats));
+	win->stats_time = g_get_monotonic_time();
+}
 
-			g_free(item.size);
-			g_free(item.name);
-			g_free(item.modified);
-			g_free(item.ct);
-		}
+/* Fills the popover right away rather than after the next tick */
+static void stats_popover_show(GtkPopover *popover, gpointer data)
+{
+	InotifyAppWindow *win = INOTIFY_APP_WINDOW(data);
 
-		gtk_tree_view_set_model(view, model);
-		g_object_unref(model);
+	stats_show(win, &win->stats, &win->stats, 0);
+	roots_show(win);
+}
 
-		char dbf[64];
-		struct tm ts = *localtime(&dst.st_mtim.tv_sec);
-		strftime(dbf, sizeof(dbf), "%d %b %Y %H:%M", &ts);
-		gtk_label_set_text(GTK_LABEL(win->view_status_bar_modified), dbf);
+static void stats_popover_build(InotifyAppWindow *win)
+{
+	GtkGrid *grid = GTK_GRID(win->stats_grid);
+	GtkWidget *label;
 
-		int dlen = arr->len;
-		char *contents = g_strdup_printf("%d items", dlen);
-		gtk_label_set_text(GTK_LABEL(win->view_status_bar_contents), contents);
-		g_free(contents);
+	label = gtk_label_new("Total");
+	gtk_widget_set_sensitive(label, FALSE);
+	gtk_widget_set_halign(label, GTK_ALIGN_END);
+	gtk_grid_attach(grid, label, 1, 0, 1, 1);
 
-		g_array_free(arr, FALSE);
-	}
-	else
+	label = gtk_label_new("Last second");
+	gtk_widget_set_sensitive(label, FALSE);
+	gtk_widget_set_halign(label, GTK_ALIGN_END);
+	gtk_grid_attach(grid, label, 2, 0, 1, 1);
+
+	for (guint i = 0; i < STATS_ROWS; ++i)
 	{
-		char *error = g_strdup_printf("Can't open '%s': %s", dir, strerror(errno));
-		gtk_label_set_text(GTK_LABEL(win->status_bar_err), error);
+		label = gtk_label_new(stats_titles[i]);
+		gtk_widget_set_halign(label, GTK_ALIGN_START);
+		gtk_grid_attach(grid, label, 0, i + 1, 1, 1);
 
-		if ((gtk_widget_get_visible(win->status_bar_err)) == FALSE)
-			gtk_widget_set_visible(win->status_bar_err, TRUE);
+		win->stats_totals[i] = gtk_label_new("0");
+		gtk_widget_set_halign(win->stats_totals[i], GTK_ALIGN_END);
+		gtk_grid_attach(grid, win->stats_totals[i], 1, i + 1, 1, 1);
 
-		g_free(error);
+		win->stats_rates[i] = gtk_label_new("");
+		gtk_widget_set_halign(win->stats_rates[i], GTK_ALIGN_END);
+		gtk_grid_attach(grid, win->stats_rates[i], 2, i + 1, 1, 1);
 	}
+
+	/* Per-root counters of the run, below the listener's own */
+	win->stats_roots = gtk_grid_new();
+	gtk_grid_set_row_spacing(GTK_GRID(win->stats_roots), 4);
+	gtk_grid_set_column_spacing(GTK_GRID(win->stats_roots), 16);
+	gtk_widget_set_margin_top(win->stats_roots, 8);
+	gtk_grid_attach(grid, win->stats_roots, 0, STATS_ROWS + 1, 3, 1);
+	win->run_roots = g_ptr_array_new_with_free_func(window_root_free);
+
+	g_signal_connect(win->stats_popover, "show", G_CALLBACK(stats_popover_show), win);
 }
 
-void view_row_activated(GtkTreeView *view, 
-		GtkTreePath *path,
-		GtkTreeViewColumn *column,
-		gpointer data)
+/*
+ * Publishes the counters of every run from now on to target, see
+ * metrics_open(); they are updated once a second while listening.
+ */
+void inotify_app_window_set_metrics(InotifyAppWindow *win, const char *target)
 {
-	if (!lt)
-	{
-		InotifyAppWindow *win = INOTIFY_APP_WINDOW(data);
-		GtkTreeIter iter;
-		GtkTreeModel *model = gtk_tree_view_get_model(view);
+	GError *error = NULL;
 
-		char *name, *full;
+	g_clear_pointer(&win->metrics, metrics_close);
 
-		if (gtk_tree_model_get_iter(model, &iter, path))
-		{
-			gtk_tree_model_get(model, &iter, 1, &name, -1);
-			full = realpath(name, NULL);
-			update_view(win, full, TRUE);
-			g_free(full);
-		}
+	win->metrics = metrics_open(target, &error);
+	if (win->metrics == NULL)
+	{
+		gui_set_err(win, error->message);
+		g_error_free(error);
+		return;
 	}
+
+	if (win->metrics_text == NULL)
+		win->metrics_text = g_string_new(NULL);
 }
 
 /* }}} */
 
-/* Clear list {{{ */
+/* Journal {{{ */
 
-static void clear_clicked(GtkButton *button,
-		gpointer data)
+/* Most journaled events replayed per frame when replaying as fast as possible */
+#define REPLAY_BATCH_SIZE 4096
+
+static void replay_finish(InotifyAppWindow *win, const char *status)
 {
-	InotifyAppWindow *win = INOTIFY_APP_WINDOW(data);
-	
-	GtkTreeView *list = GTK_TREE_VIEW(win->list);
-	GtkTreeModel *model = gtk_tree_view_get_model(list);
-	GtkListStore *store = GTK_LIST_STORE(model);
+	if (win->replay == NULL)
+		return;
 
-	gtk_list_store_clear(store);
+	gtk_widget_remove_tick_callback(GTK_WIDGET(win), win->replay_tick_id);
+	win->replay_tick_id = 0;
 
-	gtk_label_set_text(GTK_LABEL(win->status_bar_entries), "0");
-	gtk_widget_set_sensitive(win->status_bar_clear, FALSE);
+	journal_reader_close(win->replay);
+	win->replay = NULL;
+
+	if (win->listener == NULL)
+		gtk_label_set_text(GTK_LABEL(win->status_bar_listening_status), status);
+}
+
+/*
+ * Appends every journaled event whose time has come. Journal time advances
+ * speed times as fast as real time, starting at the first event; with a
+ * speed of 0 a fixed batch is appended per frame instead.
+ */
+static gboolean replay_tick(GtkWidget *widget,
+		GdkFrameClock *clock,
+		gpointer data)
+{
+	InotifyAppWindow *win = INOTIFY_APP_WINDOW(widget);
+	struct RingEvent ev;
+	gint64 horizon = G_MAXINT64;
+	guint total = 0;
+
+	if (win->replay_speed > 0 && win->replay_origin != -1)
+		horizon = win->replay_origin + (gint64) ((g_get_monotonic_time() - win->replay_start) * win->replay_speed);
+
+	while (total < REPLAY_BATCH_SIZE && journal_reader_peek(win->replay, &ev))
+	{
+		if (win->replay_origin == -1)
+		{
+			win->replay_origin = ev.time;
+			win->replay_start = g_get_monotonic_time();
+
+			if (win->replay_speed > 0)
+				horizon = ev.time;
+		}
+
+		if (ev.time > horizon)
+			break;
+
+		/* The path lives in the journal mapping, so append before advancing */
+		log_append(win, &ev, 1);
+		journal_reader_advance(win->replay);
+		total++;
+	}
+
+	log_flush(win, total);
+
+	if (total == 0 && !journal_reader_peek(win->replay, &ev))
+		replay_finish(win, "Replay finished");
+
+	return G_SOURCE_CONTINUE;
+}
+
+/*
+ * Feeds a journal written by an earlier run back into the event list.
+ * speed scales the recorded pace, 0 replays as fast as the list keeps up.
+ */
+void inotify_app_window_replay(InotifyAppWindow *win, const char *path, double speed)
+{
+	GError *error = NULL;
+
+	replay_finish(win, "Not listening...");
+
+	win->replay = journal_reader_open(path, &error);
+	if (win->replay == NULL)
+	{
+		gui_set_err(win, error->message);
+		g_error_free(error);
+		return;
+	}
+
+	win->replay_speed = speed;
+	win->replay_origin = -1;
+	win->replay_tick_id = gtk_widget_add_tick_callback(GTK_WIDGET(win), replay_tick, NULL, NULL);
+
+	gtk_label_set_text(GTK_LABEL(win->status_bar_listening_status), "Replaying journal...");
+	gtk_stack_set_visible_child(GTK_STACK(win->stack1), win->page2);
+}
+
+/* Records every event the listener delivers from now on under path */
+void inotify_app_window_set_journal(InotifyAppWindow *win, const char *path)
+{
+	GError *error = NULL;
+
+	journal_close(win->journal);
+
+	win->journal = journal_open(path, JOURNAL_SEGMENT_SIZE, JOURNAL_MAX_SEGMENTS, &error);
+	if (win->journal == NULL)
+	{
+		gui_set_err(win, error->message);
+		g_error_free(error);
+	}
+}
+
+/* }}} */
+
+/* View {{{ */
+
+static gint view_item_cmp(gconstpointer a, gconstpointer b, gpointer data)
+{
+	InotifyAppWindow *win = INOTIFY_APP_WINDOW(data);
+
+	return dir_item_compare(a, b, GUINT_TO_POINTER(win->view_sort));
+}
+
+/* win->view_items doesn't own its items, so sorting can move them around */
+static void view_item_free(gpointer data, gpointer user_data)
+{
+	dir_item_free(data);
+}
+
+static void view_items_clear(InotifyAppWindow *win)
+{
+	g_hash_table_remove_all(win->view_names);
+	g_sequence_foreach(win->view_items, view_item_free, NULL);
+	g_sequence_remove_range(g_sequence_get_begin_iter(win->view_items),
+			g_sequence_get_end_iter(win->view_items));
+}
+
+/* One icon per content type, shared by every row of every window */
+static GIcon *view_icon(const struct dir_item_info *item)
+{
+	static GHashTable *icons;
+	static GIcon *up;
+	GIcon *icon;
+
+	if (item->rank == 0)
+	{
+		if (up == NULL)
+			up = g_themed_icon_new("go-up");
+
+		return up;
+	}
+
+	/* Content types are interned, so the pointer is the key */
+	if (icons == NULL)
+		icons = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_object_unref);
+
+	icon = g_hash_table_lookup(icons, item->ct);
+	if (icon == NULL)
+	{
+		icon = g_content_type_get_icon(item->ct);
+		g_hash_table_insert(icons, (gpointer) item->ct, icon);
+	}
+
+	return icon;
+}
+
+/*
+ * Times are shown to the minute, so most rows of a listing share their
+ * text with others. Returns a string valid until the next call.
+ */
+static const char *view_format_time(gint64 sec)
+{
+	static struct
+	{
+		gint64 minute;
+		char text[64];
+	} slots[VIEW_TIME_SLOTS];
+
+	gint64 minute = sec >= 0 ? sec / 60 : (sec - 59) / 60;
+	guint slot = (guint64) minute % VIEW_TIME_SLOTS;
+
+	if (slots[slot].text[0] == '\0' || slots[slot].minute != minute)
+	{
+		time_t t = minute * 60;
+		struct tm ts;
+
+		localtime_r(&t, &ts);
+		strftime(slots[slot].text, sizeof(slots[slot].text), "%d %b %Y %H:%M", &ts);
+		slots[slot].minute = minute;
+	}
+
+	return slots[slot].text;
+}
+
+/*
+ * Rows of the store are the items of win->view_items, position for position:
+ * icon, name, size or entry count, modification time, whether a directory.
+ * Numbers are only formatted for the rows on screen.
+ */
+static void view_row_insert(GtkListStore *store, int pos, struct dir_item_info *item)
+{
+	GtkTreeIter iter;
+
+	gtk_list_store_insert_with_values(store, &iter, pos,
+			0, view_icon(item),
+			1, item->name,
+			2, item->is_dir ? item->count : item->bytes,
+			3, item->mtime_sec,
+			4, item->is_dir,
+			-1);
+}
+
+static void view_size_data(GtkTreeViewColumn *column,
+		GtkCellRenderer *renderer,
+		GtkTreeModel *model,
+		GtkTreeIter *iter,
+		gpointer data)
+{
+	char text[DIR_SIZE_TEXT];
+	gboolean is_dir;
+	gint64 size;
+
+	gtk_tree_model_get(model, iter, 2, &size, 4, &is_dir, -1);
+
+	/* Directories show nothing until they are counted */
+	if (is_dir && size < 0)
+		text[0] = '\0';
+	else if (is_dir)
+		g_snprintf(text, sizeof(text), "%" G_GINT64_FORMAT " items", size);
+	else
+		transormBytes(size, text, sizeof(text));
+
+	g_object_set(renderer, "text", text, NULL);
+}
+
+static void view_modified_data(GtkTreeViewColumn *column,
+		GtkCellRenderer *renderer,
+		GtkTreeModel *model,
+		GtkTreeIter *iter,
+		gpointer data)
+{
+	gint64 mtime;
+
+	gtk_tree_model_get(model, iter, 3, &mtime, -1);
+	g_object_set(renderer, "text", view_format_time(mtime), NULL);
+}
+
+static gboolean view_row_nth(InotifyAppWindow *win, GSequenceIter *it, GtkTreeIter *iter)
+{
+	GtkTreeModel *model = gtk_tree_view_get_model(GTK_TREE_VIEW(win->view));
+
+	return gtk_tree_model_iter_nth_child(model, iter, NULL, g_sequence_iter_get_position(it));
+}
+
+/*
+ * Only the item itself knows where it sorts under columns other than the
+ * name, so it is looked up by name first.
+ */
+static GSequenceIter *view_find(InotifyAppWindow *win, const char *name)
+{
+	struct dir_item_info *item = g_hash_table_lookup(win->view_names, name);
+
+	if (item == NULL)
+		return NULL;
+
+	return g_sequence_lookup(win->view_items, item, view_item_cmp, win);
+}
+
+/* Whether item may take the place of the one at it without breaking the order */
+static gboolean view_item_fits(InotifyAppWindow *win, GSequenceIter *it, struct dir_item_info *item)
+{
+	GSequenceIter *prev = g_sequence_iter_prev(it);
+	GSequenceIter *next = g_sequence_iter_next(it);
+
+	if (prev != it && view_item_cmp(g_sequence_get(prev), item, win) >= 0)
+		return FALSE;
+
+	if (!g_sequence_iter_is_end(next) && view_item_cmp(item, g_sequence_get(next), win) >= 0)
+		return FALSE;
+
+	return TRUE;
+}
+
+static void view_show_count(InotifyAppWindow *win)
+{
+	char *contents = g_strdup_printf("%d items", g_sequence_get_length(win->view_items));
+	gtk_label_set_text(GTK_LABEL(win->view_status_bar_contents), contents);
+	g_free(contents);
+}
+
+static void view_show_modified(InotifyAppWindow *win, time_t mtime)
+{
+	gtk_label_set_text(GTK_LABEL(win->view_status_bar_modified), view_format_time(mtime));
+}
+
+/* }}} */
+
+/* Directory counts {{{ */
+
+static void view_set_count(InotifyAppWindow *win, GSequenceIter *it, gint64 count)
+{
+	struct dir_item_info *item = g_sequence_get(it);
+	GtkTreeIter iter;
+
+	item->count = count;
+	item->count_state = DIR_ITEM_COUNTED;
+
+	if (view_row_nth(win, it, &iter))
+	{
+		GtkListStore *store = GTK_LIST_STORE(gtk_tree_view_get_model(GTK_TREE_VIEW(win->view)));
+		gtk_list_store_set(store, &iter, 2, item->count, -1);
+	}
+}
+
+/* Until the listing is sorted an item still sits where the scan put it */
+static GSequenceIter *view_count_find(InotifyAppWindow *win, const struct DirCountRequest *req)
+{
+	GSequenceIter *it;
+
+	if (win->view_sorted)
+		return view_find(win, req->name);
+
+	it = g_sequence_get_iter_at_pos(win->view_items, req->index);
+	if (g_sequence_iter_is_end(it))
+		return NULL;
+
+	if (strcmp(((struct dir_item_info*) g_sequence_get(it))->name, req->name) != 0)
+		return NULL;
+
+	return it;
+}
+
+static gboolean view_count_visible(gpointer data);
+
+static void view_count_reset(gpointer data, gpointer user_data)
+{
+	struct dir_item_info *item = data;
+
+	if (item->count_state == DIR_ITEM_COUNTING)
+		item->count_state = DIR_ITEM_UNCOUNTED;
+}
+
+static void view_count_done(GObject *source,
+		GAsyncResult *result,
+		gpointer data)
+{
+	InotifyAppWindow *win = INOTIFY_APP_WINDOW(source);
+	GError *error = NULL;
+	GArray *requests;
+
+	requests = dir_count_finish(result, &error);
+	if (requests == NULL)
+	{
+		/* Cancelled when the view moved on; those rows are gone anyway */
+		if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+		{
+			g_error_free(error);
+			return;
+		}
+
+		/*
+		 * The directory couldn't be opened at all. Its rows would wait
+		 * for a count forever, so they are asked for again, after a
+		 * pause in case the error doesn't go away.
+		 */
+		g_error_free(error);
+		g_sequence_foreach(win->view_items, view_count_reset, NULL);
+
+		if (win->count_idle == 0)
+			win->count_idle = g_timeout_add_seconds(VIEW_COUNT_RETRY, view_count_visible, win);
+
+		return;
+	}
+
+	for (guint i = 0; i < requests->len; ++i)
+	{
+		struct DirCountRequest *req = &g_array_index(requests, struct DirCountRequest, i);
+		GSequenceIter *it;
+
+		dir_count_remember(req);
+
+		/* The row may have been removed or replaced meanwhile */
+		it = view_count_find(win, req);
+		if (it != NULL && ((struct dir_item_info*) g_sequence_get(it))->count_state == DIR_ITEM_COUNTING)
+			view_set_count(win, it, req->count);
+	}
+
+	g_array_free(requests, TRUE);
+}
+
+/*
+ * Counts the entries of the subdirectories in the visible rows, so the
+ * listing itself never reads more than the one directory.
+ */
+static gboolean view_count_visible(gpointer data)
+{
+	InotifyAppWindow *win = INOTIFY_APP_WINDOW(data);
+	GtkTreePath *start, *end;
+	GSequenceIter *it;
+	GArray *requests;
+	int first, last;
+
+	win->count_idle = 0;
+
+	if (!gtk_tree_view_get_visible_range(GTK_TREE_VIEW(win->view), &start, &end))
+		return FALSE;
+
+	first = gtk_tree_path_get_indices(start)[0];
+	last = gtk_tree_path_get_indices(end)[0];
+	gtk_tree_path_free(start);
+	gtk_tree_path_free(end);
+
+	requests = dir_count_request_array_new();
+	it = g_sequence_get_iter_at_pos(win->view_items, first);
+
+	for (int pos = first; pos <= last && !g_sequence_iter_is_end(it); ++pos, it = g_sequence_iter_next(it))
+	{
+		struct dir_item_info *item = g_sequence_get(it);
+		struct DirCountRequest req;
+
+		if (!item->is_dir || item->count_state != DIR_ITEM_UNCOUNTED)
+			continue;
+
+		req.index = item->index;
+		req.dev = item->dev;
+		req.ino = item->ino;
+		req.mtime_sec = item->mtime_sec;
+		req.mtime_nsec = item->mtime_nsec;
+		req.count = -1;
+
+		if (dir_count_lookup(&req, &req.count))
+		{
+			view_set_count(win, it, req.count);
+			continue;
+		}
+
+		req.name = g_strdup(item->name);
+		item->count_state = DIR_ITEM_COUNTING;
+		g_array_append_val(requests, req);
+	}
+
+	if (requests->len == 0)
+	{
+		g_array_free(requests, TRUE);
+		return FALSE;
+	}
+
+	if (win->count == NULL)
+		win->count = g_cancellable_new();
+
+	dir_count_async(win, win->view_dir, requests, win->count, view_count_done, NULL);
+
+	return FALSE;
+}
+
+/* Coalesces scrolling, resizing and new rows into one visible range check */
+static void view_queue_count(InotifyAppWindow *win)
+{
+	if (win->count_idle == 0)
+		win->count_idle = g_idle_add(view_count_visible, win);
+}
+
+static void view_count_cancel(InotifyAppWindow *win)
+{
+	if (win->count_idle != 0)
+	{
+		g_source_remove(win->count_idle);
+		win->count_idle = 0;
+	}
+
+	if (win->count != NULL)
+	{
+		g_cancellable_cancel(win->count);
+		g_clear_object(&win->count);
+	}
+
+	/* The listing may stay up if the next scan fails, so ask again later */
+	if (win->view_items)
+		g_sequence_foreach(win->view_items, view_count_reset, NULL);
+}
+
+/* }}} */
+
+/* Live updates {{{ */
+
+static void view_live_remove(InotifyAppWindow *win, const char *name)
+{
+	GSequenceIter *it = view_find(win, name);
+	struct dir_item_info *item;
+	GtkTreeIter iter;
+
+	if (it == NULL)
+		return;
+
+	if (view_row_nth(win, it, &iter))
+		gtk_list_store_remove(GTK_LIST_STORE(gtk_tree_view_get_model(GTK_TREE_VIEW(win->view))), &iter);
+
+	item = g_sequence_get(it);
+	g_hash_table_remove(win->view_names, item->name);
+	g_sequence_remove(it);
+	dir_item_free(item);
+}
+
+static void view_sniff_done(GObject *source,
+		GAsyncResult *result,
+		gpointer data)
+{
+	InotifyAppWindow *win = INOTIFY_APP_WINDOW(source);
+	GArray *requests;
+
+	/* Cancelled when the view moved on; guessed types are good enough otherwise */
+	requests = dir_scan_sniff_finish(result, NULL);
+	if (requests == NULL)
+		return;
+
+	for (guint i = 0; i < requests->len; ++i)
+	{
+		struct DirSniffRequest *req = &g_array_index(requests, struct DirSniffRequest, i);
+		struct dir_item_info *item;
+		GSequenceIter *it;
+		GtkTreeIter iter;
+
+		if (req->ct == NULL || (it = view_find(win, req->name)) == NULL)
+			continue;
+
+		/* Changed again since; a sniff for that is on its way */
+		item = g_sequence_get(it);
+		if (item->dev != req->dev || item->ino != req->ino ||
+				item->mtime_sec != req->mtime_sec || item->mtime_nsec != req->mtime_nsec)
+			continue;
+
+		item->ct = req->ct;
+
+		if (view_row_nth(win, it, &iter))
+		{
+			GtkListStore *store = GTK_LIST_STORE(gtk_tree_view_get_model(GTK_TREE_VIEW(win->view)));
+			gtk_list_store_set(store, &iter, 0, view_icon(item), -1);
+		}
+	}
+
+	g_array_free(requests, TRUE);
+}
+
+/*
+ * Re-stats name and puts it where it sorts. A row that keeps its place is
+ * updated in place, so selection and scroll position survive. The content
+ * type is guessed from the name; if that isn't conclusive the entry is
+ * added to sniffs, to be read on the scan pool rather than here.
+ */
+static void view_live_update(InotifyAppWindow *win, const char *name, GArray *sniffs)
+{
+	GtkListStore *store = GTK_LIST_STORE(gtk_tree_view_get_model(GTK_TREE_VIEW(win->view)));
+	struct dir_item_info *item = g_new0(struct dir_item_info, 1);
+	GSequenceIter *it;
+	GtkTreeIter iter;
+	gboolean sniff;
+
+	if (!dir_scan_entry(win->view_dfd, name, item, &sniff))
+	{
+		g_free(item);
+		view_live_remove(win, name);
+		return;
+	}
+
+	it = view_find(win, name);
+	if (it != NULL && view_item_fits(win, it, item))
+	{
+		struct dir_item_info *old = g_sequence_get(it);
+
+		g_hash_table_replace(win->view_names, item->name, item);
+		g_sequence_set(it, item);
+		dir_item_free(old);
+
+		if (view_row_nth(win, it, &iter))
+		{
+			gtk_list_store_set(store, &iter,
+					0, view_icon(item),
+					2, item->is_dir ? item->count : item->bytes,
+					3, item->mtime_sec,
+					-1);
+		}
+	}
+	else
+	{
+		if (it != NULL)
+			view_live_remove(win, name);
+
+		it = g_sequence_insert_sorted(win->view_items, item, view_item_cmp, win);
+		g_hash_table_insert(win->view_names, item->name, item);
+		view_row_insert(store, g_sequence_iter_get_position(it), item);
+	}
+
+	if (sniff)
+	{
+		struct DirSniffRequest req;
+
+		req.name = g_strdup(item->name);
+		req.dev = item->dev;
+		req.ino = item->ino;
+		req.mtime_sec = item->mtime_sec;
+		req.mtime_nsec = item->mtime_nsec;
+		req.ct = NULL;
+
+		g_array_append_val(sniffs, req);
+	}
+
+	if (item->is_dir)
+		view_queue_count(win);
+}
+
+/* The directory itself went away; the listing stays up, but stops following it */
+static void view_watch_lost(InotifyAppWindow *win, guint32 mask)
+{
+	char *error = g_strdup_printf("Directory '%s' was %s!", win->view_dir,
+			(mask & IN_MOVE_SELF) ? "moved" : (mask & IN_UNMOUNT) ? "unmounted" : "deleted");
+
+	gtk_label_set_text(GTK_LABEL(win->status_bar_err), error);
+	if ((gtk_widget_get_visible(win->status_bar_err)) == FALSE)
+		gtk_widget_set_visible(win->status_bar_err, TRUE);
+
+	g_free(error);
+
+	/* Called from the watch's own dispatch, which removes the source */
+	win->view_watch = 0;
+	view_watch_stop(win);
+}
+
+/* One read per dispatch, so a storm of changes can't starve the UI */
+static gboolean view_watch_read(gint fd, GIOCondition condition, gpointer data)
+{
+	InotifyAppWindow *win = INOTIFY_APP_WINDOW(data);
+	char buf[VIEW_WATCH_BUFFER] __attribute__((aligned(__alignof__(struct inotify_event))));
+	gboolean changed = FALSE;
+	GArray *sniffs;
+	struct stat st;
+	ssize_t len;
+
+	len = read(fd, buf, sizeof(buf));
+	if (len <= 0)
+		return G_SOURCE_CONTINUE;
+
+	sniffs = dir_sniff_request_array_new();
+
+	for (char *ptr = buf; ptr < buf + len;)
+	{
+		const struct inotify_event *ev = (const struct inotify_event*) ptr;
+		ptr += sizeof(struct inotify_event) + ev->len;
+
+		/* Lost track of the directory; start over from a fresh listing */
+		if (ev->mask & IN_Q_OVERFLOW)
+		{
+			g_array_free(sniffs, TRUE);
+			win->view_watch = 0;
+			update_view(win, win->view_dir, FALSE);
+			return G_SOURCE_REMOVE;
+		}
+
+		/* Left over from a directory shown earlier */
+		if (ev->wd != win->view_wd)
+			continue;
+
+		/* Moved away, deleted, or unmounted from under the view */
+		if (ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF | IN_UNMOUNT | IN_IGNORED))
+		{
+			g_array_free(sniffs, TRUE);
+
+			if (changed)
+				view_show_count(win);
+
+			view_watch_lost(win, ev->mask);
+			return G_SOURCE_REMOVE;
+		}
+
+		if (ev->len == 0)
+			continue;
+
+		if (ev->mask & (IN_DELETE | IN_MOVED_FROM))
+			view_live_remove(win, ev->name);
+		else
+			view_live_update(win, ev->name, sniffs);
+
+		changed = TRUE;
+	}
+
+	if (sniffs->len > 0)
+	{
+		if (win->sniff == NULL)
+			win->sniff = g_cancellable_new();
+
+		dir_scan_sniff_async(win, win->view_dfd, sniffs, win->sniff, view_sniff_done, NULL);
+	}
+	else
+		g_array_free(sniffs, TRUE);
+
+	if (changed)
+	{
+		view_show_count(win);
+
+		if (fstat(win->view_dfd, &st) == 0)
+			view_show_modified(win, st.st_mtim.tv_sec);
+	}
+
+	return G_SOURCE_CONTINUE;
+}
+
+static void view_watch_stop(InotifyAppWindow *win)
+{
+	if (win->view_watch != 0)
+	{
+		g_source_remove(win->view_watch);
+		win->view_watch = 0;
+	}
+
+	if (win->sniff != NULL)
+	{
+		g_cancellable_cancel(win->sniff);
+		g_clear_object(&win->sniff);
+	}
+
+	if (win->view_wd != -1)
+	{
+		inotify_rm_watch(win->view_fd, win->view_wd);
+		win->view_wd = -1;
+	}
+
+	if (win->view_dfd != -1)
+	{
+		close(win->view_dfd);
+		win->view_dfd = -1;
+	}
+}
+
+/*
+ * The watch goes in before the scan opens the directory, so nothing that
+ * changes during the scan is missed. Its events wait in the kernel queue
+ * until the listing is sorted; replaying them is harmless, since every
+ * event re-stats the entry it names.
+ */
+static void view_watch_start(InotifyAppWindow *win, const char *dir)
+{
+	if (win->view_fd == -1)
+		return;
+
+	win->view_dfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (win->view_dfd == -1)
+		return;
+
+	win->view_wd = inotify_add_watch(win->view_fd, dir, VIEW_WATCH_MASK);
+	if (win->view_wd == -1)
+		view_watch_stop(win);
+}
+
+static void view_watch_attach(InotifyAppWindow *win)
+{
+	if (win->view_wd != -1 && win->view_watch == 0)
+		win->view_watch = g_unix_fd_add(win->view_fd, G_IO_IN, view_watch_read, win);
+}
+
+/* }}} */
+
+/* Listing {{{ */
+
+/*
+ * Puts the listing in win->view_sort order. The items are sorted as an
+ * array on their precomputed keys and dealt back out over the sequence
+ * nodes they came from, so neither the sequence nor the store is rebuilt.
+ */
+static void view_sort(InotifyAppWindow *win)
+{
+	GSequence *seq = win->view_items;
+	GtkListStore *store = GTK_LIST_STORE(gtk_tree_view_get_model(GTK_TREE_VIEW(win->view)));
+	int len = g_sequence_get_length(seq);
+	struct dir_item_info **items;
+	GSequenceIter *it;
+	int *new_order;
+	gint64 span;
+	int i;
+
+	if (len < 2)
+		return;
+
+	span = trace_begin();
+
+	items = g_new(struct dir_item_info*, len);
+
+	for (i = 0, it = g_sequence_get_begin_iter(seq); !g_sequence_iter_is_end(it); ++i, it = g_sequence_iter_next(it))
+	{
+		items[i] = g_sequence_get(it);
+		items[i]->index = i;
+	}
+
+	dir_item_sort(items, len, win->view_sort);
+
+	/* new_order[i] is the row that ends up at position i */
+	new_order = g_new(int, len);
+
+	for (i = 0, it = g_sequence_get_begin_iter(seq); !g_sequence_iter_is_end(it); ++i, it = g_sequence_iter_next(it))
+	{
+		g_sequence_set(it, items[i]);
+		new_order[i] = items[i]->index;
+	}
+
+	gtk_list_store_reorder(store, new_order);
+	g_free(new_order);
+	g_free(items);
+
+	trace_end("view_sort", span, len);
+
+	view_queue_count(win);
+}
+
+/*
+ * A header click sorts by that column, or flips the direction if the
+ * listing is sorted by it already. A listing still being scanned takes the
+ * new order when it is done.
+ */
+static void view_column_clicked(GtkTreeViewColumn *column, gpointer data)
+{
+	InotifyAppWindow *win = INOTIFY_APP_WINDOW(data);
+	guint sort = DIR_SORT_NAME;
+
+	while (win->view_columns[sort] != column)
+		sort++;
+
+	if ((win->view_sort & ~DIR_SORT_DESCENDING) == sort)
+		sort = win->view_sort ^ DIR_SORT_DESCENDING;
+
+	win->view_sort = sort;
+
+	for (guint i = 0; i < G_N_ELEMENTS(win->view_columns); ++i)
+		gtk_tree_view_column_set_sort_indicator(win->view_columns[i], win->view_columns[i] == column);
+
+	gtk_tree_view_column_set_sort_order(column,
+			sort & DIR_SORT_DESCENDING ? GTK_SORT_DESCENDING : GTK_SORT_ASCENDING);
+
+	if (win->view_sorted)
+		view_sort(win);
+}
+
+/* Swaps the old listing for the new one once the scan has produced something */
+static void view_scan_show(InotifyAppWindow *win)
+{
+	if (win->scan_shown)
+		return;
+
+	win->scan_shown = TRUE;
+
+	g_free(win->view_dir);
+	win->view_dir = g_strdup(win->scan_dir);
+
+	if (win->scan_change_entry)
+	{
+		GtkEntryBuffer *buffer = gtk_entry_get_buffer(GTK_ENTRY(win->directory_choose_entry));
+		gtk_entry_buffer_set_text(buffer, win->view_dir, -1);
+	}
+
+	view_items_clear(win);
+	win->view_sorted = FALSE;
+
+	gtk_list_store_clear(GTK_LIST_STORE(gtk_tree_view_get_model(GTK_TREE_VIEW(win->view))));
+	gtk_label_set_text(GTK_LABEL(win->view_status_bar_contents), "Loading...");
+}
+
+/* Rows are appended in directory order and sorted once the scan is over */
+static void view_scan_chunk(GArray *items, gpointer data)
+{
+	InotifyAppWindow *win = INOTIFY_APP_WINDOW(data);
+	gint64 span = trace_begin();
+	GtkListStore *store;
+
+	view_scan_show(win);
+
+	store = GTK_LIST_STORE(gtk_tree_view_get_model(GTK_TREE_VIEW(win->view)));
+
+	for (guint i = 0; i < items->len; ++i)
+	{
+		struct dir_item_info *item = g_memdup2(&g_array_index(items, struct dir_item_info, i), sizeof(*item));
+
+		view_row_insert(store, -1, item);
+		g_sequence_append(win->view_items, item);
+		g_hash_table_insert(win->view_names, item->name, item);
+	}
+
+	trace_end("store_fill", span, items->len);
+
+	/* The strings now belong to win->view_items */
+	g_array_set_clear_func(items, NULL);
+	g_array_free(items, TRUE);
+
+	view_queue_count(win);
+}
+
+static void view_scan_done(GObject *source,
+		GAsyncResult *result,
+		gpointer data)
+{
+	InotifyAppWindow *win = INOTIFY_APP_WINDOW(source);
+	GError *error = NULL;
+	time_t mtime;
+
+	if (!dir_scan_finish(result, &mtime, &error))
+	{
+		if (!g_error_matches(error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+		{
+			gtk_label_set_text(GTK_LABEL(win->status_bar_err), error->message);
+
+			if ((gtk_widget_get_visible(win->status_bar_err)) == FALSE)
+				gtk_widget_set_visible(win->status_bar_err, TRUE);
+
+			if (win->scan_shown)
+				gtk_label_set_text(GTK_LABEL(win->view_status_bar_contents), "");
+
+			view_watch_stop(win);
+		}
+
+		g_error_free(error);
+		return;
+	}
+
+	view_scan_show(win);
+	view_sort(win);
+
+	win->view_sorted = TRUE;
+
+	view_show_modified(win, mtime);
+	view_show_count(win);
+
+	g_clear_object(&win->scan);
+
+	view_watch_attach(win);
+}
+
+static void view_scan_cancel(InotifyAppWindow *win)
+{
+	if (win->scan == NULL)
+		return;
+
+	g_cancellable_cancel(win->scan);
+	g_clear_object(&win->scan);
+}
+
+/*
+ * Starts listing dir into the view. The current listing stays until the
+ * new one produces its first rows; navigating again before that cancels
+ * the scan in flight. Once listed the view follows changes to dir.
+ */
+void update_view(InotifyAppWindow *win, const char *dir, gboolean change_entry)
+{
+	view_scan_cancel(win);
+	view_count_cancel(win);
+	view_watch_stop(win);
+
+	g_free(win->scan_dir);
+	win->scan_dir = g_strdup(dir);
+	win->scan_change_entry = change_entry;
+	win->scan_shown = FALSE;
+
+	view_watch_start(win, dir);
+
+	win->scan = g_cancellable_new();
+	dir_scan_async(win, dir, win->scan, view_scan_chunk, view_scan_done, win);
+}
+
+void view_row_activated(GtkTreeView *view, 
+		GtkTreePath *path,
+		GtkTreeViewColumn *column,
+		gpointer data)
+{
+	InotifyAppWindow *win = INOTIFY_APP_WINDOW(data);
+
+	if (!win->listener && win->view_dir)
+	{
+		GtkTreeIter iter;
+		GtkTreeModel *model = gtk_tree_view_get_model(view);
+
+		char *name, *full, *joined;
+
+		if (gtk_tree_model_get_iter(model, &iter, path))
+		{
+			gtk_tree_model_get(model, &iter, 1, &name, -1);
+			joined = g_build_filename(win->view_dir, name, NULL);
+			full = realpath(joined, NULL);
+
+			if (full != NULL)
+				update_view(win, full, TRUE);
+
+			free(full);
+			g_free(joined);
+			g_free(name);
+		}
+	}
+}
+
+/* }}} */
+
+/* Hot paths {{{ */
+
+static const char *const hot_titles[HOT_PATH_TYPES] =
+{
+	[HOT_PATH_CREATE] = "Create",
+	[HOT_PATH_MODIFY] = "Modify",
+	[HOT_PATH_DELETE] = "Delete",
+	[HOT_PATH_MOVE] = "Move",
+	[HOT_PATH_ACCESS] = "Access",
+	[HOT_PATH_ATTRIB] = "Attrib",
+};
+
+static void hot_count_data(GtkTreeViewColumn *column,
+		GtkCellRenderer *renderer,
+		GtkTreeModel *model,
+		GtkTreeIter *iter,
+		gpointer data)
+{
+	guint64 count, error;
+	char text[64];
+
+	gtk_tree_model_get(model, iter, HOT_COL_COUNT, &count, HOT_COL_ERROR, &error, -1);
+
+	if (error > 0)
+		g_snprintf(text, sizeof(text), "%" G_GUINT64_FORMAT " \u00b1%" G_GUINT64_FORMAT, count, error);
+	else
+		g_snprintf(text, sizeof(text), "%" G_GUINT64_FORMAT, count);
+
+	g_object_set(renderer, "text", text, NULL);
+}
+
+/* Refills the table with the current top paths; the store keeps them in the order picked */
+static void hot_show(InotifyAppWindow *win)
+{
+	GtkListStore *store = GTK_LIST_STORE(gtk_tree_view_get_model(GTK_TREE_VIEW(win->hot_view)));
+	const struct HotPath *top[HOT_TOP];
+	guint n = hot_paths_top(win->hot, top, HOT_TOP);
+	char status[128];
+
+	gtk_list_store_clear(store);
+
+	for (guint i = 0; i < n; ++i)
+	{
+		const guint64 *types = top[i]->types;
+
+		gtk_list_store_insert_with_values(store, NULL, -1,
+				HOT_COL_PATH, top[i]->path,
+				HOT_COL_COUNT, top[i]->count,
+				HOT_COL_ERROR, top[i]->error,
+				HOT_COL_TYPES + HOT_PATH_CREATE, types[HOT_PATH_CREATE],
+				HOT_COL_TYPES + HOT_PATH_MODIFY, types[HOT_PATH_MODIFY],
+				HOT_COL_TYPES + HOT_PATH_DELETE, types[HOT_PATH_DELETE],
+				HOT_COL_TYPES + HOT_PATH_MOVE, types[HOT_PATH_MOVE],
+				HOT_COL_TYPES + HOT_PATH_ACCESS, types[HOT_PATH_ACCESS],
+				HOT_COL_TYPES + HOT_PATH_ATTRIB, types[HOT_PATH_ATTRIB],
+				-1);
+	}
+
+	win->hot_shown = hot_paths_get_total(win->hot);
+
+	if (win->hot_shown == 0)
+		g_strlcpy(status, "No events yet", sizeof(status));
+	else
+		g_snprintf(status, sizeof(status), "%" G_GUINT64_FORMAT " events, %u paths tracked",
+				win->hot_shown, hot_paths_get_size(win->hot));
+
+	gtk_label_set_text(GTK_LABEL(win->hot_status), status);
+}
+
+/* Only while the page is shown, and only if something was counted since */
+static gboolean hot_tick(gpointer data)
+{
+	InotifyAppWindow *win = INOTIFY_APP_WINDOW(data);
+
+	if (gtk_widget_get_mapped(win->page3) && hot_paths_get_total(win->hot) != win->hot_shown)
+		hot_show(win);
+
+	return G_SOURCE_CONTINUE;
+}
+
+static void hot_clear(InotifyAppWindow *win)
+{
+	hot_paths_clear(win->hot);
+	hot_show(win);
+}
+
+static void hot_view_build(InotifyAppWindow *win)
+{
+	GtkTreeView *view = GTK_TREE_VIEW(win->hot_view);
+	GtkTreeViewColumn *col;
+	GtkCellRenderer *renderer;
+
+	renderer = gtk_cell_renderer_text_new();
+	g_object_set(renderer, "ellipsize", PANGO_ELLIPSIZE_MIDDLE, NULL);
+	col = gtk_tree_view_column_new_with_attributes("Path", renderer, "text", HOT_COL_PATH, NULL);
+	gtk_tree_view_column_set_expand(col, TRUE);
+	gtk_tree_view_column_set_sort_column_id(col, HOT_COL_PATH);
+	gtk_tree_view_append_column(view, col);
+	gtk_tree_view_set_tooltip_column(view, HOT_COL_PATH);
+
+	renderer = gtk_cell_renderer_text_new();
+	col = gtk_tree_view_column_new();
+	gtk_tree_view_column_set_title(col, "Events");
+	gtk_tree_view_column_pack_start(col, renderer, FALSE);
+	gtk_tree_view_column_set_cell_data_func(col, renderer, hot_count_data, NULL, NULL);
+	gtk_tree_view_column_set_sort_column_id(col, HOT_COL_COUNT);
+	gtk_tree_view_append_column(view, col);
+
+	for (guint i = 0; i < HOT_PATH_TYPES; ++i)
+	{
+		renderer = gtk_cell_renderer_text_new();
+		col = gtk_tree_view_column_new_with_attributes(hot_titles[i], renderer, "text", HOT_COL_TYPES + i, NULL);
+		gtk_tree_view_column_set_sort_column_id(col, HOT_COL_TYPES + i);
+		gtk_tree_view_append_column(view, col);
+	}
+
+	/* Hottest first until a header says otherwise */
+	gtk_tree_sortable_set_sort_column_id(GTK_TREE_SORTABLE(gtk_tree_view_get_model(view)),
+			HOT_COL_COUNT, GTK_SORT_DESCENDING);
+}
+
+/* }}} */
+
+/* Search {{{ */
+
+/* What each entry of the search type drop-down matches, as HotPathType groups them */
+static const guint32 search_masks[] =
+{
+	0,
+	IN_CREATE,
+	IN_MODIFY | IN_CLOSE_WRITE,
+	IN_DELETE | IN_DELETE_SELF,
+	IN_MOVED_FROM | IN_MOVED_TO | IN_MOVE_SELF,
+	IN_OPEN | IN_ACCESS | IN_CLOSE_NOWRITE,
+	IN_ATTRIB,
+};
+
+static void search_show(InotifyAppWindow *win)
+{
+	char status[64];
+
+	if (!event_search_is_active(win->search))
+	{
+		gtk_label_set_text(GTK_LABEL(win->search_status), "");
+		return;
+	}
+
+	g_snprintf(status, sizeof(status), "%u of %u rows",
+			g_list_model_get_n_items(G_LIST_MODEL(win->search)), event_log_get_size(win->log));
+	gtk_label_set_text(GTK_LABEL(win->search_status), status);
+}
+
+static void search_items_changed(GListModel *model, guint position, guint removed, guint added,
+		gpointer data)
+{
+	search_show(INOTIFY_APP_WINDOW(data));
+}
+
+/* The entry only says it changed once typing pauses for a moment */
+static void search_changed(InotifyAppWindow *win)
+{
+	guint type = gtk_drop_down_get_selected(GTK_DROP_DOWN(win->search_types));
+
+	event_search_set_query(win->search, gtk_editable_get_text(GTK_EDITABLE(win->search_entry)),
+			type < G_N_ELEMENTS(search_masks) ? search_masks[type] : 0);
+	search_show(win);
+}
+
+/* }}} */
+
+/* Clear list {{{ */
+
+static void clear_clicked(GtkButton *button,
+		gpointer data)
+{
+	InotifyAppWindow *win = INOTIFY_APP_WINDOW(data);
+
+	event_log_clear(win->log);
+	hot_clear(win);
+
+	win->entries = 0;
+	win->overflows = 0;
+	gtk_label_set_text(GTK_LABEL(win->status_bar_entries), "0");
+	gtk_widget_set_visible(win->status_bar_overflows_box, FALSE);
+	gtk_widget_set_sensitive(win->status_bar_clear, FALSE);
 
 	if ((gtk_widget_get_visible(win->status_bar_err)) == TRUE)
 		gtk_widget_set_visible(win->status_bar_err, FALSE);
@@ -828,18 +2153,149 @@ static void choose_entry_activated(GtkEntry *entry,
 	InotifyAppWindow *win = INOTIFY_APP_WINDOW(data);
 
 	char *dir = g_strdup(gtk_entry_buffer_get_text(buffer));
-	update_view(win, dir, FALSE);
+
+	if (win->listener && listener_is_running(win->listener))
+	{
+		struct ListenerRoot root = {0};
+
+		root.dir = dir;
+		root.recursive = gtk_check_button_get_active(GTK_CHECK_BUTTON(win->recursive));
+		root.events = win->events;
+		root.filter = win->filter;
+		roots_track(win, listener_add_root(win->listener, &root), dir);
+	}
+	else
+		update_view(win, dir, FALSE);
+
 	g_free(dir);
 }
 
 /* }}} */
 
+/* Event list {{{ */
+
+static void list_setup_label(GtkSignalListItemFactory *factory,
+		GtkListItem *item,
+		gpointer data)
+{
+	GtkWidget *label = gtk_label_new(NULL);
+	gtk_label_set_xalign(GTK_LABEL(label), 0);
+
+	if (GPOINTER_TO_INT(data))
+		gtk_label_set_ellipsize(GTK_LABEL(label), PANGO_ELLIPSIZE_END);
+
+	gtk_list_item_set_child(item, label);
+}
+
+static void format_event_time(gint64 time, char *bf, size_t size)
+{
+	time_t sec = time / G_USEC_PER_SEC;
+	struct tm ts;
+	size_t len;
+
+	localtime_r(&sec, &ts);
+	len = strftime(bf, size, "%H:%M:%S", &ts);
+	g_snprintf(bf + len, size - len, ".%03d", (int) (time % G_USEC_PER_SEC / 1000));
+}
+
+static void list_bind_time(GtkSignalListItemFactory *factory,
+		GtkListItem *item,
+		gpointer data)
+{
+	EventLogRow *row = gtk_list_item_get_item(item);
+	char bf[64];
+
+	format_event_time(event_log_row_get_time(row), bf, sizeof(bf));
+	gtk_label_set_text(GTK_LABEL(gtk_list_item_get_child(item)), bf);
+}
+
+static void list_bind_count(GtkSignalListItemFactory *factory,
+		GtkListItem *item,
+		gpointer data)
+{
+	EventLogRow *row = gtk_list_item_get_item(item);
+	GtkWidget *label = gtk_list_item_get_child(item);
+	guint32 count = event_log_row_get_count(row);
+	char bf[64], last[32];
+
+	if (count <= 1)
+	{
+		gtk_label_set_text(GTK_LABEL(label), "");
+		gtk_widget_set_tooltip_text(label, NULL);
+		return;
+	}
+
+	g_snprintf(bf, sizeof(bf), "\u00d7%u", count);
+	gtk_label_set_text(GTK_LABEL(label), bf);
+
+	format_event_time(event_log_row_get_last_time(row), last, sizeof(last));
+	g_snprintf(bf, sizeof(bf), "Last at %s", last);
+	gtk_widget_set_tooltip_text(label, bf);
+}
+
+static void list_bind_event(GtkSignalListItemFactory *factory,
+		GtkListItem *item,
+		gpointer data)
+{
+	EventLogRow *row = gtk_list_item_get_item(item);
+	gtk_label_set_text(GTK_LABEL(gtk_list_item_get_child(item)), event_mask_name(event_log_row_get_mask(row)));
+}
+
+static void list_bind_path(GtkSignalListItemFactory *factory,
+		GtkListItem *item,
+		gpointer data)
+{
+	EventLogRow *row = gtk_list_item_get_item(item);
+	GtkWidget *label = gtk_list_item_get_child(item);
+	const char *path = event_log_row_get_path(row);
+
+	gtk_label_set_text(GTK_LABEL(label), path);
+	gtk_widget_set_tooltip_text(label, path);
+}
+
+/* }}} */
+
+/* Tracing {{{ */
+
+/* Frames, from before their update until they are painted */
+static void trace_frame_begin(GdkFrameClock *clock, gpointer data)
+{
+	INOTIFY_APP_WINDOW(data)->frame_span = trace_begin();
+}
+
+static void trace_frame_end(GdkFrameClock *clock, gpointer data)
+{
+	InotifyAppWindow *win = INOTIFY_APP_WINDOW(data);
+
+	trace_end("frame", win->frame_span, TRACE_NONE);
+	win->frame_span = 0;
+}
+
+/* The frame clock only exists once the window is realized */
+static void trace_frames(GtkWidget *widget, gpointer data)
+{
+	GdkFrameClock *clock = gtk_widget_get_frame_clock(widget);
+
+	g_signal_connect_object(clock, "before-paint", G_CALLBACK(trace_frame_begin), widget, 0);
+	g_signal_connect_object(clock, "after-paint", G_CALLBACK(trace_frame_end), widget, 0);
+}
+
+/* }}} */
+
 /* Initialization {{{ */
 
 static void inotify_app_window_init(InotifyAppWindow *win)
 {
 	gtk_widget_init_template(GTK_WIDGET(win));
 
+	win->roots = g_ptr_array_new_with_free_func(g_free);
+	win->view_items = g_sequence_new(NULL);
+	win->view_names = g_hash_table_new(g_str_hash, g_str_equal);
+	win->view_sort = DIR_SORT_NAME;
+	win->view_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	win->view_wd = -1;
+	win->view_dfd = -1;
+
 	char cwd[PATH_MAX];
 
 	if (getcwd(cwd, sizeof(cwd)) != NULL)
@@ -876,80 +2332,177 @@ static void inotify_app_window_init(InotifyAppWindow *win)
 			NULL);
 
 	gtk_tree_view_column_set_expand(vcol, TRUE);
+	gtk_tree_view_column_set_sort_indicator(vcol, TRUE);
 	gtk_tree_view_append_column(view, vcol);
 	gtk_tree_view_set_tooltip_column(view, 1);
+	win->view_columns[DIR_SORT_NAME] = vcol;
 
 	vcol = gtk_tree_view_column_new();
 	gtk_tree_view_column_set_title(vcol, "Size");
 
 	vrenderer = gtk_cell_renderer_text_new();
 	gtk_tree_view_column_pack_start(vcol, vrenderer, FALSE);
-	gtk_tree_view_column_set_attributes(vcol, vrenderer, 
-			"text", 2,
-			NULL);
+	gtk_tree_view_column_set_cell_data_func(vcol, vrenderer, view_size_data, NULL, NULL);
 
 	gtk_tree_view_append_column(view, vcol);
+	win->view_columns[DIR_SORT_SIZE] = vcol;
 
 	vcol = gtk_tree_view_column_new();
 	gtk_tree_view_column_set_title(vcol, "Modified");
 
 	vrenderer = gtk_cell_renderer_text_new();
 	gtk_tree_view_column_pack_start(vcol, vrenderer, FALSE);
-	gtk_tree_view_column_set_attributes(vcol, vrenderer, 
-			"text", 3,
-			NULL);
+	gtk_tree_view_column_set_cell_data_func(vcol, vrenderer, view_modified_data, NULL, NULL);
 
 	gtk_tree_view_append_column(view, vcol);
+	win->view_columns[DIR_SORT_MODIFIED] = vcol;
 
-	/* }}} */
-
-	/* List {{{ */
-
-	GtkTreeView *list;
-	GtkTreeViewColumn *lcol;
-	GtkCellRenderer *lrenderer;
-
-	list = GTK_TREE_VIEW(win->list);
-
-	lcol = gtk_tree_view_column_new();
-	gtk_tree_view_column_set_title(lcol, "Event");
-
-	lrenderer = gtk_cell_renderer_text_new();
-	gtk_tree_view_column_pack_end(lcol, lrenderer, TRUE);
-	gtk_tree_view_column_set_attributes(lcol, lrenderer, 
-			"text", 0,
-			NULL);
+	/* Sorting is done on the items, not by the store */
+	for (guint i = 0; i < G_N_ELEMENTS(win->view_columns); ++i)
+	{
+		gtk_tree_view_column_set_clickable(win->view_columns[i], TRUE);
+		g_signal_connect(win->view_columns[i], "clicked", G_CALLBACK(view_column_clicked), win);
+	}
 
-	gtk_tree_view_append_column(list, lcol);
+	/* Directory sizes are counted as their rows scroll into view */
+	GtkAdjustment *vadjustment = gtk_scrollable_get_vadjustment(GTK_SCROLLABLE(view));
+	g_signal_connect_swapped(vadjustment, "value-changed", G_CALLBACK(view_queue_count), win);
+	g_signal_connect_swapped(vadjustment, "changed", G_CALLBACK(view_queue_count), win);
 
-	lcol = gtk_tree_view_column_new();
-	gtk_tree_view_column_set_title(lcol, "Item");
+	/* }}} */
 
-	lrenderer = gtk_cell_renderer_text_new();
-	g_object_set(lrenderer, 
-			"ellipsize", PANGO_ELLIPSIZE_END,
-			NULL);
-	gtk_tree_view_column_pack_start(lcol, lrenderer, TRUE);
-	gtk_tree_view_column_set_attributes(lcol, lrenderer, 
-			"text", 1,
-			NULL);
+	/* List {{{ */
 
-	gtk_tree_view_column_set_expand(lcol, 1);
-	gtk_tree_view_append_column(list, lcol);
-	gtk_tree_view_set_tooltip_column(list, 1);
+	GtkColumnView *list;
+	GtkColumnViewColumn *lcol;
+	GtkListItemFactory *lfactory;
+	GtkSelectionModel *lselection;
+
+	list = GTK_COLUMN_VIEW(win->list);
+
+	win->log = event_log_new();
+	win->search = event_search_new(win->log);
+	lselection = GTK_SELECTION_MODEL(gtk_no_selection_new(G_LIST_MODEL(g_object_ref(win->search))));
+	gtk_column_view_set_model(list, lselection);
+	g_object_unref(lselection);
+
+	lfactory = gtk_signal_list_item_factory_new();
+	g_signal_connect(lfactory, "setup", G_CALLBACK(list_setup_label), GINT_TO_POINTER(FALSE));
+	g_signal_connect(lfactory, "bind", G_CALLBACK(list_bind_time), NULL);
+	lcol = gtk_column_view_column_new("Time", lfactory);
+	gtk_column_view_append_column(list, lcol);
+	g_object_unref(lcol);
+
+	lfactory = gtk_signal_list_item_factory_new();
+	g_signal_connect(lfactory, "setup", G_CALLBACK(list_setup_label), GINT_TO_POINTER(FALSE));
+	g_signal_connect(lfactory, "bind", G_CALLBACK(list_bind_event), NULL);
+	lcol = gtk_column_view_column_new("Event", lfactory);
+	gtk_column_view_append_column(list, lcol);
+	g_object_unref(lcol);
+
+	lfactory = gtk_signal_list_item_factory_new();
+	g_signal_connect(lfactory, "setup", G_CALLBACK(list_setup_label), GINT_TO_POINTER(FALSE));
+	g_signal_connect(lfactory, "bind", G_CALLBACK(list_bind_count), NULL);
+	lcol = gtk_column_view_column_new("Count", lfactory);
+	gtk_column_view_append_column(list, lcol);
+	g_object_unref(lcol);
+
+	lfactory = gtk_signal_list_item_factory_new();
+	g_signal_connect(lfactory, "setup", G_CALLBACK(list_setup_label), GINT_TO_POINTER(TRUE));
+	g_signal_connect(lfactory, "bind", G_CALLBACK(list_bind_path), NULL);
+	lcol = gtk_column_view_column_new("Item", lfactory);
+	gtk_column_view_column_set_expand(lcol, TRUE);
+	gtk_column_view_append_column(list, lcol);
+	g_object_unref(lcol);
 
 	/* }}} */
 
 	g_signal_connect(win->directory_choose, "clicked", G_CALLBACK(directory_choose_clicked), win);
 	g_signal_connect(win->listening, "clicked", G_CALLBACK(listening_clicked), win);
 	g_signal_connect(win->status_bar_clear, "clicked", G_CALLBACK(clear_clicked), win);
+	g_signal_connect_swapped(win->search_entry, "search-changed", G_CALLBACK(search_changed), win);
+	g_signal_connect_swapped(win->search_types, "notify::selected", G_CALLBACK(search_changed), win);
+	g_signal_connect_object(win->search, "items-changed", G_CALLBACK(search_items_changed), win, 0);
+
+	if (atomic_load(&trace_enabled))
+		g_signal_connect(win, "realize", G_CALLBACK(trace_frames), NULL);
+
+	stats_popover_build(win);
+	win->stats_id = g_timeout_add_seconds(1, stats_tick, win);
+
+	win->hot = hot_paths_new(HOT_PATHS_CAPACITY);
+	hot_view_build(win);
+	win->hot_id = g_timeout_add(HOT_REFRESH_MS, hot_tick, win);
+
 	g_signal_connect(win->directory_choose_entry, "changed", G_CALLBACK(choose_entry_changed), win);
 	g_signal_connect(win->directory_choose_entry, "activate", G_CALLBACK(choose_entry_activated), win);
 	g_signal_connect(win->view, "row_activated", G_CALLBACK(view_row_activated), win);
 }
 
+static void inotify_app_window_dispose(GObject *object)
+{
+	InotifyAppWindow *win = INOTIFY_APP_WINDOW(object);
+
+	/* Idles still posted by the listener must not touch the window any more */
+	listener_finish(win);
+	win->session++;
+	g_clear_pointer(&win->roots, g_ptr_array_unref);
+	g_clear_pointer(&win->run_roots, g_ptr_array_unref);
+	g_clear_pointer(&win->filter, path_filter_unref);
+
+	replay_finish(win, "Not listening...");
+	g_clear_pointer(&win->journal, journal_close);
+
+	if (win->stats_id != 0)
+	{
+		g_source_remove(win->stats_id);
+		win->stats_id = 0;
+	}
+
+	if (win->hot_id != 0)
+	{
+		g_source_remove(win->hot_id);
+		win->hot_id = 0;
+	}
+
+	g_clear_pointer(&win->hot, hot_paths_free);
+
+	g_clear_pointer(&win->metrics, metrics_close);
+	if (win->metrics_text)
+	{
+		g_string_free(win->metrics_text, TRUE);
+		win->metrics_text = NULL;
+	}
+
+	view_scan_cancel(win);
+	view_count_cancel(win);
+	view_watch_stop(win);
+
+	if (win->view_items)
+		view_items_clear(win);
+
+	g_clear_pointer(&win->view_items, g_sequence_free);
+	g_clear_pointer(&win->view_names, g_hash_table_destroy);
+
+	if (win->view_fd != -1)
+	{
+		close(win->view_fd);
+		win->view_fd = -1;
+	}
+
+	g_clear_pointer(&win->view_dir, g_free);
+	g_clear_pointer(&win->scan_dir, g_free);
+
+	g_clear_object(&win->search);
+	g_clear_object(&win->log);
+
+	G_OBJECT_CLASS(inotify_app_window_parent_class)->dispose(object);
+}
+
 static void inotify_app_window_class_init(InotifyAppWindowClass *class)
 {
+	G_OBJECT_CLASS(class)->dispose = inotify_app_window_dispose;
+
 	gtk_widget_class_set_template_from_resource(GTK_WIDGET_CLASS(class), "/org/gtk/inotifyapp/window.ui");
 
 	gtk_widget_class_bind_template_child(GTK_WIDGET_CLASS(class), InotifyAppWindow, directory_choose);
@@ -957,17 +2510,30 @@ static void inotify_app_window_class_init(InotifyAppWindowClass *class)
 	gtk_widget_class_bind_template_child(GTK_WIDGET_CLASS(class), InotifyAppWindow, list);
 	gtk_widget_class_bind_template_child(GTK_WIDGET_CLASS(class), InotifyAppWindow, view);
 	gtk_widget_class_bind_template_child(GTK_WIDGET_CLASS(class), InotifyAppWindow, listening);
+	gtk_widget_class_bind_template_child(GTK_WIDGET_CLASS(class), InotifyAppWindow, recursive);
+	gtk_widget_class_bind_template_child(GTK_WIDGET_CLASS(class), InotifyAppWindow, backend);
+	gtk_widget_class_bind_template_child(GTK_WIDGET_CLASS(class), InotifyAppWindow, coalesce);
 	gtk_widget_class_bind_template_child(GTK_WIDGET_CLASS(class), InotifyAppWindow, status_bar);
 	gtk_widget_class_bind_template_child(GTK_WIDGET_CLASS(class), InotifyAppWindow, status_bar_entries);
 	gtk_widget_class_bind_template_child(GTK_WIDGET_CLASS(class), InotifyAppWindow, status_bar_listening_image);
 	gtk_widget_class_bind_template_child(GTK_WIDGET_CLASS(class), InotifyAppWindow, status_bar_listening_status);
 	gtk_widget_class_bind_template_child(GTK_WIDGET_CLASS(class), InotifyAppWindow, status_bar_clear);
 	gtk_widget_class_bind_template_child(GTK_WIDGET_CLASS(class), InotifyAppWindow, status_bar_err);
+	gtk_widget_class_bind_template_child(GTK_WIDGET_CLASS(class), InotifyAppWindow, status_bar_overflows);
+	gtk_widget_class_bind_template_child(GTK_WIDGET_CLASS(class), InotifyAppWindow, status_bar_overflows_box);
+	gtk_widget_class_bind_template_child(GTK_WIDGET_CLASS(class), InotifyAppWindow, stats_popover);
+	gtk_widget_class_bind_template_child(GTK_WIDGET_CLASS(class), InotifyAppWindow, stats_grid);
 	gtk_widget_class_bind_template_child(GTK_WIDGET_CLASS(class), InotifyAppWindow, view_status_bar_contents);
 	gtk_widget_class_bind_template_child(GTK_WIDGET_CLASS(class), InotifyAppWindow, view_status_bar_modified);
 	gtk_widget_class_bind_template_child(GTK_WIDGET_CLASS(class), InotifyAppWindow, stack1);
 	gtk_widget_class_bind_template_child(GTK_WIDGET_CLASS(class), InotifyAppWindow, page1);
 	gtk_widget_class_bind_template_child(GTK_WIDGET_CLASS(class), InotifyAppWindow, page2);
+	gtk_widget_class_bind_template_child(GTK_WIDGET_CLASS(class), InotifyAppWindow, page3);
+	gtk_widget_class_bind_template_child(GTK_WIDGET_CLASS(class), InotifyAppWindow, hot_view);
+	gtk_widget_class_bind_template_child(GTK_WIDGET_CLASS(class), InotifyAppWindow, hot_status);
+	gtk_widget_class_bind_template_child(GTK_WIDGET_CLASS(class), InotifyAppWindow, search_entry);
+	gtk_widget_class_bind_template_child(GTK_WIDGET_CLASS(class), InotifyAppWindow, search_types);
+	gtk_widget_class_bind_template_child(GTK_WIDGET_CLASS(class), InotifyAppWindow, search_status);
 }
 
 InotifyAppWindow* inotify_app_window_new(InotifyApp *app)
@@ -982,4 +2548,51 @@ void inotify_app_window_open(InotifyAppWindow *win, GFile *file)
 	g_free(dir);
 }
 
+/*
+ * Limits what listening reports from the next run on: events to the IN_*
+ * types in events (0 for all), paths to what filter lets through.
+ */
+void inotify_app_window_set_filter(InotifyAppWindow *win, guint32 events, struct PathFilter *filter)
+{
+	g_clear_pointer(&win->filter, path_filter_unref);
+
+	win->events = events;
+	if (filter != NULL)
+		win->filter = path_filter_ref(filter);
+}
+
+/*
+ * Bounds what the event list keeps in memory and spills to disk, in bytes;
+ * rows past both are dropped, oldest first.
+ */
+void inotify_app_window_set_log_limits(InotifyAppWindow *win, gsize memory, gsize disk)
+{
+	event_log_set_limits(win->log, memory, disk);
+}
+
+/*
+ * Listens to file as well as to the directory in the entry, starting with
+ * the next run if not listening right now.
+ */
+void inotify_app_window_add_root(InotifyAppWindow *win, GFile *file)
+{
+	char *dir = g_file_get_path(file);
+
+	if (dir == NULL)
+		return;
+
+	if (win->listener && listener_is_running(win->listener))
+	{
+		struct ListenerRoot root = {0};
+
+		root.dir = dir;
+		root.recursive = gtk_check_button_get_active(GTK_CHECK_BUTTON(win->recursive));
+		root.events = win->events;
+		root.filter = win->filter;
+		roots_track(win, listener_add_root(win->listener, &root), dir);
+	}
+
+	g_ptr_array_add(win->roots, dir);
+}
+
 /* }}} */
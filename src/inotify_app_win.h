@@ -4,10 +4,18 @@
 #include <gtk/gtk.h>
 #include "inotify_app.h"
 
+struct PathFilter;
+
 #define INOTIFY_APP_WINDOW_TYPE (inotify_app_window_get_type())
 G_DECLARE_FINAL_TYPE(InotifyAppWindow, inotify_app_window, INOTIFY, APP_WINDOW, GtkApplicationWindow)
 
 InotifyAppWindow *inotify_app_window_new(InotifyApp *app);
 void inotify_app_window_open(InotifyAppWindow *win, GFile *file);
+void inotify_app_window_add_root(InotifyAppWindow *win, GFile *file);
+void inotify_app_window_set_filter(InotifyAppWindow *win, guint32 events, struct PathFilter *filter);
+void inotify_app_window_set_log_limits(InotifyAppWindow *win, gsize memory, gsize disk);
+void inotify_app_window_set_journal(InotifyAppWindow *win, const char *path);
+void inotify_app_window_set_metrics(InotifyAppWindow *win, const char *target);
+void inotify_app_window_replay(InotifyAppWindow *win, const char *path, double speed);
 
 #endif /* end of include guard: INOTIFY_APP_WIN_H_GU1TARQN */
@@ -0,0 +1,478 @@
+/* vim: set fdm=marker : */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "journal.h"
+
+/* Smallest segment that still fits a few records next to a PATH_MAX path */
+#define JOURNAL_SEGMENT_MIN (64 << 10)
+
+/* Largest segment whose every offset still fits the 32 bits records keep them in */
+#define JOURNAL_SEGMENT_MAX ((gsize) G_MAXUINT32)
+
+#define JOURNAL_ERROR g_quark_from_static_string("journal-error")
+
+struct Journal
+{
+	char *path;
+	gsize segment_size;
+	guint max_segments;
+	guint64 sequence;
+
+	/* Current segment */
+	int fd;
+	char *map;
+	struct JournalHeader *header;
+	gsize records_end;
+
+	/* Paths already in the current segment, keys point into the map */
+	GHashTable *paths;
+};
+
+struct JournalReader
+{
+	GPtrArray *files;
+	guint next_file;
+
+	/* Current segment */
+	char *map;
+	gsize size;
+	const struct JournalHeader *header;
+	guint64 index;
+};
+
+/* Segments {{{ */
+
+static char *segment_name(const char *path, guint64 sequence)
+{
+	return g_strdup_printf("%s.%06" G_GUINT64_FORMAT, path, sequence);
+}
+
+static gint sequence_cmp(gconstpointer a, gconstpointer b)
+{
+	guint64 sa = *(const guint64*) a;
+	guint64 sb = *(const guint64*) b;
+
+	return sa < sb ? -1 : sa > sb;
+}
+
+/* Sequence numbers of the segments that exist for path, in order */
+static GArray *segment_list(const char *path)
+{
+	GArray *seqs = g_array_new(FALSE, FALSE, sizeof(guint64));
+	char *dirname = g_path_get_dirname(path);
+	char *basename = g_path_get_basename(path);
+	size_t len = strlen(basename);
+	const char *name;
+	GDir *dir;
+
+	dir = g_dir_open(dirname, 0, NULL);
+	if (dir != NULL)
+	{
+		while ((name = g_dir_read_name(dir)) != NULL)
+		{
+			char *end;
+
+			if (strncmp(name, basename, len) != 0 || name[len] != '.' || !g_ascii_isdigit(name[len + 1]))
+				continue;
+
+			guint64 seq = g_ascii_strtoull(name + len + 1, &end, 10);
+			if (*end == '\0')
+				g_array_append_val(seqs, seq);
+		}
+
+		g_dir_close(dir);
+	}
+
+	g_array_sort(seqs, sequence_cmp);
+
+	g_free(basename);
+	g_free(dirname);
+
+	return seqs;
+}
+
+static void segment_close(struct Journal *journal)
+{
+	if (journal->map == NULL)
+		return;
+
+	g_hash_table_remove_all(journal->paths);
+
+	/* Written back by the kernel; nothing to flush by hand */
+	munmap(journal->map, journal->segment_size);
+	close(journal->fd);
+
+	journal->map = NULL;
+	journal->header = NULL;
+	journal->fd = -1;
+}
+
+/* Creates, preallocates and maps the next segment, dropping the oldest one past the limit */
+static gboolean segment_open(struct Journal *journal, GError **error)
+{
+	char *name;
+	int fd, res;
+	void *map;
+
+	name = segment_name(journal->path, journal->sequence);
+
+	fd = open(name, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1)
+	{
+		g_set_error(error, JOURNAL_ERROR, errno, "Can't create '%s': %s", name, strerror(errno));
+		g_free(name);
+		return FALSE;
+	}
+
+	/* Reserve the blocks now, so a full disk fails here and not as SIGBUS later */
+	res = posix_fallocate(fd, 0, journal->segment_size);
+	if (res == EOPNOTSUPP || res == EINVAL)
+		res = ftruncate(fd, journal->segment_size) == -1 ? errno : 0;
+
+	if (res != 0)
+	{
+		g_set_error(error, JOURNAL_ERROR, res, "Can't allocate '%s': %s", name, strerror(res));
+		close(fd);
+		unlink(name);
+		g_free(name);
+		return FALSE;
+	}
+
+	map = mmap(NULL, journal->segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED)
+	{
+		g_set_error(error, JOURNAL_ERROR, errno, "Can't map '%s': %s", name, strerror(errno));
+		close(fd);
+		unlink(name);
+		g_free(name);
+		return FALSE;
+	}
+
+	g_free(name);
+
+	journal->fd = fd;
+	journal->map = map;
+	journal->header = map;
+	journal->records_end = sizeof(struct JournalHeader);
+
+	memcpy(journal->header->magic, JOURNAL_MAGIC, sizeof(journal->header->magic));
+	journal->header->version = JOURNAL_VERSION;
+	journal->header->record_size = sizeof(struct JournalRecord);
+	journal->header->segment_size = journal->segment_size;
+	journal->header->sequence = journal->sequence;
+	journal->header->records = 0;
+	journal->header->paths_offset = journal->segment_size;
+	journal->header->first_time = 0;
+	journal->header->last_time = 0;
+
+	if (journal->sequence >= journal->max_segments)
+	{
+		name = segment_name(journal->path, journal->sequence - journal->max_segments);
+		unlink(name);
+		g_free(name);
+	}
+
+	return TRUE;
+}
+
+/* }}} */
+
+/* Writing {{{ */
+
+struct Journal *journal_open(const char *path, gsize segment_size, guint max_segments, GError **error)
+{
+	struct Journal *journal;
+	GArray *seqs;
+
+	journal = g_new0(struct Journal, 1);
+	journal->path = g_strdup(path);
+	journal->segment_size = CLAMP(segment_size, JOURNAL_SEGMENT_MIN, JOURNAL_SEGMENT_MAX);
+	journal->max_segments = MAX(max_segments, 1);
+	journal->fd = -1;
+	journal->paths = g_hash_table_new(g_str_hash, g_str_equal);
+
+	/* Continue after whatever an earlier run left, and trim it to the limit */
+	seqs = segment_list(path);
+	if (seqs->len > 0)
+		journal->sequence = g_array_index(seqs, guint64, seqs->len - 1) + 1;
+
+	for (guint i = 0; i < seqs->len; ++i)
+	{
+		guint64 seq = g_array_index(seqs, guint64, i);
+
+		if (seq + journal->max_segments > journal->sequence)
+			break;
+
+		char *name = segment_name(path, seq);
+		unlink(name);
+		g_free(name);
+	}
+
+	g_array_free(seqs, TRUE);
+
+	if (!segment_open(journal, error))
+	{
+		journal_close(journal);
+		return NULL;
+	}
+
+	return journal;
+}
+
+/*
+ * Stores path in the current segment unless it is there already and
+ * returns its offset, or 0 if the segment can't fit it next to one more
+ * record.
+ */
+static guint32 journal_intern(struct Journal *journal, const char *path)
+{
+	struct JournalHeader *header = journal->header;
+	gpointer offset;
+	size_t len;
+
+	offset = g_hash_table_lookup(journal->paths, path);
+	if (offset != NULL)
+		return GPOINTER_TO_UINT(offset);
+
+	len = strlen(path) + 1;
+	if (journal->records_end + sizeof(struct JournalRecord) + len > header->paths_offset)
+		return 0;
+
+	header->paths_offset -= len;
+	memcpy(journal->map + header->paths_offset, path, len);
+	g_hash_table_insert(journal->paths, journal->map + header->paths_offset,
+			GUINT_TO_POINTER((guint) header->paths_offset));
+
+	return header->paths_offset;
+}
+
+/*
+ * Appends events to the journal. Starting a new segment is the only thing
+ * that can fail; the events before the failure are kept.
+ */
+gboolean journal_append(struct Journal *journal, const struct RingEvent *events, guint n, GError **error)
+{
+	for (guint i = 0; i < n; ++i)
+	{
+		const struct RingEvent *ev = &events[i];
+		struct JournalRecord *record;
+		guint32 path = 0;
+
+		if (journal->records_end + sizeof(struct JournalRecord) > journal->header->paths_offset ||
+				(ev->path && (path = journal_intern(journal, ev->path)) == 0))
+		{
+			segment_close(journal);
+			journal->sequence++;
+
+			if (!segment_open(journal, error))
+				return FALSE;
+
+			/* A fresh segment always has room for a record and one path */
+			path = ev->path ? journal_intern(journal, ev->path) : 0;
+		}
+
+		record = (struct JournalRecord*) (journal->map + journal->records_end);
+		record->mask = ev->mask;
+		record->path = path;
+		record->time = ev->time;
+		record->count = ev->count;
+		record->span = (guint32) MIN((ev->last_time - ev->time) / 1000, G_MAXUINT32);
+
+		journal->records_end += sizeof(struct JournalRecord);
+
+		if (journal->header->records == 0)
+			journal->header->first_time = ev->time;
+
+		journal->header->last_time = ev->last_time;
+		journal->header->records++;
+	}
+
+	return TRUE;
+}
+
+void journal_close(struct Journal *journal)
+{
+	if (journal == NULL)
+		return;
+
+	segment_close(journal);
+
+	g_hash_table_destroy(journal->paths);
+	g_free(journal->path);
+	g_free(journal);
+}
+
+/* }}} */
+
+/* Reading {{{ */
+
+static void reader_unmap(struct JournalReader *reader)
+{
+	if (reader->map == NULL)
+		return;
+
+	munmap(reader->map, reader->size);
+
+	reader->map = NULL;
+	reader->header = NULL;
+	reader->index = 0;
+}
+
+static gboolean reader_map(struct JournalReader *reader, const char *name, GError **error)
+{
+	const struct JournalHeader *header;
+	struct stat st;
+	void *map;
+	int fd;
+
+	fd = open(name, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+	{
+		g_set_error(error, JOURNAL_ERROR, errno, "Can't open '%s': %s", name, strerror(errno));
+		return FALSE;
+	}
+
+	if (fstat(fd, &st) == -1 || (gsize) st.st_size < sizeof(struct JournalHeader))
+	{
+		g_set_error(error, JOURNAL_ERROR, EINVAL, "'%s' is not a journal", name);
+		close(fd);
+		return FALSE;
+	}
+
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+
+	if (map == MAP_FAILED)
+	{
+		g_set_error(error, JOURNAL_ERROR, errno, "Can't map '%s': %s", name, strerror(errno));
+		return FALSE;
+	}
+
+	header = map;
+	if (memcmp(header->magic, JOURNAL_MAGIC, sizeof(header->magic)) != 0 ||
+			header->version != JOURNAL_VERSION ||
+			header->record_size != sizeof(struct JournalRecord) ||
+			header->segment_size > (guint64) st.st_size ||
+			header->paths_offset > header->segment_size ||
+			header->records > (header->paths_offset - sizeof(struct JournalHeader)) / sizeof(struct JournalRecord))
+	{
+		g_set_error(error, JOURNAL_ERROR, EINVAL, "'%s' is not a journal", name);
+		munmap(map, st.st_size);
+		return FALSE;
+	}
+
+	reader->map = map;
+	reader->size = st.st_size;
+	reader->header = header;
+	reader->index = 0;
+
+	return TRUE;
+}
+
+/*
+ * Opens a single segment, or every segment of the journal at path in
+ * order when path itself is not a file.
+ */
+struct JournalReader *journal_reader_open(const char *path, GError **error)
+{
+	struct JournalReader *reader;
+
+	reader = g_new0(struct JournalReader, 1);
+	reader->files = g_ptr_array_new_with_free_func(g_free);
+
+	if (g_file_test(path, G_FILE_TEST_IS_REGULAR))
+		g_ptr_array_add(reader->files, g_strdup(path));
+	else
+	{
+		GArray *seqs = segment_list(path);
+
+		for (guint i = 0; i < seqs->len; ++i)
+			g_ptr_array_add(reader->files, segment_name(path, g_array_index(seqs, guint64, i)));
+
+		g_array_free(seqs, TRUE);
+	}
+
+	if (reader->files->len == 0)
+	{
+		g_set_error(error, JOURNAL_ERROR, ENOENT, "No journal at '%s'", path);
+		journal_reader_close(reader);
+		return NULL;
+	}
+
+	/* Only the first segment has to be valid; broken later ones are skipped */
+	if (!reader_map(reader, g_ptr_array_index(reader->files, 0), error))
+	{
+		journal_reader_close(reader);
+		return NULL;
+	}
+
+	reader->next_file = 1;
+
+	return reader;
+}
+
+/*
+ * Fills ev with the next event without consuming it. ev->path points into
+ * the mapped segment and stays valid until the reader is advanced; it must
+ * not be freed. Returns FALSE at the end of the journal.
+ */
+gboolean journal_reader_peek(struct JournalReader *reader, struct RingEvent *ev)
+{
+	const struct JournalRecord *record;
+
+	while (reader->map == NULL || reader->index >= reader->header->records)
+	{
+		reader_unmap(reader);
+
+		if (reader->next_file >= reader->files->len)
+			return FALSE;
+
+		reader_map(reader, g_ptr_array_index(reader->files, reader->next_file++), NULL);
+	}
+
+	record = (const struct JournalRecord*) (reader->map + sizeof(struct JournalHeader)) + reader->index;
+
+	ev->mask = record->mask;
+	ev->cookie = 0;
+	ev->root = 0;
+	ev->count = record->count;
+	ev->time = record->time;
+	ev->last_time = record->time + (gint64) record->span * 1000;
+	ev->dir = RING_EVENT_NONE;
+	ev->name = RING_EVENT_NONE;
+	ev->path = NULL;
+
+	if (record->path >= reader->header->paths_offset && record->path < reader->header->segment_size &&
+			memchr(reader->map + record->path, '\0', reader->header->segment_size - record->path) != NULL)
+		ev->path = reader->map + record->path;
+
+	return TRUE;
+}
+
+void journal_reader_advance(struct JournalReader *reader)
+{
+	if (reader->map != NULL)
+		reader->index++;
+}
+
+void journal_reader_close(struct JournalReader *reader)
+{
+	if (reader == NULL)
+		return;
+
+	reader_unmap(reader);
+
+	g_ptr_array_free(reader->files, TRUE);
+	g_free(reader);
+}
+
+/* }}} */
@@ -0,0 +1,69 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <glib.h>
+
+#include "event_ring.h"
+
+/*
+ * Append-only binary event journal.
+ *
+ * The journal is a sequence of segment files named <path>.<sequence>. Each
+ * segment is preallocated and mapped, fixed-size records grow from the
+ * header towards the end and the paths they refer to are interned into a
+ * section that grows from the end towards the records. Appending is a
+ * memcpy; only starting a new segment costs syscalls. Once max_segments
+ * exist the oldest one is removed.
+ */
+
+#define JOURNAL_MAGIC "INJRNL\0\1"
+#define JOURNAL_VERSION 1
+
+/* Defaults for journal_open() */
+#define JOURNAL_SEGMENT_SIZE (64 << 20)
+#define JOURNAL_MAX_SEGMENTS 8
+
+struct JournalHeader
+{
+	char magic[8];
+	guint32 version;
+	guint32 record_size;
+	guint64 segment_size;
+	guint64 sequence;
+
+	/* Records following the header */
+	guint64 records;
+
+	/* Start of the path section, which ends at segment_size */
+	guint64 paths_offset;
+
+	gint64 first_time;
+	gint64 last_time;
+};
+
+/*
+ * One journaled event. path is the offset of a NUL-terminated path within
+ * the segment, 0 for events without one; span is in ms, as in the log.
+ */
+struct JournalRecord
+{
+	guint32 mask;
+	guint32 path;
+	gint64 time;
+	guint32 count;
+	guint32 span;
+};
+
+struct Journal;
+struct JournalReader;
+
+struct Journal *journal_open(const char *path, gsize segment_size, guint max_segments, GError **error);
+gboolean journal_append(struct Journal *journal, const struct RingEvent *events, guint n, GError **error);
+void journal_close(struct Journal *journal);
+
+struct JournalReader *journal_reader_open(const char *path, GError **error);
+gboolean journal_reader_peek(struct JournalReader *reader, struct RingEvent *ev);
+void journal_reader_advance(struct JournalReader *reader);
+void journal_reader_close(struct JournalReader *reader);
+
+#endif /* end of include guard: JOURNAL_H */
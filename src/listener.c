@@ -0,0 +1,1074 @@
+/* vim: set fdm=marker : */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <linux/limits.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/fanotify.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "coalescer.h"
+#include "event_ring.h"
+#include "listener.h"
+#include "listener_private.h"
+#include "string_table.h"
+#include "trace.h"
+
+/* Largest single event either backend can return */
+#define LISTENER_EVENT_MAX (sizeof(struct fanotify_event_metadata) + \
+		sizeof(struct fanotify_event_info_fid) + MAX_HANDLE_SZ + NAME_MAX + 1)
+
+/* Directories watched per loop iteration while a recursive walk runs */
+#define LISTENER_WALK_STEP 64
+
+/* epoll tags of the two descriptors the thread waits on */
+#define LISTENER_POLL_WAKE 0
+#define LISTENER_POLL_NOTIFY 1
+
+/* Masks made of these bits get their names joined, see listener_event_name() */
+#define LISTENER_NAME_BITS 12
+
+/* Helpers {{{ */
+
+/* IN_* names by bit position */
+static const char *const event_names[32] =
+{
+	[0] = "IN_ACCESS",
+	[1] = "IN_MODIFY",
+	[2] = "IN_ATTRIB",
+	[3] = "IN_CLOSE_WRITE",
+	[4] = "IN_CLOSE_NOWRITE",
+	[5] = "IN_OPEN",
+	[6] = "IN_MOVED_FROM",
+	[7] = "IN_MOVED_TO",
+	[8] = "IN_CREATE",
+	[9] = "IN_DELETE",
+	[10] = "IN_DELETE_SELF",
+	[11] = "IN_MOVE_SELF",
+	[13] = "IN_UNMOUNT",
+	[14] = "IN_Q_OVERFLOW",
+	[15] = "IN_IGNORED",
+};
+
+/*
+ * Names every event bit set in mask, joined by '|' as in
+ * "IN_OPEN|IN_CLOSE_NOWRITE" (fanotify merges events). Single bits come
+ * straight from the table; combinations are joined the first time they are
+ * seen and kept, so this never allocates in steady state. Flags such as
+ * IN_ISDIR are left out. Safe to call from any thread.
+ */
+const char *listener_event_name(guint32 mask)
+{
+	static const char *joined[1 << LISTENER_NAME_BITS];
+	guint32 bits = mask & ((1u << LISTENER_NAME_BITS) - 1);
+	const char *name;
+	char *built;
+	GString *str;
+
+	if (bits == 0)
+	{
+		bits = mask & (IN_UNMOUNT | IN_Q_OVERFLOW | IN_IGNORED);
+		return bits != 0 ? event_names[g_bit_nth_lsf(bits, -1)] : "";
+	}
+
+	if ((bits & (bits - 1)) == 0)
+		return event_names[g_bit_nth_lsf(bits, -1)];
+
+	name = g_atomic_pointer_get(&joined[bits]);
+	if (name != NULL)
+		return name;
+
+	str = g_string_new(NULL);
+	for (gint bit = -1; (bit = g_bit_nth_lsf(bits, bit)) != -1;)
+	{
+		if (str->len > 0)
+			g_string_append_c(str, '|');
+
+		g_string_append(str, event_names[bit]);
+	}
+
+	built = g_string_free(str, FALSE);
+
+	/* Another thread may have joined the same mask meanwhile */
+	if (!g_atomic_pointer_compare_and_exchange(&joined[bits], NULL, built))
+	{
+		g_free(built);
+		return g_atomic_pointer_get(&joined[bits]);
+	}
+
+	return built;
+}
+
+/*
+ * Parses a comma-separated list of event names, as in "create,delete" or
+ * "IN_CLOSE_WRITE", into IN_* bits.
+ */
+gboolean listener_parse_events(const char *list, guint32 *events, GError **error)
+{
+	static const struct
+	{
+		const char *name;
+		guint32 mask;
+	} names[] =
+	{
+		{ "open", IN_OPEN },
+		{ "close", IN_CLOSE },
+		{ "close_write", IN_CLOSE_WRITE },
+		{ "close_nowrite", IN_CLOSE_NOWRITE },
+		{ "move", IN_MOVE },
+		{ "moved_from", IN_MOVED_FROM },
+		{ "moved_to", IN_MOVED_TO },
+		{ "create", IN_CREATE },
+		{ "delete", IN_DELETE },
+		{ "delete_self", IN_DELETE_SELF },
+		{ "modify", IN_MODIFY },
+		{ "move_self", IN_MOVE_SELF },
+		{ "all", LISTENER_EVENTS },
+	};
+
+	char **items = g_strsplit(list, ",", -1);
+	guint32 mask = 0;
+
+	for (char **item = items; *item; ++item)
+	{
+		char *name = g_strstrip(*item);
+		guint i;
+
+		if (*name == '\0')
+			continue;
+
+		if (g_ascii_strncasecmp(name, "IN_", 3) == 0)
+			name += 3;
+
+		for (i = 0; i < G_N_ELEMENTS(names); ++i)
+		{
+			if (g_ascii_strcasecmp(name, names[i].name) == 0)
+				break;
+		}
+
+		if (i == G_N_ELEMENTS(names))
+		{
+			g_set_error(error, g_quark_from_static_string("listener-error"), EINVAL,
+					"Unknown event '%s'", *item);
+			g_strfreev(items);
+			return FALSE;
+		}
+
+		mask |= names[i].mask;
+	}
+
+	g_strfreev(items);
+	*events = mask;
+
+	return TRUE;
+}
+
+void listener_error(struct Listener *listener, guint root, const char *format, ...)
+{
+	va_list args;
+	char *message;
+
+	va_start(args, format);
+	message = g_strdup_vprintf(format, args);
+	va_end(args);
+
+	listener->state_func(listener, LISTENER_ERROR, root, message, listener->state_data);
+	g_free(message);
+}
+
+void listener_status(struct Listener *listener, guint root, const char *format, ...)
+{
+	va_list args;
+	char *message;
+
+	va_start(args, format);
+	message = g_strdup_vprintf(format, args);
+	va_end(args);
+
+	listener->state_func(listener, LISTENER_STATUS, root, message, listener->state_data);
+	g_free(message);
+}
+
+/* A root that is still watched, or NULL. Listener thread only */
+struct ListenerRootState *listener_get_root(struct Listener *listener, guint id)
+{
+	struct ListenerRootState *root = g_hash_table_lookup(listener->roots, GUINT_TO_POINTER(id));
+
+	if (root == NULL || !atomic_load_explicit(&root->active, memory_order_relaxed))
+		return NULL;
+
+	return root;
+}
+
+/* Sets the root directory, without trailing slashes unless it is "/" */
+void listener_root_set_dir(struct ListenerRootState *root, const char *dir)
+{
+	g_free(root->dir);
+	root->dir = g_strdup(dir);
+
+	root->dir_len = strlen(root->dir);
+	while (root->dir_len > 1 && root->dir[root->dir_len - 1] == '/')
+		root->dir[--root->dir_len] = '\0';
+}
+
+/* path relative to the root, or NULL if it isn't below it */
+const char *listener_root_relative(struct ListenerRootState *root, const char *path)
+{
+	if (strncmp(path, root->dir, root->dir_len) != 0)
+		return NULL;
+
+	path += root->dir_len;
+
+	/* The root "/" keeps its slash */
+	if (*path != '\0' && *path != '/' && root->dir_len > 1)
+		return NULL;
+
+	while (*path == '/')
+		path++;
+
+	return path;
+}
+
+/*
+ * Whether the root's event types and path filter let an event for path
+ * through; counts it either way. path is only looked at, and may be NULL,
+ * when the root has no filter.
+ */
+gboolean listener_root_accepts(struct ListenerRootState *root, guint32 mask, const char *path)
+{
+	gboolean pass = root->events == 0 || (mask & root->events) != 0;
+
+	if (pass && root->filter != NULL)
+	{
+		const char *rel = listener_root_relative(root, path);
+
+		if (rel != NULL)
+			pass = path_filter_match(root->filter, rel, (mask & IN_ISDIR) != 0);
+	}
+
+	if (!pass)
+	{
+		listener_count(&root->n_filtered, 1);
+		return FALSE;
+	}
+
+	listener_count(&root->n_events, 1);
+	return TRUE;
+}
+
+/* Hands an event that made it through coalescing over to the consumer */
+static void listener_push(struct RingEvent *ev, gpointer data)
+{
+	struct Listener *listener = data;
+
+	if (!event_ring_push(listener->ring, ev))
+		listener_count(&listener->n_dropped, 1);
+
+	if (ev->count > 1)
+		listener_count(&listener->n_coalesced, ev->count - 1);
+
+	listener->pushed++;
+}
+
+/*
+ * Interns a directory or entry name for RingEvent.dir and .name. Only the
+ * first sighting of a string copies it; every later one is a hash lookup.
+ * Ids are only good within listener->paths_generation, so backends that
+ * keep them around have to check it.
+ */
+guint32 listener_intern(struct Listener *listener, const char *str)
+{
+	guint current = listener->paths_current;
+
+	return string_table_intern(listener->paths[current], str) | current << LISTENER_PATHS_BIT;
+}
+
+/*
+ * Moves on to the other path table once the current one is full and the
+ * consumer is done with the one before. Everything the coalescer holds is
+ * released first, so no event pushed from now on uses the old table.
+ */
+static void listener_rotate_paths(struct Listener *listener)
+{
+	struct StringTable *table = listener->paths[listener->paths_current];
+
+	if (table->bytes + string_table_size(table) * LISTENER_PATH_OVERHEAD < LISTENER_PATHS_MAX ||
+			atomic_load_explicit(&listener->paths_retiring, memory_order_acquire) != 0)
+		return;
+
+	coalescer_flush(listener->coalescer, G_MAXINT64);
+
+	atomic_store_explicit(&listener->paths_retire_at,
+			atomic_load_explicit(&listener->ring->head, memory_order_relaxed), memory_order_relaxed);
+	atomic_store_explicit(&listener->paths_retiring, listener->paths_current + 1, memory_order_release);
+
+	listener->paths_current ^= 1;
+	listener->paths_generation++;
+	listener->paths[listener->paths_current] = string_table_new();
+}
+
+/* Queues an event for a path interned with listener_intern() */
+void listener_emit(struct Listener *listener, struct RingEvent *ev)
+{
+	ev->path = NULL;
+	coalescer_add(listener->coalescer, ev);
+}
+
+/* Queues a marker for events the kernel had to throw away */
+void listener_overflow(struct Listener *listener, gint64 now)
+{
+	struct RingEvent ev;
+
+	ev.mask = IN_Q_OVERFLOW;
+	ev.cookie = 0;
+	ev.count = 1;
+	ev.root = 0;
+	ev.time = now;
+	ev.last_time = now;
+	ev.dir = RING_EVENT_NONE;
+	ev.name = RING_EVENT_NONE;
+
+	atomic_fetch_add_explicit(&listener->overflows, 1, memory_order_relaxed);
+	listener_emit(listener, &ev);
+}
+
+/* Wakes a consumer sleeping on listener_get_fd() */
+static void listener_notify(struct Listener *listener)
+{
+	if (listener->notify_fd != -1 && listener->pushed > 0)
+		eventfd_write(listener->notify_fd, 1);
+
+	listener->pushed = 0;
+}
+
+/* }}} */
+
+/* Roots {{{ */
+
+static void listener_root_free(gpointer data)
+{
+	struct ListenerRootState *root = data;
+
+	path_filter_unref(root->filter);
+	g_free(root->handle);
+	g_free(root->dir);
+	g_free(root);
+}
+
+static void listener_command_free(gpointer data)
+{
+	struct ListenerCommand *cmd = data;
+
+	if (cmd->add != NULL)
+		listener_root_free(cmd->add);
+
+	g_free(cmd);
+}
+
+static void listener_queue(struct Listener *listener, guint id, struct ListenerRootState *add)
+{
+	struct ListenerCommand *cmd = g_new(struct ListenerCommand, 1);
+
+	cmd->id = id;
+	cmd->add = add;
+
+	g_mutex_lock(&listener->lock);
+	g_queue_push_tail(&listener->commands, cmd);
+	g_mutex_unlock(&listener->lock);
+}
+
+/* Starts watching a root; on failure it is reported and kept as inactive */
+static void listener_add(struct Listener *listener, struct ListenerRootState *root)
+{
+	struct stat dir_stat;
+
+	g_mutex_lock(&listener->lock);
+	g_hash_table_insert(listener->roots, GUINT_TO_POINTER(root->id), root);
+	g_mutex_unlock(&listener->lock);
+
+	if (stat(root->dir, &dir_stat) == -1)
+	{
+		listener_error(listener, root->id, "Can't watch '%s': %s", root->dir, strerror(errno));
+		return;
+	}
+
+	if (!S_ISDIR(dir_stat.st_mode))
+	{
+		listener_error(listener, root->id, "Can't watch '%s': it is not directory!", root->dir);
+		return;
+	}
+
+	if (listener->add(listener, root) == -1)
+		return;
+
+	atomic_store(&root->active, 1);
+	listener->n_active++;
+}
+
+/*
+ * Stops watching a root. Its counters stay readable until the listener is
+ * freed. The listener thread stops once no root is left.
+ */
+void listener_drop_root(struct Listener *listener, struct ListenerRootState *root)
+{
+	if (!atomic_load(&root->active))
+		return;
+
+	listener->remove(listener, root);
+
+	atomic_store(&root->active, 0);
+	listener->n_active--;
+}
+
+/* Applies the roots added and removed since the last call */
+static void listener_run_commands(struct Listener *listener)
+{
+	struct ListenerCommand *cmd;
+
+	while (1)
+	{
+		g_mutex_lock(&listener->lock);
+		cmd = g_queue_pop_head(&listener->commands);
+		g_mutex_unlock(&listener->lock);
+
+		if (cmd == NULL)
+			break;
+
+		if (cmd->add != NULL)
+			listener_add(listener, cmd->add);
+		else
+		{
+			struct ListenerRootState *root = listener_get_root(listener, cmd->id);
+
+			if (root != NULL)
+				listener_drop_root(listener, root);
+		}
+
+		g_free(cmd);
+	}
+}
+
+/* }}} */
+
+/* Thread {{{ */
+
+/*
+ * Reads until the notification queue is empty. The read buffer doubles, up to
+ * LISTENER_READ_MAX, whenever a read leaves no room for another full-sized
+ * event, so a busy queue is emptied in as few syscalls as possible.
+ */
+static int handle_events(struct Listener *listener)
+{
+	ssize_t len;
+	GString *str;
+	int total = 0;
+	gint64 span = trace_begin();
+
+	str = g_string_new(NULL);
+
+	while (atomic_load_explicit(&listener->stop, memory_order_relaxed) == 0)
+	{
+		gint64 read_span = trace_begin();
+
+		len = read(listener->fd, listener->buf, listener->buf_size);
+		trace_end("read", read_span, len);
+
+		if (len == -1)
+		{
+			if (errno == EINTR)
+				continue;
+
+			if (errno == EAGAIN)
+				break;
+
+			listener_error(listener, 0, "read: %s", strerror(errno));
+
+			g_string_free(str, TRUE);
+			return -1;
+		}
+
+		gint64 decode_span = trace_begin();
+		int res = listener->handle(listener, listener->buf, len, str);
+		trace_end("decode", decode_span, res);
+
+		if (res == -1)
+		{
+			g_string_free(str, TRUE);
+			return -1;
+		}
+
+		total += res;
+
+		listener_count(&listener->n_reads, 1);
+		listener_count(&listener->n_bytes, len);
+		listener_count(&listener->n_read_events, res);
+
+		if (listener->buf_size - len < LISTENER_EVENT_MAX && listener->buf_size < LISTENER_READ_MAX)
+		{
+			listener->buf_size *= 2;
+			listener->buf = g_realloc(listener->buf, listener->buf_size);
+		}
+	}
+
+	g_string_free(str, TRUE);
+	trace_end("handle_events", span, total);
+
+	return total;
+}
+
+/* Poll timeout in ms: the next coalescing deadline, or none at all */
+static int listener_timeout(struct Listener *listener)
+{
+	gint64 deadline;
+
+	/* Don't sleep while part of the tree is still waiting to be watched */
+	if (listener->pending.length > 0)
+		return 0;
+
+	deadline = coalescer_next_deadline(listener->coalescer);
+	if (deadline == -1)
+		return -1;
+
+	deadline -= g_get_real_time();
+	return deadline <= 0 ? 0 : (int) ((deadline + 999) / 1000);
+}
+
+static void listener_loop(struct Listener *listener)
+{
+	struct epoll_event events[2];
+	int n;
+
+	while (atomic_load_explicit(&listener->stop, memory_order_relaxed) == 0)
+	{
+		n = epoll_wait(listener->epfd, events, G_N_ELEMENTS(events), listener_timeout(listener));
+		if (n == -1)
+		{
+			if (errno == EINTR)
+				continue;
+
+			listener_error(listener, 0, "epoll_wait: %s", strerror(errno));
+			break;
+		}
+
+		for (int i = 0; i < n; ++i)
+		{
+			if (events[i].data.u32 == LISTENER_POLL_WAKE)
+			{
+				eventfd_t value;
+
+				eventfd_read(listener->efd, &value);
+				listener_run_commands(listener);
+			}
+			else
+			{
+				listener_count(&listener->n_wakeups, 1);
+
+				if (handle_events(listener) == -1)
+					atomic_store(&listener->stop, 1);
+			}
+		}
+
+		listener_rotate_paths(listener);
+
+		gint64 span = trace_begin();
+		coalescer_flush(listener->coalescer, g_get_real_time());
+		trace_end("coalescer_flush", span, TRACE_NONE);
+
+		if (listener->pending.length > 0)
+		{
+			listener_inotify_walk(listener, LISTENER_WALK_STEP);
+
+			if (listener->pending.length == 0)
+				listener_status(listener, 0, "Listening to %u directories...",
+						g_hash_table_size(listener->wd_dirs));
+		}
+
+		listener_notify(listener);
+
+		/* Every root was removed or is gone */
+		if (listener->n_active == 0)
+			break;
+	}
+}
+
+/*
+ * Sets up the backend and everything the loop needs, then applies the roots
+ * queued so far. The benchmarks call it, and the backend's handle(), on
+ * their own thread instead of starting one.
+ */
+int listener_open(struct Listener *listener)
+{
+	struct epoll_event event;
+	int res;
+
+	if (listener->backend == LISTENER_BACKEND_FANOTIFY)
+		res = listener_fanotify_setup(listener);
+	else
+		res = listener_inotify_setup(listener);
+
+	if (res == -1)
+		return -1;
+
+	listener->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (listener->epfd == -1)
+	{
+		listener_error(listener, 0, "epoll_create1: %s", strerror(errno));
+		return -1;
+	}
+
+	event.events = EPOLLIN;
+	event.data.u32 = LISTENER_POLL_WAKE;
+	epoll_ctl(listener->epfd, EPOLL_CTL_ADD, listener->efd, &event);
+
+	event.events = EPOLLIN;
+	event.data.u32 = LISTENER_POLL_NOTIFY;
+	epoll_ctl(listener->epfd, EPOLL_CTL_ADD, listener->fd, &event);
+
+	listener->buf_size = LISTENER_READ_MIN;
+	listener->buf = g_malloc(listener->buf_size);
+	listener->coalescer = coalescer_new((gint64) listener->coalesce_ms * 1000, listener_push, listener);
+
+	/* The roots passed to listener_start() */
+	listener_run_commands(listener);
+
+	return 0;
+}
+
+/* Undoes listener_open(), even one that failed halfway */
+void listener_close(struct Listener *listener)
+{
+	/* Closing the descriptor drops every watch or mark at once */
+	if (listener->epfd != -1)
+		close(listener->epfd);
+
+	if (listener->fd != -1)
+		close(listener->fd);
+
+	listener->epfd = -1;
+	listener->fd = -1;
+
+	/* Let the events still held back reach the consumer */
+	coalescer_free(listener->coalescer);
+	listener->coalescer = NULL;
+
+	g_free(listener->buf);
+	listener->buf = NULL;
+
+	listener_inotify_cleanup(listener);
+	listener_fanotify_cleanup(listener);
+}
+
+static gpointer listener_thread(gpointer data)
+{
+	struct Listener *listener = data;
+	GHashTableIter iter;
+	gpointer root;
+
+	if (listener_open(listener) == 0 && listener->n_active > 0)
+	{
+		listener->state_func(listener, LISTENER_STARTED, 0, NULL, listener->state_data);
+
+		if (listener->pending.length > 0)
+			listener_status(listener, 0, "Listening, scanning tree...");
+
+		listener_loop(listener);
+	}
+
+	listener_close(listener);
+
+	g_mutex_lock(&listener->lock);
+
+	g_hash_table_iter_init(&iter, listener->roots);
+	while (g_hash_table_iter_next(&iter, NULL, &root))
+		atomic_store(&((struct ListenerRootState*) root)->active, 0);
+
+	/* Roots queued from now on will never be watched */
+	g_queue_clear_full(&listener->commands, listener_command_free);
+	atomic_store(&listener->running, 0);
+
+	g_mutex_unlock(&listener->lock);
+
+	listener->pushed++;
+	listener_notify(listener);
+
+	listener->state_func(listener, LISTENER_STOPPED, 0, NULL, listener->state_data);
+	return NULL;
+}
+
+/* }}} */
+
+/* Public API {{{ */
+
+static struct ListenerRootState *listener_root_new(guint id, const struct ListenerRoot *root)
+{
+	struct ListenerRootState *state = g_new0(struct ListenerRootState, 1);
+
+	state->id = id;
+	state->recursive = root->recursive;
+	state->events = root->events & LISTENER_EVENTS;
+	state->wd = -1;
+
+	listener_root_set_dir(state, root->dir);
+
+	if (root->filter != NULL && !path_filter_is_empty(root->filter))
+		state->filter = path_filter_ref(root->filter);
+
+	atomic_init(&state->n_events, 0);
+	atomic_init(&state->n_filtered, 0);
+	atomic_init(&state->n_watches, 0);
+	atomic_init(&state->active, 0);
+
+	return state;
+}
+
+/*
+ * Everything listener_start() does short of starting the thread. Roots are
+ * queued, not watched yet.
+ */
+struct Listener *listener_new(const struct ListenerOptions *options,
+		ListenerStateFunc func,
+		gpointer data,
+		GError **error)
+{
+	struct Listener *listener;
+	int efd, notify_fd;
+
+	efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (efd == -1)
+	{
+		g_set_error(error, g_quark_from_static_string("listener-error"), errno,
+				"eventfd: %s", strerror(errno));
+		return NULL;
+	}
+
+	notify_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (notify_fd == -1)
+	{
+		g_set_error(error, g_quark_from_static_string("listener-error"), errno,
+				"eventfd: %s", strerror(errno));
+		close(efd);
+		return NULL;
+	}
+
+	listener = g_new0(struct Listener, 1);
+	listener->backend = options->backend;
+	listener->coalesce_ms = options->coalesce_ms;
+	listener->state_func = func;
+	listener->state_data = data;
+	listener->efd = efd;
+	listener->notify_fd = notify_fd;
+	listener->fd = -1;
+	listener->epfd = -1;
+	g_queue_init(&listener->pending);
+
+	g_mutex_init(&listener->lock);
+	g_queue_init(&listener->commands);
+	listener->roots = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, listener_root_free);
+
+	for (guint i = 0; i < options->n_roots; ++i)
+	{
+		guint id = ++listener->next_root;
+		listener_queue(listener, id, listener_root_new(id, &options->roots[i]));
+	}
+
+	listener->ring = event_ring_new(options->ring_size ? options->ring_size : LISTENER_RING_SIZE);
+	listener->paths[0] = string_table_new();
+	listener->batch_size = 1024;
+	listener->batch = g_new(struct RingEvent, listener->batch_size);
+	listener->batch_paths = g_string_sized_new(64 * 1024);
+
+	atomic_init(&listener->paths_retiring, 0);
+	atomic_init(&listener->paths_retire_at, 0);
+	atomic_init(&listener->overflows, 0);
+	atomic_init(&listener->n_wakeups, 0);
+	atomic_init(&listener->n_reads, 0);
+	atomic_init(&listener->n_bytes, 0);
+	atomic_init(&listener->n_read_events, 0);
+	atomic_init(&listener->n_coalesced, 0);
+	atomic_init(&listener->n_dropped, 0);
+	atomic_init(&listener->n_drained, 0);
+	atomic_init(&listener->n_drains, 0);
+	atomic_init(&listener->drain_time, 0);
+	atomic_init(&listener->running, 1);
+	atomic_init(&listener->stop, 0);
+
+	return listener;
+}
+
+/*
+ * Starts listening to options->roots on a new thread. func gets every state
+ * change of the listener from that thread. With the fd from
+ * listener_get_fd() a consumer can sleep until events arrive; otherwise it
+ * simply drains periodically.
+ */
+struct Listener *listener_start(const struct ListenerOptions *options,
+		ListenerStateFunc func,
+		gpointer data,
+		GError **error)
+{
+	struct Listener *listener = listener_new(options, func, data, error);
+
+	if (listener != NULL)
+		listener->thread = g_thread_new("listener", listener_thread, listener);
+
+	return listener;
+}
+
+/*
+ * Stops the thread if it still runs and waits for it. Events queued before
+ * it stopped can still be drained afterwards.
+ */
+void listener_stop(struct Listener *listener)
+{
+	if (listener->thread == NULL)
+		return;
+
+	atomic_store(&listener->stop, 1);
+	eventfd_write(listener->efd, 1);
+
+	g_thread_join(listener->thread);
+	listener->thread = NULL;
+}
+
+/* Stops the listener if needed and frees it along with undrained events */
+void listener_free(struct Listener *listener)
+{
+	if (listener == NULL)
+		return;
+
+	listener_stop(listener);
+
+	close(listener->efd);
+	close(listener->notify_fd);
+
+	event_ring_free(listener->ring);
+	string_table_free(listener->paths[0]);
+	string_table_free(listener->paths[1]);
+	g_free(listener->batch);
+	g_string_free(listener->batch_paths, TRUE);
+
+	g_hash_table_destroy(listener->roots);
+	g_queue_clear_full(&listener->commands, listener_command_free);
+	g_mutex_clear(&listener->lock);
+	g_free(listener);
+}
+
+/*
+ * Queues another root and returns its id, which events seen under it carry
+ * in RingEvent.root. If it can't be watched, a LISTENER_ERROR for the id
+ * follows. Must be called from the consumer thread.
+ */
+guint listener_add_root(struct Listener *listener, const struct ListenerRoot *root)
+{
+	guint id = ++listener->next_root;
+
+	listener_queue(listener, id, listener_root_new(id, root));
+	eventfd_write(listener->efd, 1);
+
+	return id;
+}
+
+/*
+ * Stops watching a root. Events it already queued are still drained, and
+ * the listener stops on its own once its last root is removed.
+ */
+void listener_remove_root(struct Listener *listener, guint root)
+{
+	listener_queue(listener, root, NULL);
+	eventfd_write(listener->efd, 1);
+}
+
+/* FALSE if there is no root with that id (yet) */
+gboolean listener_get_root_stats(struct Listener *listener, guint root, struct ListenerRootStats *stats)
+{
+	struct ListenerRootState *state;
+
+	g_mutex_lock(&listener->lock);
+
+	state = g_hash_table_lookup(listener->roots, GUINT_TO_POINTER(root));
+	if (state != NULL)
+	{
+		stats->events = atomic_load_explicit(&state->n_events, memory_order_relaxed);
+		stats->filtered = atomic_load_explicit(&state->n_filtered, memory_order_relaxed);
+		stats->watches = atomic_load_explicit(&state->n_watches, memory_order_relaxed);
+		stats->active = atomic_load_explicit(&state->active, memory_order_relaxed);
+	}
+
+	g_mutex_unlock(&listener->lock);
+
+	return state != NULL;
+}
+
+gboolean listener_is_running(struct Listener *listener)
+{
+	return atomic_load(&listener->running) != 0;
+}
+
+/*
+ * Becomes readable whenever new events were queued or the listener
+ * stopped. listener_drain() resets it.
+ */
+int listener_get_fd(struct Listener *listener)
+{
+	return listener->notify_fd;
+}
+
+/* A string interned with listener_intern(), from whichever table it is in */
+static const char *listener_lookup(struct Listener *listener, guint32 id)
+{
+	return string_table_lookup(listener->paths[id >> LISTENER_PATHS_BIT], id & ~(1u << LISTENER_PATHS_BIT));
+}
+
+/*
+ * Frees the path table the listener thread moved away from, once every
+ * event pushed before it did has been drained.
+ */
+static void listener_retire_paths(struct Listener *listener)
+{
+	int retiring = atomic_load_explicit(&listener->paths_retiring, memory_order_acquire);
+	guint tail;
+
+	if (retiring == 0)
+		return;
+
+	tail = atomic_load_explicit(&listener->ring->tail, memory_order_relaxed);
+	if ((gint) (tail - atomic_load_explicit(&listener->paths_retire_at, memory_order_relaxed)) < 0)
+		return;
+
+	/* The thread won't switch again before this is released */
+	string_table_free(listener->paths[retiring - 1]);
+	listener->paths[retiring - 1] = NULL;
+
+	atomic_store_explicit(&listener->paths_retiring, 0, memory_order_release);
+}
+
+/*
+ * Joins the interned dir and name of every event in the batch into one
+ * buffer that is reused from batch to batch, and points the events at it.
+ * The buffer is sized up front, so the pointers stay valid.
+ */
+static void listener_resolve(struct Listener *listener, struct RingEvent *events, guint n)
+{
+	GString *buf = listener->batch_paths;
+	gsize total = 0, pos = 0;
+
+	for (guint i = 0; i < n; ++i)
+	{
+		if (events[i].dir == RING_EVENT_NONE)
+			continue;
+
+		total += strlen(listener_lookup(listener, events[i].dir)) + 1;
+		if (events[i].name != RING_EVENT_NONE)
+			total += strlen(listener_lookup(listener, events[i].name)) + 1;
+	}
+
+	if (buf->allocated_len <= total)
+		g_string_set_size(buf, total);
+
+	for (guint i = 0; i < n; ++i)
+	{
+		struct RingEvent *ev = &events[i];
+		const char *dir, *name;
+		size_t len;
+
+		if (ev->dir == RING_EVENT_NONE)
+		{
+			ev->path = NULL;
+			continue;
+		}
+
+		ev->path = buf->str + pos;
+
+		dir = listener_lookup(listener, ev->dir);
+		len = strlen(dir);
+		memcpy(buf->str + pos, dir, len);
+		pos += len;
+
+		if (ev->name != RING_EVENT_NONE)
+		{
+			if (len == 0 || dir[len - 1] != '/')
+				buf->str[pos++] = '/';
+
+			name = listener_lookup(listener, ev->name);
+			len = strlen(name);
+			memcpy(buf->str + pos, name, len);
+			pos += len;
+		}
+
+		buf->str[pos++] = '\0';
+	}
+}
+
+/*
+ * Passes up to max queued events to func, in batches, and returns how many
+ * there were. Must always be called from the same thread.
+ */
+guint listener_drain(struct Listener *listener, ListenerBatchFunc func, gpointer data, guint max)
+{
+	eventfd_t value;
+	guint n, total = 0;
+	gint64 start = g_get_monotonic_time();
+	gint64 span = trace_begin();
+
+	eventfd_read(listener->notify_fd, &value);
+
+	while (total < max &&
+			(n = event_ring_pop(listener->ring, listener->batch, MIN(listener->batch_size, max - total))) > 0)
+	{
+		listener_resolve(listener, listener->batch, n);
+		func(listener->batch, n, data);
+
+		total += n;
+	}
+
+	listener_retire_paths(listener);
+
+	trace_end("listener_drain", span, total);
+
+	listener_count(&listener->n_drained, total);
+	listener_count(&listener->n_drains, 1);
+	listener_count(&listener->drain_time, g_get_monotonic_time() - start);
+
+	return total;
+}
+
+guint listener_take_dropped(struct Listener *listener)
+{
+	return event_ring_take_dropped(listener->ring);
+}
+
+guint listener_get_overflows(struct Listener *listener)
+{
+	return atomic_load_explicit(&listener->overflows, memory_order_relaxed);
+}
+
+/*
+ * Safe from any thread and while the listener runs. The counters are read
+ * one by one, so they may be a few events apart from each other.
+ */
+void listener_get_stats(struct Listener *listener, struct ListenerStats *stats)
+{
+	stats->wakeups = atomic_load_explicit(&listener->n_wakeups, memory_order_relaxed);
+	stats->reads = atomic_load_explicit(&listener->n_reads, memory_order_relaxed);
+	stats->bytes = atomic_load_explicit(&listener->n_bytes, memory_order_relaxed);
+	stats->events = atomic_load_explicit(&listener->n_read_events, memory_order_relaxed);
+	stats->coalesced = atomic_load_explicit(&listener->n_coalesced, memory_order_relaxed);
+	stats->dropped = atomic_load_explicit(&listener->n_dropped, memory_order_relaxed);
+	stats->overflows = atomic_load_explicit(&listener->overflows, memory_order_relaxed);
+	stats->queued = event_ring_length(listener->ring);
+	stats->capacity = listener->ring->capacity;
+	stats->drained = atomic_load_explicit(&listener->n_drained, memory_order_relaxed);
+	stats->drains = atomic_load_explicit(&listener->n_drains, memory_order_relaxed);
+	stats->drain_time = atomic_load_explicit(&listener->drain_time, memory_order_relaxed);
+}
+
+/* }}} */
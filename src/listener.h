@@ -0,0 +1,136 @@
+#ifndef LISTENER_H
+#define LISTENER_H
+
+#include <glib.h>
+
+#include "event_ring.h"
+
+/*
+ * Directory listener: watches any number of directory trees (roots) on one
+ * thread, with one notification fd for all of them, and queues decoded
+ * events for one consumer thread. Depends on GLib only, so it can run
+ * without a display.
+ */
+
+enum ListenerBackend
+{
+	LISTENER_BACKEND_INOTIFY,
+	LISTENER_BACKEND_FANOTIFY,
+};
+
+enum ListenerState
+{
+	LISTENER_STARTED,
+	LISTENER_STATUS,
+	LISTENER_ERROR,
+	LISTENER_STOPPED,
+};
+
+struct PathFilter;
+
+struct ListenerRoot
+{
+	const char *dir;
+	gboolean recursive;
+
+	/*
+	 * IN_* events passed on for this root, 0 for all of them. Only these
+	 * are asked of the kernel.
+	 */
+	guint32 events;
+
+	/* Paths to pass on, or NULL; excluded directories are not watched */
+	struct PathFilter *filter;
+};
+
+struct ListenerRootStats
+{
+	/* Events passed on, and events the root's filter held back */
+	guint64 events;
+	guint64 filtered;
+
+	/* Directories watched for the root */
+	guint watches;
+
+	/* FALSE once the root was removed or couldn't be watched */
+	gboolean active;
+};
+
+/* Totals since the listener started, see listener_get_stats() */
+struct ListenerStats
+{
+	/* Listener thread: times the notification fd woke it, and what it read */
+	guint64 wakeups;
+	guint64 reads;
+	guint64 bytes;
+	guint64 events;
+
+	/* Events merged into others by coalescing, and lost to a full ring */
+	guint64 coalesced;
+	guint64 dropped;
+
+	/* Times the kernel's own queue overflowed */
+	guint64 overflows;
+
+	/* Events in the ring right now, and how many fit */
+	guint queued;
+	guint capacity;
+
+	/* Consumer: events drained, listener_drain() calls and their time in µs */
+	guint64 drained;
+	guint64 drains;
+	guint64 drain_time;
+};
+
+struct ListenerOptions
+{
+	/* Watched from the start, with ids 1 to n_roots */
+	const struct ListenerRoot *roots;
+	guint n_roots;
+	enum ListenerBackend backend;
+	guint coalesce_ms;
+
+	/* Ring capacity, 0 for the default */
+	guint ring_size;
+};
+
+struct Listener;
+
+/*
+ * Called on the listener thread. message is a status or error text for
+ * LISTENER_STATUS and LISTENER_ERROR, NULL otherwise; root is the root it
+ * is about, or 0. LISTENER_STOPPED is always the last call, even when
+ * starting failed.
+ */
+typedef void (*ListenerStateFunc)(struct Listener *listener,
+		enum ListenerState state,
+		guint root,
+		const char *message,
+		gpointer data);
+
+/* Called on the consumer thread; the events and their paths are only valid during the call */
+typedef void (*ListenerBatchFunc)(const struct RingEvent *events, guint n, gpointer data);
+
+struct Listener *listener_start(const struct ListenerOptions *options,
+		ListenerStateFunc func,
+		gpointer data,
+		GError **error);
+void listener_stop(struct Listener *listener);
+void listener_free(struct Listener *listener);
+
+guint listener_add_root(struct Listener *listener, const struct ListenerRoot *root);
+void listener_remove_root(struct Listener *listener, guint root);
+gboolean listener_get_root_stats(struct Listener *listener, guint root, struct ListenerRootStats *stats);
+
+gboolean listener_is_running(struct Listener *listener);
+int listener_get_fd(struct Listener *listener);
+
+guint listener_drain(struct Listener *listener, ListenerBatchFunc func, gpointer data, guint max);
+guint listener_take_dropped(struct Listener *listener);
+guint listener_get_overflows(struct Listener *listener);
+void listener_get_stats(struct Listener *listener, struct ListenerStats *stats);
+
+const char *listener_event_name(guint32 mask);
+gboolean listener_parse_events(const char *list, guint32 *events, GError **error);
+
+#endif /* end of include guard: LISTENER_H */
@@ -0,0 +1,534 @@
+/* vim: set fdm=marker : */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <linux/limits.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/fanotify.h>
+#include <sys/statfs.h>
+#include <unistd.h>
+
+#include "listener_private.h"
+
+#define FANOTIFY_MASK (FAN_OPEN | FAN_CLOSE | FAN_MOVE | FAN_CREATE | FAN_DELETE | \
+		FAN_DELETE_SELF | FAN_MODIFY | FAN_MOVE_SELF)
+
+/* Handle to path cache entries kept per file system */
+#define LISTENER_HANDLE_CACHE 65536
+
+/*
+ * A file system carrying at least one root. File handles are only unique
+ * within one, so each has its own mount fd and handle cache.
+ */
+struct ListenerMount
+{
+	__kernel_fsid_t fsid;
+	int fd;
+
+	/* Resolved directories by handle, and the same by path */
+	GHashTable *handles;
+	GTree *paths;
+
+	/* Union of what its roots asked for; only ever grows */
+	guint32 mask;
+
+	/* Roots on the file system */
+	GPtrArray *roots;
+};
+
+/* A resolved directory handle */
+struct ListenerHandle
+{
+	struct file_handle *fh;
+	char *path;
+
+	/* Interned on the first event passed on, again after the listener switched tables */
+	guint32 id;
+	guint generation;
+};
+
+/* Handles {{{ */
+
+static void handle_free(gpointer data)
+{
+	struct ListenerHandle *handle = data;
+
+	g_free(handle->fh);
+	g_free(handle->path);
+	g_free(handle);
+}
+
+static guint handle_hash(gconstpointer key)
+{
+	const struct file_handle *fh = key;
+	const unsigned char *p = fh->f_handle;
+	guint hash = 2166136261u ^ (guint) fh->handle_type;
+
+	for (unsigned int i = 0; i < fh->handle_bytes; ++i)
+		hash = (hash ^ p[i]) * 16777619u;
+
+	return hash;
+}
+
+static gboolean handle_equal(gconstpointer a, gconstpointer b)
+{
+	const struct file_handle *fa = a;
+	const struct file_handle *fb = b;
+
+	return fa->handle_type == fb->handle_type &&
+		fa->handle_bytes == fb->handle_bytes &&
+		memcmp(fa->f_handle, fb->f_handle, fa->handle_bytes) == 0;
+}
+
+static void fanotify_cache_clear(struct ListenerMount *mount)
+{
+	g_tree_unref(mount->paths);
+	g_hash_table_remove_all(mount->handles);
+	mount->paths = g_tree_new((GCompareFunc) strcmp);
+}
+
+static void fanotify_cache_remove(struct ListenerMount *mount, struct ListenerHandle *handle)
+{
+	g_tree_remove(mount->paths, handle->path);
+	g_hash_table_remove(mount->handles, handle->fh);
+}
+
+/*
+ * Drops the cached directories at dir and below it, which a rename or
+ * removal of dir leaves with stale paths. The paths below dir sort right
+ * after it, among others that merely start with its name.
+ */
+static void fanotify_cache_invalidate(struct ListenerMount *mount, const char *dir)
+{
+	size_t len = strlen(dir);
+	GPtrArray *stale;
+	GTreeNode *node;
+
+	if (len <= 1)
+	{
+		fanotify_cache_clear(mount);
+		return;
+	}
+
+	stale = g_ptr_array_new();
+
+	for (node = g_tree_lower_bound(mount->paths, dir);
+			node != NULL && strncmp(g_tree_node_key(node), dir, len) == 0;
+			node = g_tree_node_next(node))
+	{
+		const char *path = g_tree_node_key(node);
+
+		if (path[len] == '\0' || path[len] == '/')
+			g_ptr_array_add(stale, g_tree_node_value(node));
+	}
+
+	for (guint i = 0; i < stale->len; ++i)
+		fanotify_cache_remove(mount, g_ptr_array_index(stale, i));
+
+	g_ptr_array_free(stale, TRUE);
+}
+
+/*
+ * Turns a directory file handle into its path. Every lookup that misses the
+ * cache costs an open_by_handle_at() and a readlink(), so the cache is what
+ * makes this backend cheap; renaming or removing a directory only drops
+ * what is cached at and below it. Returns NULL if the handle can't be
+ * resolved.
+ */
+static struct ListenerHandle *fanotify_resolve(struct ListenerMount *mount, const struct file_handle *fh)
+{
+	struct ListenerHandle *handle;
+	char link[64], path[PATH_MAX];
+	ssize_t len;
+	int fd;
+
+	handle = g_hash_table_lookup(mount->handles, fh);
+	if (handle != NULL)
+		return handle;
+
+	fd = open_by_handle_at(mount->fd, (struct file_handle*) fh, O_PATH);
+	if (fd == -1)
+		return NULL;
+
+	g_snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+	len = readlink(link, path, sizeof(path) - 1);
+	close(fd);
+
+	if (len == -1)
+		return NULL;
+
+	path[len] = '\0';
+
+	if (g_hash_table_size(mount->handles) >= LISTENER_HANDLE_CACHE)
+		fanotify_cache_clear(mount);
+
+	/* A directory that used to be at the same path is gone */
+	if ((handle = g_tree_lookup(mount->paths, path)) != NULL)
+		fanotify_cache_remove(mount, handle);
+
+	handle = g_new(struct ListenerHandle, 1);
+	handle->fh = g_memdup2(fh, sizeof(*fh) + fh->handle_bytes);
+	handle->path = g_strndup(path, len);
+	handle->id = RING_EVENT_NONE;
+	handle->generation = 0;
+	g_hash_table_insert(mount->handles, handle->fh, handle);
+	g_tree_insert(mount->paths, handle->path, handle);
+
+	return handle;
+}
+
+/* The id of a resolved directory in the listener's current path table */
+static guint32 fanotify_dir_id(struct Listener *listener, struct ListenerHandle *handle)
+{
+	if (handle->id == RING_EVENT_NONE || handle->generation != listener->paths_generation)
+	{
+		handle->id = listener_intern(listener, handle->path);
+		handle->generation = listener->paths_generation;
+	}
+
+	return handle->id;
+}
+
+/* The full path of an event, only built once a root needs it */
+static const char *fanotify_path(GString *str, const char *dir, const char *name)
+{
+	if (str->len > 0)
+		return str->str;
+
+	g_string_append(str, dir);
+	if (name != NULL)
+	{
+		if (str->str[str->len - 1] != '/')
+			g_string_append_c(str, '/');
+
+		g_string_append(str, name);
+	}
+
+	return str->str;
+}
+
+/* Whether events in dir belong to what the user asked to watch for a root */
+static gboolean fanotify_in_scope(struct ListenerRootState *root, const char *dir)
+{
+	if (strncmp(dir, root->dir, root->dir_len) != 0)
+		return FALSE;
+
+	if (dir[root->dir_len] == '\0')
+		return TRUE;
+
+	/* The root "/" keeps its slash, every other root has it stripped */
+	if (!root->recursive)
+		return FALSE;
+
+	return root->dir_len == 1 || dir[root->dir_len] == '/';
+}
+
+static struct ListenerMount *fanotify_find_mount(struct Listener *listener, const __kernel_fsid_t *fsid)
+{
+	for (guint i = 0; i < listener->mounts->len; ++i)
+	{
+		struct ListenerMount *mount = g_ptr_array_index(listener->mounts, i);
+
+		if (memcmp(&mount->fsid, fsid, sizeof(*fsid)) == 0)
+			return mount;
+	}
+
+	return NULL;
+}
+
+static void fanotify_mount_free(gpointer data)
+{
+	struct ListenerMount *mount = data;
+
+	g_tree_unref(mount->paths);
+	g_hash_table_destroy(mount->handles);
+	g_ptr_array_free(mount->roots, TRUE);
+	close(mount->fd);
+	g_free(mount);
+}
+
+/* }}} */
+
+/* Events {{{ */
+
+/*
+ * Reports and drops the roots whose own directory an event says was
+ * deleted or moved away, as the inotify backend does. Dropping the last
+ * root on a file system frees its mount.
+ */
+static void fanotify_roots_gone(struct Listener *listener, struct ListenerMount *mount,
+		const struct file_handle *fh, guint32 mask)
+{
+	GPtrArray *gone = g_ptr_array_new();
+
+	for (guint i = 0; i < mount->roots->len; ++i)
+	{
+		struct ListenerRootState *root = g_ptr_array_index(mount->roots, i);
+
+		if (root->handle != NULL && handle_equal(root->handle, fh))
+			g_ptr_array_add(gone, root);
+	}
+
+	for (guint i = 0; i < gone->len; ++i)
+	{
+		struct ListenerRootState *root = g_ptr_array_index(gone, i);
+
+		if (mask & FAN_DELETE_SELF)
+			listener_error(listener, root->id, "Listening directory '%s' was deleted!", root->dir);
+		else
+			listener_error(listener, root->id, "Listening directory '%s' was moved!", root->dir);
+
+		listener_drop_root(listener, root);
+	}
+
+	g_ptr_array_free(gone, TRUE);
+}
+
+static int fanotify_buffer(struct Listener *listener, const char *buf, ssize_t len, GString *str)
+{
+	struct fanotify_event_metadata *meta;
+	int count = 0;
+
+	gint64 now = g_get_real_time();
+
+	for (meta = (struct fanotify_event_metadata*) buf; FAN_EVENT_OK(meta, len);
+			meta = FAN_EVENT_NEXT(meta, len))
+	{
+		if (atomic_load_explicit(&listener->stop, memory_order_relaxed) != 0)
+			break;
+
+		struct fanotify_event_info_fid *fid;
+		struct ListenerMount *mount;
+		struct ListenerHandle *handle;
+		struct file_handle *fh;
+		const char *name, *dir;
+		guint32 name_id = RING_EVENT_NONE;
+
+		if (meta->mask & FAN_Q_OVERFLOW)
+		{
+			listener_overflow(listener, now);
+			count++;
+			continue;
+		}
+
+		fid = (struct fanotify_event_info_fid*) (meta + 1);
+		if (meta->event_len <= sizeof(*meta) || fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME)
+			continue;
+
+		/* A file system whose last root was just removed */
+		mount = fanotify_find_mount(listener, &fid->fsid);
+		if (mount == NULL)
+			continue;
+
+		fh = (struct file_handle*) fid->handle;
+		name = (const char*) fh->f_handle + fh->handle_bytes;
+
+		if (strcmp(name, ".") == 0)
+			name = NULL;
+
+		/* Directories that are already gone can't be resolved any more */
+		handle = fanotify_resolve(mount, fh);
+		dir = handle != NULL ? handle->path : NULL;
+
+		for (guint i = 0; dir != NULL && i < mount->roots->len; ++i)
+		{
+			struct ListenerRootState *root = g_ptr_array_index(mount->roots, i);
+			struct RingEvent ev;
+
+			if (!fanotify_in_scope(root, dir) ||
+					!listener_root_accepts(root, meta->mask, root->filter ? fanotify_path(str, dir, name) : NULL))
+				continue;
+
+			/* Only paths under a root are interned, not all of the file system */
+			if (name != NULL && name_id == RING_EVENT_NONE)
+				name_id = listener_intern(listener, name);
+
+			/* FAN_* bits share their values with the matching IN_* ones */
+			ev.mask = meta->mask;
+			ev.cookie = 0;
+			ev.count = 1;
+			ev.root = root->id;
+			ev.time = now;
+			ev.last_time = now;
+			ev.dir = fanotify_dir_id(listener, handle);
+			ev.name = name_id;
+			listener_emit(listener, &ev);
+
+			count++;
+		}
+
+		g_string_erase(str, 0, -1);
+
+		/* A directory renamed or removed, either named in its parent or reporting itself */
+		if ((meta->mask & FAN_ONDIR) && (meta->mask & (FAN_MOVE | FAN_DELETE | FAN_MOVE_SELF | FAN_DELETE_SELF)))
+		{
+			if (name != NULL && dir != NULL)
+			{
+				fanotify_path(str, dir, name);
+				fanotify_cache_invalidate(mount, str->str);
+				g_string_erase(str, 0, -1);
+			}
+			else if (name == NULL && (handle != NULL || (handle = g_hash_table_lookup(mount->handles, fh)) != NULL))
+				fanotify_cache_invalidate(mount, handle->path);
+		}
+
+		/* Last, as it may free the mount */
+		if (name == NULL && (meta->mask & (FAN_DELETE_SELF | FAN_MOVE_SELF)))
+			fanotify_roots_gone(listener, mount, fh, meta->mask);
+	}
+
+	return count;
+}
+
+/* }}} */
+
+/* Roots {{{ */
+
+/*
+ * One filesystem mark covers the whole mount the directory lives on, no
+ * matter how many directories are below it; events outside the root are
+ * filtered out in fanotify_buffer(). Roots on the same file system share
+ * the mark. Needs CAP_SYS_ADMIN for the mark and CAP_DAC_READ_SEARCH for
+ * open_by_handle_at().
+ */
+static int fanotify_add_root(struct Listener *listener, struct ListenerRootState *root)
+{
+	struct ListenerMount *mount;
+	struct statfs st;
+	__kernel_fsid_t fsid;
+	int fd;
+
+	/*
+	 * FAN_* bits share their values with the matching IN_* ones. Whatever
+	 * the root asked for, it has to notice its own directory going away.
+	 */
+	guint32 mask = (root->events != 0 ? root->events : FANOTIFY_MASK) |
+		FAN_DELETE_SELF | FAN_MOVE_SELF | FAN_ONDIR;
+	struct file_handle *fh;
+	int mount_id;
+
+	fd = open(root->dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (fd == -1)
+	{
+		listener_error(listener, root->id, "Can't open '%s': %s", root->dir, strerror(errno));
+		return -1;
+	}
+
+	if (fstatfs(fd, &st) == -1)
+	{
+		listener_error(listener, root->id, "Can't stat '%s': %s", root->dir, strerror(errno));
+		close(fd);
+		return -1;
+	}
+
+	memcpy(&fsid, &st.f_fsid, sizeof(fsid));
+
+	/* What FAN_DELETE_SELF and FAN_MOVE_SELF on the root itself will carry */
+	fh = g_malloc(sizeof(*fh) + MAX_HANDLE_SZ);
+	fh->handle_bytes = MAX_HANDLE_SZ;
+
+	if (name_to_handle_at(fd, "", fh, &mount_id, AT_EMPTY_PATH) == -1)
+		g_clear_pointer(&fh, g_free);
+
+	mount = fanotify_find_mount(listener, &fsid);
+
+	/* Marking again adds to the mask the file system is already marked with */
+	if ((mount == NULL || (mount->mask | mask) != mount->mask) &&
+			fanotify_mark(listener->fd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, mask, fd, NULL) == -1)
+	{
+		listener_error(listener, root->id, "Can't mark '%s': %s", root->dir, strerror(errno));
+		g_free(fh);
+		close(fd);
+		return -1;
+	}
+
+	if (mount == NULL)
+	{
+		mount = g_new(struct ListenerMount, 1);
+		mount->fsid = fsid;
+		mount->fd = fd;
+		mount->handles = g_hash_table_new_full(handle_hash, handle_equal, NULL, handle_free);
+		mount->paths = g_tree_new((GCompareFunc) strcmp);
+		mount->mask = 0;
+		mount->roots = g_ptr_array_new();
+
+		g_ptr_array_add(listener->mounts, mount);
+	}
+	else
+		close(fd);
+
+	mount->mask |= mask;
+	g_ptr_array_add(mount->roots, root);
+	root->mount = mount;
+	root->handle = fh;
+
+	/* Paths come back from the kernel canonical, so compare against the canonical root */
+	char *canonical = realpath(root->dir, NULL);
+	if (canonical != NULL)
+	{
+		listener_root_set_dir(root, canonical);
+		free(canonical);
+	}
+
+	atomic_store(&root->n_watches, 1);
+
+	return 0;
+}
+
+static void fanotify_remove_root(struct Listener *listener, struct ListenerRootState *root)
+{
+	struct ListenerMount *mount = root->mount;
+
+	root->mount = NULL;
+	g_clear_pointer(&root->handle, g_free);
+	atomic_store(&root->n_watches, 0);
+
+	g_ptr_array_remove_fast(mount->roots, root);
+	if (mount->roots->len > 0)
+		return;
+
+	fanotify_mark(listener->fd, FAN_MARK_REMOVE | FAN_MARK_FILESYSTEM, mount->mask, mount->fd, NULL);
+	g_ptr_array_remove_fast(listener->mounts, mount);
+}
+
+/* }}} */
+
+/* Setup {{{ */
+
+int listener_fanotify_setup(struct Listener *listener)
+{
+	int fd;
+
+	fd = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME | FAN_NONBLOCK | FAN_CLOEXEC,
+			O_RDONLY | O_LARGEFILE);
+
+	if (fd == -1)
+	{
+		listener_error(listener, 0, "fanotify_init: %s", strerror(errno));
+		return -1;
+	}
+
+	listener->fd = fd;
+	listener->handle = fanotify_buffer;
+	listener->add = fanotify_add_root;
+	listener->remove = fanotify_remove_root;
+	listener->mounts = g_ptr_array_new_with_free_func(fanotify_mount_free);
+
+	return 0;
+}
+
+void listener_fanotify_cleanup(struct Listener *listener)
+{
+	if (listener->mounts == NULL)
+		return;
+
+	g_ptr_array_free(listener->mounts, TRUE);
+	listener->mounts = NULL;
+}
+
+/* }}} */
@@ -0,0 +1,858 @@
+/* vim: set fdm=marker : */
+
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glib.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "listener_private.h"
+
+/*
+ * A watched directory. Roots that overlap share one watch, so each event is
+ * read once and handed to every root the directory belongs to.
+ */
+struct ListenerWatch
+{
+	int wd;
+	char *dir;
+
+	/* Interned on the first event passed on, again after the listener switched tables */
+	guint32 dir_id;
+	guint dir_generation;
+
+	/* Union of what its roots asked for; only ever grows */
+	guint32 mask;
+
+	/* Ids of the roots the directory belongs to */
+	GArray *roots;
+
+	/* The watch on the parent directory, if any, and those on subdirectories */
+	struct ListenerWatch *parent;
+	GPtrArray *children;
+};
+
+/* A directory waiting to be walked for a root */
+struct ListenerPending
+{
+	guint root;
+	char *dir;
+
+	/* Appeared while watching, so what it already holds is reported as created */
+	gboolean created;
+};
+
+/* A directory moved away within one read, until its IN_MOVED_TO shows up */
+struct ListenerMove
+{
+	guint32 cookie;
+	char *dir;
+};
+
+/* Watches {{{ */
+
+static void watch_free(gpointer data)
+{
+	struct ListenerWatch *watch = data;
+
+	g_free(watch->dir);
+	g_array_free(watch->roots, TRUE);
+	g_ptr_array_free(watch->children, TRUE);
+	g_free(watch);
+}
+
+static void pending_free(gpointer data)
+{
+	struct ListenerPending *pending = data;
+
+	g_free(pending->dir);
+	g_free(pending);
+}
+
+/*
+ * Queues a directory to be walked. Directories that appear while watching go
+ * first, ahead of what is left of an initial walk, so the files written into
+ * them right away are caught as soon as possible.
+ */
+static void pending_push(struct Listener *listener, guint root, char *dir, gboolean created)
+{
+	struct ListenerPending *pending = g_new(struct ListenerPending, 1);
+
+	pending->root = root;
+	pending->dir = dir;
+	pending->created = created;
+
+	if (created)
+		g_queue_push_head(&listener->pending, pending);
+	else
+		g_queue_push_tail(&listener->pending, pending);
+}
+
+/*
+ * The kernel mask a root needs on one of its directories: the events it
+ * passes on, whatever it takes to follow the tree when recursive, and
+ * noticing the root itself going away.
+ */
+static guint32 watch_mask(struct ListenerRootState *root, gboolean is_root)
+{
+	guint32 mask = root->events != 0 ? root->events : LISTENER_EVENTS;
+
+	if (root->recursive)
+		mask |= IN_CREATE | IN_MOVED_TO | IN_MOVED_FROM;
+
+	if (is_root)
+		mask |= IN_DELETE_SELF | IN_MOVE_SELF;
+
+	return mask;
+}
+
+static void watch_unlink(struct ListenerWatch *watch)
+{
+	if (watch->parent == NULL)
+		return;
+
+	g_ptr_array_remove_fast(watch->parent->children, watch);
+	watch->parent = NULL;
+}
+
+/*
+ * Hangs a watch below the one on its parent directory, if that is watched.
+ * A walk watches a directory before its subdirectories, so every watch of
+ * a recursive root ends up linked.
+ */
+static void watch_link(struct Listener *listener, struct ListenerWatch *watch)
+{
+	char *parent_dir = g_path_get_dirname(watch->dir);
+	gpointer wd;
+
+	watch_unlink(watch);
+
+	if (strcmp(parent_dir, watch->dir) != 0 &&
+			g_hash_table_lookup_extended(listener->dir_wds, parent_dir, NULL, &wd))
+	{
+		watch->parent = g_hash_table_lookup(listener->wd_dirs, wd);
+		g_ptr_array_add(watch->parent->children, watch);
+	}
+
+	g_free(parent_dir);
+}
+
+/*
+ * Registers a watch on dir for a root and remembers which directory it
+ * belongs to. Adding a directory that is already watched is harmless: the
+ * kernel hands back the same wd and IN_MASK_ADD merges the masks of the
+ * roots sharing it.
+ */
+static int watch_add(struct Listener *listener, struct ListenerRootState *root, const char *dir)
+{
+	struct ListenerWatch *watch;
+	gboolean is_root = strcmp(dir, root->dir) == 0;
+	guint32 mask = watch_mask(root, is_root);
+	int wd;
+
+	/* Only the root itself may be a symlink */
+	wd = inotify_add_watch(listener->fd, dir, mask | IN_MASK_ADD | (is_root ? 0 : IN_ONLYDIR | IN_DONT_FOLLOW));
+	if (wd == -1)
+		return -1;
+
+	watch = g_hash_table_lookup(listener->wd_dirs, GINT_TO_POINTER(wd));
+	if (watch == NULL)
+	{
+		watch = g_new(struct ListenerWatch, 1);
+		watch->wd = wd;
+		watch->dir = g_strdup(dir);
+		watch->dir_id = RING_EVENT_NONE;
+		watch->mask = 0;
+		watch->roots = g_array_new(FALSE, FALSE, sizeof(guint));
+		watch->parent = NULL;
+		watch->children = g_ptr_array_new();
+
+		g_hash_table_replace(listener->wd_dirs, GINT_TO_POINTER(wd), watch);
+		g_hash_table_replace(listener->dir_wds, watch->dir, GINT_TO_POINTER(wd));
+		watch_link(listener, watch);
+	}
+	else if (strcmp(watch->dir, dir) != 0)
+	{
+		/* Reached under another name, report it under the latest one */
+		g_hash_table_remove(listener->dir_wds, watch->dir);
+		g_free(watch->dir);
+
+		watch->dir = g_strdup(dir);
+		watch->dir_id = RING_EVENT_NONE;
+		g_hash_table_replace(listener->dir_wds, watch->dir, GINT_TO_POINTER(wd));
+		watch_link(listener, watch);
+	}
+	else if (watch->parent == NULL)
+		/* Watched for another root before its parent was */
+		watch_link(listener, watch);
+
+	watch->mask |= mask;
+
+	for (guint i = 0; i < watch->roots->len; ++i)
+	{
+		if (g_array_index(watch->roots, guint, i) == root->id)
+			return wd;
+	}
+
+	g_array_append_val(watch->roots, root->id);
+	atomic_fetch_add_explicit(&root->n_watches, 1, memory_order_relaxed);
+
+	return wd;
+}
+
+/* Forgets a watch the kernel has already dropped (IN_IGNORED) */
+static void watch_forget(struct Listener *listener, int wd)
+{
+	struct ListenerWatch *watch = g_hash_table_lookup(listener->wd_dirs, GINT_TO_POINTER(wd));
+
+	if (watch == NULL)
+		return;
+
+	for (guint i = 0; i < watch->roots->len; ++i)
+	{
+		struct ListenerRootState *root = listener_get_root(listener, g_array_index(watch->roots, guint, i));
+
+		if (root != NULL)
+			atomic_fetch_sub_explicit(&root->n_watches, 1, memory_order_relaxed);
+	}
+
+	watch_unlink(watch);
+	for (guint i = 0; i < watch->children->len; ++i)
+		((struct ListenerWatch*) g_ptr_array_index(watch->children, i))->parent = NULL;
+
+	g_hash_table_remove(listener->dir_wds, watch->dir);
+	g_hash_table_remove(listener->wd_dirs, GINT_TO_POINTER(wd));
+}
+
+/* The id of the watched directory in the listener's current path table */
+static guint32 watch_dir_id(struct Listener *listener, struct ListenerWatch *watch)
+{
+	if (watch->dir_id == RING_EVENT_NONE || watch->dir_generation != listener->paths_generation)
+	{
+		watch->dir_id = listener_intern(listener, watch->dir);
+		watch->dir_generation = listener->paths_generation;
+	}
+
+	return watch->dir_id;
+}
+
+/* Takes a root off a watch, and drops the watch once no root needs it */
+static void watch_release(struct Listener *listener, struct ListenerRootState *root, int wd)
+{
+	struct ListenerWatch *watch = g_hash_table_lookup(listener->wd_dirs, GINT_TO_POINTER(wd));
+
+	if (watch == NULL)
+		return;
+
+	for (guint i = 0; i < watch->roots->len; ++i)
+	{
+		if (g_array_index(watch->roots, guint, i) == root->id)
+		{
+			g_array_remove_index_fast(watch->roots, i);
+			atomic_fetch_sub_explicit(&root->n_watches, 1, memory_order_relaxed);
+			break;
+		}
+	}
+
+	if (watch->roots->len == 0)
+	{
+		inotify_rm_watch(listener->fd, wd);
+		watch_forget(listener, wd);
+	}
+}
+
+/* Whether path is dir or lies below it */
+static gboolean watch_path_under(const char *path, const char *dir, gsize len)
+{
+	return strncmp(path, dir, len) == 0 && (path[len] == '\0' || path[len] == '/');
+}
+
+/* The watch on dir and every watch below it, found through the child links */
+static GPtrArray *watch_subtree(struct Listener *listener, const char *dir)
+{
+	GPtrArray *tree;
+	gpointer wd;
+
+	if (!g_hash_table_lookup_extended(listener->dir_wds, dir, NULL, &wd))
+		return NULL;
+
+	tree = g_ptr_array_new();
+	g_ptr_array_add(tree, g_hash_table_lookup(listener->wd_dirs, wd));
+
+	for (guint i = 0; i < tree->len; ++i)
+	{
+		struct ListenerWatch *watch = g_ptr_array_index(tree, i);
+
+		for (guint j = 0; j < watch->children->len; ++j)
+			g_ptr_array_add(tree, g_ptr_array_index(watch->children, j));
+	}
+
+	return tree;
+}
+
+static gboolean watch_same_roots(const struct ListenerWatch *a, const struct ListenerWatch *b)
+{
+	if (a->roots->len != b->roots->len)
+		return FALSE;
+
+	for (guint i = 0; i < a->roots->len; ++i)
+	{
+		guint id = g_array_index(a->roots, guint, i);
+		guint j;
+
+		for (j = 0; j < b->roots->len && g_array_index(b->roots, guint, j) != id; ++j);
+
+		if (j == b->roots->len)
+			return FALSE;
+	}
+
+	return TRUE;
+}
+
+/*
+ * Follows a directory renamed from one watched directory into another,
+ * parent being the watch it arrived in. The kernel watches inodes, so the
+ * watches below it stay valid and only their paths change, as do those of
+ * the directories still waiting to be walked. Returns FALSE, changing
+ * nothing, if the tree has to be walked again instead: when it moved in
+ * or out of some root, or a root's filter may judge the new paths
+ * differently.
+ */
+static gboolean watch_move_tree(struct Listener *listener, const char *from, const char *to,
+		struct ListenerWatch *parent)
+{
+	gsize from_len = strlen(from);
+	GPtrArray *tree;
+
+	tree = watch_subtree(listener, from);
+	if (tree == NULL)
+		return FALSE;
+
+	for (guint i = 0; i < tree->len; ++i)
+	{
+		struct ListenerWatch *watch = g_ptr_array_index(tree, i);
+
+		if (!watch_same_roots(watch, parent))
+		{
+			g_ptr_array_free(tree, TRUE);
+			return FALSE;
+		}
+	}
+
+	for (guint i = 0; i < parent->roots->len; ++i)
+	{
+		struct ListenerRootState *root = listener_get_root(listener, g_array_index(parent->roots, guint, i));
+
+		if (root == NULL || !root->recursive || root->filter != NULL)
+		{
+			g_ptr_array_free(tree, TRUE);
+			return FALSE;
+		}
+	}
+
+	for (guint i = 0; i < tree->len; ++i)
+	{
+		struct ListenerWatch *watch = g_ptr_array_index(tree, i);
+		char *dir = g_strconcat(to, watch->dir + from_len, NULL);
+
+		g_hash_table_remove(listener->dir_wds, watch->dir);
+		g_free(watch->dir);
+
+		watch->dir = dir;
+		watch->dir_id = RING_EVENT_NONE;
+		g_hash_table_replace(listener->dir_wds, watch->dir, GINT_TO_POINTER(watch->wd));
+	}
+
+	/* Everything below keeps its links, only the top moves to another parent */
+	watch_link(listener, g_ptr_array_index(tree, 0));
+	g_ptr_array_free(tree, TRUE);
+
+	for (GList *link = listener->pending.head; link != NULL; link = link->next)
+	{
+		struct ListenerPending *pending = link->data;
+
+		if (watch_path_under(pending->dir, from, from_len))
+		{
+			char *dir = g_strconcat(to, pending->dir + from_len, NULL);
+			g_free(pending->dir);
+			pending->dir = dir;
+		}
+	}
+
+	return TRUE;
+}
+
+/*
+ * Releases a root's watches on dir and everything below it, used when a
+ * directory is moved away: the watches would keep reporting the old paths
+ * otherwise. If it was moved somewhere the tree couldn't simply be
+ * renamed, IN_MOVED_TO walks it again. Follows the child links, so it
+ * costs the size of the subtree.
+ */
+static void watch_remove_tree(struct Listener *listener, struct ListenerRootState *root, const char *dir)
+{
+	GPtrArray *tree = watch_subtree(listener, dir);
+	GArray *wds;
+
+	if (tree == NULL)
+		return;
+
+	wds = g_array_sized_new(FALSE, FALSE, sizeof(int), tree->len);
+
+	for (guint i = 0; i < tree->len; ++i)
+		g_array_append_val(wds, ((struct ListenerWatch*) g_ptr_array_index(tree, i))->wd);
+
+	/* Releasing changes the links, so only once they were all followed */
+	for (guint i = 0; i < wds->len; ++i)
+		watch_release(listener, root, g_array_index(wds, int, i));
+
+	g_ptr_array_free(tree, TRUE);
+	g_array_free(wds, TRUE);
+}
+
+/*
+ * Gives up on a directory moved away whose IN_MOVED_TO never came, or
+ * whose tree couldn't be renamed: it left, or will be walked again.
+ */
+static void watch_move_drop(struct Listener *listener, struct ListenerMove *move)
+{
+	GArray *ids;
+	gpointer wd;
+
+	if (move->dir == NULL)
+		return;
+
+	if (g_hash_table_lookup_extended(listener->dir_wds, move->dir, NULL, &wd))
+	{
+		struct ListenerWatch *watch = g_hash_table_lookup(listener->wd_dirs, wd);
+
+		/* Releasing changes watch->roots */
+		ids = g_array_copy(watch->roots);
+
+		for (guint i = 0; i < ids->len; ++i)
+		{
+			struct ListenerRootState *root = listener_get_root(listener, g_array_index(ids, guint, i));
+
+			if (root != NULL && root->recursive)
+				watch_remove_tree(listener, root, move->dir);
+		}
+
+		g_array_free(ids, TRUE);
+	}
+
+	g_clear_pointer(&move->dir, g_free);
+}
+
+/* Whether the root's filter keeps the directory at path and all below it unwatched */
+static gboolean watch_excluded(struct ListenerRootState *root, const char *path)
+{
+	const char *rel;
+
+	if (root->filter == NULL)
+		return FALSE;
+
+	rel = listener_root_relative(root, path);
+	return rel != NULL && path_filter_excludes_dir(root->filter, rel);
+}
+
+/*
+ * Reports an entry found in a directory that appeared while watching. It may
+ * have been created before the watch was added, so the kernel never told;
+ * one created after that is reported twice, which is the lesser evil.
+ */
+static void watch_emit_created(struct Listener *listener, struct ListenerRootState *root,
+		struct ListenerWatch *watch, const char *name, gboolean is_dir, gint64 now)
+{
+	guint32 mask = IN_CREATE | (is_dir ? IN_ISDIR : 0);
+	struct RingEvent ev;
+	char *path = NULL;
+
+	if (root->filter != NULL)
+		path = g_build_filename(watch->dir, name, NULL);
+
+	if (listener_root_accepts(root, mask, path))
+	{
+		ev.mask = mask;
+		ev.cookie = 0;
+		ev.count = 1;
+		ev.root = root->id;
+		ev.time = now;
+		ev.last_time = now;
+		ev.dir = watch_dir_id(listener, watch);
+		ev.name = listener_intern(listener, name);
+		listener_emit(listener, &ev);
+	}
+
+	g_free(path);
+}
+
+/*
+ * Watches up to budget queued directories and queues their subdirectories.
+ * The initial walk of a large tree is spread over many calls so that
+ * events keep being read while it runs.
+ */
+void listener_inotify_walk(struct Listener *listener, guint budget)
+{
+	struct ListenerPending *pending;
+
+	while (budget-- > 0 && (pending = g_queue_pop_head(&listener->pending)) != NULL)
+	{
+		struct ListenerRootState *root = listener_get_root(listener, pending->root);
+		struct ListenerWatch *watch;
+		const char *dir = pending->dir;
+		gint64 now = g_get_real_time();
+		DIR *dp;
+		struct dirent *ep;
+		int wd;
+
+		/* Removed while its tree was still being walked */
+		if (root == NULL)
+		{
+			pending_free(pending);
+			continue;
+		}
+
+		wd = watch_add(listener, root, dir);
+		if (wd == -1)
+		{
+			if (errno == ENOSPC && !root->limit_reported)
+			{
+				listener_error(listener, root->id, "Watch limit reached, raise fs.inotify.max_user_watches");
+				root->limit_reported = TRUE;
+			}
+
+			pending_free(pending);
+			continue;
+		}
+
+		watch = g_hash_table_lookup(listener->wd_dirs, GINT_TO_POINTER(wd));
+
+		dp = opendir(dir);
+		if (dp == NULL)
+		{
+			pending_free(pending);
+			continue;
+		}
+
+		while ((ep = readdir(dp)))
+		{
+			gboolean is_dir;
+
+			if (strcmp(ep->d_name, ".") == 0 || strcmp(ep->d_name, "..") == 0)
+				continue;
+
+			if (ep->d_type == DT_UNKNOWN)
+			{
+				struct stat st;
+
+				if (fstatat(dirfd(dp), ep->d_name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+					continue;
+
+				is_dir = S_ISDIR(st.st_mode);
+			}
+			else
+				is_dir = ep->d_type == DT_DIR;
+
+			if (pending->created)
+				watch_emit_created(listener, root, watch, ep->d_name, is_dir, now);
+
+			if (!is_dir)
+				continue;
+
+			char *path = g_build_filename(dir, ep->d_name, NULL);
+
+			if (watch_excluded(root, path))
+			{
+				g_free(path);
+				continue;
+			}
+
+			/* Below a new directory everything is new as well */
+			pending_push(listener, root->id, path, pending->created);
+		}
+
+		closedir(dp);
+		pending_free(pending);
+	}
+}
+
+/* }}} */
+
+/* Events {{{ */
+
+/* The full path of an event, only built once a root needs it */
+static const char *inotify_path(GString *str, const struct ListenerWatch *watch,
+		const struct inotify_event *event)
+{
+	if (str->len > 0)
+		return str->str;
+
+	g_string_append(str, watch->dir);
+	if (str->len == 0 || str->str[str->len - 1] != '/')
+		g_string_append_c(str, '/');
+
+	if (event->len)
+		g_string_append(str, event->name);
+
+	return str->str;
+}
+
+/*
+ * Passes one event on to every root its directory belongs to. Returns the
+ * number of events queued. Paths are interned once a root takes the event,
+ * and only names seen for the first time are copied. A directory moved
+ * away is kept in move, for the IN_MOVED_TO that may follow it.
+ */
+static int inotify_event(struct Listener *listener, const struct inotify_event *event,
+		struct ListenerWatch *watch, GString *str, gint64 now, struct ListenerMove *move)
+{
+	GArray *gone = NULL;
+	gboolean moved_dir = FALSE;
+	gboolean renamed = FALSE;
+	guint32 name = RING_EVENT_NONE;
+	int count = 0;
+
+	/* Renamed within the watched trees: the watches can stay */
+	if ((event->mask & IN_MOVED_TO) && move->dir != NULL)
+	{
+		renamed = watch_move_tree(listener, move->dir, inotify_path(str, watch, event), watch);
+
+		if (renamed)
+			g_clear_pointer(&move->dir, g_free);
+		else
+			watch_move_drop(listener, move);
+	}
+
+	for (guint i = 0; i < watch->roots->len; ++i)
+	{
+		struct ListenerRootState *root = listener_get_root(listener, g_array_index(watch->roots, guint, i));
+		struct RingEvent ev;
+
+		if (root == NULL)
+			continue;
+
+		if (root->recursive && (event->mask & IN_ISDIR) && event->len)
+		{
+			const char *path = inotify_path(str, watch, event);
+
+			/* Only a new directory can hold entries nobody was told about */
+			if ((event->mask & (IN_CREATE | IN_MOVED_TO)) && !renamed && !watch_excluded(root, path))
+				pending_push(listener, root->id, g_strdup(path), (event->mask & IN_CREATE) != 0);
+			else if (event->mask & IN_MOVED_FROM)
+				moved_dir = TRUE;
+		}
+
+		if (listener_root_accepts(root, event->mask, root->filter ? inotify_path(str, watch, event) : NULL))
+		{
+			/* An empty name keeps the trailing slash of events about the directory itself */
+			if (name == RING_EVENT_NONE)
+				name = listener_intern(listener, event->len ? event->name : "");
+
+			ev.mask = event->mask;
+			ev.cookie = event->cookie;
+			ev.count = 1;
+			ev.root = root->id;
+			ev.time = now;
+			ev.last_time = now;
+			ev.dir = watch_dir_id(listener, watch);
+			ev.name = name;
+			listener_emit(listener, &ev);
+
+			count++;
+		}
+
+		if (event->wd == root->wd && (event->mask & (IN_DELETE_SELF | IN_MOVE_SELF)))
+		{
+			if (gone == NULL)
+				gone = g_array_new(FALSE, FALSE, sizeof(guint));
+
+			g_array_append_val(gone, root->id);
+		}
+	}
+
+	/* Kept until the next event tells whether it was a rename */
+	if (moved_dir)
+	{
+		move->cookie = event->cookie;
+		move->dir = g_strdup(inotify_path(str, watch, event));
+	}
+
+	/* Changes watch->roots, so it waits until the loop is done */
+	if (gone != NULL)
+	{
+		for (guint i = 0; i < gone->len; ++i)
+		{
+			struct ListenerRootState *root = listener_get_root(listener, g_array_index(gone, guint, i));
+
+			if (root == NULL)
+				continue;
+
+			if (event->mask & IN_DELETE_SELF)
+				listener_error(listener, root->id, "Listening directory '%s' was deleted!", root->dir);
+			else
+				listener_error(listener, root->id, "Listening directory '%s' was moved!", root->dir);
+
+			listener_drop_root(listener, root);
+		}
+
+		g_array_free(gone, TRUE);
+	}
+
+	g_string_erase(str, 0, -1);
+
+	return count;
+}
+
+/* Queues every event in buf for the consumer and returns how many there were */
+static int inotify_buffer(struct Listener *listener, const char *buf, ssize_t len, GString *str)
+{
+	const struct inotify_event *event;
+	struct ListenerMove move = { 0, NULL };
+	int count = 0;
+
+	/* Everything in one read arrived together, one timestamp will do */
+	gint64 now = g_get_real_time();
+
+	for (const char *ptr = buf; ptr < buf + len;
+			ptr += sizeof(struct inotify_event) + event->len)
+	{
+		if (atomic_load_explicit(&listener->stop, memory_order_relaxed) != 0)
+			break;
+
+		struct ListenerWatch *watch;
+
+		event = (const struct inotify_event*) ptr;
+
+		/*
+		 * The kernel queues the two halves of a rename next to each other,
+		 * so anything else means the directory left the watched trees.
+		 * Dropping its watches may free the one this event is for, so it
+		 * happens before that is looked up.
+		 */
+		if (move.dir != NULL && !((event->mask & IN_MOVED_TO) && event->cookie == move.cookie))
+			watch_move_drop(listener, &move);
+
+		if (event->mask & IN_Q_OVERFLOW)
+		{
+			/* Not tied to any watch, so there is no path to report */
+			listener_overflow(listener, now);
+			count++;
+			continue;
+		}
+
+		if (event->mask & IN_IGNORED)
+		{
+			watch_forget(listener, event->wd);
+			continue;
+		}
+
+		/* Events still queued for a watch that was already released */
+		watch = g_hash_table_lookup(listener->wd_dirs, GINT_TO_POINTER(event->wd));
+		if (watch == NULL)
+			continue;
+
+		count += inotify_event(listener, event, watch, str, now, &move);
+	}
+
+	/* A rename split over two reads is walked again, like a move from outside */
+	watch_move_drop(listener, &move);
+
+	return count;
+}
+
+/* }}} */
+
+/* Roots {{{ */
+
+static int inotify_add_root(struct Listener *listener, struct ListenerRootState *root)
+{
+	int wd = watch_add(listener, root, root->dir);
+
+	if (wd == -1)
+	{
+		listener_error(listener, root->id, "Can't watch '%s': %s", root->dir, strerror(errno));
+		return -1;
+	}
+
+	root->wd = wd;
+
+	if (root->recursive)
+		pending_push(listener, root->id, g_strdup(root->dir), FALSE);
+
+	return 0;
+}
+
+static void inotify_remove_root(struct Listener *listener, struct ListenerRootState *root)
+{
+	GHashTableIter iter;
+	gpointer key, value;
+	GArray *wds = g_array_new(FALSE, FALSE, sizeof(int));
+
+	g_hash_table_iter_init(&iter, listener->wd_dirs);
+	while (g_hash_table_iter_next(&iter, &key, &value))
+	{
+		struct ListenerWatch *watch = value;
+
+		for (guint i = 0; i < watch->roots->len; ++i)
+		{
+			if (g_array_index(watch->roots, guint, i) == root->id)
+			{
+				int wd = GPOINTER_TO_INT(key);
+				g_array_append_val(wds, wd);
+				break;
+			}
+		}
+	}
+
+	for (guint i = 0; i < wds->len; ++i)
+		watch_release(listener, root, g_array_index(wds, int, i));
+
+	g_array_free(wds, TRUE);
+}
+
+/* }}} */
+
+/* Setup {{{ */
+
+int listener_inotify_setup(struct Listener *listener)
+{
+	int fd;
+
+	fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+	if (fd == -1)
+	{
+		listener_error(listener, 0, "inotify_init1: %s", strerror(errno));
+		return -1;
+	}
+
+	listener->fd = fd;
+	listener->handle = inotify_buffer;
+	listener->add = inotify_add_root;
+	listener->remove = inotify_remove_root;
+	listener->wd_dirs = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, watch_free);
+	listener->dir_wds = g_hash_table_new(g_str_hash, g_str_equal);
+
+	return 0;
+}
+
+void listener_inotify_cleanup(struct Listener *listener)
+{
+	if (listener->wd_dirs == NULL)
+		return;
+
+	g_hash_table_destroy(listener->dir_wds);
+	g_hash_table_destroy(listener->wd_dirs);
+	g_queue_clear_full(&listener->pending, pending_free);
+
+	listener->dir_wds = NULL;
+	listener->wd_dirs = NULL;
+}
+
+/* }}} */
@@ -0,0 +1,184 @@
+#ifndef LISTENER_PRIVATE_H
+#define LISTENER_PRIVATE_H
+
+#include <glib.h>
+#include <stdatomic.h>
+#include <sys/inotify.h>
+#include <sys/types.h>
+
+#include "coalescer.h"
+#include "event_ring.h"
+#include "listener.h"
+#include "path_filter.h"
+#include "string_table.h"
+
+/* Default ring capacity */
+#define LISTENER_RING_SIZE 65536
+
+/* Events a root can ask for */
+#define LISTENER_EVENTS (IN_OPEN | IN_CLOSE | IN_MOVE | IN_CREATE | IN_DELETE | IN_DELETE_SELF | IN_MODIFY | IN_MOVE_SELF)
+
+/*
+ * Bytes a path table may take before the listener starts another one, and
+ * what an interned string costs beyond its characters
+ */
+#define LISTENER_PATHS_MAX ((gsize) 8 << 20)
+#define LISTENER_PATH_OVERHEAD 48
+
+/* The bit of an interned id saying which of the two path tables it is in */
+#define LISTENER_PATHS_BIT 31
+
+/* Bounds of the adaptive read buffer */
+#define LISTENER_READ_MIN 4096
+#define LISTENER_READ_MAX (1 << 20)
+
+/* fanotify: a file system with at least one root on it */
+struct ListenerMount;
+
+/* One watched directory tree */
+struct ListenerRootState
+{
+	/* Fixed once queued */
+	guint id;
+	char *dir;
+	size_t dir_len;
+	gboolean recursive;
+	guint32 events;
+	struct PathFilter *filter;
+
+	/* Read by the consumer */
+	atomic_ullong n_events;
+	atomic_ullong n_filtered;
+	atomic_uint n_watches;
+	atomic_int active;
+
+	/* Listener thread only */
+	gboolean limit_reported;
+
+	/* inotify: watch on dir itself */
+	int wd;
+
+	/* fanotify: file system the root lives on, and the root's own file handle */
+	struct ListenerMount *mount;
+	gpointer handle;
+};
+
+/* Pending root changes, applied by the listener thread */
+struct ListenerCommand
+{
+	guint id;
+
+	/* NULL to remove root id */
+	struct ListenerRootState *add;
+};
+
+struct Listener
+{
+	/* Fixed once the thread is running */
+	enum ListenerBackend backend;
+	guint coalesce_ms;
+	ListenerStateFunc state_func;
+	gpointer state_data;
+	GThread *thread;
+	int efd;
+	int notify_fd;
+
+	/* Shared between the thread and the consumer */
+	struct EventRing *ring;
+
+	/*
+	 * Interned dirs and names; the thread adds, the consumer looks up. Once
+	 * the current table outgrows LISTENER_PATHS_MAX the thread moves on to
+	 * the other one, and the consumer frees the old one as soon as it has
+	 * drained every event pushed before the switch (ring head paths_retire_at).
+	 * paths_retiring is the old table's index plus one, 0 when there is none.
+	 */
+	struct StringTable *paths[2];
+	atomic_int paths_retiring;
+	atomic_uint paths_retire_at;
+	atomic_uint overflows;
+	atomic_int running;
+	atomic_int stop;
+
+	/*
+	 * Every root ever queued, by id, and the commands not applied yet. Only
+	 * the listener thread changes the table, so it reads it without the lock.
+	 */
+	GMutex lock;
+	GHashTable *roots;
+	GQueue commands;
+
+	/*
+	 * Counters for listener_get_stats(). Each has a single writer, the
+	 * listener thread or the consumer, see listener_count().
+	 */
+	atomic_ullong n_wakeups;
+	atomic_ullong n_reads;
+	atomic_ullong n_bytes;
+	atomic_ullong n_read_events;
+	atomic_ullong n_coalesced;
+	atomic_ullong n_dropped;
+	atomic_ullong n_drained;
+	atomic_ullong n_drains;
+	atomic_ullong drain_time;
+
+	/* Consumer only */
+	struct RingEvent *batch;
+	guint batch_size;
+	GString *batch_paths;
+	guint next_root;
+
+	/* Listener thread only */
+	int fd;
+	int epfd;
+	guint n_active;
+	int (*handle)(struct Listener *listener, const char *buf, ssize_t len, GString *str);
+	int (*add)(struct Listener *listener, struct ListenerRootState *root);
+	void (*remove)(struct Listener *listener, struct ListenerRootState *root);
+	struct Coalescer *coalescer;
+	guint paths_current;
+	guint paths_generation;
+	char *buf;
+	size_t buf_size;
+	guint pushed;
+
+	/* inotify */
+	GHashTable *wd_dirs;
+	GHashTable *dir_wds;
+	GQueue pending;
+
+	/* fanotify */
+	GPtrArray *mounts;
+};
+
+/* Adds to a counter only the calling thread writes, without a locked instruction */
+static inline void listener_count(atomic_ullong *counter, guint64 n)
+{
+	atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + n,
+			memory_order_relaxed);
+}
+
+void listener_error(struct Listener *listener, guint root, const char *format, ...) G_GNUC_PRINTF(3, 4);
+void listener_status(struct Listener *listener, guint root, const char *format, ...) G_GNUC_PRINTF(3, 4);
+struct ListenerRootState *listener_get_root(struct Listener *listener, guint id);
+void listener_root_set_dir(struct ListenerRootState *root, const char *dir);
+const char *listener_root_relative(struct ListenerRootState *root, const char *path);
+gboolean listener_root_accepts(struct ListenerRootState *root, guint32 mask, const char *path);
+guint32 listener_intern(struct Listener *listener, const char *str);
+void listener_emit(struct Listener *listener, struct RingEvent *ev);
+void listener_overflow(struct Listener *listener, gint64 now);
+void listener_drop_root(struct Listener *listener, struct ListenerRootState *root);
+
+struct Listener *listener_new(const struct ListenerOptions *options, ListenerStateFunc func,
+		gpointer data, GError **error);
+int listener_open(struct Listener *listener);
+void listener_close(struct Listener *listener);
+
+int listener_inotify_setup(struct Listener *listener);
+void listener_inotify_walk(struct Listener *listener, guint budget);
+void listener_inotify_cleanup(struct Listener *listener);
+
+int listener_fanotify_setup(struct Listener *listener);
+void listener_fanotify_cleanup(struct Listener *listener);
+
+#endif /* end of include guard: LISTENER_PRIVATE_H */
@@ -0,0 +1,305 @@
+/* vim: set fdm=marker : */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <glib.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "metrics.h"
+
+#define METRICS_ERROR g_quark_from_static_string("metrics-error")
+
+/* Name prefix of every metric */
+#define METRICS_PREFIX "inotify_listener_"
+
+/* A client that doesn't take its snapshot within this long is dropped */
+#define METRICS_SEND_TIMEOUT 1
+
+struct Metrics
+{
+	/* File target */
+	char *path;
+
+	/* Socket target, served by thread */
+	char *socket_path;
+	int fd;
+	GThread *thread;
+	atomic_int stop;
+
+	/* Latest snapshot */
+	GMutex lock;
+	GString *text;
+};
+
+/* Format {{{ */
+
+static void metrics_family(GString *out, const char *name, const char *type, const char *help)
+{
+	g_string_append_printf(out, "# HELP " METRICS_PREFIX "%s %s\n", name, help);
+	g_string_append_printf(out, "# TYPE " METRICS_PREFIX "%s %s\n", name, type);
+}
+
+static void metrics_value(GString *out, const char *name, const char *type, const char *help, guint64 value)
+{
+	metrics_family(out, name, type, help);
+	g_string_append_printf(out, METRICS_PREFIX "%s %" G_GUINT64_FORMAT "\n", name, value);
+}
+
+/* Label values escape backslashes, quotes and newlines */
+static void metrics_label(GString *out, const char *name, const char *value)
+{
+	g_string_append_printf(out, "{%s=\"", name);
+
+	for (const char *c = value; *c; ++c)
+	{
+		switch (*c)
+		{
+		case '\\':
+			g_string_append(out, "\\\\");
+			break;
+		case '"':
+			g_string_append(out, "\\\"");
+			break;
+		case '\n':
+			g_string_append(out, "\\n");
+			break;
+		default:
+			g_string_append_c(out, *c);
+			break;
+		}
+	}
+
+	g_string_append(out, "\"}");
+}
+
+void metrics_format(GString *out, const struct ListenerStats *stats)
+{
+	metrics_value(out, "wakeups_total", "counter",
+			"Times the notification fd woke the listener thread", stats->wakeups);
+	metrics_value(out, "reads_total", "counter",
+			"read() calls that returned events", stats->reads);
+	metrics_value(out, "read_bytes_total", "counter",
+			"Bytes read from the notification fd", stats->bytes);
+	metrics_value(out, "read_events_total", "counter",
+			"Events decoded from what was read", stats->events);
+	metrics_value(out, "coalesced_events_total", "counter",
+			"Events merged into an earlier one by coalescing", stats->coalesced);
+	metrics_value(out, "dropped_events_total", "counter",
+			"Events lost because the queue to the consumer was full", stats->dropped);
+	metrics_value(out, "queue_overflows_total", "counter",
+			"Times the kernel's event queue overflowed", stats->overflows);
+	metrics_value(out, "queue_depth", "gauge",
+			"Events waiting for the consumer", stats->queued);
+	metrics_value(out, "queue_capacity", "gauge",
+			"Events the queue to the consumer holds", stats->capacity);
+	metrics_value(out, "drained_events_total", "counter",
+			"Events taken off the queue by the consumer", stats->drained);
+	metrics_value(out, "drains_total", "counter",
+			"Times the consumer drained the queue", stats->drains);
+
+	metrics_family(out, "drain_seconds_total", "counter",
+			"Time the consumer spent draining and handling events");
+	g_string_append_printf(out, METRICS_PREFIX "drain_seconds_total %" G_GUINT64_FORMAT ".%06u\n",
+			stats->drain_time / G_USEC_PER_SEC, (guint) (stats->drain_time % G_USEC_PER_SEC));
+}
+
+void metrics_format_roots(GString *out, const char *const *dirs,
+		const struct ListenerRootStats *stats, guint n)
+{
+	if (n == 0)
+		return;
+
+	metrics_family(out, "root_events_total", "counter", "Events passed on for a root");
+	for (guint i = 0; i < n; ++i)
+	{
+		g_string_append(out, METRICS_PREFIX "root_events_total");
+		metrics_label(out, "root", dirs[i]);
+		g_string_append_printf(out, " %" G_GUINT64_FORMAT "\n", stats[i].events);
+	}
+
+	metrics_family(out, "root_filtered_total", "counter", "Events a root's filter held back");
+	for (guint i = 0; i < n; ++i)
+	{
+		g_string_append(out, METRICS_PREFIX "root_filtered_total");
+		metrics_label(out, "root", dirs[i]);
+		g_string_append_printf(out, " %" G_GUINT64_FORMAT "\n", stats[i].filtered);
+	}
+
+	metrics_family(out, "root_watches", "gauge", "Directories watched for a root");
+	for (guint i = 0; i < n; ++i)
+	{
+		g_string_append(out, METRICS_PREFIX "root_watches");
+		metrics_label(out, "root", dirs[i]);
+		g_string_append_printf(out, " %u\n", stats[i].watches);
+	}
+}
+
+/* }}} */
+
+/* Socket {{{ */
+
+static void metrics_send(int fd, const char *buf, gsize len)
+{
+	while (len > 0)
+	{
+		ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+		if (n == -1)
+		{
+			if (errno == EINTR)
+				continue;
+
+			return;
+		}
+
+		buf += n;
+		len -= n;
+	}
+}
+
+/* Hands every client the latest snapshot until metrics_close() shuts the socket down */
+static gpointer metrics_serve(gpointer data)
+{
+	struct Metrics *metrics = data;
+	struct timeval timeout = { METRICS_SEND_TIMEOUT, 0 };
+	GString *text = g_string_new(NULL);
+
+	while (atomic_load(&metrics->stop) == 0)
+	{
+		int fd = accept4(metrics->fd, NULL, NULL, SOCK_CLOEXEC);
+		if (fd == -1)
+		{
+			if (errno == EINTR || errno == ECONNABORTED)
+				continue;
+
+			/* Out of fds or the like; try again in a bit rather than spin */
+			if (atomic_load(&metrics->stop) == 0)
+				g_usleep(G_USEC_PER_SEC / 10);
+
+			continue;
+		}
+
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+		g_mutex_lock(&metrics->lock);
+		g_string_assign(text, metrics->text->str);
+		g_mutex_unlock(&metrics->lock);
+
+		metrics_send(fd, text->str, text->len);
+		close(fd);
+	}
+
+	g_string_free(text, TRUE);
+	return NULL;
+}
+
+static gboolean metrics_listen(struct Metrics *metrics, const char *path, GError **error)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct stat st;
+
+	if (strlen(path) >= sizeof(addr.sun_path))
+	{
+		g_set_error(error, METRICS_ERROR, ENAMETOOLONG, "%s: socket path too long", path);
+		return FALSE;
+	}
+
+	strcpy(addr.sun_path, path);
+
+	/* Left over from an earlier run */
+	if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+		unlink(path);
+
+	metrics->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (metrics->fd == -1)
+	{
+		g_set_error(error, METRICS_ERROR, errno, "socket: %s", strerror(errno));
+		return FALSE;
+	}
+
+	if (bind(metrics->fd, (struct sockaddr*) &addr, sizeof(addr)) == -1 ||
+			listen(metrics->fd, 16) == -1)
+	{
+		g_set_error(error, METRICS_ERROR, errno, "%s: %s", path, strerror(errno));
+		close(metrics->fd);
+		metrics->fd = -1;
+		return FALSE;
+	}
+
+	metrics->socket_path = g_strdup(path);
+	metrics->thread = g_thread_new("metrics", metrics_serve, metrics);
+
+	return TRUE;
+}
+
+/* }}} */
+
+struct Metrics *metrics_open(const char *target, GError **error)
+{
+	struct Metrics *metrics = g_new0(struct Metrics, 1);
+
+	metrics->fd = -1;
+	metrics->text = g_string_new(NULL);
+	g_mutex_init(&metrics->lock);
+	atomic_init(&metrics->stop, 0);
+
+	if (g_str_has_prefix(target, "unix:"))
+	{
+		if (!metrics_listen(metrics, target + strlen("unix:"), error))
+		{
+			metrics_close(metrics);
+			return NULL;
+		}
+	}
+	else
+		metrics->path = g_strdup(target);
+
+	return metrics;
+}
+
+/*
+ * Replaces the snapshot. A file target is rewritten right away, through a
+ * temporary file, so readers never see half of it.
+ */
+gboolean metrics_publish(struct Metrics *metrics, const GString *text, GError **error)
+{
+	if (metrics->path != NULL)
+		return g_file_set_contents(metrics->path, text->str, text->len, error);
+
+	g_mutex_lock(&metrics->lock);
+	g_string_assign(metrics->text, text->str);
+	g_mutex_unlock(&metrics->lock);
+
+	return TRUE;
+}
+
+void metrics_close(struct Metrics *metrics)
+{
+	if (metrics == NULL)
+		return;
+
+	if (metrics->thread != NULL)
+	{
+		/* Makes the blocked accept() fail */
+		atomic_store(&metrics->stop, 1);
+		shutdown(metrics->fd, SHUT_RDWR);
+		g_thread_join(metrics->thread);
+	}
+
+	if (metrics->fd != -1)
+		close(metrics->fd);
+
+	if (metrics->socket_path != NULL)
+		unlink(metrics->socket_path);
+
+	g_free(metrics->socket_path);
+	g_free(metrics->path);
+	g_string_free(metrics->text, TRUE);
+	g_mutex_clear(&metrics->lock);
+	g_free(metrics);
+}
@@ -0,0 +1,27 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <glib.h>
+
+#include "listener.h"
+
+/*
+ * Listener counters in the Prometheus text format. A snapshot is either
+ * written to a file, replaced as a whole on every update, or served over a
+ * Unix socket ("unix:PATH"): whoever connects gets the latest snapshot and
+ * the connection is closed, so `socat - UNIX-CONNECT:PATH` is a scrape.
+ */
+
+struct Metrics;
+
+struct Metrics *metrics_open(const char *target, GError **error);
+gboolean metrics_publish(struct Metrics *metrics, const GString *text, GError **error);
+void metrics_close(struct Metrics *metrics);
+
+void metrics_format(GString *out, const struct ListenerStats *stats);
+
+/* dirs[i] is the directory of the root stats[i] is about */
+void metrics_format_roots(GString *out, const char *const *dirs,
+		const struct ListenerRootStats *stats, guint n);
+
+#endif /* end of include guard: METRICS_H */
@@ -0,0 +1,226 @@
+/* vim: set fdm=marker : */
+
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <gio/gio.h>
+#include <magic.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <unistd.h>
+
+#include "mime_cache.h"
+
+struct MimeKey
+{
+	dev_t dev;
+	ino_t ino;
+	gint64 mtime_sec;
+	glong mtime_nsec;
+	off_t size;
+};
+
+/* libmagic handles can't be shared between threads, so each thread loads its own */
+struct MimeMagic
+{
+	magic_t magic;
+};
+
+static void mime_magic_free(gpointer data)
+{
+	struct MimeMagic *mm = data;
+
+	if (mm->magic != NULL)
+		magic_close(mm->magic);
+
+	g_free(mm);
+}
+
+static GPrivate magic_key = G_PRIVATE_INIT(mime_magic_free);
+
+static GMutex cache_lock;
+static guint sniff_latency;
+static GHashTable *cache;
+
+/* Cache {{{ */
+
+static guint mime_key_hash(gconstpointer key)
+{
+	const struct MimeKey *k = key;
+
+	return (guint) (k->ino * 2654435761u) ^ (guint) k->dev ^
+		(guint) k->mtime_sec ^ (guint) k->mtime_nsec ^ (guint) k->size;
+}
+
+static gboolean mime_key_equal(gconstpointer a, gconstpointer b)
+{
+	const struct MimeKey *ka = a;
+	const struct MimeKey *kb = b;
+
+	return ka->ino == kb->ino && ka->dev == kb->dev &&
+		ka->mtime_sec == kb->mtime_sec && ka->mtime_nsec == kb->mtime_nsec &&
+		ka->size == kb->size;
+}
+
+static const char *cache_lookup(const struct MimeKey *key)
+{
+	const char *ct = NULL;
+
+	g_mutex_lock(&cache_lock);
+
+	if (cache != NULL)
+		ct = g_hash_table_lookup(cache, key);
+
+	g_mutex_unlock(&cache_lock);
+
+	return ct;
+}
+
+void mime_cache_clear(void)
+{
+	g_mutex_lock(&cache_lock);
+
+	if (cache != NULL)
+		g_hash_table_remove_all(cache);
+
+	g_mutex_unlock(&cache_lock);
+}
+
+static void cache_insert(const struct MimeKey *key, const char *ct)
+{
+	g_mutex_lock(&cache_lock);
+
+	if (cache == NULL)
+		cache = g_hash_table_new_full(mime_key_hash, mime_key_equal, g_free, NULL);
+
+	if (g_hash_table_size(cache) >= MIME_CACHE_SIZE)
+		g_hash_table_remove_all(cache);
+
+	g_hash_table_insert(cache, g_memdup2(key, sizeof(*key)), (gpointer) ct);
+
+	g_mutex_unlock(&cache_lock);
+}
+
+/* }}} */
+
+/* Sniffing {{{ */
+
+/* The calling thread's handle, loaded on first use; NULL if libmagic isn't usable */
+static magic_t mime_magic(void)
+{
+	struct MimeMagic *mm = g_private_get(&magic_key);
+
+	if (mm == NULL)
+	{
+		mm = g_new0(struct MimeMagic, 1);
+		mm->magic = magic_open(MAGIC_MIME_TYPE);
+
+		if (mm->magic != NULL && magic_load(mm->magic, NULL) != 0)
+		{
+			magic_close(mm->magic);
+			mm->magic = NULL;
+		}
+
+		g_private_set(&magic_key, mm);
+	}
+
+	return mm->magic;
+}
+
+/* Reads the start of the file; returns NULL if libmagic isn't usable */
+static const char *mime_sniff(int dfd, const char *name)
+{
+	const char *mime, *ct = NULL;
+	magic_t magic;
+	guint latency;
+	int fd;
+
+	magic = mime_magic();
+	if (magic == NULL)
+		return NULL;
+
+	latency = g_atomic_int_get(&sniff_latency);
+	if (latency != 0)
+		g_usleep(latency);
+
+	/* O_NONBLOCK so a file swapped for a FIFO under our feet can't hang the scan */
+	fd = openat(dfd, name, O_RDONLY | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (fd == -1)
+		return NULL;
+
+	mime = magic_descriptor(magic, fd);
+	if (mime != NULL)
+	{
+		char *type = g_content_type_from_mime_type(mime);
+		ct = g_intern_string(type);
+		g_free(type);
+	}
+
+	close(fd);
+
+	return ct;
+}
+
+/* }}} */
+
+void mime_cache_set_latency(guint usec)
+{
+	g_atomic_int_set(&sniff_latency, usec);
+}
+
+const char *mime_cache_guess(const char *name, const struct statx *stx, gboolean *uncertain)
+{
+	const char *ct;
+	char *guess;
+
+	*uncertain = FALSE;
+
+	/* Nothing to read for anything but regular files */
+	if (S_ISDIR(stx->stx_mode))
+		return g_intern_static_string("inode/directory");
+	if (S_ISCHR(stx->stx_mode))
+		return g_intern_static_string("inode/chardevice");
+	if (S_ISBLK(stx->stx_mode))
+		return g_intern_static_string("inode/blockdevice");
+	if (S_ISFIFO(stx->stx_mode))
+		return g_intern_static_string("inode/fifo");
+	if (S_ISSOCK(stx->stx_mode))
+		return g_intern_static_string("inode/socket");
+	if (stx->stx_size == 0)
+		return g_intern_static_string("application/x-zerosize");
+
+	guess = g_content_type_guess(name, NULL, 0, uncertain);
+	ct = g_intern_string(guess);
+	g_free(guess);
+
+	return ct;
+}
+
+const char *mime_cache_get(int dfd, const char *name, const struct statx *stx)
+{
+	struct MimeKey key;
+	gboolean uncertain;
+	const char *ct;
+
+	ct = mime_cache_guess(name, stx, &uncertain);
+	if (!uncertain)
+		return ct;
+
+	key.dev = makedev(stx->stx_dev_major, stx->stx_dev_minor);
+	key.ino = stx->stx_ino;
+	key.mtime_sec = stx->stx_mtime.tv_sec;
+	key.mtime_nsec = stx->stx_mtime.tv_nsec;
+	key.size = stx->stx_size;
+
+	const char *cached = cache_lookup(&key);
+	if (cached != NULL)
+		return cached;
+
+	const char *sniffed = mime_sniff(dfd, name);
+	if (sniffed == NULL)
+		return ct;
+
+	cache_insert(&key, sniffed);
+
+	return sniffed;
+}
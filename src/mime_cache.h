@@ -0,0 +1,35 @@
+#ifndef MIME_CACHE_H
+#define MIME_CACHE_H
+
+#include <glib.h>
+#include <sys/stat.h>
+
+/*
+ * Content type detection for the directory view. The file name is tried
+ * first; file contents are only sniffed with libmagic when the name is not
+ * conclusive, and the result is cached by (dev, inode, mtime, size), so
+ * listing the same directory again reads no file contents at all.
+ *
+ * Safe to call from any thread. Every thread loads its own magic database
+ * on first use, so sniffing runs in parallel.
+ */
+
+/* Cached sniffing results kept before the cache starts over */
+#define MIME_CACHE_SIZE 65536
+
+/* Returns an interned content type for name in the directory dfd */
+const char *mime_cache_get(int dfd, const char *name, const struct statx *stx);
+
+/*
+ * The type going by the name and mode alone, without touching the file;
+ * *uncertain is set when mime_cache_get() might tell better.
+ */
+const char *mime_cache_guess(const char *name, const struct statx *stx, gboolean *uncertain);
+
+/* Forgets every sniffed type, so the next lookups read file contents again */
+void mime_cache_clear(void);
+
+/* For benchmarks: waits usec before reading each file, as a slow file system would */
+void mime_cache_set_latency(guint usec);
+
+#endif /* end of include guard: MIME_CACHE_H */
@@ -0,0 +1,353 @@
+/* vim: set fdm=marker : */
+
+#include <glib.h>
+#include <linux/limits.h>
+#include <string.h>
+
+#include "path_filter.h"
+
+struct PathRule
+{
+	/* Position among all rules of its kind; later rules win */
+	guint index;
+	gboolean negate;
+	gboolean dir_only;
+
+	/* Matched against the whole relative path rather than the name */
+	gboolean anchored;
+
+	/* NULL for rules looked up by name or suffix */
+	GPatternSpec *spec;
+};
+
+struct PathRules
+{
+	/* Owns every rule, by index */
+	GPtrArray *rules;
+
+	/* Name or ".ext" -> GPtrArray of the rules for it, by index */
+	GHashTable *names;
+	GHashTable *suffixes;
+
+	/* Rules that need a GPatternSpec, by index */
+	GPtrArray *patterns;
+};
+
+struct PathFilter
+{
+	gint ref;
+	struct PathRules exclude;
+	struct PathRules include;
+};
+
+/* Rules {{{ */
+
+static void rule_free(gpointer data)
+{
+	struct PathRule *rule = data;
+
+	if (rule->spec != NULL)
+		g_pattern_spec_free(rule->spec);
+
+	g_free(rule);
+}
+
+static void rules_init(struct PathRules *rules)
+{
+	rules->rules = g_ptr_array_new_with_free_func(rule_free);
+	rules->names = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_ptr_array_unref);
+	rules->suffixes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, (GDestroyNotify) g_ptr_array_unref);
+	rules->patterns = g_ptr_array_new();
+}
+
+static void rules_clear(struct PathRules *rules)
+{
+	g_hash_table_destroy(rules->names);
+	g_hash_table_destroy(rules->suffixes);
+	g_ptr_array_free(rules->patterns, TRUE);
+	g_ptr_array_free(rules->rules, TRUE);
+}
+
+static void rules_insert(GHashTable *table, const char *key, struct PathRule *rule)
+{
+	GPtrArray *list = g_hash_table_lookup(table, key);
+
+	if (list == NULL)
+	{
+		list = g_ptr_array_new();
+		g_hash_table_insert(table, g_strdup(key), list);
+	}
+
+	g_ptr_array_add(list, rule);
+}
+
+/* GPatternSpec knows no other wildcards */
+static gboolean has_wildcard(const char *pattern)
+{
+	return strpbrk(pattern, "*?") != NULL;
+}
+
+static void rules_add(struct PathRules *rules, const char *text, gboolean allow_negate)
+{
+	struct PathRule rule = {0};
+	char *copy, *pattern;
+	size_t len;
+
+	copy = g_strstrip(g_strdup(text));
+	pattern = copy;
+
+	if (*pattern == '\0' || *pattern == '#')
+		goto out;
+
+	if (allow_negate && *pattern == '!')
+	{
+		rule.negate = TRUE;
+		pattern++;
+	}
+
+	/* "\!name" and "\#name" stand for the names themselves */
+	if (*pattern == '\\')
+		pattern++;
+
+	len = strlen(pattern);
+	while (len > 0 && pattern[len - 1] == '/')
+	{
+		pattern[--len] = '\0';
+		rule.dir_only = TRUE;
+	}
+
+	while (g_str_has_prefix(pattern, "**/"))
+		pattern += 3;
+
+	if (*pattern == '/')
+	{
+		rule.anchored = TRUE;
+		while (*pattern == '/')
+			pattern++;
+	}
+	else if (strchr(pattern, '/') != NULL)
+		rule.anchored = TRUE;
+
+	if (*pattern == '\0')
+		goto out;
+
+	struct PathRule *r = g_memdup2(&rule, sizeof(rule));
+	r->index = rules->rules->len;
+	g_ptr_array_add(rules->rules, r);
+
+	if (!r->anchored && !has_wildcard(pattern))
+		rules_insert(rules->names, pattern, r);
+	else if (!r->anchored && pattern[0] == '*' && pattern[1] == '.' && !has_wildcard(pattern + 1))
+		rules_insert(rules->suffixes, pattern + 1, r);
+	else
+	{
+		r->spec = g_pattern_spec_new(pattern);
+		g_ptr_array_add(rules->patterns, r);
+	}
+
+out:
+	g_free(copy);
+}
+
+/* The latest rule for key that applies, if it is later than best */
+static const struct PathRule *rules_lookup(GHashTable *table, const char *key, gboolean is_dir,
+		const struct PathRule *best)
+{
+	GPtrArray *list = g_hash_table_lookup(table, key);
+
+	if (list == NULL)
+		return best;
+
+	for (guint i = list->len; i-- > 0;)
+	{
+		const struct PathRule *rule = g_ptr_array_index(list, i);
+
+		if (best != NULL && rule->index < best->index)
+			break;
+
+		if (rule->dir_only && !is_dir)
+			continue;
+
+		return rule;
+	}
+
+	return best;
+}
+
+/* The last rule matching the entry name at path, or NULL */
+static const struct PathRule *rules_match(const struct PathRules *rules, const char *path,
+		const char *name, gboolean is_dir)
+{
+	const struct PathRule *best;
+
+	best = rules_lookup(rules->names, name, is_dir, NULL);
+
+	for (const char *dot = strchr(name, '.'); dot != NULL; dot = strchr(dot + 1, '.'))
+		best = rules_lookup(rules->suffixes, dot, is_dir, best);
+
+	for (guint i = rules->patterns->len; i-- > 0;)
+	{
+		const struct PathRule *rule = g_ptr_array_index(rules->patterns, i);
+		const char *subject = rule->anchored ? path : name;
+
+		if (best != NULL && rule->index < best->index)
+			break;
+
+		if (rule->dir_only && !is_dir)
+			continue;
+
+		if (g_pattern_spec_match(rule->spec, strlen(subject), subject, NULL))
+			return rule;
+	}
+
+	return best;
+}
+
+/* }}} */
+
+/* Matching {{{ */
+
+/*
+ * Whether path, which may be changed in between but is restored, is
+ * excluded itself or through one of its parents. Sets *name to its last
+ * component.
+ */
+static gboolean filter_excluded(struct PathFilter *filter, char *path, gboolean is_dir, const char **name)
+{
+	const struct PathRule *rule;
+	char *p, *slash;
+
+	if (filter->exclude.rules->len == 0)
+	{
+		p = strrchr(path, '/');
+		*name = p != NULL ? p + 1 : path;
+		return FALSE;
+	}
+
+	for (p = path; (slash = strchr(p, '/')) != NULL; p = slash + 1)
+	{
+		if (slash == p)
+			continue;
+
+		*slash = '\0';
+		rule = rules_match(&filter->exclude, path, p, TRUE);
+		*slash = '/';
+
+		if (rule != NULL && !rule->negate)
+			return TRUE;
+	}
+
+	*name = p;
+
+	rule = rules_match(&filter->exclude, path, p, is_dir);
+	return rule != NULL && !rule->negate;
+}
+
+/* Checks rel on a writable copy without trailing slashes */
+static gboolean filter_check(struct PathFilter *filter, const char *rel, gboolean is_dir, gboolean include)
+{
+	char buf[PATH_MAX];
+	char *path = buf;
+	const char *name;
+	size_t len = strlen(rel);
+	gboolean pass;
+
+	while (len > 0 && rel[len - 1] == '/')
+		len--;
+
+	/* The root itself */
+	if (len == 0)
+		return TRUE;
+
+	if (len >= sizeof(buf))
+		path = g_malloc(len + 1);
+
+	memcpy(path, rel, len);
+	path[len] = '\0';
+
+	pass = !filter_excluded(filter, path, is_dir, &name);
+
+	if (pass && include && !is_dir && filter->include.rules->len > 0)
+		pass = rules_match(&filter->include, path, name, FALSE) != NULL;
+
+	if (path != buf)
+		g_free(path);
+
+	return pass;
+}
+
+/* }}} */
+
+struct PathFilter *path_filter_new(void)
+{
+	struct PathFilter *filter = g_new(struct PathFilter, 1);
+
+	filter->ref = 1;
+	rules_init(&filter->exclude);
+	rules_init(&filter->include);
+
+	return filter;
+}
+
+struct PathFilter *path_filter_ref(struct PathFilter *filter)
+{
+	g_atomic_int_inc(&filter->ref);
+	return filter;
+}
+
+void path_filter_unref(struct PathFilter *filter)
+{
+	if (filter == NULL || !g_atomic_int_dec_and_test(&filter->ref))
+		return;
+
+	rules_clear(&filter->exclude);
+	rules_clear(&filter->include);
+	g_free(filter);
+}
+
+void path_filter_add_exclude(struct PathFilter *filter, const char *rule)
+{
+	rules_add(&filter->exclude, rule, TRUE);
+}
+
+void path_filter_add_include(struct PathFilter *filter, const char *rule)
+{
+	rules_add(&filter->include, rule, FALSE);
+}
+
+gboolean path_filter_load(struct PathFilter *filter, const char *path, GError **error)
+{
+	char *contents;
+	char **lines;
+
+	if (!g_file_get_contents(path, &contents, NULL, error))
+		return FALSE;
+
+	lines = g_strsplit(contents, "\n", -1);
+
+	for (char **line = lines; *line; ++line)
+		path_filter_add_exclude(filter, *line);
+
+	g_strfreev(lines);
+	g_free(contents);
+
+	return TRUE;
+}
+
+gboolean path_filter_is_empty(struct PathFilter *filter)
+{
+	return filter->exclude.rules->len == 0 && filter->include.rules->len == 0;
+}
+
+gboolean path_filter_match(struct PathFilter *filter, const char *rel, gboolean is_dir)
+{
+	return filter_check(filter, rel, is_dir, TRUE);
+}
+
+gboolean path_filter_excludes_dir(struct PathFilter *filter, const char *rel)
+{
+	if (filter->exclude.rules->len == 0)
+		return FALSE;
+
+	return !filter_check(filter, rel, TRUE, FALSE);
+}
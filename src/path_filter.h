@@ -0,0 +1,43 @@
+#ifndef PATH_FILTER_H
+#define PATH_FILTER_H
+
+#include <glib.h>
+
+/*
+ * Include/exclude rules for paths relative to a watched root, compiled once
+ * and matched on the listener thread for every event.
+ *
+ * Exclude rules follow .gitignore: a rule without a slash matches the name
+ * at any depth, one with a slash matches the path from the root, a trailing
+ * slash limits it to directories, "!" re-includes what an earlier rule
+ * excluded and the last matching rule wins. Nothing below an excluded
+ * directory can be re-included. Include rules are plain globs of the same
+ * form; once there is one, entries other than directories have to match
+ * at least one of them.
+ *
+ * Plain names and "*.ext" rules are hash lookups, the rest are GPatternSpecs.
+ * A filter is immutable once handed to a listener and may be shared.
+ */
+
+struct PathFilter;
+
+struct PathFilter *path_filter_new(void);
+struct PathFilter *path_filter_ref(struct PathFilter *filter);
+void path_filter_unref(struct PathFilter *filter);
+
+/* Blank lines and comments are skipped */
+void path_filter_add_exclude(struct PathFilter *filter, const char *rule);
+void path_filter_add_include(struct PathFilter *filter, const char *rule);
+
+/* Adds the exclude rules of a .gitignore-style file */
+gboolean path_filter_load(struct PathFilter *filter, const char *path, GError **error);
+
+gboolean path_filter_is_empty(struct PathFilter *filter);
+
+/* Whether events for rel should be passed on */
+gboolean path_filter_match(struct PathFilter *filter, const char *rel, gboolean is_dir);
+
+/* Whether the directory rel is excluded along with everything below it */
+gboolean path_filter_excludes_dir(struct PathFilter *filter, const char *rel);
+
+#endif /* end of include guard: PATH_FILTER_H */
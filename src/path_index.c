@@ -0,0 +1,154 @@
+/* vim: set fdm=marker : */
+
+#include <glib.h>
+#include <string.h>
+
+#include "path_index.h"
+
+/* What a trigram costs besides its list: hash node, GArray header */
+#define PATH_INDEX_GRAM_OVERHEAD 64
+
+struct PathIndex
+{
+	/* Trigram to GArray of guint32 ids */
+	GHashTable *grams;
+	gsize bytes;
+};
+
+static void path_index_list_free(gpointer data)
+{
+	g_array_free(data, TRUE);
+}
+
+struct PathIndex *path_index_new(void)
+{
+	struct PathIndex *index = g_new0(struct PathIndex, 1);
+
+	index->grams = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, path_index_list_free);
+
+	return index;
+}
+
+void path_index_free(struct PathIndex *index)
+{
+	if (index == NULL)
+		return;
+
+	g_hash_table_destroy(index->grams);
+	g_free(index);
+}
+
+/* Adding {{{ */
+
+void path_index_add(struct PathIndex *index, guint32 id, const char *str)
+{
+	gsize len = strlen(str);
+
+	for (gsize i = 0; i + PATH_INDEX_GRAM <= len; ++i)
+	{
+		gpointer gram = GUINT_TO_POINTER(path_index_gram(str + i));
+		GArray *ids = g_hash_table_lookup(index->grams, gram);
+
+		if (ids == NULL)
+		{
+			ids = g_array_new(FALSE, FALSE, sizeof(guint32));
+			g_hash_table_insert(index->grams, gram, ids);
+			index->bytes += PATH_INDEX_GRAM_OVERHEAD;
+		}
+		else if (g_array_index(ids, guint32, ids->len - 1) == id)
+			/* Seen earlier in this string */
+			continue;
+
+		g_array_append_val(ids, id);
+		index->bytes += sizeof(guint32);
+	}
+}
+
+/* }}} */
+
+/* Querying {{{ */
+
+static gint path_index_list_cmp(gconstpointer a, gconstpointer b)
+{
+	guint la = (*(GArray* const*) a)->len;
+	guint lb = (*(GArray* const*) b)->len;
+
+	return (la > lb) - (la < lb);
+}
+
+/* First position in ids holding at least id */
+static guint path_index_lower_bound(GArray *ids, guint32 id)
+{
+	guint lo = 0, hi = ids->len;
+
+	while (lo < hi)
+	{
+		guint mid = lo + (hi - lo) / 2;
+
+		if (g_array_index(ids, guint32, mid) < id)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+gboolean path_index_query(struct PathIndex *index, const char *needle, guint32 from, GArray *ids)
+{
+	gsize len = strlen(needle);
+	GPtrArray *lists;
+	GArray *shortest;
+
+	if (len < PATH_INDEX_GRAM)
+		return FALSE;
+
+	lists = g_ptr_array_new();
+
+	for (gsize i = 0; i + PATH_INDEX_GRAM <= len; ++i)
+	{
+		GArray *list = g_hash_table_lookup(index->grams, GUINT_TO_POINTER(path_index_gram(needle + i)));
+
+		/* A trigram nothing has means nothing matches */
+		if (list == NULL)
+		{
+			g_ptr_array_free(lists, TRUE);
+			return TRUE;
+		}
+
+		g_ptr_array_add(lists, list);
+	}
+
+	/* Walk the shortest list, looking the others up from the next shortest on */
+	g_ptr_array_sort(lists, path_index_list_cmp);
+	shortest = g_ptr_array_index(lists, 0);
+
+	for (guint i = path_index_lower_bound(shortest, from); i < shortest->len; ++i)
+	{
+		guint32 id = g_array_index(shortest, guint32, i);
+		guint j;
+
+		for (j = 1; j < lists->len; ++j)
+		{
+			GArray *list = g_ptr_array_index(lists, j);
+			guint pos = path_index_lower_bound(list, id);
+
+			if (pos == list->len || g_array_index(list, guint32, pos) != id)
+				break;
+		}
+
+		if (j == lists->len)
+			g_array_append_val(ids, id);
+	}
+
+	g_ptr_array_free(lists, TRUE);
+
+	return TRUE;
+}
+
+/* }}} */
+
+gsize path_index_get_bytes(struct PathIndex *index)
+{
+	return index->bytes;
+}
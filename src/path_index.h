@@ -0,0 +1,41 @@
+#ifndef PATH_INDEX_H
+#define PATH_INDEX_H
+
+#include <glib.h>
+
+/*
+ * Substring index over strings with dense ids, such as a StringTable's.
+ * Every id is listed under each distinct trigram of its string, ASCII case
+ * folded, in the order ids were added. A query intersects the lists of the
+ * needle's trigrams, leaving the ids whose strings may contain it; they
+ * still have to be checked.
+ */
+
+#define PATH_INDEX_GRAM 3
+
+struct PathIndex;
+
+struct PathIndex *path_index_new(void);
+void path_index_free(struct PathIndex *index);
+
+/* Ids have to be added in ascending order */
+void path_index_add(struct PathIndex *index, guint32 id, const char *str);
+
+/*
+ * Appends the ids from on that may contain needle to ids, ascending.
+ * Returns FALSE, adding nothing, if needle is too short to narrow them down.
+ */
+gboolean path_index_query(struct PathIndex *index, const char *needle, guint32 from, GArray *ids);
+
+/* Memory the index takes, roughly */
+gsize path_index_get_bytes(struct PathIndex *index);
+
+/* The trigram at s, which must have PATH_INDEX_GRAM characters */
+static inline guint32 path_index_gram(const char *s)
+{
+	return (guint32) g_ascii_tolower(s[0]) << 16 |
+		(guint32) g_ascii_tolower(s[1]) << 8 |
+		(guint32) g_ascii_tolower(s[2]);
+}
+
+#endif /* end of include guard: PATH_INDEX_H */
@@ -0,0 +1,84 @@
+#include <glib.h>
+#include <string.h>
+
+#include "string_table.h"
+
+/* Which segment id lives in, and where in it */
+static guint table_segment(guint32 id, guint32 *offset)
+{
+	guint seg = g_bit_storage(id / STRING_TABLE_FIRST + 1) - 1;
+
+	*offset = id - ((1u << seg) - 1) * STRING_TABLE_FIRST;
+	return seg;
+}
+
+struct StringTable *string_table_new(void)
+{
+	struct StringTable *table = g_new0(struct StringTable, 1);
+
+	/* Keys point into the chunk, so the hash table frees nothing */
+	table->ids = g_hash_table_new(g_str_hash, g_str_equal);
+	table->chunk = g_string_chunk_new(64 * 1024);
+	table->bytes = 0;
+	table->size = 0;
+
+	return table;
+}
+
+void string_table_free(struct StringTable *table)
+{
+	if (table == NULL)
+		return;
+
+	for (guint i = 0; i < STRING_TABLE_SEGMENTS; ++i)
+		g_free(table->segments[i]);
+
+	g_hash_table_destroy(table->ids);
+	g_string_chunk_free(table->chunk);
+	g_free(table);
+}
+
+/* Only ever called from one thread at a time */
+guint32 string_table_intern(struct StringTable *table, const char *str)
+{
+	gpointer key, value;
+	guint32 id, offset;
+	guint seg;
+
+	if (g_hash_table_lookup_extended(table->ids, str, &key, &value))
+		return GPOINTER_TO_UINT(value);
+
+	gsize len = strlen(str);
+	char *copy = (char*) g_string_chunk_insert_len(table->chunk, str, len);
+
+	id = table->size;
+	seg = table_segment(id, &offset);
+
+	if (table->segments[seg] == NULL)
+		table->segments[seg] = g_new(const char*, (gsize) STRING_TABLE_FIRST << seg);
+
+	table->segments[seg][offset] = copy;
+	g_hash_table_insert(table->ids, copy, GUINT_TO_POINTER(id));
+	table->bytes += len + 1;
+
+	g_atomic_int_set(&table->size, id + 1);
+
+	return id;
+}
+
+const char *string_table_lookup(struct StringTable *table, guint32 id)
+{
+	guint32 offset;
+	guint seg;
+
+	if (id >= (guint) g_atomic_int_get(&table->size))
+		return NULL;
+
+	seg = table_segment(id, &offset);
+	return table->segments[seg][offset];
+}
+
+guint string_table_size(struct StringTable *table)
+{
+	return g_atomic_int_get(&table->size);
+}
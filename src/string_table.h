@@ -0,0 +1,37 @@
+#ifndef STRING_TABLE_H
+#define STRING_TABLE_H
+
+#include <glib.h>
+
+/* Segment i holds STRING_TABLE_FIRST << i strings, enough for every guint32 id */
+#define STRING_TABLE_FIRST 1024
+#define STRING_TABLE_SEGMENTS 23
+
+/*
+ * Append-only table of interned strings. Every distinct string is stored
+ * once and gets a small stable id; ids are dense and start at 0.
+ *
+ * Neither the strings nor the segments holding their pointers ever move,
+ * so one thread may intern while others look up ids it handed them through
+ * some release/acquire pair, such as an EventRing.
+ */
+
+struct StringTable
+{
+	/* Writer only */
+	GHashTable *ids;
+	GStringChunk *chunk;
+	gsize bytes;
+
+	const char **segments[STRING_TABLE_SEGMENTS];
+	guint size;
+};
+
+struct StringTable *string_table_new(void);
+void string_table_free(struct StringTable *table);
+
+guint32 string_table_intern(struct StringTable *table, const char *str);
+const char *string_table_lookup(struct StringTable *table, guint32 id);
+guint string_table_size(struct StringTable *table);
+
+#endif /* end of include guard: STRING_TABLE_H */
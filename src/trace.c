@@ -0,0 +1,246 @@
+/* vim: set fdm=marker : */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <glib.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+/* Spans per buffer; a thread starts another one when it fills up */
+#define TRACE_BUFFER_EVENTS 4096
+
+/* Most buffers kept, 128 MiB; spans past that are only counted */
+#define TRACE_MAX_BUFFERS 1024
+
+#define TRACE_ERROR g_quark_from_static_string("trace-error")
+
+struct TraceEvent
+{
+	const char *name;
+	gint64 start;
+	gint64 end;
+	gint64 n;
+};
+
+/*
+ * Written by its thread only. n is published with release ordering, so
+ * trace_close() can read the events below it while the thread goes on.
+ */
+struct TraceBuffer
+{
+	pid_t tid;
+	char thread[16];
+	atomic_uint n;
+	struct TraceEvent events[TRACE_BUFFER_EVENTS];
+};
+
+atomic_int trace_enabled;
+
+static FILE *trace_file;
+static gint64 trace_origin;
+static atomic_uint trace_lost;
+
+/*
+ * Every buffer started while tracing, in order. trace_close() leaves them
+ * allocated: a pool thread may still be ending a span in one, and nothing
+ * joins the pool before exit.
+ */
+static GMutex trace_lock;
+static GPtrArray *trace_buffers;
+
+/* Bumped by trace_close(), so threads stop writing to the buffers it wrote out */
+static atomic_uint trace_generation;
+
+static _Thread_local struct TraceBuffer *trace_buffer;
+static _Thread_local guint trace_buffer_generation;
+
+/* Recording {{{ */
+
+static struct TraceBuffer *trace_buffer_new(void)
+{
+	struct TraceBuffer *buffer = NULL;
+
+	g_mutex_lock(&trace_lock);
+
+	if (trace_buffers != NULL && trace_buffers->len < TRACE_MAX_BUFFERS)
+	{
+		buffer = g_new(struct TraceBuffer, 1);
+		buffer->tid = syscall(SYS_gettid);
+		atomic_init(&buffer->n, 0);
+
+		if (prctl(PR_GET_NAME, buffer->thread) == -1)
+			buffer->thread[0] = '\0';
+
+		g_ptr_array_add(trace_buffers, buffer);
+	}
+
+	g_mutex_unlock(&trace_lock);
+
+	return buffer;
+}
+
+void trace_span(const char *name, gint64 start, gint64 n)
+{
+	struct TraceBuffer *buffer = trace_buffer;
+	guint generation = atomic_load_explicit(&trace_generation, memory_order_relaxed);
+	struct TraceEvent *ev;
+	guint i;
+
+	/* A span begun before trace_close() */
+	if (!atomic_load_explicit(&trace_enabled, memory_order_relaxed))
+		return;
+
+	if (buffer == NULL || trace_buffer_generation != generation ||
+			atomic_load_explicit(&buffer->n, memory_order_relaxed) == TRACE_BUFFER_EVENTS)
+	{
+		buffer = trace_buffer = trace_buffer_new();
+		trace_buffer_generation = generation;
+
+		if (buffer == NULL)
+		{
+			atomic_fetch_add_explicit(&trace_lost, 1, memory_order_relaxed);
+			return;
+		}
+	}
+
+	i = atomic_load_explicit(&buffer->n, memory_order_relaxed);
+	ev = &buffer->events[i];
+	ev->name = name;
+	ev->start = start;
+	ev->end = g_get_monotonic_time();
+	ev->n = n;
+
+	atomic_store_explicit(&buffer->n, i + 1, memory_order_release);
+}
+
+/* }}} */
+
+/* Output {{{ */
+
+static void trace_write_string(const char *str)
+{
+	putc('"', trace_file);
+
+	for (; *str; ++str)
+	{
+		if (*str == '"' || *str == '\\')
+			putc('\\', trace_file);
+
+		if ((unsigned char) *str >= 0x20)
+			putc(*str, trace_file);
+	}
+
+	putc('"', trace_file);
+}
+
+/* Names each thread once, by its first buffer */
+static void trace_write_thread(const struct TraceBuffer *buffer, GHashTable *named, pid_t pid)
+{
+	if (!g_hash_table_add(named, GINT_TO_POINTER(buffer->tid)))
+		return;
+
+	fprintf(trace_file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":",
+			pid, buffer->tid);
+	trace_write_string(buffer->thread[0] ? buffer->thread : "thread");
+	fputs("}}", trace_file);
+}
+
+/* Complete ("X") events, in µs from trace_open() */
+static void trace_write_buffer(const struct TraceBuffer *buffer, pid_t pid)
+{
+	guint n = atomic_load_explicit(&buffer->n, memory_order_acquire);
+
+	for (guint i = 0; i < n; ++i)
+	{
+		const struct TraceEvent *ev = &buffer->events[i];
+
+		fprintf(trace_file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,"
+				"\"ts\":%" G_GINT64_FORMAT ",\"dur\":%" G_GINT64_FORMAT,
+				ev->name, pid, buffer->tid, ev->start - trace_origin, ev->end - ev->start);
+
+		if (ev->n != TRACE_NONE)
+			fprintf(trace_file, ",\"args\":{\"n\":%" G_GINT64_FORMAT "}", ev->n);
+
+		putc('}', trace_file);
+	}
+}
+
+/* }}} */
+
+/*
+ * Starts tracing into path, which is created right away so that a bad
+ * path shows up now rather than at exit.
+ */
+gboolean trace_open(const char *path, GError **error)
+{
+	if (trace_file != NULL)
+		return TRUE;
+
+	trace_file = fopen(path, "we");
+	if (trace_file == NULL)
+	{
+		g_set_error(error, TRACE_ERROR, errno, "%s: %s", path, strerror(errno));
+		return FALSE;
+	}
+
+	trace_buffers = g_ptr_array_new();
+	trace_origin = g_get_monotonic_time();
+	atomic_store(&trace_enabled, TRUE);
+
+	return TRUE;
+}
+
+/*
+ * Stops tracing and writes out every span ended so far. Spans threads
+ * still end afterwards go to buffers that are no longer written out.
+ */
+void trace_close(void)
+{
+	GHashTable *named;
+	guint lost;
+	pid_t pid = getpid();
+
+	if (trace_file == NULL)
+		return;
+
+	atomic_store(&trace_enabled, FALSE);
+	atomic_fetch_add(&trace_generation, 1);
+
+	g_mutex_lock(&trace_lock);
+
+	named = g_hash_table_new(g_direct_hash, g_direct_equal);
+	fprintf(trace_file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+			"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":", pid);
+	trace_write_string(g_get_prgname() ? g_get_prgname() : "inotify");
+	fputs("}}", trace_file);
+
+	for (guint i = 0; i < trace_buffers->len; ++i)
+	{
+		trace_write_thread(g_ptr_array_index(trace_buffers, i), named, pid);
+		trace_write_buffer(g_ptr_array_index(trace_buffers, i), pid);
+	}
+
+	lost = atomic_load(&trace_lost);
+	if (lost > 0)
+		fprintf(trace_file, ",\n{\"name\":\"spans lost\",\"ph\":\"i\",\"s\":\"g\",\"pid\":%d,\"tid\":0,"
+				"\"ts\":%" G_GINT64_FORMAT ",\"args\":{\"n\":%u}}",
+				pid, g_get_monotonic_time() - trace_origin, lost);
+
+	fputs("\n]}\n", trace_file);
+	fclose(trace_file);
+	trace_file = NULL;
+
+	g_hash_table_destroy(named);
+
+	/* Only the array goes, see trace_buffers */
+	g_clear_pointer(&trace_buffers, g_ptr_array_unref);
+
+	g_mutex_unlock(&trace_lock);
+}
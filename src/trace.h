@@ -0,0 +1,44 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <glib.h>
+#include <stdatomic.h>
+
+/*
+ * Spans around the hot paths, written as a Chrome trace (chrome://tracing,
+ * ui.perfetto.dev) once tracing stops. Every thread records into buffers
+ * of its own, so a span costs a clock read and a store. With tracing off a
+ * span is a branch on trace_enabled.
+ */
+
+/* Environment variable naming the trace file, for the programs that take one */
+#define TRACE_ENV "INOTIFY_TRACE"
+
+/* No count to attach to a span */
+#define TRACE_NONE -1
+
+/* Set by trace_open(), before the threads being traced start; read by every thread */
+extern atomic_int trace_enabled;
+
+gboolean trace_open(const char *path, GError **error);
+void trace_close(void);
+void trace_span(const char *name, gint64 start, gint64 n);
+
+/* Start of a span, 0 while not tracing */
+static inline gint64 trace_begin(void)
+{
+	return G_UNLIKELY(atomic_load_explicit(&trace_enabled, memory_order_relaxed)) ?
+		g_get_monotonic_time() : 0;
+}
+
+/*
+ * Ends a span begun with trace_begin(). name must outlive tracing, a
+ * literal in practice; n is a count shown with the span, or TRACE_NONE.
+ */
+static inline void trace_end(const char *name, gint64 start, gint64 n)
+{
+	if (G_UNLIKELY(start != 0))
+		trace_span(name, start, n);
+}
+
+#endif /* end of include guard: TRACE_H */